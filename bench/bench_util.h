@@ -0,0 +1,20 @@
+#ifndef KDL_BENCH_BENCH_UTIL_H_
+#define KDL_BENCH_BENCH_UTIL_H_
+
+#include <stdio.h>
+#include <time.h>
+
+// Wall clock time in seconds
+static inline double bench_now(void)
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static inline void bench_report(char const* name, double seconds, double count, char const* unit)
+{
+    printf("%-40s %10.3f ms  %10.3f ns/%s\n", name, seconds * 1e3, seconds * 1e9 / count, unit);
+}
+
+#endif // KDL_BENCH_BENCH_UTIL_H_
@@ -0,0 +1,165 @@
+// Benchmark: emitting a document of integers and short strings through a stream emitter,
+// compared with snprintf() on the same integers, and the effect of the emitter's write buffer
+
+#include <kdl/kdl.h>
+
+#include "bench_util.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define N_NUMBERS 10000000
+#define NUMBERS_PER_NODE 10
+
+static uint64_t rng_state = 0x2545F4914F6CDD1DULL;
+
+static uint64_t next_random(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static size_t discard(void* user_data, char const* data, size_t nbytes)
+{
+    (void)data;
+    *(size_t*)user_data += nbytes;
+    return nbytes;
+}
+
+static void run_integers(void)
+{
+    long long* numbers = malloc(sizeof(long long) * N_NUMBERS);
+    if (numbers == NULL) return;
+    for (int i = 0; i < N_NUMBERS; ++i) {
+        // a mix of magnitudes, so that short and long numbers are both represented
+        numbers[i] = (long long)(next_random() >> (next_random() % 64));
+        if (i % 2 == 1) numbers[i] = -numbers[i];
+    }
+
+    size_t written = 0;
+    double t0 = bench_now();
+    kdl_emitter* emitter = kdl_create_stream_emitter(&discard, &written, &KDL_DEFAULT_EMITTER_OPTIONS);
+    for (int i = 0; i < N_NUMBERS; ++i) {
+        if (i % NUMBERS_PER_NODE == 0) {
+            if (i != 0) kdl_emit_end(emitter);
+            kdl_emit_node(emitter, kdl_str_from_cstr("n"));
+        }
+        kdl_value v = {
+            .type = KDL_TYPE_NUMBER,
+            .number = {.type = KDL_NUMBER_TYPE_INTEGER, .integer = numbers[i]}
+        };
+        kdl_emit_arg(emitter, &v);
+    }
+    kdl_emit_end(emitter);
+    kdl_destroy_emitter(emitter);
+    double t1 = bench_now();
+    bench_report("emitter, integers", t1 - t0, N_NUMBERS, "number");
+
+    // reference: snprintf on the same numbers
+    char buf[32];
+    size_t ref_written = 0;
+    t0 = bench_now();
+    for (int i = 0; i < N_NUMBERS; ++i) {
+        ref_written += (size_t)snprintf(buf, sizeof(buf), "%lld", numbers[i]);
+    }
+    t1 = bench_now();
+    bench_report("snprintf %lld (reference)", t1 - t0, N_NUMBERS, "number");
+    if (written == 0 || ref_written == 0) printf("nothing written!\n");
+
+    free(numbers);
+}
+
+static void run_nested(void)
+{
+    // deeply indented nodes with quoted string properties
+    size_t written = 0;
+    kdl_value v = {.type = KDL_TYPE_STRING, .string = kdl_str_from_cstr("some \"quoted\" text")};
+    double t0 = bench_now();
+    kdl_emitter* emitter = kdl_create_stream_emitter(&discard, &written, &KDL_DEFAULT_EMITTER_OPTIONS);
+    for (int i = 0; i < N_NUMBERS / 10; ++i) {
+        for (int d = 0; d < 8; ++d) {
+            kdl_emit_node(emitter, kdl_str_from_cstr("child"));
+            kdl_emit_property(emitter, kdl_str_from_cstr("key with spaces"), &v);
+            kdl_start_emitting_children(emitter);
+        }
+        for (int d = 0; d < 8; ++d) {
+            kdl_finish_emitting_children(emitter);
+        }
+    }
+    kdl_emit_end(emitter);
+    kdl_destroy_emitter(emitter);
+    double t1 = bench_now();
+    bench_report("emitter, nested nodes", t1 - t0, (N_NUMBERS / 10) * 8, "node");
+    if (written == 0) printf("nothing written!\n");
+}
+
+static void run_strings(void)
+{
+    // string values, most of which need no escaping
+    static char const* const strings[] = {
+        "/usr/local/share/some/fairly/long/path.kdl",
+        "Lorem ipsum dolor sit amet, consectetur adipiscing elit",
+        "short",
+        "a \"quoted\" word",
+    };
+    size_t written = 0;
+    double t0 = bench_now();
+    kdl_emitter* emitter = kdl_create_stream_emitter(&discard, &written, &KDL_DEFAULT_EMITTER_OPTIONS);
+    for (int i = 0; i < N_NUMBERS; ++i) {
+        if (i % NUMBERS_PER_NODE == 0) {
+            if (i != 0) kdl_emit_end(emitter);
+            kdl_emit_node(emitter, kdl_str_from_cstr("n"));
+        }
+        char const* str = strings[i % 8 == 7 ? 3 : i % 3];
+        kdl_value v = {.type = KDL_TYPE_STRING, .string = kdl_str_from_cstr(str)};
+        kdl_emit_arg(emitter, &v);
+    }
+    kdl_emit_end(emitter);
+    kdl_destroy_emitter(emitter);
+    double t1 = bench_now();
+    bench_report("emitter, strings", t1 - t0, N_NUMBERS, "string");
+    if (written == 0) printf("nothing written!\n");
+}
+
+static size_t write_to_file(void* user_data, char const* data, size_t nbytes)
+{
+    return fwrite(data, 1, nbytes, (FILE*)user_data);
+}
+
+static void run_file(char const* label, size_t write_buffer_size)
+{
+    // write to an unbuffered FILE, as a stand-in for a socket or pipe
+    FILE* f = fopen("/dev/null", "wb");
+    if (f == NULL) return;
+    setvbuf(f, NULL, _IONBF, 0);
+    kdl_emitter_options opts = KDL_DEFAULT_EMITTER_OPTIONS;
+    opts.write_buffer_size = write_buffer_size;
+    kdl_value v = {
+        .type = KDL_TYPE_NUMBER,
+        .number = {.type = KDL_NUMBER_TYPE_INTEGER, .integer = 12345}
+    };
+    double t0 = bench_now();
+    kdl_emitter* emitter = kdl_create_stream_emitter(&write_to_file, f, &opts);
+    for (int i = 0; i < N_NUMBERS / 10; ++i) {
+        kdl_emit_node(emitter, kdl_str_from_cstr("n"));
+        kdl_emit_property(emitter, kdl_str_from_cstr("key"), &v);
+    }
+    kdl_emit_end(emitter);
+    kdl_destroy_emitter(emitter);
+    double t1 = bench_now();
+    bench_report(label, t1 - t0, N_NUMBERS / 10, "node");
+    fclose(f);
+}
+
+int main(void)
+{
+    run_integers();
+    run_strings();
+    run_nested();
+    run_file("unbuffered FILE, no write buffer", 0);
+    run_file("unbuffered FILE, default write buffer", KDL_DEFAULT_EMITTER_OPTIONS.write_buffer_size);
+    return 0;
+}
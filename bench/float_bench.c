@@ -0,0 +1,149 @@
+// Benchmark: parsing and emitting documents consisting mostly of floating point numbers, compared
+// with strtod() and snprintf() on the same numbers
+
+#include <kdl/kdl.h>
+
+#include "bench_util.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define N_NUMBERS 1000000
+#define NUMBERS_PER_NODE 10
+
+static uint64_t rng_state = 0x2545F4914F6CDD1DULL;
+
+static uint64_t next_random(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+// Make a document with N_NUMBERS random floats, either with all 17 significant digits or as short
+// decimals (like "12.375")
+static char* make_document(bool full_precision, size_t* len)
+{
+    size_t capacity = (size_t)N_NUMBERS * 32;
+    char* doc = malloc(capacity);
+    if (doc == NULL) return NULL;
+    char* p = doc;
+    for (int i = 0; i < N_NUMBERS; ++i) {
+        if (i % NUMBERS_PER_NODE == 0) {
+            if (i != 0) *(p++) = '\n';
+            memcpy(p, "n", 1);
+            p += 1;
+        }
+        double d;
+        if (full_precision) {
+            d = (double)(next_random() >> 11) / (double)(1ULL << 53) * 1e6;
+            p += sprintf(p, " %.17g", d);
+        } else {
+            d = (double)(next_random() % 10000000) / 1000.0;
+            p += sprintf(p, " %.3f", d);
+        }
+    }
+    *(p++) = '\n';
+    *len = (size_t)(p - doc);
+    return doc;
+}
+
+static void run(char const* label, bool full_precision)
+{
+    size_t len = 0;
+    char* doc = make_document(full_precision, &len);
+    if (doc == NULL) return;
+
+    double sum = 0.0;
+    double t0 = bench_now();
+    kdl_parser* parser = kdl_create_string_parser((kdl_str){doc, len}, KDL_DEFAULTS);
+    kdl_event_data* ev;
+    do {
+        ev = kdl_parser_next_event(parser);
+        if (ev->event == KDL_EVENT_ARGUMENT) sum += ev->value.number.floating_point;
+    } while (ev->event != KDL_EVENT_EOF && ev->event != KDL_EVENT_PARSE_ERROR);
+    kdl_destroy_parser(parser);
+    double t1 = bench_now();
+    bench_report(label, t1 - t0, N_NUMBERS, "number");
+
+    // reference: strtod on the same text (without the node names)
+    double ref_sum = 0.0;
+    t0 = bench_now();
+    char const* p = doc;
+    char const* end = doc + len;
+    while (p < end) {
+        if (*p == 'n' || *p == ' ' || *p == '\n') {
+            ++p;
+        } else {
+            char* num_end;
+            ref_sum += strtod(p, &num_end);
+            p = num_end;
+        }
+    }
+    t1 = bench_now();
+    bench_report("strtod (reference)", t1 - t0, N_NUMBERS, "number");
+    if (sum != ref_sum) printf("results differ!\n");
+
+    free(doc);
+}
+
+static size_t discard(void* user_data, char const* data, size_t nbytes)
+{
+    (void)data;
+    *(size_t*)user_data += nbytes;
+    return nbytes;
+}
+
+static void run_emitter(char const* label, bool full_precision)
+{
+    double* numbers = malloc(sizeof(double) * N_NUMBERS);
+    if (numbers == NULL) return;
+    for (int i = 0; i < N_NUMBERS; ++i) {
+        numbers[i] = full_precision ? (double)(next_random() >> 11) / (double)(1ULL << 53) * 1e6
+                                    : (double)(next_random() % 10000000) / 1000.0;
+    }
+
+    size_t written = 0;
+    double t0 = bench_now();
+    kdl_emitter* emitter = kdl_create_stream_emitter(&discard, &written, &KDL_DEFAULT_EMITTER_OPTIONS);
+    for (int i = 0; i < N_NUMBERS; ++i) {
+        if (i % NUMBERS_PER_NODE == 0) {
+            if (i != 0) kdl_emit_end(emitter);
+            kdl_emit_node(emitter, kdl_str_from_cstr("n"));
+        }
+        kdl_value v = {
+            .type = KDL_TYPE_NUMBER,
+            .number = {.type = KDL_NUMBER_TYPE_FLOATING_POINT, .floating_point = numbers[i]}
+        };
+        kdl_emit_arg(emitter, &v);
+    }
+    kdl_emit_end(emitter);
+    kdl_destroy_emitter(emitter);
+    double t1 = bench_now();
+    bench_report(label, t1 - t0, N_NUMBERS, "number");
+
+    // reference: snprintf with enough digits to round-trip
+    char buf[32];
+    size_t ref_written = 0;
+    t0 = bench_now();
+    for (int i = 0; i < N_NUMBERS; ++i) {
+        ref_written += (size_t)snprintf(buf, sizeof(buf), "%.17g", numbers[i]);
+    }
+    t1 = bench_now();
+    bench_report("snprintf %.17g (reference)", t1 - t0, N_NUMBERS, "number");
+    if (written == 0 || ref_written == 0) printf("nothing written!\n");
+
+    free(numbers);
+}
+
+int main(void)
+{
+    run("parser, 17 significant digits", true);
+    run("parser, short decimals", false);
+    run_emitter("emitter, 17 significant digits", true);
+    run_emitter("emitter, short decimals", false);
+    return 0;
+}
@@ -0,0 +1,70 @@
+// Micro-benchmark: cost of classifying a codepoint with the reference predicates
+// (comparison chains) vs. the generated lookup tables
+
+#include "grammar.h"
+#include "grammar_ref.h"
+
+#include "bench_util.h"
+
+#include <stdlib.h>
+
+#define N_CODEPOINTS (1 << 16)
+#define ROUNDS 200
+
+static uint32_t codepoints[N_CODEPOINTS];
+
+// Mostly ASCII, with some Latin-1, CJK, and astral codepoints mixed in
+static void fill_codepoints(void)
+{
+    srand(12345);
+    for (size_t i = 0; i < N_CODEPOINTS; ++i) {
+        int r = rand() % 100;
+        if (r < 90) {
+            codepoints[i] = 0x20 + (uint32_t)(rand() % 0x5F);
+        } else if (r < 95) {
+            codepoints[i] = 0xA0 + (uint32_t)(rand() % 0x60);
+        } else if (r < 99) {
+            codepoints[i] = 0x4E00 + (uint32_t)(rand() % 0x5000);
+        } else {
+            codepoints[i] = 0x1F300 + (uint32_t)(rand() % 0x300);
+        }
+    }
+}
+
+#define BENCH_PREDICATE(label, expr)                                                                         \
+    do {                                                                                                     \
+        size_t hits = 0;                                                                                     \
+        double t0 = bench_now();                                                                             \
+        for (int round = 0; round < ROUNDS; ++round) {                                                       \
+            for (size_t i = 0; i < N_CODEPOINTS; ++i) {                                                      \
+                uint32_t c = codepoints[i];                                                                  \
+                hits += (expr) ? 1 : 0;                                                                      \
+            }                                                                                                \
+        }                                                                                                    \
+        double t1 = bench_now();                                                                             \
+        sink += hits;                                                                                        \
+        bench_report(label, t1 - t0, (double)N_CODEPOINTS * ROUNDS, "codepoint");                           \
+    } while (0)
+
+int main(void)
+{
+    volatile size_t sink = 0;
+    fill_codepoints();
+
+    for (int i = 0; i < 2; ++i) {
+        kdl_character_set cs = i == 0 ? KDL_CHARACTER_SET_V1 : KDL_CHARACTER_SET_V2;
+        printf("--- %s ---\n", i == 0 ? "KDLv1" : "KDLv2");
+        BENCH_PREDICATE("is_whitespace (reference)", _kdl_ref_is_whitespace(cs, c));
+        BENCH_PREDICATE("is_whitespace (table)", _kdl_is_whitespace(cs, c));
+        BENCH_PREDICATE("is_word_char (reference)", _kdl_ref_is_word_char(cs, c));
+        BENCH_PREDICATE("is_word_char (table)", _kdl_is_word_char(cs, c));
+        BENCH_PREDICATE("is_end_of_word (reference)", _kdl_ref_is_end_of_word(cs, c));
+        BENCH_PREDICATE("is_end_of_word (table)", _kdl_is_end_of_word(cs, c));
+        BENCH_PREDICATE("is_illegal_char (reference)", _kdl_ref_is_illegal_char(cs, c));
+        BENCH_PREDICATE("is_illegal_char (table)", _kdl_is_illegal_char(cs, c));
+        BENCH_PREDICATE("is_id_start (reference)", _kdl_ref_is_id_start(cs, c));
+        BENCH_PREDICATE("is_id_start (table)", _kdl_is_id_start(cs, c));
+    }
+
+    return sink == 0 ? 1 : 0;
+}
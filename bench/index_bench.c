@@ -0,0 +1,90 @@
+// Benchmark: string tokenizer and parser vs. indexed tokenizer and parser (which walk a structural
+// index built by a SIMD pass) on a document with many short tokens, on one dominated by long
+// identifiers and whitespace, and on one dominated by strings
+
+#include <kdl/kdl.h>
+
+#include "bench_util.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define N_NODES 200000
+
+enum doc_kind { SHORT_TOKENS, LONG_TOKENS, STRINGS, N_KINDS };
+
+static char const* const kind_names[] = {"short tokens", "long tokens", "strings"};
+
+static char* make_document(size_t* len, enum doc_kind kind)
+{
+    size_t capacity = (size_t)N_NODES * 256 + 4096;
+    char* doc = malloc(capacity);
+    if (doc == NULL) return NULL;
+    char* p = doc;
+    for (int i = 0; i < N_NODES; ++i) {
+        if (kind == LONG_TOKENS) {
+            p += sprintf(p,
+                "configuration-entry-number-%d                some.fully.qualified.identifier.name-%d"
+                "                    another-rather-long-bare-identifier-argument\n",
+                i, i);
+        } else if (kind == STRINGS) {
+            p += sprintf(p,
+                "entry \"a string value, number %d, with some words in it\" "
+                "description=\"another \\\"quoted\\\" string: %d\"\n",
+                i, i % 1000);
+        } else {
+            p += sprintf(p, "n%d a=%d b=\"x%d\" (t)c { d; e 1 2 3 }\n", i % 10, i % 100, i % 7);
+        }
+    }
+    *len = (size_t)(p - doc);
+    return doc;
+}
+
+static void run_tokenizer(char const* label, kdl_str doc, bool indexed)
+{
+    double t0 = bench_now();
+    kdl_tokenizer* tokenizer = indexed ? kdl_create_indexed_tokenizer(doc) : kdl_create_string_tokenizer(doc);
+    kdl_token token;
+    kdl_tokenizer_status status;
+    do {
+        status = kdl_pop_token(tokenizer, &token);
+    } while (status == KDL_TOKENIZER_OK);
+    kdl_destroy_tokenizer(tokenizer);
+    double t1 = bench_now();
+    bench_report(label, t1 - t0, (double)doc.len, "byte");
+    if (status == KDL_TOKENIZER_ERROR) printf("tokenizer error!\n");
+}
+
+static void run_parser(char const* label, kdl_str doc, bool indexed)
+{
+    size_t count = 0;
+    double t0 = bench_now();
+    kdl_parser* parser = indexed ? kdl_create_indexed_parser(doc, KDL_READ_VERSION_2)
+                                 : kdl_create_string_parser(doc, KDL_READ_VERSION_2);
+    kdl_event_data* ev;
+    do {
+        ev = kdl_parser_next_event(parser);
+        ++count;
+    } while (ev->event != KDL_EVENT_EOF && ev->event != KDL_EVENT_PARSE_ERROR);
+    kdl_destroy_parser(parser);
+    double t1 = bench_now();
+    bench_report(label, t1 - t0, (double)doc.len, "byte");
+    if (ev->event == KDL_EVENT_PARSE_ERROR) printf("parse error!\n");
+}
+
+int main(void)
+{
+    for (int kind = 0; kind < N_KINDS; ++kind) {
+        size_t len = 0;
+        char* doc = make_document(&len, (enum doc_kind)kind);
+        if (doc == NULL) return 1;
+        printf("%.1f MB, %s\n", len / 1e6, kind_names[kind]);
+        run_tokenizer("string tokenizer", (kdl_str){doc, len}, false);
+        run_tokenizer("indexed tokenizer", (kdl_str){doc, len}, true);
+        run_parser("string parser", (kdl_str){doc, len}, false);
+        run_parser("indexed parser", (kdl_str){doc, len}, true);
+        free(doc);
+    }
+    return 0;
+}
@@ -0,0 +1,133 @@
+// Benchmark: parsing documents with large multi-line strings (embedded shell scripts and SQL
+// queries), escaped and raw
+
+#include <kdl/kdl.h>
+
+#include "bench_util.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define N_BLOCKS 20000
+
+static char const* const script_lines[] = {
+    "#!/bin/sh",
+    "set -eu",
+    "",
+    "# Rotate the logs and compress everything older than a day",
+    "LOG_DIR=\"${LOG_DIR:-/var/log/app}\"",
+    "ARCHIVE=\"$LOG_DIR/archive/$(date +%Y-%m-%d)\"",
+    "mkdir -p \"$ARCHIVE\"",
+    "",
+    "for f in \"$LOG_DIR\"/*.log; do",
+    "    [ -e \"$f\" ] || continue",
+    "    name=$(basename \"$f\" .log | sed 's/\\\\./_/g')",
+    "    echo \"rotating $f -> $ARCHIVE/$name.log.gz\" >&2",
+    "    gzip -c \"$f\" > \"$ARCHIVE/$name.log.gz\"",
+    "    : > \"$f\"",
+    "done",
+    "",
+    "find \"$LOG_DIR/archive\" -type f -mtime +30 -print0 | xargs -0 rm -f",
+    "printf 'done:\\\\t%s\\\\n' \"$(date)\"",
+};
+
+static char const* const sql_lines[] = {
+    "SELECT u.id,",
+    "       u.name,",
+    "       u.email,",
+    "       count(o.id) AS \"orders\",",
+    "       coalesce(sum(o.total), 0) AS \"revenue\"",
+    "  FROM users u",
+    "  LEFT JOIN orders o",
+    "         ON o.user_id = u.id",
+    "        AND o.created_at >= now() - interval '90 days'",
+    " WHERE u.deleted_at IS NULL",
+    "   AND u.email NOT LIKE '%@example.com'",
+    " GROUP BY u.id, u.name, u.email",
+    "HAVING count(o.id) > 0",
+    " ORDER BY revenue DESC",
+    " LIMIT 100;",
+};
+
+#define N_SCRIPT_LINES (sizeof(script_lines) / sizeof(script_lines[0]))
+#define N_SQL_LINES (sizeof(sql_lines) / sizeof(sql_lines[0]))
+#define INDENT "        "
+
+static char* append(char* p, char const* s)
+{
+    size_t n = strlen(s);
+    memcpy(p, s, n);
+    return p + n;
+}
+
+static char* append_block(
+    char* p, char const* open, char const* close, char const* const* lines, size_t n_lines)
+{
+    p = append(p, open);
+    for (size_t i = 0; i < n_lines; ++i) {
+        *(p++) = '\n';
+        if (lines[i][0] != '\0') p = append(p, INDENT);
+        p = append(p, lines[i]);
+    }
+    p = append(p, "\n" INDENT);
+    return append(p, close);
+}
+
+// Each block holds a script in an escaped multi-line string and a query in a raw one
+static char* make_document(size_t* len)
+{
+    size_t capacity = (size_t)N_BLOCKS * 2048;
+    char* doc = malloc(capacity);
+    if (doc == NULL) return NULL;
+    char* p = doc;
+    for (int i = 0; i < N_BLOCKS; ++i) {
+        p = append(p, "job {\n    script ");
+        p = append_block(p, "\"\"\"", "\"\"\"", script_lines, N_SCRIPT_LINES);
+        p = append(p, "\n    query ");
+        p = append_block(p, "#\"\"\"", "\"\"\"#", sql_lines, N_SQL_LINES);
+        p = append(p, "\n}\n");
+    }
+    *len = (size_t)(p - doc);
+    return doc;
+}
+
+int main(void)
+{
+    size_t len = 0;
+    char* doc = make_document(&len);
+    if (doc == NULL) return 1;
+
+    size_t total = 0;
+    double t0 = bench_now();
+    kdl_parser* parser = kdl_create_string_parser((kdl_str){doc, len}, KDL_READ_VERSION_2);
+    kdl_event_data* ev;
+    do {
+        ev = kdl_parser_next_event(parser);
+        if (ev->event == KDL_EVENT_ARGUMENT) total += ev->value.string.len;
+    } while (ev->event != KDL_EVENT_EOF && ev->event != KDL_EVENT_PARSE_ERROR);
+    kdl_destroy_parser(parser);
+    double t1 = bench_now();
+    double n_lines = (double)N_BLOCKS * (N_SCRIPT_LINES + N_SQL_LINES);
+    bench_report("scripts and SQL, parsed", t1 - t0, n_lines, "line");
+    if (ev->event == KDL_EVENT_PARSE_ERROR || total == 0) printf("parse error!\n");
+
+    // The same script through the public API
+    char const* begin = strstr(doc, "\"\"\"") + 3;
+    kdl_str script = {begin, (size_t)(strstr(begin, "\"\"\"") - begin)};
+
+    total = 0;
+    t0 = bench_now();
+    for (int i = 0; i < N_BLOCKS; ++i) {
+        kdl_owned_string s = kdl_unescape_multi_line(KDL_VERSION_2, &script);
+        total += s.len;
+        kdl_free_string(&s);
+    }
+    t1 = bench_now();
+    bench_report("scripts, kdl_unescape_multi_line()", t1 - t0, (double)N_BLOCKS * N_SCRIPT_LINES, "line");
+    if (total == 0) printf("unescape error!\n");
+
+    free(doc);
+    return 0;
+}
@@ -0,0 +1,98 @@
+// Benchmark: parsing a large log-style document (many small top-level nodes) with
+// kdl_parse_parallel() on different numbers of threads
+
+#include <kdl/kdl.h>
+
+#include "bench_util.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define N_RECORDS 400000
+
+static char* make_document(size_t* len)
+{
+    size_t capacity = (size_t)N_RECORDS * 160 + 4096;
+    char* doc = malloc(capacity);
+    if (doc == NULL) return NULL;
+    char* p = doc;
+    for (int i = 0; i < N_RECORDS; ++i) {
+        p += sprintf(p,
+            "record %d level=\"info\" elapsed=%d.%03d msg=\"request \\\"/item/%d\\\" done\" {\n"
+            "    tag \"web\"; bytes %d\n}\n",
+            i, i % 100, i % 1000, i, i * 7);
+    }
+    *len = (size_t)(p - doc);
+    return doc;
+}
+
+// Counting arguments and properties; one counter per chunk so the threads don't share anything
+struct counts {
+    size_t* per_chunk;
+    size_t n_chunks;
+};
+
+static bool count_values(void* user_data, size_t chunk_index, kdl_event_data* event)
+{
+    struct counts* counts = user_data;
+    if (chunk_index >= counts->n_chunks) return false;
+    if (event->event == KDL_EVENT_ARGUMENT || event->event == KDL_EVENT_PROPERTY) {
+        ++counts->per_chunk[chunk_index];
+    }
+    return true;
+}
+
+static void run(char const* label, kdl_str doc, unsigned int n_threads)
+{
+    kdl_parallel_options popt = KDL_DEFAULT_PARALLEL_OPTIONS;
+    popt.n_threads = n_threads;
+    popt.chunk_size = 256 * 1024;
+    struct counts counts;
+    counts.n_chunks = doc.len / popt.chunk_size + 1;
+    counts.per_chunk = calloc(counts.n_chunks, sizeof(size_t));
+
+    double t0 = bench_now();
+    bool ok = kdl_parse_parallel(doc, KDL_READ_VERSION_2, &popt, &count_values, &counts);
+    double t1 = bench_now();
+    bench_report(label, t1 - t0, (double)doc.len, "byte");
+
+    size_t total = 0;
+    for (size_t i = 0; i < counts.n_chunks; ++i) total += counts.per_chunk[i];
+    if (!ok || total != (size_t)N_RECORDS * 6) printf("parse error!\n");
+    free(counts.per_chunk);
+}
+
+static void run_sequentially(kdl_str doc)
+{
+    size_t total = 0;
+    double t0 = bench_now();
+    kdl_parser* parser = kdl_create_string_parser(doc, KDL_READ_VERSION_2);
+    kdl_event_data* ev;
+    do {
+        ev = kdl_parser_next_event(parser);
+        if (ev->event == KDL_EVENT_ARGUMENT || ev->event == KDL_EVENT_PROPERTY) ++total;
+    } while (ev->event != KDL_EVENT_EOF && ev->event != KDL_EVENT_PARSE_ERROR);
+    bool ok = ev->event == KDL_EVENT_EOF;
+    kdl_destroy_parser(parser);
+    double t1 = bench_now();
+    bench_report("kdl_parser_next_event()", t1 - t0, (double)doc.len, "byte");
+    if (!ok || total != (size_t)N_RECORDS * 6) printf("parse error!\n");
+}
+
+int main(void)
+{
+    size_t len = 0;
+    char* doc = make_document(&len);
+    if (doc == NULL) return 1;
+
+    printf("%.1f MB, %d top-level nodes\n", len / 1e6, N_RECORDS);
+    run_sequentially((kdl_str){doc, len});
+    run("kdl_parse_parallel(), 1 thread", (kdl_str){doc, len}, 1);
+    run("kdl_parse_parallel(), 2 threads", (kdl_str){doc, len}, 2);
+    run("kdl_parse_parallel(), 4 threads", (kdl_str){doc, len}, 4);
+    run("kdl_parse_parallel(), 8 threads", (kdl_str){doc, len}, 8);
+
+    free(doc);
+    return 0;
+}
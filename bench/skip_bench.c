@@ -0,0 +1,92 @@
+// Benchmark: reading a few sections of a large configuration file, skipping the others with
+// kdl_parser_skip_node() (with and without KDL_UNCHECKED_SKIP) or by reading and discarding their
+// events
+
+#include <kdl/kdl.h>
+
+#include "bench_util.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define N_SECTIONS 40
+#define ENTRIES_PER_SECTION 10000
+
+static char* make_document(size_t* len)
+{
+    size_t capacity = (size_t)N_SECTIONS * ENTRIES_PER_SECTION * 128 + 4096;
+    char* doc = malloc(capacity);
+    if (doc == NULL) return NULL;
+    char* p = doc;
+    for (int i = 0; i < N_SECTIONS; ++i) {
+        p += sprintf(p, "section-%d {\n", i);
+        for (int j = 0; j < ENTRIES_PER_SECTION; ++j) {
+            p += sprintf(p,
+                "    entry %d \"C:\\\\data\\\\item-%d.bin\" weight=%d.%03d enabled=#true {\n"
+                "        tag \"a\\tb\"; limit 0x%x\n    }\n",
+                j, j, j % 100, j % 1000, j);
+        }
+        p += sprintf(p, "}\n");
+    }
+    *len = (size_t)(p - doc);
+    return doc;
+}
+
+static bool wanted(kdl_str name)
+{
+    static char const* const sections[] = {"section-3", "section-17", "section-31"};
+    for (size_t i = 0; i < sizeof(sections) / sizeof(sections[0]); ++i) {
+        if (name.len == strlen(sections[i]) && memcmp(name.data, sections[i], name.len) == 0) return true;
+    }
+    return false;
+}
+
+static void run(char const* label, kdl_str doc, bool skip, kdl_parse_option opt)
+{
+    size_t total = 0;
+    int depth = 0;
+    int skipping_at = -1; // depth of the section being skipped by reading its events
+    double t0 = bench_now();
+    kdl_parser* parser = kdl_create_string_parser(doc, opt);
+    kdl_event_data* ev;
+    do {
+        ev = kdl_parser_next_event(parser);
+        if (ev->event == KDL_EVENT_START_NODE) {
+            ++depth;
+            if (depth == 1 && !wanted(ev->name)) {
+                if (skip) {
+                    ev = kdl_parser_skip_node(parser);
+                    --depth;
+                } else {
+                    skipping_at = depth;
+                }
+            }
+        } else if (ev->event == KDL_EVENT_END_NODE) {
+            if (depth == skipping_at) skipping_at = -1;
+            --depth;
+        } else if (ev->event == KDL_EVENT_ARGUMENT && skipping_at < 0) {
+            ++total;
+        }
+    } while (ev->event != KDL_EVENT_EOF && ev->event != KDL_EVENT_PARSE_ERROR);
+    kdl_destroy_parser(parser);
+    double t1 = bench_now();
+    bench_report(label, t1 - t0, (double)N_SECTIONS * ENTRIES_PER_SECTION, "entry");
+    if (ev->event == KDL_EVENT_PARSE_ERROR || total != 3 * ENTRIES_PER_SECTION * 4) printf("parse error!\n");
+}
+
+int main(void)
+{
+    size_t len = 0;
+    char* doc = make_document(&len);
+    if (doc == NULL) return 1;
+
+    printf("%.1f MB, 3 of %d sections read\n", len / 1e6, N_SECTIONS);
+    run("skipped by reading the events", (kdl_str){doc, len}, false, KDL_DEFAULTS);
+    run("kdl_parser_skip_node()", (kdl_str){doc, len}, true, KDL_DEFAULTS);
+    run("kdl_parser_skip_node(), unchecked", (kdl_str){doc, len}, true, KDL_DEFAULTS | KDL_UNCHECKED_SKIP);
+
+    free(doc);
+    return 0;
+}
@@ -0,0 +1,85 @@
+// Benchmark: stream parser on a document consisting of one 100 MB multi-line string, which the
+// tokenizer has to buffer in its entirety, with different read chunk sizes
+
+#include <kdl/kdl.h>
+
+#include "bench_util.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define STRING_SIZE ((size_t)100 * 1024 * 1024)
+#define LINE_LENGTH 80
+
+struct mem_reader {
+    char const* data;
+    size_t len;
+    size_t n_calls;
+};
+
+static size_t read_mem(void* user_data, char* buf, size_t bufsize)
+{
+    struct mem_reader* r = (struct mem_reader*)user_data;
+    size_t n = r->len < bufsize ? r->len : bufsize;
+    memcpy(buf, r->data, n);
+    r->data += n;
+    r->len -= n;
+    ++r->n_calls;
+    return n;
+}
+
+static char* make_document(size_t* len)
+{
+    char* doc = malloc(STRING_SIZE + 64);
+    if (doc == NULL) return NULL;
+    char* p = doc;
+    memcpy(p, "node \"\"\"\n", 9);
+    p += 9;
+    for (size_t i = 0; i < STRING_SIZE; ++i) {
+        *(p++) = (i % LINE_LENGTH == LINE_LENGTH - 1) ? '\n' : (char)('a' + i % 26);
+    }
+    memcpy(p, "\n\"\"\"\n", 5);
+    p += 5;
+    *len = (size_t)(p - doc);
+    return doc;
+}
+
+int main(void)
+{
+    static size_t const chunk_sizes[] = {0, 64 * 1024, 1024 * 1024};
+    static char const* const labels[]
+        = {"stream, default chunk size", "stream, 64 KiB chunks", "stream, 1 MiB chunks"};
+
+    size_t len = 0;
+    char* doc = make_document(&len);
+    if (doc == NULL) return 1;
+
+    for (size_t i = 0; i < sizeof(chunk_sizes) / sizeof(chunk_sizes[0]); ++i) {
+        struct mem_reader reader = {doc, len, 0};
+        double t0 = bench_now();
+        kdl_parser* parser = kdl_create_stream_parser(&read_mem, &reader, KDL_DEFAULTS);
+        kdl_parser_set_read_chunk_size(parser, chunk_sizes[i]);
+        kdl_event_data* ev;
+        do {
+            ev = kdl_parser_next_event(parser);
+        } while (ev->event != KDL_EVENT_EOF && ev->event != KDL_EVENT_PARSE_ERROR);
+        kdl_destroy_parser(parser);
+        double t1 = bench_now();
+        if (ev->event != KDL_EVENT_EOF) return 1;
+        bench_report(labels[i], t1 - t0, (double)len, "byte");
+        printf("%-40s %10zu reads\n", "", reader.n_calls);
+    }
+
+    double t0 = bench_now();
+    kdl_parser* parser = kdl_create_string_parser((kdl_str){doc, len}, KDL_DEFAULTS);
+    kdl_event_data* ev;
+    do {
+        ev = kdl_parser_next_event(parser);
+    } while (ev->event != KDL_EVENT_EOF && ev->event != KDL_EVENT_PARSE_ERROR);
+    kdl_destroy_parser(parser);
+    double t1 = bench_now();
+    bench_report("string parser (reference)", t1 - t0, (double)len, "byte");
+
+    free(doc);
+    return 0;
+}
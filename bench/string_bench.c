@@ -0,0 +1,82 @@
+// Benchmark: parsing documents consisting mostly of quoted strings, with and without escapes, in
+// version detection mode, and with lazy values which are skipped or materialized
+
+#include <kdl/kdl.h>
+
+#include "bench_util.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define N_STRINGS 1000000
+#define STRINGS_PER_NODE 10
+
+static char* make_document(bool escapes, size_t* len)
+{
+    static char const* const plain[] = {
+        "\"/usr/local/share/some/fairly/long/path.kdl\"",
+        "\"Lorem ipsum dolor sit amet, consectetur adipiscing elit\"",
+        "\"short\"",
+    };
+    static char const* const escaped[] = {
+        "\"C:\\\\Program Files\\\\Some Application\\\\app.exe\"",
+        "\"a line\\nand another line\\n\"",
+        "\"\\\"quoted\\\" and \\u{e9}\\t\"",
+    };
+    char const* const* strings = escapes ? escaped : plain;
+    size_t capacity = (size_t)N_STRINGS * 64;
+    char* doc = malloc(capacity);
+    if (doc == NULL) return NULL;
+    char* p = doc;
+    for (int i = 0; i < N_STRINGS; ++i) {
+        if (i % STRINGS_PER_NODE == 0) {
+            if (i != 0) *(p++) = '\n';
+            *(p++) = 'n';
+        }
+        char const* s = strings[i % 3];
+        size_t n = strlen(s);
+        *(p++) = ' ';
+        memcpy(p, s, n);
+        p += n;
+    }
+    *(p++) = '\n';
+    *len = (size_t)(p - doc);
+    return doc;
+}
+
+static void run(char const* label, bool escapes, kdl_parse_option opt, bool materialize)
+{
+    size_t len = 0;
+    char* doc = make_document(escapes, &len);
+    if (doc == NULL) return;
+
+    size_t total = 0;
+    double t0 = bench_now();
+    kdl_parser* parser = kdl_create_string_parser((kdl_str){doc, len}, opt);
+    kdl_event_data* ev;
+    do {
+        ev = kdl_parser_next_event(parser);
+        if (materialize && !kdl_event_materialize_value(parser, ev)) break;
+        // skipped lazy values only have their raw text
+        if (ev->event == KDL_EVENT_ARGUMENT) total += ev->value.string.len + ev->token.value.len;
+    } while (ev->event != KDL_EVENT_EOF && ev->event != KDL_EVENT_PARSE_ERROR);
+    kdl_destroy_parser(parser);
+    double t1 = bench_now();
+    bench_report(label, t1 - t0, N_STRINGS, "string");
+    if (ev->event == KDL_EVENT_PARSE_ERROR || total == 0) printf("parse error!\n");
+
+    free(doc);
+}
+
+int main(void)
+{
+    run("no escapes, detect version", false, KDL_DETECT_VERSION, false);
+    run("no escapes, detect version, borrowed", false, KDL_DETECT_VERSION | KDL_BORROW_STRINGS, false);
+    run("escapes, detect version", true, KDL_DETECT_VERSION, false);
+    run("escapes, KDLv2", true, KDL_READ_VERSION_2, false);
+    run("escapes, lazy, skipped", true, KDL_DETECT_VERSION | KDL_LAZY_VALUES, false);
+    run("escapes, lazy, materialized", true, KDL_DETECT_VERSION | KDL_LAZY_VALUES, true);
+    return 0;
+}
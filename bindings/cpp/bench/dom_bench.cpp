@@ -0,0 +1,141 @@
+// Benchmark: reading the events of a large document with the C API and with kdl::EventReader,
+// parsing it into a kdl::Document and into a kdl::FlatDocument (including the time it takes to free
+// the document again), and looking up properties in a kdl::Document
+
+#include <kdl/kdl.h>
+#include <kdlpp.h>
+
+#include "bench_util.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+static constexpr int N_NODES = 200000;
+static constexpr int N_SETTINGS = 40;
+static constexpr int N_RUNS = 3;
+
+static std::u8string make_document()
+{
+    std::u8string doc;
+    char buf[256];
+    for (int i = 0; i < N_NODES; ++i) {
+        int len = std::snprintf(buf, sizeof(buf),
+            "item %d \"name-%d\" weight=%d.5 enabled=#true kind=\"widget\" {\n"
+            "    tag \"a\" \"b\"; (u8)limit %d\n}\n",
+            i, i, i % 100, i % 256);
+        doc.append(reinterpret_cast<char8_t const*>(buf), len);
+        if (i % 100 == 0) {
+            // a node with many properties
+            doc.append(u8"settings");
+            for (int j = 0; j < N_SETTINGS; ++j) {
+                len = std::snprintf(buf, sizeof(buf), " setting-%d=%d", j, j);
+                doc.append(reinterpret_cast<char8_t const*>(buf), len);
+            }
+            doc.append(u8"\n");
+        }
+    }
+    return doc;
+}
+
+// the C parser on its own, for reference
+static std::size_t read_events(std::u8string const& doc_text)
+{
+    kdl_str text = {reinterpret_cast<char const*>(doc_text.data()), doc_text.size()};
+    kdl_parser* parser = kdl_create_string_parser(text, KDL_DEFAULTS);
+    std::size_t n_nodes = 0;
+    kdl_event_data* ev;
+    do {
+        ev = kdl_parser_next_event(parser);
+        if (ev->event == KDL_EVENT_START_NODE) ++n_nodes;
+    } while (ev->event != KDL_EVENT_EOF && ev->event != KDL_EVENT_PARSE_ERROR);
+    kdl_destroy_parser(parser);
+    return n_nodes;
+}
+
+static std::size_t read_events_cpp(std::u8string const& doc_text)
+{
+    std::size_t n_nodes = 0;
+    for (auto const& ev : kdl::EventReader{doc_text}) {
+        if (ev.type() == kdl::EventType::StartNode) ++n_nodes;
+    }
+    return n_nodes;
+}
+
+static std::size_t read_document(std::u8string const& doc_text)
+{
+    return kdl::parse(doc_text).nodes().size();
+}
+
+static std::size_t read_flat_document(std::u8string const& doc_text)
+{
+    return kdl::parse_flat(doc_text).nodes().size();
+}
+
+// best of N_RUNS
+static void run(char const* label, std::u8string const& doc_text, std::size_t (*func)(std::u8string const&))
+{
+    double best = 1e30;
+    for (int i = 0; i < N_RUNS; ++i) {
+        double t0 = bench_now();
+        std::size_t n = func(doc_text);
+        double t1 = bench_now();
+        best = std::min(best, t1 - t0);
+        if (n < N_NODES) std::printf("parse error!\n");
+    }
+    bench_report(label, best, (double)doc_text.size(), "byte");
+}
+
+static double time_lookups(std::vector<kdl::Node const*> const& nodes,
+    std::u8string_view const (&keys)[4],
+    std::size_t* n_lookups)
+{
+    double best = 1e30;
+    for (int i = 0; i < N_RUNS; ++i) {
+        std::size_t found = 0;
+        double t0 = bench_now();
+        for (int k = 0; k < 10; ++k) {
+            for (auto const* node : nodes) {
+                for (auto key : keys) {
+                    if (node->properties().find(key) != node->properties().end()) ++found;
+                }
+            }
+        }
+        double t1 = bench_now();
+        best = std::min(best, t1 - t0);
+        if (found != nodes.size() * 30) std::printf("wrong number of properties found!\n");
+    }
+    *n_lookups = nodes.size() * 40;
+    return best;
+}
+
+static void run_lookups(kdl::Document const& doc)
+{
+    std::vector<kdl::Node const*> small_nodes, large_nodes;
+    for (auto const& node : doc) {
+        (node.properties().size() > 8 ? large_nodes : small_nodes).push_back(&node);
+    }
+
+    std::u8string_view const keys[] = {u8"weight", u8"kind", u8"enabled", u8"missing"};
+    std::u8string_view const setting_keys[] = {u8"setting-0", u8"setting-17", u8"setting-39", u8"missing"};
+    std::size_t n = 0;
+    double t = time_lookups(small_nodes, keys, &n);
+    bench_report("lookup (3 properties)", t, (double)n, "lookup");
+    t = time_lookups(large_nodes, setting_keys, &n);
+    bench_report("lookup (40 properties)", t, (double)n, "lookup");
+}
+
+int main()
+{
+    auto doc_text = make_document();
+    std::printf("%.1f MB, %d top-level nodes\n", doc_text.size() / 1e6, N_NODES);
+
+    run("events only", doc_text, &read_events);
+    run("kdl::EventReader", doc_text, &read_events_cpp);
+    run("kdl::Document", doc_text, &read_document);
+    run("kdl::FlatDocument", doc_text, &read_flat_document);
+
+    run_lookups(kdl::parse(doc_text));
+    return 0;
+}
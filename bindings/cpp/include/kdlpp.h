@@ -15,13 +15,20 @@
 #    define KDLPP_EXPORT
 #endif
 
+#include <cstddef>
+#include <exception>
 #include <functional>
-#include <map>
+#include <iosfwd>
+#include <iterator>
+#include <memory>
+#include <new>
 #include <optional>
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <tuple>
 #include <type_traits>
+#include <utility>
 #include <variant>
 #include <vector>
 
@@ -272,12 +279,175 @@ public:
     explicit operator kdl_value() const;
 };
 
+// The properties of a node: a map from names to values which keeps its entries in insertion order.
+// The first few entries are stored inline in the map itself, and names are looked up by linear
+// search - except in large maps, which keep a hash index.
+//
+// Unlike std::map, but like std::vector, adding an entry invalidates all references and iterators
+// into the map, and erasing one invalidates those at or after it. Don't keep a reference across an
+// insertion: in props[u8"b"] = props[u8"a"], adding b may move a away; copy a's value first.
+class KDLPP_EXPORT PropertyMap {
+public:
+    using key_type = std::u8string;
+    using mapped_type = Value;
+    using value_type = std::pair<std::u8string const, Value>;
+    using size_type = std::size_t;
+    using iterator = value_type*;
+    using const_iterator = value_type const*;
+
+    static constexpr std::size_t inline_capacity = 2;
+    static constexpr std::size_t index_threshold = 8; // maps larger than this have a hash index
+
+private:
+    value_type* m_heap = nullptr; // null while the entries are stored inline
+    std::size_t m_size = 0;
+    std::size_t m_capacity = inline_capacity;
+    alignas(value_type) unsigned char m_inline[inline_capacity * sizeof(value_type)];
+    std::vector<std::size_t> m_index; // open addressing: entry index + 1, or 0 for an empty slot
+
+    value_type* data() noexcept
+    {
+        return m_heap != nullptr ? m_heap : std::launder(reinterpret_cast<value_type*>(m_inline));
+    }
+    value_type const* data() const noexcept
+    {
+        return m_heap != nullptr ? m_heap : std::launder(reinterpret_cast<value_type const*>(m_inline));
+    }
+
+    void grow(std::size_t min_capacity);
+    void rebuild_index();
+    void add_to_index(std::size_t i);
+    std::size_t find_index(std::u8string_view key) const;
+    void take(PropertyMap&& other) noexcept;
+    void destroy() noexcept;
+
+    template <typename... Args>
+    iterator append(std::u8string_view key, Args&&... args)
+    {
+        value_type* entry;
+        if (m_size < m_capacity) {
+            entry = new (data() + m_size) value_type{std::piecewise_construct, std::forward_as_tuple(key),
+                std::forward_as_tuple(std::forward<Args>(args)...)};
+        } else {
+            // key and args may refer to existing entries, which grow() moves
+            std::pair<std::u8string, Value> new_entry{std::piecewise_construct, std::forward_as_tuple(key),
+                std::forward_as_tuple(std::forward<Args>(args)...)};
+            grow(m_size + 1);
+            entry = new (data() + m_size) value_type{std::move(new_entry)};
+        }
+        ++m_size;
+        if (m_size > index_threshold) {
+            if (m_size * 2 > m_index.size()) rebuild_index();
+            else add_to_index(m_size - 1);
+        }
+        return entry;
+    }
+
+public:
+    PropertyMap() noexcept {}
+    PropertyMap(std::initializer_list<value_type> entries) : PropertyMap(entries.begin(), entries.end()) {}
+    template <typename InputIt>
+    PropertyMap(InputIt first, InputIt last)
+    {
+        for (; first != last; ++first) try_emplace(first->first, first->second);
+    }
+    PropertyMap(PropertyMap const& other);
+    PropertyMap(PropertyMap&& other) noexcept { take(std::move(other)); }
+    ~PropertyMap() { destroy(); }
+
+    PropertyMap& operator=(PropertyMap const& other)
+    {
+        if (this != &other) *this = PropertyMap{other};
+        return *this;
+    }
+    PropertyMap& operator=(PropertyMap&& other) noexcept
+    {
+        if (this != &other) {
+            destroy();
+            take(std::move(other));
+        }
+        return *this;
+    }
+
+    // Maps are equal if they have the same entries, in any order
+    bool operator==(PropertyMap const& other) const;
+    bool operator!=(PropertyMap const& other) const { return !(*this == other); }
+
+    iterator begin() noexcept { return data(); }
+    const_iterator begin() const noexcept { return data(); }
+    iterator end() noexcept { return data() + m_size; }
+    const_iterator end() const noexcept { return data() + m_size; }
+
+    std::size_t size() const noexcept { return m_size; }
+    bool empty() const noexcept { return m_size == 0; }
+
+    iterator find(std::u8string_view key) { return data() + find_index(key); }
+    const_iterator find(std::u8string_view key) const { return data() + find_index(key); }
+    bool contains(std::u8string_view key) const { return find_index(key) != m_size; }
+    std::size_t count(std::u8string_view key) const { return contains(key) ? 1 : 0; }
+
+    Value& at(std::u8string_view key)
+    {
+        auto it = find(key);
+        if (it == end()) throw std::out_of_range("no such property");
+        return it->second;
+    }
+    Value const& at(std::u8string_view key) const
+    {
+        auto it = find(key);
+        if (it == end()) throw std::out_of_range("no such property");
+        return it->second;
+    }
+
+    Value& operator[](std::u8string_view key) { return try_emplace(key).first->second; }
+
+    // Add an entry, unless there is one with this name already
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace(std::u8string_view key, Args&&... args)
+    {
+        auto it = find(key);
+        if (it != end()) return {it, false};
+        return {append(key, std::forward<Args>(args)...), true};
+    }
+
+    std::pair<iterator, bool> insert(value_type const& entry)
+    {
+        return try_emplace(entry.first, entry.second);
+    }
+
+    // Add an entry, or replace the value of an existing one
+    template <typename V>
+    std::pair<iterator, bool> insert_or_assign(std::u8string_view key, V&& value)
+    {
+        auto it = find(key);
+        if (it != end()) {
+            it->second = std::forward<V>(value);
+            return {it, false};
+        }
+        return {append(key, std::forward<V>(value)), true};
+    }
+
+    iterator erase(const_iterator pos);
+    std::size_t erase(std::u8string_view key)
+    {
+        auto it = find(key);
+        if (it == end()) return 0;
+        erase(it);
+        return 1;
+    }
+
+    void clear() noexcept;
+    void reserve(std::size_t capacity)
+    {
+        if (capacity > m_capacity) grow(capacity);
+    }
+};
+
 // A node with all its contents
 class Node : public HasTypeAnnotation {
-    std::optional<std::u8string> m_type_annotation;
     std::u8string m_name;
     std::vector<Value> m_args;
-    std::map<std::u8string, Value, std::less<>> m_properties;
+    PropertyMap m_properties;
     std::vector<Node> m_children;
 
 public:
@@ -292,7 +462,7 @@ public:
     }
     Node(std::u8string_view name,
         std::vector<Value> args,
-        std::map<std::u8string, Value, std::less<>> properties,
+        PropertyMap properties,
         std::vector<Node> children)
         : m_name{name},
           m_args{std::move(args)},
@@ -303,7 +473,7 @@ public:
     Node(std::u8string_view type_annotation,
         std::u8string_view name,
         std::vector<Value> args,
-        std::map<std::u8string, Value, std::less<>> properties,
+        PropertyMap properties,
         std::vector<Node> children)
         : HasTypeAnnotation{type_annotation},
           m_name{name},
@@ -321,8 +491,8 @@ public:
 
     const std::vector<Value>& args() const { return m_args; }
     std::vector<Value>& args() { return m_args; }
-    const std::map<std::u8string, Value, std::less<>>& properties() const { return m_properties; }
-    std::map<std::u8string, Value, std::less<>>& properties() { return m_properties; }
+    const PropertyMap& properties() const { return m_properties; }
+    PropertyMap& properties() { return m_properties; }
     const std::vector<Node>& children() const { return m_children; }
     std::vector<Node>& children() { return m_children; }
 };
@@ -330,6 +500,7 @@ public:
 // A KDL document - consisting of several nodes.
 class KDLPP_EXPORT Document {
     std::vector<Node> m_nodes;
+    KdlVersion m_version = KdlVersion::Any;
 
 public:
     static Document read_from(kdl_parser* parser);
@@ -346,6 +517,11 @@ public:
     const std::vector<Node>& nodes() const { return m_nodes; }
     std::vector<Node>& nodes() { return m_nodes; }
 
+    // The KDL version of the text the document was parsed from (Any if the text is valid in both
+    // versions, or if the document wasn't parsed)
+    KdlVersion version() const { return m_version; }
+    void set_version(KdlVersion version) { m_version = version; }
+
     auto begin() const { return m_nodes.begin(); }
     auto begin() { return m_nodes.begin(); }
     auto end() const { return m_nodes.end(); }
@@ -355,10 +531,489 @@ public:
     std::u8string to_string(KdlVersion version) const;
 };
 
+// Storage of a FlatDocument: all nodes, values and strings of the document live in a few arrays and
+// refer to each other by index
+struct _flat_string {
+    std::size_t offset; // _flat_none if there is no string
+    std::size_t len;
+};
+
+inline constexpr std::size_t _flat_none = static_cast<std::size_t>(-1);
+
+enum class _flat_kind : unsigned char {
+    Null,
+    Bool,
+    Integer,
+    Float,
+    NumberString,
+    String
+};
+
+struct _flat_value {
+    _flat_kind kind;
+    union {
+        bool boolean;
+        long long integer;
+        double floating_point;
+        _flat_string string; // for String and NumberString
+    };
+    _flat_string type_annotation;
+};
+
+struct _flat_property {
+    _flat_string key;
+    _flat_value value;
+};
+
+struct _flat_node {
+    _flat_string name;
+    _flat_string type_annotation;
+    std::size_t first_arg;
+    std::size_t n_args;
+    std::size_t first_property;
+    std::size_t n_properties;
+    std::size_t n_children; // the first child (if any) is the next node in the array
+    std::size_t next_sibling;
+    std::size_t first_index_slot; // hash index of the properties, in _flat_storage::property_index
+    std::size_t n_index_slots;    // 0 if the node has too few properties for an index
+};
+
+struct _flat_storage {
+    std::vector<_flat_node> nodes; // in document order
+    std::vector<_flat_value> args;
+    std::vector<_flat_property> properties;
+    std::vector<std::size_t> property_index; // open addressing: property index + 1, or 0 for an empty slot
+    std::u8string strings;
+    std::size_t n_top_level_nodes = 0;
+
+    std::u8string_view str(_flat_string s) const { return {strings.data() + s.offset, s.len}; }
+    std::optional<std::u8string_view> optional_str(_flat_string s) const
+    {
+        if (s.offset == _flat_none) return std::nullopt;
+        return str(s);
+    }
+};
+
+// A value in a FlatDocument - a lightweight handle which is valid as long as the document exists
+class KDLPP_EXPORT FlatValue {
+    _flat_storage const* m_data;
+    _flat_value const* m_value;
+
+public:
+    FlatValue(_flat_storage const* data, _flat_value const* value) : m_data{data}, m_value{value} {}
+
+    Type type() const noexcept
+    {
+        switch (m_value->kind) {
+        case _flat_kind::Null:
+            return Type::Null;
+        case _flat_kind::Bool:
+            return Type::Bool;
+        case _flat_kind::String:
+            return Type::String;
+        default:
+            return Type::Number;
+        }
+    }
+
+    std::optional<std::u8string_view> type_annotation() const
+    {
+        return m_data->optional_str(m_value->type_annotation);
+    }
+
+    // Return the content as bool, as a fundamental arithmetic type (for numbers), or as a
+    // u8string_view (for strings)
+    template <typename T>
+    T as() const
+    {
+        if constexpr (std::is_same_v<T, bool>) {
+            if (m_value->kind == _flat_kind::Bool) return m_value->boolean;
+        } else if constexpr (std::is_arithmetic_v<T>) {
+            if (m_value->kind == _flat_kind::Integer) return static_cast<T>(m_value->integer);
+            if (m_value->kind == _flat_kind::Float) return static_cast<T>(m_value->floating_point);
+            if (m_value->kind == _flat_kind::NumberString)
+                throw std::runtime_error("Number is stored as a string.");
+        } else if constexpr (std::is_same_v<T, std::u8string_view>) {
+            if (m_value->kind == _flat_kind::String) return m_data->str(m_value->string);
+        }
+        throw TypeError("incompatible types");
+    }
+
+    // Copy into a stand-alone Value
+    Value to_value() const;
+};
+
+// A property in a FlatDocument (works with structured bindings, like the pairs in Node::properties())
+struct FlatProperty {
+    std::u8string_view key;
+    FlatValue value;
+
+    FlatProperty(_flat_storage const* data, _flat_property const* prop)
+        : key{data->str(prop->key)},
+          value{data, &prop->value}
+    {
+    }
+};
+
+// Iterator over consecutive args or properties in a FlatDocument
+template <typename Handle, typename Record>
+class _flat_array_iterator {
+    _flat_storage const* m_data = nullptr;
+    Record const* m_ptr = nullptr;
+
+public:
+    using iterator_concept = std::forward_iterator_tag;
+    using iterator_category = std::input_iterator_tag;
+    using value_type = Handle;
+    using difference_type = std::ptrdiff_t;
+
+    _flat_array_iterator() = default;
+    _flat_array_iterator(_flat_storage const* data, Record const* ptr) : m_data{data}, m_ptr{ptr} {}
+
+    Handle operator*() const { return Handle{m_data, m_ptr}; }
+    _flat_array_iterator& operator++()
+    {
+        ++m_ptr;
+        return *this;
+    }
+    _flat_array_iterator operator++(int)
+    {
+        auto old = *this;
+        ++m_ptr;
+        return old;
+    }
+    bool operator==(_flat_array_iterator const& other) const { return m_ptr == other.m_ptr; }
+};
+
+// Range of consecutive args or properties in a FlatDocument
+template <typename Handle, typename Record>
+class _flat_array_range {
+protected:
+    _flat_storage const* m_data;
+    Record const* m_first;
+    std::size_t m_size;
+
+public:
+    using iterator = _flat_array_iterator<Handle, Record>;
+
+    _flat_array_range(_flat_storage const* data, Record const* first, std::size_t size)
+        : m_data{data},
+          m_first{first},
+          m_size{size}
+    {
+    }
+
+    iterator begin() const { return iterator{m_data, m_first}; }
+    iterator end() const { return iterator{m_data, m_first + m_size}; }
+    std::size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    Handle operator[](std::size_t i) const { return Handle{m_data, m_first + i}; }
+};
+
+using FlatValueRange = _flat_array_range<FlatValue, _flat_value>;
+
+// Find a property by name among n properties, using their hash index if there is one (n_slots != 0).
+// Returns n if there is no such property.
+inline std::size_t _flat_find_property(_flat_storage const* data, _flat_property const* first, std::size_t n,
+    std::size_t const* index, std::size_t n_slots, std::u8string_view key)
+{
+    if (n_slots == 0) {
+        for (std::size_t i = 0; i < n; ++i) {
+            if (data->str(first[i].key) == key) return i;
+        }
+        return n;
+    }
+    std::size_t mask = n_slots - 1;
+    for (std::size_t slot = std::hash<std::u8string_view>{}(key) & mask; index[slot] != 0;
+         slot = (slot + 1) & mask) {
+        if (data->str(first[index[slot] - 1].key) == key) return index[slot] - 1;
+    }
+    return n;
+}
+
+class FlatPropertyRange : public _flat_array_range<FlatProperty, _flat_property> {
+    std::size_t const* m_index;
+    std::size_t m_index_slots;
+
+public:
+    FlatPropertyRange(_flat_storage const* data, _flat_property const* first, std::size_t size,
+        std::size_t const* index, std::size_t index_slots)
+        : _flat_array_range{data, first, size},
+          m_index{index},
+          m_index_slots{index_slots}
+    {
+    }
+
+    // Look up a property by name (by linear search, or in the hash index of a node with many properties)
+    iterator find(std::u8string_view key) const
+    {
+        return iterator{
+            m_data, m_first + _flat_find_property(m_data, m_first, m_size, m_index, m_index_slots, key)};
+    }
+};
+
+class FlatNodeRange;
+
+// A node in a FlatDocument - a lightweight handle which is valid as long as the document exists
+class FlatNode {
+    _flat_storage const* m_data;
+    std::size_t m_index;
+
+    _flat_node const& node() const { return m_data->nodes[m_index]; }
+
+public:
+    FlatNode(_flat_storage const* data, std::size_t index) : m_data{data}, m_index{index} {}
+
+    std::u8string_view name() const { return m_data->str(node().name); }
+    std::optional<std::u8string_view> type_annotation() const
+    {
+        return m_data->optional_str(node().type_annotation);
+    }
+
+    FlatValueRange args() const
+    {
+        return FlatValueRange{m_data, m_data->args.data() + node().first_arg, node().n_args};
+    }
+    FlatPropertyRange properties() const
+    {
+        return FlatPropertyRange{m_data,
+            m_data->properties.data() + node().first_property,
+            node().n_properties,
+            m_data->property_index.data() + node().first_index_slot,
+            node().n_index_slots};
+    }
+    FlatNodeRange children() const;
+};
+
+// Iterator over sibling nodes in a FlatDocument
+class FlatNodeIterator {
+    _flat_storage const* m_data = nullptr;
+    std::size_t m_index = _flat_none;
+
+public:
+    using iterator_concept = std::forward_iterator_tag;
+    using iterator_category = std::input_iterator_tag;
+    using value_type = FlatNode;
+    using difference_type = std::ptrdiff_t;
+
+    FlatNodeIterator() = default;
+    FlatNodeIterator(_flat_storage const* data, std::size_t index) : m_data{data}, m_index{index} {}
+
+    FlatNode operator*() const { return FlatNode{m_data, m_index}; }
+    FlatNodeIterator& operator++()
+    {
+        m_index = m_data->nodes[m_index].next_sibling;
+        return *this;
+    }
+    FlatNodeIterator operator++(int)
+    {
+        auto old = *this;
+        ++*this;
+        return old;
+    }
+    bool operator==(FlatNodeIterator const& other) const { return m_index == other.m_index; }
+};
+
+// The top-level nodes of a FlatDocument, or the children of a FlatNode
+class FlatNodeRange {
+    _flat_storage const* m_data;
+    std::size_t m_first;
+    std::size_t m_size;
+
+public:
+    using iterator = FlatNodeIterator;
+
+    FlatNodeRange(_flat_storage const* data, std::size_t first, std::size_t size)
+        : m_data{data},
+          m_first{first},
+          m_size{size}
+    {
+    }
+
+    iterator begin() const { return iterator{m_data, m_size == 0 ? _flat_none : m_first}; }
+    iterator end() const { return iterator{m_data, _flat_none}; }
+    std::size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+};
+
+inline FlatNodeRange FlatNode::children() const
+{
+    return FlatNodeRange{m_data, m_index + 1, node().n_children};
+}
+
+// A read-only KDL document which keeps all its nodes, values and strings in a few contiguous arrays
+// instead of allocating each of them separately. Nodes, values and properties are accessed through
+// lightweight handles (FlatNode, FlatValue, FlatProperty) and strings as views.
+class KDLPP_EXPORT FlatDocument {
+    std::unique_ptr<_flat_storage> m_data;
+    KdlVersion m_version = KdlVersion::Any;
+
+public:
+    static FlatDocument read_from(kdl_parser* parser);
+
+    FlatDocument() : m_data{std::make_unique<_flat_storage>()} {}
+    FlatDocument(FlatDocument&&) = default;
+    FlatDocument& operator=(FlatDocument&&) = default;
+
+    FlatNodeRange nodes() const { return FlatNodeRange{m_data.get(), 0, m_data->n_top_level_nodes}; }
+
+    // The KDL version of the text the document was parsed from (see Document::version())
+    KdlVersion version() const { return m_version; }
+
+    auto begin() const { return nodes().begin(); }
+    auto end() const { return nodes().end(); }
+};
+
 // Load a KDL document from string
 KDLPP_EXPORT Document parse(std::u8string_view kdl_text);
 KDLPP_EXPORT Document parse(std::u8string_view kdl_text, KdlVersion version);
 
+// Load a KDL document from string into a FlatDocument
+KDLPP_EXPORT FlatDocument parse_flat(std::u8string_view kdl_text);
+KDLPP_EXPORT FlatDocument parse_flat(std::u8string_view kdl_text, KdlVersion version);
+
+// A value in a parser event - a view into the parser's buffers, valid until the next event
+class KDLPP_EXPORT ValueView {
+    Type m_type = Type::Null;
+    NumberRepresentation m_number_representation = Integer;
+    union {
+        bool m_boolean;
+        long long m_integer;
+        double m_floating_point;
+    };
+    std::u8string_view m_string; // the string, or the text of a string-encoded number
+    std::optional<std::u8string_view> m_type_annotation;
+
+public:
+    ValueView() : m_integer{0} {}
+    ValueView(kdl_value const& val);
+
+    Type type() const noexcept { return m_type; }
+    // For numbers: how the number is stored
+    NumberRepresentation number_representation() const noexcept { return m_number_representation; }
+    std::optional<std::u8string_view> type_annotation() const { return m_type_annotation; }
+
+    // Return the content as bool, as a fundamental arithmetic type (for numbers), or as a
+    // u8string_view (for strings)
+    template <typename T>
+    T as() const
+    {
+        if constexpr (std::is_same_v<T, bool>) {
+            if (m_type == Type::Bool) return m_boolean;
+        } else if constexpr (std::is_arithmetic_v<T>) {
+            if (m_type == Type::Number) {
+                if (m_number_representation == Integer) return static_cast<T>(m_integer);
+                if (m_number_representation == Float) return static_cast<T>(m_floating_point);
+                throw std::runtime_error("Number is stored as a string.");
+            }
+        } else if constexpr (std::is_same_v<T, std::u8string_view>) {
+            if (m_type == Type::String) return m_string;
+        }
+        throw TypeError("incompatible types");
+    }
+
+    // Copy into a stand-alone Value
+    Value to_value() const;
+};
+
+enum class EventType {
+    StartNode,
+    EndNode,
+    Argument,
+    Property
+};
+
+// A parser event, as produced by EventReader - a view into the parser's buffers, valid until the
+// next event
+class Event {
+    EventType m_type = EventType::EndNode;
+    std::u8string_view m_name;
+    ValueView m_value;
+
+public:
+    Event() = default;
+    Event(EventType type, std::u8string_view name, ValueView value)
+        : m_type{type},
+          m_name{name},
+          m_value{value}
+    {
+    }
+
+    EventType type() const noexcept { return m_type; }
+    // The name of the node (StartNode) or property (Property)
+    std::u8string_view name() const noexcept { return m_name; }
+    // The value of an argument or property (for StartNode: null, with the node's type annotation)
+    ValueView const& value() const noexcept { return m_value; }
+    std::optional<std::u8string_view> type_annotation() const { return m_value.type_annotation(); }
+};
+
+struct _parser_deleter {
+    KDLPP_EXPORT void operator()(kdl_parser* parser) const;
+};
+
+// Where an EventReader's parser gets its data from (it stays put when the reader is moved)
+struct _event_source {
+    std::istream* stream = nullptr;
+    int fd = -1;
+    std::exception_ptr error; // a read error, to be thrown by the reader
+};
+
+// Reads a KDL document event by event, in constant memory. An input range of Events:
+//
+//     for (kdl::Event const& ev : kdl::EventReader{text}) { ... }
+//
+// Throws ParseError when it encounters a syntax error. Errors reading from a stream or file
+// descriptor are thrown as they are (from the stream) or as std::system_error.
+class KDLPP_EXPORT EventReader {
+    std::unique_ptr<_event_source> m_source; // only for streams and file descriptors
+    std::unique_ptr<kdl_parser, _parser_deleter> m_parser;
+    Event m_event;
+    bool m_started = false;
+    bool m_at_end = false;
+
+    void read_next();
+
+public:
+    class iterator {
+        EventReader* m_reader = nullptr;
+
+    public:
+        using value_type = Event;
+        using difference_type = std::ptrdiff_t;
+
+        iterator() = default;
+        explicit iterator(EventReader* reader) : m_reader{reader} {}
+
+        Event const& operator*() const { return m_reader->m_event; }
+        Event const* operator->() const { return &m_reader->m_event; }
+        iterator& operator++()
+        {
+            m_reader->read_next();
+            return *this;
+        }
+        void operator++(int) { ++*this; }
+        bool operator==(std::default_sentinel_t) const { return m_reader->m_at_end; }
+    };
+
+    // Read a string (which must outlive the reader)
+    EventReader(std::u8string_view kdl_text, KdlVersion version = KdlVersion::Any);
+    // Read from a stream
+    EventReader(std::istream& stream, KdlVersion version = KdlVersion::Any);
+    // Read from a file descriptor (which is not closed by the reader)
+    EventReader(int fd, KdlVersion version = KdlVersion::Any);
+
+    EventReader(EventReader&&) = default;
+    EventReader& operator=(EventReader&&) = default;
+
+    // The first call reads the first event; after that, begin() continues from the current event
+    iterator begin();
+    std::default_sentinel_t end() const { return std::default_sentinel; }
+
+    // The KDL version of the document as far as it has been read (Any while everything so far is
+    // valid in both versions)
+    KdlVersion version() const;
+};
+
 } // namespace kdl
 
 #endif // KDLPP_H_
@@ -1,6 +1,20 @@
 #include <kdl/kdl.h>
 #include <kdlpp.h>
 
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <system_error>
+
+#if defined(_WIN32)
+#    include <io.h>
+#else
+#    include <unistd.h>
+#endif
+
 namespace kdl {
 
 // internal helper functions
@@ -45,6 +59,280 @@ namespace {
         }
     }
 
+    KdlVersion detected_version(kdl_parser const* parser)
+    {
+        switch (kdl_parser_get_version(parser)) {
+        case KDL_READ_VERSION_1:
+            return KdlVersion::Kdl_1;
+        case KDL_READ_VERSION_2:
+            return KdlVersion::Kdl_2;
+        default:
+            return KdlVersion::Any;
+        }
+    }
+
+    using parser_ptr = std::unique_ptr<kdl_parser, _parser_deleter>;
+
+    kdl_parse_option version_option(KdlVersion version)
+    {
+        // With KdlVersion::Any, the parser decides on the version as soon as it sees something that
+        // is only valid in one of them
+        switch (version) {
+        case KdlVersion::Kdl_1:
+            return KDL_READ_VERSION_1;
+        case KdlVersion::Kdl_2:
+            return KDL_READ_VERSION_2;
+        default:
+            return KDL_DETECT_VERSION;
+        }
+    }
+
+    parser_ptr check_parser(kdl_parser* parser)
+    {
+        if (parser == nullptr) throw std::runtime_error("Error initializing the KDL parser");
+        return parser_ptr{parser};
+    }
+
+    parser_ptr create_string_parser(std::u8string_view kdl_text, KdlVersion version)
+    {
+        // The text outlives the parser, so strings without escapes can be returned as slices of it
+        // instead of being copied by the parser first
+        auto opts = static_cast<kdl_parse_option>(version_option(version) | KDL_BORROW_STRINGS);
+        return check_parser(kdl_create_string_parser(to_kdl_str(kdl_text), opts));
+    }
+
+    size_t read_from_istream(void* user_data, char* buf, size_t bufsize)
+    {
+        auto* source = static_cast<_event_source*>(user_data);
+        std::istream& stream = *source->stream;
+        try {
+            stream.read(buf, static_cast<std::streamsize>(bufsize));
+            if (stream.bad()) throw std::ios_base::failure("Error reading KDL from stream");
+        } catch (...) {
+            // Don't unwind through the C parser: EventReader::read_next() throws the error instead.
+            // With exceptions enabled, the final short read throws, but it's just the end of the stream.
+            if (stream.bad() || !stream.eof()) source->error = std::current_exception();
+        }
+        return static_cast<size_t>(stream.gcount());
+    }
+
+    size_t read_from_fd(void* user_data, char* buf, size_t bufsize)
+    {
+        auto* source = static_cast<_event_source*>(user_data);
+        while (true) {
+#if defined(_WIN32)
+            int n = _read(source->fd, buf, static_cast<unsigned>(std::min<size_t>(bufsize, INT_MAX)));
+#else
+            ssize_t n = ::read(source->fd, buf, bufsize);
+            if (n < 0 && errno == EINTR) continue;
+#endif
+            if (n < 0) {
+                source->error = std::make_exception_ptr(
+                    std::system_error(errno, std::generic_category(), "Error reading KDL from file"));
+                return 0;
+            }
+            return static_cast<size_t>(n);
+        }
+    }
+
+    // Move property map entries to uninitialized storage and destroy the originals. Keys are const to
+    // users of the map, but entries which are about to be destroyed may give theirs up (as std::map's
+    // node handles do).
+    void relocate(PropertyMap::value_type* first, PropertyMap::value_type* last,
+        PropertyMap::value_type* dest) noexcept
+    {
+        for (; first != last; ++first, ++dest) {
+            new (dest) PropertyMap::value_type{
+                std::move(const_cast<std::u8string&>(first->first)), std::move(first->second)};
+            std::destroy_at(first);
+        }
+    }
+
+    // Builds the arrays of a FlatDocument
+    class FlatBuilder {
+        _flat_storage& m_data;
+        // Args and properties all belong to the last node started, until its first child starts
+        std::size_t m_node = _flat_none;
+        std::size_t m_node_strings = 0;   // where the strings of m_node start
+        std::size_t m_unused_strings = 0; // bytes of them left behind by replaced properties
+        std::vector<std::size_t> m_index; // hash index of the properties of m_node, if it has many
+
+        _flat_string add_string(kdl_str const& s)
+        {
+            if (s.data == nullptr) return _flat_string{_flat_none, 0};
+            _flat_string result{m_data.strings.size(), s.len};
+            m_data.strings.append(to_u8string_view(s));
+            return result;
+        }
+
+        static std::size_t string_size(_flat_value const& value)
+        {
+            std::size_t size = value.type_annotation.offset != _flat_none ? value.type_annotation.len : 0;
+            if (value.kind == _flat_kind::String || value.kind == _flat_kind::NumberString) {
+                size += value.string.len;
+            }
+            return size;
+        }
+
+        std::size_t find_property(_flat_node const& node, std::u8string_view key) const
+        {
+            return _flat_find_property(&m_data, m_data.properties.data() + node.first_property,
+                node.n_properties, m_index.data(), m_index.size(), key);
+        }
+
+        void rebuild_index(_flat_node const& node)
+        {
+            std::size_t slots = 4 * PropertyMap::index_threshold;
+            while (slots < 2 * node.n_properties) slots *= 2;
+            m_index.assign(slots, 0);
+            for (std::size_t i = 0; i < node.n_properties; ++i) add_to_index(node, i);
+        }
+
+        void add_to_index(_flat_node const& node, std::size_t i)
+        {
+            std::size_t mask = m_index.size() - 1;
+            auto key = m_data.str(m_data.properties[node.first_property + i].key);
+            std::size_t slot = std::hash<std::u8string_view>{}(key) & mask;
+            while (m_index[slot] != 0) slot = (slot + 1) & mask;
+            m_index[slot] = i + 1;
+        }
+
+        // Move the strings of m_node which are still in use together, dropping the unused ones
+        void compact_strings(_flat_node& node)
+        {
+            std::vector<_flat_string*> used{&node.name, &node.type_annotation};
+            auto add_value = [&used](_flat_value& value) {
+                used.push_back(&value.type_annotation);
+                if (value.kind == _flat_kind::String || value.kind == _flat_kind::NumberString) {
+                    used.push_back(&value.string);
+                }
+            };
+            for (std::size_t i = node.first_arg; i < node.first_arg + node.n_args; ++i) {
+                add_value(m_data.args[i]);
+            }
+            for (std::size_t i = node.first_property; i < node.first_property + node.n_properties; ++i) {
+                used.push_back(&m_data.properties[i].key);
+                add_value(m_data.properties[i].value);
+            }
+            std::erase_if(used, [](_flat_string* s) { return s->offset == _flat_none; });
+            std::sort(used.begin(), used.end(),
+                [](_flat_string const* a, _flat_string const* b) { return a->offset < b->offset; });
+
+            auto* chars = m_data.strings.data();
+            std::size_t end = m_node_strings;
+            for (_flat_string* s : used) {
+                std::copy(chars + s->offset, chars + s->offset + s->len, chars + end);
+                s->offset = end;
+                end += s->len;
+            }
+            m_data.strings.resize(end);
+        }
+
+        // The args and properties of m_node are complete
+        void finish_node()
+        {
+            if (m_node == _flat_none) return;
+            auto& node = m_data.nodes[m_node];
+            if (m_unused_strings != 0) compact_strings(node);
+            if (!m_index.empty()) {
+                node.first_index_slot = m_data.property_index.size();
+                node.n_index_slots = m_index.size();
+                m_data.property_index.insert(m_data.property_index.end(), m_index.begin(), m_index.end());
+                m_index.clear();
+            }
+            m_node = _flat_none;
+            m_unused_strings = 0;
+        }
+
+    public:
+        FlatBuilder(_flat_storage& data) : m_data{data} {}
+
+        _flat_value make_value(kdl_value const& val)
+        {
+            _flat_value result;
+            switch (val.type) {
+            case KDL_TYPE_NULL:
+                result.kind = _flat_kind::Null;
+                break;
+            case KDL_TYPE_BOOLEAN:
+                result.kind = _flat_kind::Bool;
+                result.boolean = val.boolean;
+                break;
+            case KDL_TYPE_NUMBER:
+                switch (val.number.type) {
+                case KDL_NUMBER_TYPE_INTEGER:
+                    result.kind = _flat_kind::Integer;
+                    result.integer = val.number.integer;
+                    break;
+                case KDL_NUMBER_TYPE_FLOATING_POINT:
+                    result.kind = _flat_kind::Float;
+                    result.floating_point = val.number.floating_point;
+                    break;
+                case KDL_NUMBER_TYPE_STRING_ENCODED:
+                    result.kind = _flat_kind::NumberString;
+                    result.string = add_string(val.number.string);
+                    break;
+                default:
+                    throw std::logic_error("invalid kdl_number");
+                }
+                break;
+            case KDL_TYPE_STRING:
+                result.kind = _flat_kind::String;
+                result.string = add_string(val.string);
+                break;
+            default:
+                throw std::logic_error("invalid kdl_value");
+            }
+            result.type_annotation = add_string(val.type_annotation);
+            return result;
+        }
+
+        std::size_t start_node(kdl_event_data const& ev)
+        {
+            finish_node();
+            m_node = m_data.nodes.size();
+            m_node_strings = m_data.strings.size();
+            m_data.nodes.push_back(_flat_node{add_string(ev.name),
+                add_string(ev.value.type_annotation),
+                m_data.args.size(),
+                0,
+                m_data.properties.size(),
+                0,
+                0,
+                _flat_none,
+                0,
+                0});
+            return m_node;
+        }
+
+        void end_node() { finish_node(); }
+
+        void add_arg(kdl_event_data const& ev)
+        {
+            m_data.args.push_back(make_value(ev.value));
+            ++m_data.nodes[m_node].n_args;
+        }
+
+        void add_property(kdl_event_data const& ev)
+        {
+            // a repeated property replaces the earlier one, as in Node::properties()
+            auto& node = m_data.nodes[m_node];
+            std::size_t i = find_property(node, to_u8string_view(ev.name));
+            if (i != node.n_properties) {
+                auto& value = m_data.properties[node.first_property + i].value;
+                m_unused_strings += string_size(value);
+                value = make_value(ev.value);
+                return;
+            }
+            m_data.properties.push_back(_flat_property{add_string(ev.name), make_value(ev.value)});
+            ++node.n_properties;
+            if (node.n_properties > PropertyMap::index_threshold) {
+                if (node.n_properties * 2 > m_index.size()) rebuild_index(node);
+                else add_to_index(node, node.n_properties - 1);
+            }
+        }
+    };
+
     void emit_nodes(kdl_emitter* emitter, std::vector<Node> const& nodes)
     {
         for (const auto& node : nodes) {
@@ -152,6 +440,117 @@ Value::operator kdl_value() const
     return result;
 }
 
+PropertyMap::PropertyMap(PropertyMap const& other)
+{
+    try {
+        reserve(other.m_size);
+        for (auto const& entry : other) {
+            new (data() + m_size) value_type{entry};
+            ++m_size;
+        }
+        m_index = other.m_index;
+    } catch (...) {
+        destroy();
+        throw;
+    }
+}
+
+void PropertyMap::take(PropertyMap&& other) noexcept
+{
+    if (other.m_heap != nullptr) {
+        m_heap = std::exchange(other.m_heap, nullptr);
+        m_capacity = std::exchange(other.m_capacity, inline_capacity);
+    } else {
+        m_heap = nullptr;
+        m_capacity = inline_capacity;
+        relocate(other.begin(), other.end(), data());
+    }
+    m_size = std::exchange(other.m_size, 0);
+    m_index = std::move(other.m_index);
+    other.m_index.clear();
+}
+
+void PropertyMap::destroy() noexcept
+{
+    std::destroy(begin(), end());
+    if (m_heap != nullptr) std::allocator<value_type>{}.deallocate(m_heap, m_capacity);
+    m_heap = nullptr;
+    m_size = 0;
+    m_capacity = inline_capacity;
+}
+
+void PropertyMap::clear() noexcept
+{
+    std::destroy(begin(), end());
+    m_size = 0;
+    m_index.clear();
+}
+
+void PropertyMap::grow(std::size_t min_capacity)
+{
+    std::size_t capacity = std::max(m_capacity * 2, min_capacity);
+    value_type* heap = std::allocator<value_type>{}.allocate(capacity);
+    relocate(begin(), end(), heap);
+    if (m_heap != nullptr) std::allocator<value_type>{}.deallocate(m_heap, m_capacity);
+    m_heap = heap;
+    m_capacity = capacity;
+}
+
+void PropertyMap::rebuild_index()
+{
+    m_index.clear();
+    if (m_size <= index_threshold) return;
+    std::size_t slots = 4 * index_threshold;
+    while (slots < 2 * m_size) slots *= 2;
+    m_index.resize(slots);
+    for (std::size_t i = 0; i < m_size; ++i) add_to_index(i);
+}
+
+void PropertyMap::add_to_index(std::size_t i)
+{
+    std::size_t mask = m_index.size() - 1;
+    std::size_t slot = std::hash<std::u8string_view>{}(data()[i].first) & mask;
+    while (m_index[slot] != 0) slot = (slot + 1) & mask;
+    m_index[slot] = i + 1;
+}
+
+std::size_t PropertyMap::find_index(std::u8string_view key) const
+{
+    value_type const* entries = data();
+    if (m_index.empty()) {
+        for (std::size_t i = 0; i < m_size; ++i) {
+            if (entries[i].first == key) return i;
+        }
+        return m_size;
+    }
+    std::size_t mask = m_index.size() - 1;
+    for (std::size_t slot = std::hash<std::u8string_view>{}(key) & mask; m_index[slot] != 0;
+         slot = (slot + 1) & mask) {
+        if (entries[m_index[slot] - 1].first == key) return m_index[slot] - 1;
+    }
+    return m_size;
+}
+
+PropertyMap::iterator PropertyMap::erase(const_iterator pos)
+{
+    iterator it = begin() + (pos - begin());
+    std::destroy_at(it);
+    relocate(it + 1, end(), it);
+    --m_size;
+    rebuild_index();
+    return it;
+}
+
+bool PropertyMap::operator==(PropertyMap const& other) const
+{
+    if (m_size != other.m_size) return false;
+    for (auto const& [key, value] : *this) {
+        auto it = other.find(key);
+        if (it == other.end() || it->second != value) return false;
+    }
+    return true;
+}
+
 Document Document::read_from(kdl_parser* parser)
 {
     Document doc;
@@ -164,6 +563,7 @@ Document Document::read_from(kdl_parser* parser)
 
         switch (ev->event) {
         case KDL_EVENT_EOF:
+            doc.set_version(detected_version(parser));
             return doc;
         case KDL_EVENT_PARSE_ERROR:
             throw ParseError(ev->value.string);
@@ -190,11 +590,15 @@ Document Document::read_from(kdl_parser* parser)
             }
             break;
         case KDL_EVENT_ARGUMENT:
-            current_node->args().emplace_back(Value{ev->value});
+            current_node->args().emplace_back(ev->value);
             break;
-        case KDL_EVENT_PROPERTY:
-            current_node->properties()[std::u8string{to_u8string_view(ev->name)}] = Value{ev->value};
+        case KDL_EVENT_PROPERTY: {
+            // build the value in place; a repeated property replaces the earlier one
+            auto& props = current_node->properties();
+            auto [it, inserted] = props.try_emplace(to_u8string_view(ev->name), ev->value);
+            if (!inserted) it->second = Value{ev->value};
             break;
+        }
         default:
             throw std::logic_error("Invalid event from kdl_parser");
         }
@@ -222,23 +626,239 @@ Document parse(std::u8string_view kdl_text) { return parse(kdl_text, KdlVersion:
 
 Document parse(std::u8string_view kdl_text, KdlVersion version)
 {
-    kdl_parse_option opts = KDL_DEFAULTS;
-    if (version == KdlVersion::Kdl_1) opts = KDL_READ_VERSION_1;
-    else if (version == KdlVersion::Kdl_2) opts = KDL_READ_VERSION_2;
-    else if (version == KdlVersion::Any) {
-        try {
-            return parse(kdl_text, KdlVersion::Kdl_2);
-        } catch (ParseError const&) {
-            return parse(kdl_text, KdlVersion::Kdl_1);
+    auto parser = create_string_parser(kdl_text, version);
+    return Document::read_from(parser.get());
+}
+
+Value FlatValue::to_value() const
+{
+    Value result;
+    switch (m_value->kind) {
+    case _flat_kind::Null:
+        break;
+    case _flat_kind::Bool:
+        result = m_value->boolean;
+        break;
+    case _flat_kind::Integer:
+        result = Number{m_value->integer};
+        break;
+    case _flat_kind::Float:
+        result = Number{m_value->floating_point};
+        break;
+    case _flat_kind::NumberString: {
+        kdl_number n;
+        n.type = KDL_NUMBER_TYPE_STRING_ENCODED;
+        n.string = to_kdl_str(m_data->str(m_value->string));
+        result = Number{n};
+        break;
+    }
+    case _flat_kind::String:
+        result = m_data->str(m_value->string);
+        break;
+    }
+    if (auto ta = type_annotation(); ta.has_value()) result.set_type_annotation(*ta);
+    return result;
+}
+
+FlatDocument FlatDocument::read_from(kdl_parser* parser)
+{
+    FlatDocument doc;
+    _flat_storage& data = *doc.m_data;
+    FlatBuilder builder{data};
+
+    struct open_node {
+        std::size_t index;
+        std::size_t last_child;
+    };
+    std::vector<open_node> stack;
+    std::size_t last_top_level_node = _flat_none;
+
+    while (true) {
+        auto* ev = kdl_parser_next_event(parser);
+
+        switch (ev->event) {
+        case KDL_EVENT_EOF:
+            doc.m_version = detected_version(parser);
+            return doc;
+        case KDL_EVENT_PARSE_ERROR:
+            throw ParseError(ev->value.string);
+        case KDL_EVENT_START_NODE: {
+            std::size_t index = builder.start_node(*ev);
+            std::size_t* prev_sibling;
+            if (stack.empty()) {
+                prev_sibling = &last_top_level_node;
+                ++data.n_top_level_nodes;
+            } else {
+                prev_sibling = &stack.back().last_child;
+                ++data.nodes[stack.back().index].n_children;
+            }
+            if (*prev_sibling != _flat_none) data.nodes[*prev_sibling].next_sibling = index;
+            *prev_sibling = index;
+            stack.push_back(open_node{index, _flat_none});
+            break;
+        }
+        case KDL_EVENT_END_NODE:
+            builder.end_node();
+            stack.pop_back();
+            break;
+        case KDL_EVENT_ARGUMENT:
+            builder.add_arg(*ev);
+            break;
+        case KDL_EVENT_PROPERTY:
+            builder.add_property(*ev);
+            break;
+        default:
+            throw std::logic_error("Invalid event from kdl_parser");
         }
     }
+}
+
+void _parser_deleter::operator()(kdl_parser* parser) const { kdl_destroy_parser(parser); }
+
+ValueView::ValueView(kdl_value const& val) : m_integer{0}
+{
+    switch (val.type) {
+    case KDL_TYPE_NULL:
+        m_type = Type::Null;
+        break;
+    case KDL_TYPE_BOOLEAN:
+        m_type = Type::Bool;
+        m_boolean = val.boolean;
+        break;
+    case KDL_TYPE_NUMBER:
+        m_type = Type::Number;
+        switch (val.number.type) {
+        case KDL_NUMBER_TYPE_INTEGER:
+            m_number_representation = Integer;
+            m_integer = val.number.integer;
+            break;
+        case KDL_NUMBER_TYPE_FLOATING_POINT:
+            m_number_representation = Float;
+            m_floating_point = val.number.floating_point;
+            break;
+        case KDL_NUMBER_TYPE_STRING_ENCODED:
+            m_number_representation = String;
+            m_string = to_u8string_view(val.number.string);
+            break;
+        default:
+            throw std::logic_error("invalid kdl_number");
+        }
+        break;
+    case KDL_TYPE_STRING:
+        m_type = Type::String;
+        m_string = to_u8string_view(val.string);
+        break;
+    default:
+        throw std::logic_error("invalid kdl_value");
+    }
+    if (val.type_annotation.data != nullptr) m_type_annotation = to_u8string_view(val.type_annotation);
+}
+
+Value ValueView::to_value() const
+{
+    kdl_value val;
+    switch (m_type) {
+    case Type::Null:
+        val.type = KDL_TYPE_NULL;
+        break;
+    case Type::Bool:
+        val.type = KDL_TYPE_BOOLEAN;
+        val.boolean = m_boolean;
+        break;
+    case Type::Number:
+        val.type = KDL_TYPE_NUMBER;
+        if (m_number_representation == Integer) {
+            val.number.type = KDL_NUMBER_TYPE_INTEGER;
+            val.number.integer = m_integer;
+        } else if (m_number_representation == Float) {
+            val.number.type = KDL_NUMBER_TYPE_FLOATING_POINT;
+            val.number.floating_point = m_floating_point;
+        } else {
+            val.number.type = KDL_NUMBER_TYPE_STRING_ENCODED;
+            val.number.string = to_kdl_str(m_string);
+        }
+        break;
+    case Type::String:
+        val.type = KDL_TYPE_STRING;
+        val.string = to_kdl_str(m_string);
+        break;
+    }
+    if (m_type_annotation.has_value()) {
+        val.type_annotation = to_kdl_str(*m_type_annotation);
+    } else {
+        val.type_annotation = {nullptr, 0};
+    }
+    return Value{val};
+}
+
+EventReader::EventReader(std::u8string_view kdl_text, KdlVersion version)
+    : m_parser{create_string_parser(kdl_text, version)}
+{
+}
+
+EventReader::EventReader(std::istream& stream, KdlVersion version)
+    : m_source{std::make_unique<_event_source>(_event_source{&stream, -1, nullptr})},
+      m_parser{check_parser(
+          kdl_create_stream_parser(&read_from_istream, m_source.get(), version_option(version)))}
+{
+}
+
+EventReader::EventReader(int fd, KdlVersion version)
+    : m_source{std::make_unique<_event_source>(_event_source{nullptr, fd, nullptr})},
+      m_parser{check_parser(kdl_create_stream_parser(&read_from_fd, m_source.get(), version_option(version)))}
+{
+}
 
-    kdl_str text = {reinterpret_cast<char const*>(kdl_text.data()), kdl_text.size()};
-    kdl_parser* parser = kdl_create_string_parser(text, opts);
-    if (parser == nullptr) throw std::runtime_error("Error initializing the KDL parser");
-    auto doc = Document::read_from(parser);
-    kdl_destroy_parser(parser);
-    return doc;
+void EventReader::read_next()
+{
+    if (m_at_end) return;
+    auto* ev = kdl_parser_next_event(m_parser.get());
+    // After a read error, the parser has seen a truncated document
+    if (m_source != nullptr && m_source->error != nullptr) {
+        m_at_end = true;
+        std::rethrow_exception(std::exchange(m_source->error, nullptr));
+    }
+    switch (ev->event) {
+    case KDL_EVENT_EOF:
+        m_at_end = true;
+        break;
+    case KDL_EVENT_PARSE_ERROR:
+        m_at_end = true;
+        throw ParseError(ev->value.string);
+    case KDL_EVENT_START_NODE:
+        m_event = Event{EventType::StartNode, to_u8string_view(ev->name), ValueView{ev->value}};
+        break;
+    case KDL_EVENT_END_NODE:
+        m_event = Event{EventType::EndNode, {}, ValueView{}};
+        break;
+    case KDL_EVENT_ARGUMENT:
+        m_event = Event{EventType::Argument, {}, ValueView{ev->value}};
+        break;
+    case KDL_EVENT_PROPERTY:
+        m_event = Event{EventType::Property, to_u8string_view(ev->name), ValueView{ev->value}};
+        break;
+    default:
+        throw std::logic_error("Invalid event from kdl_parser");
+    }
+}
+
+EventReader::iterator EventReader::begin()
+{
+    if (!m_started) {
+        m_started = true;
+        read_next();
+    }
+    return iterator{this};
+}
+
+KdlVersion EventReader::version() const { return detected_version(m_parser.get()); }
+
+FlatDocument parse_flat(std::u8string_view kdl_text) { return parse_flat(kdl_text, KdlVersion::Any); }
+
+FlatDocument parse_flat(std::u8string_view kdl_text, KdlVersion version)
+{
+    auto parser = create_string_parser(kdl_text, version);
+    return FlatDocument::read_from(parser.get());
 }
 
 } // namespace kdl
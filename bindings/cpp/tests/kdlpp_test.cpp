@@ -2,8 +2,20 @@
 
 #include "test_util.h"
 
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <ranges>
+#include <sstream>
 #include <string>
 #include <string_view>
+#include <system_error>
+#include <type_traits>
+
+#if defined(_WIN32)
+#    define fileno _fileno
+#endif
 
 static void test_cycle()
 {
@@ -124,6 +136,392 @@ static void test_both_versions_allowed()
     ASSERT(doc2.to_string() == u8"node");
 }
 
+static void test_detected_version()
+{
+    ASSERT(kdl::parse(u8"a 1 \"x\"\nb key=true").version() == kdl::KdlVersion::Kdl_1);
+    ASSERT(kdl::parse(u8"a 1 \"x\"\nb key=#true").version() == kdl::KdlVersion::Kdl_2);
+    ASSERT(kdl::parse(u8"a 1 \"x\"\nb key=2").version() == kdl::KdlVersion::Any);
+    ASSERT(kdl::parse(u8"a 1", kdl::KdlVersion::Kdl_1).version() == kdl::KdlVersion::Kdl_1);
+    ASSERT(kdl::parse(u8"a 1", kdl::KdlVersion::Kdl_2).version() == kdl::KdlVersion::Kdl_2);
+    ASSERT(kdl::Document{}.version() == kdl::KdlVersion::Any);
+    ASSERT(kdl::parse(u8"a \"\"\"\n  x\n  \"\"\"\n").version() == kdl::KdlVersion::Kdl_2);
+
+    // mixing versions is an error
+    bool failed = false;
+    try {
+        kdl::parse(u8"a true\nb #true");
+    } catch (kdl::ParseError const&) {
+        failed = true;
+    }
+    ASSERT(failed);
+    // U+2028 is a newline in KDLv2 only, where multi-line strings come from
+    failed = false;
+    try {
+        kdl::parse(u8"a \"\"\"\n  x\n  \"\"\" \"b\u2028c\"");
+    } catch (kdl::ParseError const&) {
+        failed = true;
+    }
+    ASSERT(failed);
+}
+
+static std::u8string read_test_document(char const* name)
+{
+    std::ifstream in{std::string{KDL_TEST_DOCUMENTS_ROOT} + "/" + name, std::ios::binary};
+    ASSERT2(in.good(), name);
+    std::string text{std::istreambuf_iterator<char>{in}, std::istreambuf_iterator<char>{}};
+    return std::u8string{text.begin(), text.end()};
+}
+
+static bool is_valid(std::u8string_view text, kdl::KdlVersion version)
+{
+    try {
+        (void)kdl::parse(text, version);
+        return true;
+    } catch (kdl::ParseError const&) {
+        return false;
+    }
+}
+
+static void test_detected_version_corpus()
+{
+    // With version detection, a document is valid if it is valid in either version
+    char const* const invalid[] = {
+        "1.0.0/input/dot_zero.kdl",
+        "2.0.0/input/dot_zero_fail.kdl",
+        "2.0.0/input/no_integer_digit_fail.kdl",
+        "2.0.0/input/bare_ident_numeric_dot_fail.kdl",
+    };
+    for (char const* name : invalid) {
+        auto text = read_test_document(name);
+        ASSERT2(!is_valid(text, kdl::KdlVersion::Kdl_1), name);
+        ASSERT2(!is_valid(text, kdl::KdlVersion::Kdl_2), name);
+        ASSERT2(!is_valid(text, kdl::KdlVersion::Any), name);
+    }
+
+    // valid KDLv1
+    auto lri = read_test_document("2.0.0/input/unicode_lri_fail.kdl");
+    ASSERT(is_valid(lri, kdl::KdlVersion::Kdl_1));
+    ASSERT(!is_valid(lri, kdl::KdlVersion::Kdl_2));
+    ASSERT(kdl::parse(lri).version() == kdl::KdlVersion::Kdl_1);
+}
+
+static void test_strings()
+{
+    // strings with and without escapes, from KDLv1 and KDLv2 documents
+    auto doc1 = kdl::parse(u8"(\"node type\")\"node\\tname\" \"plain\" \"esc\\naped\" r#\"raw \\n\"# "
+                           u8"\"key\\u{2f}\"=(t)\"value\" key2=\"\"");
+    auto const& n1 = doc1.nodes()[0];
+    ASSERT(n1.name() == u8"node\tname" && n1.type_annotation() == u8"node type");
+    ASSERT(n1.args()[0] == kdl::Value{u8"plain"});
+    ASSERT(n1.args()[1] == kdl::Value{u8"esc\naped"});
+    ASSERT(n1.args()[2] == kdl::Value{u8"raw \\n"});
+    ASSERT(n1.properties().at(u8"key/") == (kdl::Value{u8"t", std::u8string_view{u8"value"}}));
+    ASSERT(n1.properties().at(u8"key2") == kdl::Value{u8""});
+
+    auto doc2 = kdl::parse(
+        u8"node bare #\"raw\\n\"# \"\"\"\n  multi\n    line\n  \"\"\" key=\"a\\u{1F600}\"");
+    auto const& n2 = doc2.nodes()[0];
+    ASSERT(n2.args()[0] == kdl::Value{u8"bare"});
+    ASSERT(n2.args()[1] == kdl::Value{u8"raw\\n"});
+    ASSERT(n2.args()[2] == kdl::Value{u8"multi\n  line"});
+    ASSERT(n2.properties().at(u8"key") == kdl::Value{u8"a\U0001F600"});
+
+    // the values still belong to the document after the text is gone
+    std::u8string text = u8"node \"a string which is too long for the small string optimization\"";
+    auto doc3 = kdl::parse(text);
+    text.assign(text.size(), u8'x');
+    ASSERT(doc3.nodes()[0].args()[0].as<std::u8string_view>()
+        == u8"a string which is too long for the small string optimization");
+}
+
+static void test_property_map()
+{
+    kdl::PropertyMap props{{u8"b", 1}, {u8"a", 2}, {u8"b", 3}};
+    ASSERT(props.size() == 2);
+    ASSERT(props.begin()->first == u8"b" && props.begin()->second == 1);
+    ASSERT(props.at(u8"a") == 2);
+    ASSERT(props.find(std::u8string_view{u8"c"}) == props.end());
+
+    // insertion order is kept, and repeated properties replace earlier ones
+    auto doc = kdl::parse(u8"node z=1 y=2 x=3 y=4");
+    auto const& node_props = doc.nodes()[0].properties();
+    ASSERT(node_props.size() == 3);
+    std::u8string keys;
+    for (auto const& [key, value] : node_props) keys += key;
+    ASSERT(keys == u8"zyx");
+    ASSERT(node_props.at(u8"y") == 4);
+    ASSERT(doc.to_string() == u8"node z=1 y=4 x=3");
+
+    // large maps use a hash index
+    kdl::PropertyMap big;
+    for (int i = 0; i < 100; ++i) {
+        std::u8string key = u8"key-";
+        key += static_cast<char8_t>(u8'0' + i / 10);
+        key += static_cast<char8_t>(u8'0' + i % 10);
+        big[key] = i;
+    }
+    ASSERT(big.size() == 100);
+    ASSERT(big.at(u8"key-00") == 0 && big.at(u8"key-57") == 57 && big.at(u8"key-99") == 99);
+    ASSERT(!big.contains(u8"key-100"));
+    ASSERT(big.erase(u8"key-57") == 1 && big.erase(u8"key-57") == 0);
+    ASSERT(big.size() == 99 && !big.contains(u8"key-57") && big.at(u8"key-58") == 58);
+    ASSERT(big.insert_or_assign(u8"key-00", 1000).second == false && big.at(u8"key-00") == 1000);
+
+    // copies and moves
+    kdl::PropertyMap copy = big;
+    ASSERT(copy == big && copy.at(u8"key-42") == 42);
+    kdl::PropertyMap moved = std::move(copy);
+    ASSERT(moved == big && copy.empty());
+    kdl::PropertyMap small_moved = std::move(props);
+    ASSERT(small_moved.size() == 2 && small_moved.at(u8"b") == 1 && props.empty());
+
+    // equality doesn't depend on the order
+    ASSERT((kdl::PropertyMap{{u8"a", 1}, {u8"b", 2}} == kdl::PropertyMap{{u8"b", 2}, {u8"a", 1}}));
+    ASSERT((kdl::PropertyMap{{u8"a", 1}, {u8"b", 2}} != kdl::PropertyMap{{u8"b", 2}, {u8"a", 2}}));
+
+    // keys can't be changed in place
+    static_assert(std::is_const_v<std::remove_reference_t<decltype(props.begin()->first)>>);
+
+    // new entries can be made from existing ones, even if the map has to grow
+    std::u8string long_value = u8"a value which is too long for the small string optimization";
+    kdl::PropertyMap aliased{{u8"a", kdl::Value{long_value}}, {u8"key", 2}};
+    aliased.try_emplace(u8"b", aliased.at(u8"a"));
+    ASSERT(aliased.at(u8"b") == kdl::Value{long_value} && aliased.at(u8"a") == kdl::Value{long_value});
+    aliased.insert_or_assign(u8"c", aliased.at(u8"key"));
+    ASSERT(aliased.at(u8"c") == 2);
+    aliased.try_emplace(std::u8string_view{aliased.find(u8"key")->first}.substr(0, 1), 5);
+    ASSERT(aliased.size() == 5 && aliased.at(u8"k") == 5 && aliased.at(u8"key") == 2);
+    ASSERT(aliased.erase(u8"a") == 1 && aliased.begin()->first == u8"key" && aliased.at(u8"b") == long_value);
+}
+
+static bool same_nodes(kdl::FlatNodeRange flat, std::vector<kdl::Node> const& nodes)
+{
+    if (flat.size() != nodes.size()) return false;
+    auto it = nodes.begin();
+    for (kdl::FlatNode fn : flat) {
+        auto const& node = *it++;
+        if (fn.name() != node.name() || fn.type_annotation() != node.type_annotation()) return false;
+        if (fn.args().size() != node.args().size()) return false;
+        for (std::size_t i = 0; i < node.args().size(); ++i) {
+            if (fn.args()[i].to_value() != node.args()[i]) return false;
+        }
+        if (fn.properties().size() != node.properties().size()) return false;
+        for (auto [key, value] : fn.properties()) {
+            auto prop = node.properties().find(key);
+            if (prop == node.properties().end() || value.to_value() != prop->second) return false;
+        }
+        for (auto const& [key, value] : node.properties()) {
+            auto prop = fn.properties().find(key);
+            if (prop == fn.properties().end() || (*prop).value.to_value() != value) return false;
+        }
+        if (!same_nodes(fn.children(), node.children())) return false;
+    }
+    return true;
+}
+
+static void test_flat_document()
+{
+    char8_t const* const docs[] = {
+        u8"",
+        u8"node1 10 \"abc\" 0x10 1.5 null true\n"
+        u8"(t)node2 key=(u8)1 other=\"x\" key=2 {\n"
+        u8"    child1 1 2 3 { grandchild; }\n"
+        u8"    child2 parameter=\"value\"\n"
+        u8"    - { - { - { -; }; }; }\n"
+        u8"}\n"
+        u8"node3 1e1000 (ty)\"\" r\"raw\"\n",
+        u8"a #true; b #\"raw\"# c=#null { d; e; }; f",
+    };
+    for (auto doc_text : docs) {
+        auto doc = kdl::parse(doc_text);
+        auto flat = kdl::parse_flat(doc_text);
+        ASSERT(same_nodes(flat.nodes(), doc.nodes()));
+        ASSERT(flat.version() == doc.version());
+    }
+
+    // a node with enough properties for a hash index, some of them repeated
+    std::u8string many = u8"(t)node \"arg\"";
+    for (int i = 0; i < 40; ++i) {
+        auto key = std::to_string(i % 25);
+        auto value = std::to_string(i);
+        many += u8" k" + std::u8string{key.begin(), key.end()} + u8"=(ty)\"value "
+            + std::u8string{value.begin(), value.end()} + u8"\" 1";
+    }
+    many += u8" { child \"c\" k1=#true; }; next k1=1";
+    auto many_doc = kdl::parse(many);
+    auto many_flat = kdl::parse_flat(many);
+    ASSERT(same_nodes(many_flat.nodes(), many_doc.nodes()));
+    auto many_props = (*many_flat.begin()).properties();
+    ASSERT(many_props.size() == 25);
+    ASSERT((*many_props.find(u8"k3")).value.as<std::u8string_view>() == u8"value 28");
+    ASSERT((*many_props.find(u8"k3")).value.type_annotation() == u8"ty");
+    ASSERT((*many_props.find(u8"k24")).value.as<std::u8string_view>() == u8"value 24");
+    ASSERT(many_props.find(u8"k25") == many_props.end());
+
+    // handles stay valid when the document is moved
+    auto flat = kdl::parse_flat(u8"(t)node 1 \"two\" k=#false { child; }");
+    kdl::FlatNode node = *flat.begin();
+    auto moved = std::move(flat);
+    ASSERT(node.name() == u8"node" && node.type_annotation() == u8"t");
+    ASSERT(node.args()[0].as<int>() == 1 && node.args()[1].as<std::u8string_view>() == u8"two");
+    ASSERT(node.args()[1].type() == kdl::Type::String);
+    ASSERT(node.properties().find(u8"k") != node.properties().end());
+    ASSERT((*node.properties().find(u8"k")).value.as<bool>() == false);
+    ASSERT(node.properties().find(u8"x") == node.properties().end());
+    ASSERT(std::ranges::distance(node.children()) == 1);
+    ASSERT(std::ranges::distance(moved) == 1);
+    ASSERT(std::ranges::all_of(node.args(), [](kdl::FlatValue v) { return v.type() != kdl::Type::Null; }));
+
+    bool threw_TypeError = false;
+    try {
+        (void)node.args()[1].as<double>();
+    } catch (kdl::TypeError const&) {
+        threw_TypeError = true;
+    }
+    ASSERT(threw_TypeError);
+
+    bool threw_ParseError = false;
+    try {
+        (void)kdl::parse_flat(u8"a {");
+    } catch (kdl::ParseError const&) {
+        threw_ParseError = true;
+    }
+    ASSERT(threw_ParseError);
+}
+
+// Describe the events of a document in a string
+static std::u8string describe_events(kdl::EventReader& reader)
+{
+    std::u8string result;
+    for (kdl::Event const& ev : reader) {
+        switch (ev.type()) {
+        case kdl::EventType::StartNode:
+            result += u8"(";
+            result += ev.type_annotation().value_or(u8"");
+            result += u8")";
+            result += ev.name();
+            result += u8"{";
+            break;
+        case kdl::EventType::EndNode:
+            result += u8"}";
+            break;
+        case kdl::EventType::Property:
+            result += ev.name();
+            result += u8"=";
+            [[fallthrough]];
+        case kdl::EventType::Argument:
+            if (ev.value().type() == kdl::Type::String) {
+                result += ev.value().as<std::u8string_view>();
+            } else if (ev.value().type() == kdl::Type::Number) {
+                result += ev.value().as<int>() == 42 ? u8"42" : u8"?";
+            } else {
+                result += u8"-";
+            }
+            result += u8";";
+            break;
+        }
+    }
+    return result;
+}
+
+static void test_event_reader()
+{
+    auto txt = u8"(t)node1 \"arg\" 42 key=\"value\" {\n"
+               u8"    child #null\n"
+               u8"}\n"
+               u8"node2 \"esc\\taped\"\n";
+    std::u8string expected = u8"(t)node1{arg;42;key=value;()child{-;}}()node2{esc\taped;}";
+
+    kdl::EventReader string_reader{txt};
+    ASSERT(describe_events(string_reader) == expected);
+    ASSERT(string_reader.version() == kdl::KdlVersion::Kdl_2);
+
+    // works with std::ranges
+    kdl::EventReader reader2{txt};
+    ASSERT(std::ranges::count_if(reader2, [](kdl::Event const& ev) {
+        return ev.type() == kdl::EventType::StartNode;
+    }) == 3);
+
+    // a stream, read in many chunks
+    std::string big_doc;
+    std::u8string big_expected;
+    for (int i = 0; i < 5000; ++i) {
+        big_doc += reinterpret_cast<char const*>(txt);
+        big_expected += expected;
+    }
+    std::istringstream stream{big_doc};
+    kdl::EventReader stream_reader{stream};
+    ASSERT(describe_events(stream_reader) == big_expected);
+
+    // a file descriptor
+    std::FILE* f = std::tmpfile();
+    ASSERT(f != nullptr);
+    std::fwrite(big_doc.data(), 1, big_doc.size(), f);
+    std::fflush(f);
+    std::rewind(f);
+    kdl::EventReader fd_reader{fileno(f)};
+    ASSERT(describe_events(fd_reader) == big_expected);
+    std::fclose(f);
+
+    // a stream which throws at the end, like an ifstream with exceptions enabled
+    std::istringstream throwing_stream{"a x\nb y\nc z\n"};
+    throwing_stream.exceptions(std::ios::failbit | std::ios::badbit);
+    kdl::EventReader throwing_stream_reader{throwing_stream};
+    ASSERT(describe_events(throwing_stream_reader) == u8"()a{x;}()b{y;}()c{z;}");
+
+    // read errors aren't taken for the end of the document
+    struct failing_buf : std::streambuf {
+        bool failed = false;
+        int_type underflow() override
+        {
+            if (failed) throw std::runtime_error("I/O error");
+            failed = true;
+            static char data[] = "a 1\nb";
+            setg(data, data, data + sizeof(data) - 1);
+            return traits_type::to_int_type(data[0]);
+        }
+    } buf;
+    std::istream failing_stream{&buf};
+    bool threw_stream_error = false;
+    try {
+        kdl::EventReader failing_stream_reader{failing_stream};
+        (void)describe_events(failing_stream_reader);
+    } catch (std::ios_base::failure const&) {
+        threw_stream_error = true;
+    }
+    ASSERT(threw_stream_error);
+
+    bool threw_system_error = false;
+    try {
+        kdl::EventReader bad_fd_reader{-1};
+        (void)describe_events(bad_fd_reader);
+    } catch (std::system_error const&) {
+        threw_system_error = true;
+    }
+    ASSERT(threw_system_error);
+
+    // values can be kept as stand-alone copies
+    kdl::EventReader reader3{u8"node (u8)255 1e1000 #true"};
+    std::vector<kdl::Value> values;
+    for (auto const& ev : reader3) {
+        if (ev.type() == kdl::EventType::Argument) values.push_back(ev.value().to_value());
+    }
+    ASSERT(values.size() == 3);
+    ASSERT(values[0] == (kdl::Value{u8"u8", 255}));
+    ASSERT(values[1].as<kdl::Number>().representation() == kdl::String);
+    ASSERT(values[2] == kdl::Value{true});
+
+    bool threw_ParseError = false;
+    try {
+        kdl::EventReader bad_reader{u8"node {\n  child 1 2"};
+        for ([[maybe_unused]] auto const& ev : bad_reader) {
+        }
+    } catch (kdl::ParseError const&) {
+        threw_ParseError = true;
+    }
+    ASSERT(threw_ParseError);
+}
+
 void TEST_MAIN()
 {
     run_test("kdlpp: cycle", &test_cycle);
@@ -133,5 +531,11 @@ void TEST_MAIN()
     run_test("kdlpp: writing demo code", &test_writing_demo);
     run_test("kdlpp: KDLv2 support", &test_cycle_kdl2);
     run_test("kdlpp: KDLv1 and KDLv2 allowed by default", &test_both_versions_allowed);
+    run_test("kdlpp: detected version", &test_detected_version);
+    run_test("kdlpp: detected version (test documents)", &test_detected_version_corpus);
+    run_test("kdlpp: FlatDocument", &test_flat_document);
+    run_test("kdlpp: PropertyMap", &test_property_map);
+    run_test("kdlpp: strings", &test_strings);
+    run_test("kdlpp: EventReader", &test_event_reader);
 }
 
@@ -299,9 +299,13 @@ cdef bint _emit_node(kdl_emitter *emitter, Node node) except False:
 cdef class Document:
     """
     A KDL document, consisting of zero or more nodes (Node objects).
+
+    Documents returned by parse() have their KDL version (a KdlVersion)
+    in ``version``; it is None if the document is valid in both versions.
     """
 
     cdef public list nodes
+    cdef public object version
 
     def __init__(self, *args):
         if len(args) == 1 and isinstance(args[0], list):
@@ -479,7 +483,8 @@ def parse(str kdl_text, *, version="any"):
 
     Parse a KDL document (must be a str) and return a Document.
 
-    Pass a ``version`` argument to specify the KDL version (default: 1)
+    Pass a ``version`` argument to specify the KDL version (default: "any",
+    which accepts both KDLv1 and KDLv2 in a single pass)
 
     parse(kdl_text, version=1)
     parse(kdl_text, version=2)
@@ -495,16 +500,15 @@ def parse(str kdl_text, *, version="any"):
     cdef Node current_node = None
 
     cdef kdl_parse_option parse_opt
+    cdef kdl_parse_option detected
+    cdef Document doc
 
     if version in (1, '1', '1.0.0'):
         parse_opt = KDL_READ_VERSION_1
     elif version in (2, '2', '2.0.0'):
         parse_opt = KDL_READ_VERSION_2
     elif version in (None, 'detect', 'any'):
-        try:
-            return parse(kdl_text, version=2)
-        except ParseError:
-            return parse(kdl_text, version=1)
+        parse_opt = KDL_DETECT_VERSION
     else:
         raise ValueError(f"Unexpected value for version: {version}")
 
@@ -513,33 +517,41 @@ def parse(str kdl_text, *, version="any"):
     kdl_doc.len = len(byte_str)
     parser = kdl_create_string_parser(kdl_doc, parse_opt)
 
-    while True:
-        ev = kdl_parser_next_event(parser)
-
-        if ev.event == KDL_EVENT_EOF:
-            kdl_destroy_parser(parser)
-            return Document(root_node_list)
-        elif ev.event == KDL_EVENT_PARSE_ERROR:
-            raise ParseError(_kdl_str_to_py_str(&ev.value.string))
-        elif ev.event == KDL_EVENT_START_NODE:
-            current_node = Node()
-            current_node.name = _kdl_str_to_py_str(&ev.name)
-            if ev.value.type_annotation.data != NULL:
-                current_node.type_annotation = _kdl_str_to_py_str(&ev.value.type_annotation)
-            nodes.append(current_node)
-            stack.append(current_node)
-            nodes = current_node.children
-        elif ev.event == KDL_EVENT_END_NODE:
-            stack.pop()
-            if len(stack) == 0:
-                # at the top
-                nodes = root_node_list
+    try:
+        while True:
+            ev = kdl_parser_next_event(parser)
+
+            if ev.event == KDL_EVENT_EOF:
+                doc = Document(root_node_list)
+                detected = kdl_parser_get_version(parser)
+                if detected == KDL_READ_VERSION_1:
+                    doc.version = KdlVersion.kdl_1
+                elif detected == KDL_READ_VERSION_2:
+                    doc.version = KdlVersion.kdl_2
+                return doc
+            elif ev.event == KDL_EVENT_PARSE_ERROR:
+                raise ParseError(_kdl_str_to_py_str(&ev.value.string))
+            elif ev.event == KDL_EVENT_START_NODE:
+                current_node = Node()
+                current_node.name = _kdl_str_to_py_str(&ev.name)
+                if ev.value.type_annotation.data != NULL:
+                    current_node.type_annotation = _kdl_str_to_py_str(&ev.value.type_annotation)
+                nodes.append(current_node)
+                stack.append(current_node)
+                nodes = current_node.children
+            elif ev.event == KDL_EVENT_END_NODE:
+                stack.pop()
+                if len(stack) == 0:
+                    # at the top
+                    nodes = root_node_list
+                else:
+                    # in a node
+                    nodes = stack[-1].children
+            elif ev.event == KDL_EVENT_ARGUMENT:
+                current_node.args.append(_convert_kdl_value(&ev.value))
+            elif ev.event == KDL_EVENT_PROPERTY:
+                current_node.properties[_kdl_str_to_py_str(&ev.name)] = _convert_kdl_value(&ev.value)
             else:
-                # in a node
-                nodes = stack[-1].children
-        elif ev.event == KDL_EVENT_ARGUMENT:
-            current_node.args.append(_convert_kdl_value(&ev.value))
-        elif ev.event == KDL_EVENT_PROPERTY:
-            current_node.properties[_kdl_str_to_py_str(&ev.name)] = _convert_kdl_value(&ev.value)
-        else:
-            raise RuntimeError("Unexpected event")
+                raise RuntimeError("Unexpected event")
+    finally:
+        kdl_destroy_parser(parser)
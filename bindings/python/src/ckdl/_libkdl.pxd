@@ -89,6 +89,7 @@ cdef extern from "kdl/parser.h":
     cdef void kdl_destroy_parser(kdl_parser *parser)
 
     cdef kdl_event_data *kdl_parser_next_event(kdl_parser *parser)
+    cdef kdl_parse_option kdl_parser_get_version(const kdl_parser *parser)
 
 cdef extern from "kdl/emitter.h":
     ctypedef enum kdl_identifier_emission_mode:
@@ -110,6 +111,7 @@ cdef extern from "kdl/emitter.h":
         kdl_identifier_emission_mode identifier_mode
         kdl_float_printing_options float_mode
         kdl_version version
+        size_t write_buffer_size
 
     cdef kdl_emitter_options KDL_DEFAULT_EMITTER_OPTIONS
 
@@ -128,5 +130,6 @@ cdef extern from "kdl/emitter.h":
     cdef bint kdl_start_emitting_children(kdl_emitter *emitter)
     cdef bint kdl_finish_emitting_children(kdl_emitter *emitter)
     cdef bint kdl_emit_end(kdl_emitter *emitter)
+    cdef bint kdl_emitter_flush(kdl_emitter *emitter)
 
     cdef kdl_str kdl_get_emitter_buffer(kdl_emitter *emitter)
@@ -2,8 +2,13 @@
 
 import ckdl
 
+import os
 import unittest
 
+TEST_DOCUMENTS_ROOT = os.path.join(
+    os.path.dirname(__file__), "..", "..", "..", "tests", "test_documents", "upstream"
+)
+
 
 class CKDLTest(unittest.TestCase):
     def _dedent_str(self, s):
@@ -54,6 +59,39 @@ class CKDLTest(unittest.TestCase):
         self.assertEqual(doc[1].children, [])
         self.assertEqual(doc[1].properties, {})
 
+    def test_detected_version(self):
+        self.assertEqual(ckdl.parse('node "arg" r#"raw"#').version, ckdl.KdlVersion.kdl_1)
+        self.assertEqual(ckdl.parse("node arg #true").version, ckdl.KdlVersion.kdl_2)
+        self.assertIsNone(ckdl.parse('node "arg" 1').version)
+        self.assertEqual(ckdl.parse('node "arg"', version=1).version, ckdl.KdlVersion.kdl_1)
+        self.assertIsNone(ckdl.Document().version)
+        with self.assertRaises(ckdl.ParseError):
+            ckdl.parse('node1 r#"raw"#; node2 #true')
+        self.assertEqual(
+            ckdl.parse('node """\n  x\n  """\n').version, ckdl.KdlVersion.kdl_2
+        )
+        # U+2028 is a newline in KDLv2 only
+        with self.assertRaises(ckdl.ParseError):
+            ckdl.parse('node """\n  x\n  """ "a\u2028b"')
+
+    def test_detected_version_test_documents(self):
+        def read(name):
+            with open(os.path.join(TEST_DOCUMENTS_ROOT, name), encoding="utf-8") as f:
+                return f.read()
+
+        # invalid in both versions
+        for name in [
+            "1.0.0/input/dot_zero.kdl",
+            "2.0.0/input/dot_zero_fail.kdl",
+            "2.0.0/input/no_integer_digit_fail.kdl",
+            "2.0.0/input/bare_ident_numeric_dot_fail.kdl",
+        ]:
+            with self.subTest(name=name), self.assertRaises(ckdl.ParseError):
+                ckdl.parse(read(name))
+        # valid KDLv1
+        doc = ckdl.parse(read("2.0.0/input/unicode_lri_fail.kdl"))
+        self.assertEqual(doc.version, ckdl.KdlVersion.kdl_1)
+
     def test_simple_emission_v1(self):
         doc = ckdl.Document(
             ckdl.Node(
@@ -29,8 +29,14 @@ enum kdl_version {
 typedef size_t (*kdl_read_func)(void* user_data, char* buf, size_t bufsize);
 typedef size_t (*kdl_write_func)(void* user_data, char const* data, size_t nbytes);
 
+// Function pointers used to interface with a custom memory allocator
+typedef void* (*kdl_malloc_func)(void* user_data, size_t size);
+typedef void* (*kdl_realloc_func)(void* user_data, void* ptr, size_t size);
+typedef void (*kdl_free_func)(void* user_data, void* ptr);
+
 typedef struct kdl_str kdl_str;
 typedef struct kdl_owned_string kdl_owned_string;
+typedef struct kdl_allocator kdl_allocator;
 typedef enum kdl_escape_mode kdl_escape_mode;
 typedef enum kdl_version kdl_version;
 
@@ -48,6 +54,16 @@ struct kdl_owned_string {
     size_t len;
 };
 
+// A set of memory allocation functions. They must behave like malloc, realloc and free; in
+// particular, realloc_func must accept a NULL pointer. free_func is never called with NULL.
+// Wherever a kdl_allocator const* is accepted, NULL means "use malloc, realloc and free".
+struct kdl_allocator {
+    kdl_malloc_func malloc_func;
+    kdl_realloc_func realloc_func;
+    kdl_free_func free_func;
+    void* user_data; // passed to all functions
+};
+
 // Get a reference to an owned string
 KDL_EXPORT_INLINE kdl_str kdl_borrow_str(kdl_owned_string const* str)
 {
@@ -61,6 +77,10 @@ KDL_EXPORT kdl_str kdl_str_from_cstr(char const* s);
 KDL_NODISCARD KDL_EXPORT kdl_owned_string kdl_clone_str(kdl_str const* s);
 // Free the memory associated with an owned string, and set the pointer to NULL
 KDL_EXPORT void kdl_free_string(kdl_owned_string* s);
+// Create an owned string with the same content as another string, using a custom allocator
+KDL_NODISCARD KDL_EXPORT kdl_owned_string kdl_clone_str_ex(kdl_str const* s, kdl_allocator const* allocator);
+// Free an owned string that was allocated with a custom allocator, and set the pointer to NULL
+KDL_EXPORT void kdl_free_string_ex(kdl_owned_string* s, kdl_allocator const* allocator);
 
 // Escape special characters in a string
 KDL_NODISCARD KDL_EXPORT kdl_owned_string kdl_escape_v(kdl_version version, kdl_str const* s, kdl_escape_mode mode);
@@ -68,6 +88,14 @@ KDL_NODISCARD KDL_EXPORT kdl_owned_string kdl_escape_v(kdl_version version, kdl_
 KDL_NODISCARD KDL_EXPORT kdl_owned_string kdl_unescape_v(kdl_version version, kdl_str const* s);
 // Resolve backslash escape sequences and (in v2) dedent string
 KDL_NODISCARD KDL_EXPORT kdl_owned_string kdl_unescape_multi_line(kdl_version version, kdl_str const* s);
+// Variants of the above functions which allocate the result (and all intermediate buffers) with a
+// custom allocator
+KDL_NODISCARD KDL_EXPORT kdl_owned_string kdl_escape_v_ex(
+    kdl_version version, kdl_str const* s, kdl_escape_mode mode, kdl_allocator const* allocator);
+KDL_NODISCARD KDL_EXPORT kdl_owned_string kdl_unescape_v_ex(
+    kdl_version version, kdl_str const* s, kdl_allocator const* allocator);
+KDL_NODISCARD KDL_EXPORT kdl_owned_string kdl_unescape_multi_line_ex(
+    kdl_version version, kdl_str const* s, kdl_allocator const* allocator);
 
 // Escape special characters in a string according to KDLv1 string rules
 KDL_DEPRECATED("Use kdl_escape_v instead")
@@ -37,6 +37,7 @@ struct kdl_emitter_options {
     kdl_identifier_emission_mode identifier_mode; // How to quote identifiers
     kdl_float_printing_options float_mode;        // How to print floating point numbers
     kdl_version version;                          // KDL version to use
+    size_t write_buffer_size;                     // Bytes to collect before calling write_func
 };
 
 KDL_EXPORT extern const kdl_emitter_options KDL_DEFAULT_EMITTER_OPTIONS;
@@ -46,6 +47,13 @@ KDL_NODISCARD KDL_EXPORT kdl_emitter* kdl_create_buffering_emitter(kdl_emitter_o
 // Create an emitter that writes by calling a user-supplied function
 KDL_NODISCARD KDL_EXPORT kdl_emitter* kdl_create_stream_emitter(
     kdl_write_func write_func, void* user_data, kdl_emitter_options const* opt);
+// Create an emitter than writes into an internal buffer, allocating memory with a custom allocator
+KDL_NODISCARD KDL_EXPORT kdl_emitter* kdl_create_buffering_emitter_ex(
+    kdl_emitter_options const* opt, kdl_allocator const* allocator);
+// Create an emitter that writes by calling a user-supplied function, allocating memory with a
+// custom allocator
+KDL_NODISCARD KDL_EXPORT kdl_emitter* kdl_create_stream_emitter_ex(kdl_write_func write_func,
+    void* user_data, kdl_emitter_options const* opt, kdl_allocator const* allocator);
 
 // Destroy an emitter
 KDL_EXPORT void kdl_destroy_emitter(kdl_emitter* emitter);
@@ -62,8 +70,10 @@ KDL_EXPORT bool kdl_emit_property(kdl_emitter* emitter, kdl_str name, kdl_value
 KDL_EXPORT bool kdl_start_emitting_children(kdl_emitter* emitter);
 // End the list of children ('}')
 KDL_EXPORT bool kdl_finish_emitting_children(kdl_emitter* emitter);
-// Finish - write a final newline if required
+// Finish - write a final newline if required, and flush
 KDL_EXPORT bool kdl_emit_end(kdl_emitter* emitter);
+// Pass any output collected by a stream emitter to its write_func
+KDL_EXPORT bool kdl_emitter_flush(kdl_emitter* emitter);
 
 // Get a reference to the current emitter buffer
 // This string is invalidated on any call to kdl_emit_*
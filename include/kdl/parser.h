@@ -2,6 +2,7 @@
 #define KDL_PARSER_H_
 
 #include "common.h"
+#include "tokenizer.h"
 #include "value.h"
 
 #ifdef __cplusplus
@@ -26,6 +27,12 @@ enum kdl_event {
 // Parser configuration
 enum kdl_parse_option {
     KDL_EMIT_COMMENTS = 0x001,         // Emit comments (default: don't)
+    KDL_BORROW_STRINGS = 0x002,        // Where possible, return strings as slices of the document
+                                       // (string parsers only)
+    KDL_LAZY_VALUES = 0x004,           // Don't decode argument and property values until
+                                       // kdl_event_materialize_value() is called
+    KDL_UNCHECKED_SKIP = 0x008,        // kdl_parser_skip_node() only matches braces and doesn't check
+                                       // the syntax of the skipped part
     KDL_READ_VERSION_1 = 0x20000,      // Use KDL version 1.0.0
     KDL_READ_VERSION_2 = 0x40000,      // Use KDL version 2.0.0
     KDL_DETECT_VERSION = 0x70000,      // Allow both KDL v2 and KDL v1
@@ -36,12 +43,15 @@ typedef enum kdl_event kdl_event;
 typedef struct kdl_event_data kdl_event_data;
 typedef enum kdl_parse_option kdl_parse_option;
 typedef struct _kdl_parser kdl_parser;
+typedef struct kdl_parallel_options kdl_parallel_options;
 
 // Full event structure
 struct kdl_event_data {
     kdl_event event; // What is the event?
     kdl_str name;    // name of the node or property
     kdl_value value; // value including type annotation (for nodes: null with type annotation)
+    kdl_token token; // KDL_LAZY_VALUES: the token of a value that has not been decoded yet (if
+                     // token.value.data != NULL; value is null until it is materialized)
 };
 
 // Create a parser that reads from a string
@@ -49,13 +59,74 @@ KDL_NODISCARD KDL_EXPORT kdl_parser* kdl_create_string_parser(kdl_str doc, kdl_p
 // Create a parser that reads data by calling a user-supplied function
 KDL_NODISCARD KDL_EXPORT kdl_parser* kdl_create_stream_parser(
     kdl_read_func read_func, void* user_data, kdl_parse_option opt);
+// Create a parser that reads a file by mapping it into memory (returns NULL if the file can't be
+// opened)
+KDL_NODISCARD KDL_EXPORT kdl_parser* kdl_create_file_parser(char const* path, kdl_parse_option opt);
+// Create a parser that reads from a string, allocating memory with a custom allocator
+KDL_NODISCARD KDL_EXPORT kdl_parser* kdl_create_string_parser_ex(
+    kdl_str doc, kdl_parse_option opt, kdl_allocator const* allocator);
+// Create a parser that reads data by calling a user-supplied function, allocating memory with a
+// custom allocator
+KDL_NODISCARD KDL_EXPORT kdl_parser* kdl_create_stream_parser_ex(
+    kdl_read_func read_func, void* user_data, kdl_parse_option opt, kdl_allocator const* allocator);
+// Create a parser that reads a file by mapping it into memory, allocating memory with a custom
+// allocator
+KDL_NODISCARD KDL_EXPORT kdl_parser* kdl_create_file_parser_ex(
+    char const* path, kdl_parse_option opt, kdl_allocator const* allocator);
+// Create a parser that reads from a string in two stages: an index of the token boundaries is built
+// using SIMD instructions, a window of the document at a time, and the tokenizer walks the index
+// instead of the text. The events are exactly the same as those of a string parser.
+KDL_NODISCARD KDL_EXPORT kdl_parser* kdl_create_indexed_parser(kdl_str doc, kdl_parse_option opt);
+// Create a parser that reads from a string using an index of the token boundaries, allocating
+// memory with a custom allocator
+KDL_NODISCARD KDL_EXPORT kdl_parser* kdl_create_indexed_parser_ex(
+    kdl_str doc, kdl_parse_option opt, kdl_allocator const* allocator);
 // Destroy a parser
 KDL_EXPORT void kdl_destroy_parser(kdl_parser* parser);
 
+// Set the minimum number of bytes a stream parser asks its read function for (0 = default).
+// Larger reads (e.g. 64 KiB to 1 MiB) reduce the number of calls when reading from pipes or sockets.
+KDL_EXPORT void kdl_parser_set_read_chunk_size(kdl_parser* parser, size_t chunk_size);
+
+// Get the KDL version of the document as far as it has been read: KDL_READ_VERSION_1 or
+// KDL_READ_VERSION_2 once it is known, or KDL_DETECT_VERSION while everything so far is valid in
+// both versions. After KDL_EVENT_EOF, KDL_DETECT_VERSION means that the whole document is.
+KDL_EXPORT kdl_parse_option kdl_parser_get_version(kdl_parser const* parser);
+
 // Get the next parse event
 // Returns a pointer to an event structure. The structure (including all strings it contains!) is
 // invalidated on the next call.
 KDL_EXPORT kdl_event_data* kdl_parser_next_event(kdl_parser* parser);
+// Skip the rest of the innermost open node, including all its children, and return its
+// KDL_EVENT_END_NODE event (or the parse error or end of file encountered on the way). The skipped
+// part is checked for syntax errors, but its strings and numbers are not decoded.
+KDL_EXPORT kdl_event_data* kdl_parser_skip_node(kdl_parser* parser);
+// Decode the value of an argument or property event returned by a parser with KDL_LAZY_VALUES.
+// event must be the parser's most recent event. Returns true on success (or if there is nothing to
+// decode); if the value is invalid, the event is turned into a KDL_EVENT_PARSE_ERROR and false is
+// returned.
+KDL_EXPORT bool kdl_event_materialize_value(kdl_parser* parser, kdl_event_data* event);
+
+// Configuration of kdl_parse_parallel()
+struct kdl_parallel_options {
+    unsigned int n_threads; // Number of worker threads (0: one per CPU)
+    size_t chunk_size;      // The document is split into chunks of at least this many bytes
+};
+
+KDL_EXPORT extern const kdl_parallel_options KDL_DEFAULT_PARALLEL_OPTIONS;
+
+// Called by kdl_parse_parallel() for each event. chunk_index is the number of the chunk the event
+// belongs to, counting from 0 in document order. Return false to stop parsing.
+typedef bool (*kdl_chunk_event_func)(void* user_data, size_t chunk_index, kdl_event_data* event);
+
+// Parse a document consisting of many top-level nodes using several threads. The document is split
+// into chunks at top-level node boundaries, and each chunk is parsed by a string parser with the
+// given options. The events of each chunk are passed to func in order, ending with
+// KDL_EVENT_EOF or KDL_EVENT_PARSE_ERROR, but different chunks are parsed concurrently, so func
+// must be thread-safe. With KDL_DETECT_VERSION, all chunks must be in the same version. Returns true
+// if the whole document was parsed without errors.
+KDL_EXPORT bool kdl_parse_parallel(kdl_str doc, kdl_parse_option opt,
+    kdl_parallel_options const* parallel_opt, kdl_chunk_event_func func, void* user_data);
 
 #ifdef __cplusplus
 }
@@ -59,11 +59,34 @@ struct kdl_token {
 KDL_NODISCARD KDL_EXPORT kdl_tokenizer* kdl_create_string_tokenizer(kdl_str doc);
 // Create a tokenizer that reads data by calling a user-supplied function
 KDL_NODISCARD KDL_EXPORT kdl_tokenizer* kdl_create_stream_tokenizer(kdl_read_func read_func, void* user_data);
+// Create a tokenizer that reads a file by mapping it into memory (returns NULL if the file can't be
+// opened)
+KDL_NODISCARD KDL_EXPORT kdl_tokenizer* kdl_create_file_tokenizer(char const* path);
+// Create a tokenizer that reads from a string, allocating memory with a custom allocator
+KDL_NODISCARD KDL_EXPORT kdl_tokenizer* kdl_create_string_tokenizer_ex(
+    kdl_str doc, kdl_allocator const* allocator);
+// Create a tokenizer that reads data by calling a user-supplied function, allocating memory with a
+// custom allocator
+KDL_NODISCARD KDL_EXPORT kdl_tokenizer* kdl_create_stream_tokenizer_ex(
+    kdl_read_func read_func, void* user_data, kdl_allocator const* allocator);
+// Create a tokenizer that reads a file by mapping it into memory, allocating memory with a custom
+// allocator
+KDL_NODISCARD KDL_EXPORT kdl_tokenizer* kdl_create_file_tokenizer_ex(
+    char const* path, kdl_allocator const* allocator);
+// Create a tokenizer that reads from a string, finding the ends of tokens in an index of the token
+// boundaries which is built ahead of it
+KDL_NODISCARD KDL_EXPORT kdl_tokenizer* kdl_create_indexed_tokenizer(kdl_str doc);
+// Create a tokenizer that reads from a string using an index of the token boundaries, allocating
+// memory with a custom allocator
+KDL_NODISCARD KDL_EXPORT kdl_tokenizer* kdl_create_indexed_tokenizer_ex(
+    kdl_str doc, kdl_allocator const* allocator);
 // Destroy a tokenizer
 KDL_EXPORT void kdl_destroy_tokenizer(kdl_tokenizer* tokenizer);
 
 // Change the character set used by the tokenizer
 KDL_EXPORT void kdl_tokenizer_set_character_set(kdl_tokenizer* tokenizer, kdl_character_set cs);
+// Set the minimum number of bytes a stream tokenizer asks its read function for (0 = default)
+KDL_EXPORT void kdl_tokenizer_set_read_chunk_size(kdl_tokenizer* tokenizer, size_t chunk_size);
 
 // Get the next token and write it to a user-supplied structure (or return an error)
 KDL_EXPORT kdl_tokenizer_status kdl_pop_token(kdl_tokenizer* tokenizer, kdl_token* dest);
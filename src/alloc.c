@@ -0,0 +1,28 @@
+#include "alloc.h"
+
+#include <stdlib.h>
+
+static void* _default_malloc(void* user_data, size_t size)
+{
+    (void)user_data;
+    return malloc(size);
+}
+
+static void* _default_realloc(void* user_data, void* ptr, size_t size)
+{
+    (void)user_data;
+    return realloc(ptr, size);
+}
+
+static void _default_free(void* user_data, void* ptr)
+{
+    (void)user_data;
+    free(ptr);
+}
+
+kdl_allocator const _kdl_default_allocator = {
+    .malloc_func = &_default_malloc,
+    .realloc_func = &_default_realloc,
+    .free_func = &_default_free,
+    .user_data = NULL,
+};
@@ -0,0 +1,40 @@
+#ifndef KDL_INTERNAL_ALLOC_H_
+#define KDL_INTERNAL_ALLOC_H_
+
+#include "kdl/common.h"
+
+#include <stddef.h>
+
+// malloc, realloc and free
+extern kdl_allocator const _kdl_default_allocator;
+
+// Resolve the user's choice of allocator (NULL means default)
+static inline kdl_allocator _kdl_allocator_or_default(kdl_allocator const* alloc)
+{
+    return alloc != NULL ? *alloc : _kdl_default_allocator;
+}
+
+static inline void* _kdl_malloc(kdl_allocator const* alloc, size_t size)
+{
+    return alloc->malloc_func(alloc->user_data, size);
+}
+
+static inline void* _kdl_realloc(kdl_allocator const* alloc, void* ptr, size_t size)
+{
+    return alloc->realloc_func(alloc->user_data, ptr, size);
+}
+
+static inline void _kdl_free(kdl_allocator const* alloc, void* ptr)
+{
+    if (ptr != NULL) alloc->free_func(alloc->user_data, ptr);
+}
+
+// Like reallocf(): free the original memory if it cannot be resized
+static inline void* _kdl_reallocf(kdl_allocator const* alloc, void* ptr, size_t size)
+{
+    void* new_ptr = _kdl_realloc(alloc, ptr, size);
+    if (new_ptr == NULL) _kdl_free(alloc, ptr);
+    return new_ptr;
+}
+
+#endif // KDL_INTERNAL_ALLOC_H_
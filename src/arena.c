@@ -0,0 +1,149 @@
+#include "arena.h"
+#include "alloc.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// Small blocks in Debug mode to exercise the slow paths
+#ifdef KDL_DEBUG
+#    define INITIAL_BLOCK_SIZE 1
+#else
+#    define INITIAL_BLOCK_SIZE 4096
+#endif
+
+#define ALIGNMENT _Alignof(max_align_t)
+#define ALIGN_UP(n) (((n) + (ALIGNMENT - 1)) & ~(size_t)(ALIGNMENT - 1))
+
+struct _kdl_arena_block {
+    _kdl_arena_block* prev;
+    size_t size; // usable size
+};
+
+// Every allocation is preceded by its size, so that it can be copied by _kdl_arena_realloc
+#define BLOCK_HEADER_SIZE ALIGN_UP(sizeof(_kdl_arena_block))
+#define ALLOC_HEADER_SIZE ALIGN_UP(sizeof(size_t))
+
+static inline char* _block_data(_kdl_arena_block* block) { return (char*)block + BLOCK_HEADER_SIZE; }
+
+static inline size_t* _alloc_header(void* ptr) { return (size_t*)((char*)ptr - ALLOC_HEADER_SIZE); }
+
+static void _free_blocks(kdl_allocator const* backing, _kdl_arena_block* block)
+{
+    while (block != NULL) {
+        _kdl_arena_block* prev = block->prev;
+        _kdl_free(backing, block);
+        block = prev;
+    }
+}
+
+void _kdl_arena_init(_kdl_arena* arena, kdl_allocator const* backing)
+{
+    arena->backing = backing;
+    arena->block = NULL;
+    arena->used = 0;
+    arena->last = NULL;
+}
+
+void _kdl_arena_destroy(_kdl_arena* arena)
+{
+    _free_blocks(arena->backing, arena->block);
+    _kdl_arena_init(arena, arena->backing);
+}
+
+void _kdl_arena_reset(_kdl_arena* arena)
+{
+    // Blocks grow geometrically, so the current block is the largest one
+    if (arena->block != NULL) {
+        _free_blocks(arena->backing, arena->block->prev);
+        arena->block->prev = NULL;
+    }
+    arena->used = 0;
+    arena->last = NULL;
+}
+
+static bool _add_block(_kdl_arena* arena, size_t min_size)
+{
+    size_t size = arena->block != NULL ? 2 * arena->block->size : INITIAL_BLOCK_SIZE;
+    if (size < min_size) size = min_size;
+    _kdl_arena_block* block = _kdl_malloc(arena->backing, BLOCK_HEADER_SIZE + size);
+    if (block == NULL) return false;
+    block->prev = arena->block;
+    block->size = size;
+    arena->block = block;
+    arena->used = 0;
+    arena->last = NULL;
+    return true;
+}
+
+void* _kdl_arena_alloc(_kdl_arena* arena, size_t size)
+{
+    if (size > SIZE_MAX / 4) return NULL;
+    size_t needed = ALLOC_HEADER_SIZE + ALIGN_UP(size);
+    if (arena->block == NULL || arena->block->size - arena->used < needed) {
+        if (!_add_block(arena, needed)) return NULL;
+    }
+    char* p = _block_data(arena->block) + arena->used;
+    *(size_t*)p = size;
+    arena->used += needed;
+    arena->last = p + ALLOC_HEADER_SIZE;
+    return arena->last;
+}
+
+void* _kdl_arena_realloc(_kdl_arena* arena, void* ptr, size_t size)
+{
+    if (ptr == NULL) return _kdl_arena_alloc(arena, size);
+    if (size > SIZE_MAX / 4) return NULL;
+
+    size_t* header = _alloc_header(ptr);
+    size_t old_size = *header;
+    if (ptr == arena->last) {
+        // The most recent allocation can grow into the rest of the block
+        size_t offset = (size_t)((char*)ptr - _block_data(arena->block));
+        if (arena->block->size - offset >= ALIGN_UP(size)) {
+            *header = size;
+            arena->used = offset + ALIGN_UP(size);
+            return ptr;
+        }
+    } else if (size <= old_size) {
+        *header = size;
+        return ptr;
+    }
+
+    void* new_ptr = _kdl_arena_alloc(arena, size);
+    if (new_ptr != NULL) {
+        memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+    }
+    return new_ptr;
+}
+
+void _kdl_arena_free(_kdl_arena* arena, void* ptr)
+{
+    // Only the most recent allocation can be given back before the next reset
+    if (ptr != NULL && ptr == arena->last) {
+        arena->used = (size_t)((char*)ptr - ALLOC_HEADER_SIZE - _block_data(arena->block));
+        arena->last = NULL;
+    }
+}
+
+static void* _arena_malloc_func(void* user_data, size_t size)
+{
+    return _kdl_arena_alloc((_kdl_arena*)user_data, size);
+}
+
+static void* _arena_realloc_func(void* user_data, void* ptr, size_t size)
+{
+    return _kdl_arena_realloc((_kdl_arena*)user_data, ptr, size);
+}
+
+static void _arena_free_func(void* user_data, void* ptr) { _kdl_arena_free((_kdl_arena*)user_data, ptr); }
+
+kdl_allocator _kdl_arena_allocator(_kdl_arena* arena)
+{
+    return (kdl_allocator){
+        .malloc_func = &_arena_malloc_func,
+        .realloc_func = &_arena_realloc_func,
+        .free_func = &_arena_free_func,
+        .user_data = arena,
+    };
+}
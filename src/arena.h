@@ -0,0 +1,34 @@
+#ifndef KDL_INTERNAL_ARENA_H_
+#define KDL_INTERNAL_ARENA_H_
+
+#include "kdl/common.h"
+
+#include <stddef.h>
+
+typedef struct _kdl_arena_block _kdl_arena_block;
+typedef struct _kdl_arena _kdl_arena;
+
+// Bump allocator for short-lived allocations. Memory is taken from a backing allocator in
+// blocks of increasing size and only given back in bulk, by _kdl_arena_reset() or
+// _kdl_arena_destroy(). The most recent allocation may be resized or released in place,
+// which suits the _kdl_write_buffer pattern of growing a buffer and then trimming it.
+struct _kdl_arena {
+    kdl_allocator const* backing;
+    _kdl_arena_block* block; // current block, linked to the older ones
+    size_t used;             // number of bytes used in the current block
+    char* last;              // most recent allocation, or NULL
+};
+
+void _kdl_arena_init(_kdl_arena* arena, kdl_allocator const* backing);
+void _kdl_arena_destroy(_kdl_arena* arena);
+// Release all allocations at once, keeping the most recent block for reuse
+void _kdl_arena_reset(_kdl_arena* arena);
+
+KDL_NODISCARD void* _kdl_arena_alloc(_kdl_arena* arena, size_t size);
+KDL_NODISCARD void* _kdl_arena_realloc(_kdl_arena* arena, void* ptr, size_t size);
+void _kdl_arena_free(_kdl_arena* arena, void* ptr);
+
+// Get a kdl_allocator handing out memory from this arena (for use with the str.h functions)
+kdl_allocator _kdl_arena_allocator(_kdl_arena* arena);
+
+#endif // KDL_INTERNAL_ARENA_H_
@@ -1,17 +1,17 @@
 #include "bigint.h"
-#include "compat.h"
+#include "alloc.h"
 
-#include <stdlib.h>
 #include <string.h>
 
 #define DIGIT_BITS ((uint64_t)32)
 #define DIGIT_BITMASK ((uint64_t)0xFFFFFFFFUL)
 #define HIGH_DIGIT_BITMASK (DIGIT_BITMASK << DIGIT_BITS)
 
-_kdl_ubigint* _kdl_ubigint_new(uint32_t initial_value)
+_kdl_ubigint* _kdl_ubigint_new(uint32_t initial_value, kdl_allocator const* alloc)
 {
-    _kdl_ubigint* i = malloc(sizeof(_kdl_ubigint) + sizeof(uint32_t));
+    _kdl_ubigint* i = _kdl_malloc(alloc, sizeof(_kdl_ubigint) + sizeof(uint32_t));
     if (i == NULL) return NULL;
+    i->alloc = alloc;
     i->n_digits = 1;
     i->num[0] = initial_value;
     return i;
@@ -20,13 +20,16 @@ _kdl_ubigint* _kdl_ubigint_new(uint32_t initial_value)
 _kdl_ubigint* _kdl_ubigint_dup(_kdl_ubigint const* value)
 {
     size_t size = sizeof(_kdl_ubigint) + value->n_digits * sizeof(uint32_t);
-    _kdl_ubigint* i = malloc(size);
+    _kdl_ubigint* i = _kdl_malloc(value->alloc, size);
     if (i == NULL) return NULL;
     memcpy(i, value, size);
     return i;
 }
 
-void _kdl_ubigint_free(_kdl_ubigint* i) { free(i); }
+void _kdl_ubigint_free(_kdl_ubigint* i)
+{
+    if (i != NULL) _kdl_free(i->alloc, i);
+}
 
 // a += b
 _kdl_ubigint* _kdl_ubigint_add_inplace(_kdl_ubigint* a, unsigned int b)
@@ -39,9 +42,9 @@ _kdl_ubigint* _kdl_ubigint_add_inplace(_kdl_ubigint* a, unsigned int b)
     }
     if (carry != 0) {
         // overflow
-        a = reallocf(a, sizeof(_kdl_ubigint) + (++a->n_digits) * sizeof(uint32_t));
+        a = _kdl_reallocf(a->alloc, a, sizeof(_kdl_ubigint) + (a->n_digits + 1) * sizeof(uint32_t));
         if (a != NULL) {
-            a->num[a->n_digits - 1] = (uint32_t)(carry & DIGIT_BITMASK);
+            a->num[a->n_digits++] = (uint32_t)(carry & DIGIT_BITMASK);
         }
     }
     return a;
@@ -60,14 +63,36 @@ _kdl_ubigint* _kdl_ubigint_multiply_inplace(_kdl_ubigint* a, unsigned int b)
     }
     if (carry != 0) {
         // overflow
-        a = reallocf(a, sizeof(_kdl_ubigint) + (++a->n_digits) * sizeof(uint32_t));
+        a = _kdl_reallocf(a->alloc, a, sizeof(_kdl_ubigint) + (a->n_digits + 1) * sizeof(uint32_t));
         if (a != NULL) {
-            a->num[a->n_digits - 1] = carry;
+            a->num[a->n_digits++] = carry;
         }
     }
     return a;
 }
 
+// a <<= bits
+_kdl_ubigint* _kdl_ubigint_shift_left_inplace(_kdl_ubigint* a, size_t bits)
+{
+    size_t word_shift = bits / DIGIT_BITS;
+    unsigned bit_shift = (unsigned)(bits % DIGIT_BITS);
+    size_t old_n = a->n_digits;
+    size_t new_n = old_n + word_shift + 1;
+    a = _kdl_reallocf(a->alloc, a, sizeof(_kdl_ubigint) + new_n * sizeof(uint32_t));
+    if (a == NULL) return NULL;
+    a->num[new_n - 1] = 0;
+    for (size_t i = old_n; i-- > 0;) {
+        uint64_t tmp = (uint64_t)a->num[i] << bit_shift;
+        a->num[i + word_shift + 1] |= (uint32_t)(tmp >> DIGIT_BITS);
+        a->num[i + word_shift] = (uint32_t)(tmp & DIGIT_BITMASK);
+    }
+    memset(a->num, 0, word_shift * sizeof(uint32_t));
+    a->n_digits = new_n;
+    // shrink the number if possible
+    while (a->n_digits > 1 && a->num[a->n_digits - 1] == 0) --a->n_digits;
+    return a;
+}
+
 uint32_t _kdl_ubigint_divide_inplace(_kdl_ubigint* a, uint32_t b)
 {
     uint64_t rem = 0;
@@ -81,6 +106,17 @@ uint32_t _kdl_ubigint_divide_inplace(_kdl_ubigint* a, uint32_t b)
     return (uint32_t)rem;
 }
 
+int _kdl_ubigint_compare(_kdl_ubigint const* a, _kdl_ubigint const* b)
+{
+    size_t n = a->n_digits > b->n_digits ? a->n_digits : b->n_digits;
+    for (size_t i = n; i-- > 0;) {
+        uint32_t da = i < a->n_digits ? a->num[i] : 0;
+        uint32_t db = i < b->n_digits ? b->num[i] : 0;
+        if (da != db) return da < db ? -1 : 1;
+    }
+    return 0;
+}
+
 bool _kdl_ubigint_as_long_long(_kdl_ubigint* i, long long* dest)
 {
     // does it fit?
@@ -103,12 +139,16 @@ kdl_owned_string _kdl_ubigint_as_string(_kdl_ubigint* i) { return _kdl_ubigint_a
 
 kdl_owned_string _kdl_ubigint_as_string_sgn(int sign, _kdl_ubigint* i)
 {
+    kdl_allocator const* alloc = i->alloc;
     i = _kdl_ubigint_dup(i);
     if (i == NULL) goto error;
 
     size_t max_digits = i->n_digits * 10; // max 10 decimal digits per 32 bits
-    char* buf = malloc(max_digits);
-    if (buf == NULL) goto error;
+    char* buf = _kdl_malloc(alloc, max_digits);
+    if (buf == NULL) {
+        _kdl_ubigint_free(i);
+        goto error;
+    }
     char* p = buf;
     // write the number backwards
     while (i->n_digits > 1 || i->num[0] != 0) {
@@ -119,13 +159,16 @@ kdl_owned_string _kdl_ubigint_as_string_sgn(int sign, _kdl_ubigint* i)
     // flip the number and add the sign
     size_t len = p - buf;
     if (sign < 0) ++len;
-    char* buf2 = malloc(len + 1);
-    if (buf2 == NULL) goto error;
+    char* buf2 = _kdl_malloc(alloc, len + 1);
+    if (buf2 == NULL) {
+        _kdl_free(alloc, buf);
+        goto error;
+    }
     char* p2 = buf2;
     if (sign < 0) *(p2++) = '-';
     while (p > buf) *(p2++) = *(--p);
     *p2 = '\0';
-    free(buf);
+    _kdl_free(alloc, buf);
     return (kdl_owned_string){buf2, len};
 
 error:
@@ -10,15 +10,16 @@
 // *Minimal* unsigned big integer type with only the features needed for integer
 // parsing and formatting
 struct _kdl_ubigint {
+    kdl_allocator const* alloc;
     size_t n_digits;
     uint32_t num[];
 };
 
 typedef struct _kdl_ubigint _kdl_ubigint;
 
-// Create a new big int object
-_kdl_ubigint* _kdl_ubigint_new(uint32_t initial_value);
-// Copy a big int
+// Create a new big int object (alloc must outlive it)
+_kdl_ubigint* _kdl_ubigint_new(uint32_t initial_value, kdl_allocator const* alloc);
+// Copy a big int (using the same allocator)
 _kdl_ubigint* _kdl_ubigint_dup(_kdl_ubigint const* value);
 // Destroy a big int
 void _kdl_ubigint_free(_kdl_ubigint* i);
@@ -27,12 +28,16 @@ void _kdl_ubigint_free(_kdl_ubigint* i);
 _kdl_ubigint* _kdl_ubigint_add_inplace(_kdl_ubigint* a, uint32_t b);
 // a *= b
 _kdl_ubigint* _kdl_ubigint_multiply_inplace(_kdl_ubigint* a, uint32_t b);
+// a <<= bits
+_kdl_ubigint* _kdl_ubigint_shift_left_inplace(_kdl_ubigint* a, size_t bits);
 // a /= b (returns: remainder)
 uint32_t _kdl_ubigint_divide_inplace(_kdl_ubigint* a, uint32_t b);
+// Compare a and b (returns: -1, 0, or +1)
+int _kdl_ubigint_compare(_kdl_ubigint const* a, _kdl_ubigint const* b);
 
 // Convert to long long, if possible (return true on success)
 bool _kdl_ubigint_as_long_long(_kdl_ubigint* i, long long* dest);
-// Format decimal representation as string
+// Format decimal representation as string (allocated with the big int's allocator)
 kdl_owned_string _kdl_ubigint_as_string(_kdl_ubigint* i);
 // Format decimal representation, starting with a sign
 // sign: -1 or +1
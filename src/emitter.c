@@ -1,13 +1,18 @@
 #include "kdl/emitter.h"
 
+#include "alloc.h"
+#include "float_conv.h"
 #include "grammar.h"
 #include "str.h"
 #include "utf8.h"
 
 #include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #define INITIAL_BUFFER_SIZE 4096
+#define INITIAL_SCRATCH_SIZE 256
 
 const kdl_emitter_options KDL_DEFAULT_EMITTER_OPTIONS = {
     .indent = 4,
@@ -19,7 +24,8 @@ const kdl_emitter_options KDL_DEFAULT_EMITTER_OPTIONS = {
                    .exponent_plus = false,
                    .plus = false,
                    .min_exponent = 4},
-    .version = KDL_VERSION_2
+    .version = KDL_VERSION_2,
+    .write_buffer_size = 65536
 };
 
 struct _kdl_emitter {
@@ -29,6 +35,10 @@ struct _kdl_emitter {
     int depth;
     bool start_of_line;
     _kdl_write_buffer buf;
+    _kdl_write_buffer out; // stream emitters: output not yet passed to write_func
+    _kdl_write_buffer scratch; // reused for escaped strings and indentation
+    _kdl_ascii_span_func ascii_span;
+    kdl_allocator alloc;
 };
 
 static size_t _buffer_write_func(void* user_data, char const* data, size_t nbytes)
@@ -40,32 +50,67 @@ static size_t _buffer_write_func(void* user_data, char const* data, size_t nbyte
 
 kdl_emitter* kdl_create_buffering_emitter(kdl_emitter_options const* opt)
 {
-    kdl_emitter* self = malloc(sizeof(kdl_emitter));
+    return kdl_create_buffering_emitter_ex(opt, NULL);
+}
+
+kdl_emitter* kdl_create_stream_emitter(
+    kdl_write_func write_func, void* user_data, kdl_emitter_options const* opt)
+{
+    return kdl_create_stream_emitter_ex(write_func, user_data, opt, NULL);
+}
+
+kdl_emitter* kdl_create_buffering_emitter_ex(kdl_emitter_options const* opt, kdl_allocator const* allocator)
+{
+    kdl_allocator alloc = _kdl_allocator_or_default(allocator);
+    kdl_emitter* self = _kdl_malloc(&alloc, sizeof(kdl_emitter));
     if (self == NULL) return NULL;
+    self->alloc = alloc;
     self->opt = *opt;
     self->write_func = &_buffer_write_func;
     self->write_user_data = &self->buf;
     self->depth = 0;
     self->start_of_line = true;
-    self->buf = _kdl_new_write_buffer(INITIAL_BUFFER_SIZE);
-    if (self->buf.buf == NULL) {
-        free(self);
+    self->ascii_span = _kdl_select_ascii_span_func();
+    self->buf = _kdl_new_write_buffer(INITIAL_BUFFER_SIZE, &self->alloc);
+    self->out = (_kdl_write_buffer){NULL, 0, 0, &self->alloc};
+    self->scratch = _kdl_new_write_buffer(INITIAL_SCRATCH_SIZE, &self->alloc);
+    if (self->buf.buf == NULL || self->scratch.buf == NULL) {
+        _kdl_free(&alloc, self->buf.buf);
+        _kdl_free(&alloc, self->scratch.buf);
+        _kdl_free(&alloc, self);
         return NULL;
     }
     return self;
 }
 
-kdl_emitter* kdl_create_stream_emitter(
-    kdl_write_func write_func, void* user_data, kdl_emitter_options const* opt)
+kdl_emitter* kdl_create_stream_emitter_ex(kdl_write_func write_func, void* user_data,
+    kdl_emitter_options const* opt, kdl_allocator const* allocator)
 {
-    kdl_emitter* self = malloc(sizeof(kdl_emitter));
+    kdl_allocator alloc = _kdl_allocator_or_default(allocator);
+    kdl_emitter* self = _kdl_malloc(&alloc, sizeof(kdl_emitter));
     if (self == NULL) return NULL;
+    self->alloc = alloc;
     self->opt = *opt;
     self->write_func = write_func;
     self->write_user_data = user_data;
     self->depth = 0;
     self->start_of_line = true;
-    self->buf = (_kdl_write_buffer){NULL, 0, 0};
+    self->ascii_span = _kdl_select_ascii_span_func();
+    self->buf = (_kdl_write_buffer){NULL, 0, 0, &self->alloc};
+    self->out = (_kdl_write_buffer){NULL, 0, 0, &self->alloc};
+    if (opt->write_buffer_size != 0) {
+        self->out = _kdl_new_write_buffer(opt->write_buffer_size, &self->alloc);
+        if (self->out.buf == NULL) {
+            _kdl_free(&alloc, self);
+            return NULL;
+        }
+    }
+    self->scratch = _kdl_new_write_buffer(INITIAL_SCRATCH_SIZE, &self->alloc);
+    if (self->scratch.buf == NULL) {
+        _kdl_free(&alloc, self->out.buf);
+        _kdl_free(&alloc, self);
+        return NULL;
+    }
     return self;
 }
 
@@ -75,192 +120,250 @@ void kdl_destroy_emitter(kdl_emitter* self)
     if (self->buf.buf != NULL) {
         _kdl_free_write_buffer(&self->buf);
     }
-    free(self);
+    if (self->out.buf != NULL) {
+        _kdl_free_write_buffer(&self->out);
+    }
+    _kdl_free_write_buffer(&self->scratch);
+    kdl_allocator alloc = self->alloc;
+    _kdl_free(&alloc, self);
 }
 
-static bool _emit_quoted_str(kdl_emitter* self, kdl_str s)
+bool kdl_emitter_flush(kdl_emitter* self)
 {
-    kdl_owned_string escaped = kdl_escape_v(self->opt.version, &s, self->opt.escape_mode);
-    bool ok = self->write_func(self->write_user_data, "\"", 1) == 1
-        && self->write_func(self->write_user_data, escaped.data, escaped.len) == escaped.len
-        && self->write_func(self->write_user_data, "\"", 1) == 1;
-    kdl_free_string(&escaped);
-    return ok;
+    size_t len = self->out.str_len;
+    if (len == 0) return true;
+    self->out.str_len = 0;
+    return self->write_func(self->write_user_data, self->out.buf, len) == len;
 }
 
-static kdl_owned_string _float_to_string(double f, kdl_float_printing_options const* opts)
+// All output goes through here. Stream emitters collect small writes in self->out.
+static bool _write(kdl_emitter* self, char const* data, size_t len)
 {
-    // emit #nan, #inf, #-inf even in KDLv1 because there is no alternative
-    if (isnan(f)) {
-        kdl_str result = kdl_str_from_cstr("#nan");
-        return kdl_clone_str(&result);
-    } else if (isinf(f)) {
-        kdl_str result = f < 0.0 ? kdl_str_from_cstr("#-inf") : kdl_str_from_cstr("#inf");
-        return kdl_clone_str(&result);
+    _kdl_write_buffer* out = &self->out;
+    if (out->buf == NULL) return self->write_func(self->write_user_data, data, len) == len;
+    if (out->buf_len - out->str_len >= len) {
+        memcpy(out->buf + out->str_len, data, len);
+        out->str_len += len;
+        return true;
     }
-
-    bool negative = f < 0.0;
-    f = fabs(f);
-    int exponent = f != 0.0 ? (int)floor(log10(f)) : 0;
-    double exp_factor = 1.0;
-    if (abs(exponent) < opts->min_exponent) {
-        // don't use scientific notation
-        exponent = 0;
-    } else {
-        // do use scientific notation
-        exp_factor = pow(10.0, exponent);
+    if (!kdl_emitter_flush(self)) return false;
+    if (len < out->buf_len) {
+        memcpy(out->buf, data, len);
+        out->str_len = len;
+        return true;
     }
+    return self->write_func(self->write_user_data, data, len) == len;
+}
 
-    int integer_part = (int)floor(f / exp_factor);
+static bool _emit_quoted_str(kdl_emitter* self, kdl_str s)
+{
+    // most strings need no escaping at all and can be written as they are
+    if (self->ascii_span(KDL_ASCII_NO_ESCAPE, s.data, s.data + s.len) == s.len) {
+        return _write(self, "\"", 1) && _write(self, s.data, s.len) && _write(self, "\"", 1);
+    }
+    // otherwise, escape into the scratch buffer, which keeps its memory between calls
+    _kdl_write_buffer* buf = &self->scratch;
+    buf->str_len = 0;
+    kdl_escape_mode mode = self->opt.escape_mode;
+    bool ok = _kdl_buf_push_char(buf, '"')
+        && (self->opt.version == KDL_VERSION_1 ? _kdl_escape_v1_into(buf, &s, mode, self->ascii_span)
+                                               : _kdl_escape_v2_into(buf, &s, mode, self->ascii_span))
+        && _kdl_buf_push_char(buf, '"');
+    return ok && _write(self, buf->buf, buf->str_len);
+}
 
-    // f is now the positive fractional part as displayed
-    _kdl_write_buffer buf = _kdl_new_write_buffer(32);
-    if (negative) _kdl_buf_push_char(&buf, '-');
-    else if (opts->plus) _kdl_buf_push_char(&buf, '+');
+// "00" to "99", for formatting integers two digits at a time
+static char const _digit_pairs[201] = "00010203040506070809"
+                                      "10111213141516171819"
+                                      "20212223242526272829"
+                                      "30313233343536373839"
+                                      "40414243444546474849"
+                                      "50515253545556575859"
+                                      "60616263646566676869"
+                                      "70717273747576777879"
+                                      "80818283848586878889"
+                                      "90919293949596979899";
+
+// Write the decimal representation of n so that it ends at end; returns the start
+static char* _format_uint_backwards(char* end, uint64_t n)
+{
+    char* p = end;
+    while (n >= 100) {
+        size_t pair = (size_t)(n % 100) * 2;
+        n /= 100;
+        p -= 2;
+        memcpy(p, _digit_pairs + pair, 2);
+    }
+    if (n >= 10) {
+        p -= 2;
+        memcpy(p, _digit_pairs + n * 2, 2);
+    } else {
+        *(--p) = (char)('0' + n);
+    }
+    return p;
+}
 
-    // Write the integer part
-    buf.str_len += snprintf(buf.buf + buf.str_len, buf.buf_len - buf.str_len, "%d", integer_part);
-    // Write the decimal part if required
-    double f_intpart = integer_part * exp_factor;
-    bool written_point = false;
-    int zeros = 0;
-    int nines = 0;
-    int queued_digit = -1;
-    unsigned long long fractional_part_so_far = 0;
-    double pos = 0.1 * exp_factor;
+// Write the decimal representation of n into p, returning the end
+static char* _write_uint(char* p, uint64_t n)
+{
+    char tmp[20];
+    char* start = _format_uint_backwards(tmp + sizeof(tmp), n);
+    size_t len = (size_t)(tmp + sizeof(tmp) - start);
+    memcpy(p, start, len);
+    return p + len;
+}
 
-    double f_so_far = f_intpart;
+// Large enough for any finite double in positional notation (e.g. 0.000...0001 with 323 zeros)
+#define FLOAT_BUFFER_SIZE 512
 
-    while (f + pos != f && f_so_far < f) { // while this digit makes a difference
-        double remainder = f - f_so_far;
+// Format f with the shortest number of digits that round-trip. buf must hold FLOAT_BUFFER_SIZE
+// characters. Returns the length of the result.
+static size_t _float_to_buffer(double f, kdl_float_printing_options const* opts, char* buf)
+{
+    // emit #nan, #inf, #-inf even in KDLv1 because there is no alternative
+    if (isnan(f)) {
+        memcpy(buf, "#nan", 4);
+        return 4;
+    } else if (isinf(f)) {
+        if (f < 0.0) {
+            memcpy(buf, "#-inf", 5);
+            return 5;
+        } else {
+            memcpy(buf, "#inf", 4);
+            return 4;
+        }
+    }
 
-        int next_digit = (int)floor(remainder / pos);
-        fractional_part_so_far = 10 * fractional_part_so_far + next_digit;
+    char* p = buf;
+    if (f < 0.0) *(p++) = '-';
+    else if (opts->plus) *(p++) = '+';
 
-        while (f_intpart + (fractional_part_so_far + 1) * pos <= f) {
-            ++next_digit;
-            ++fractional_part_so_far;
-        }
+    // f = digits * 10^digits_exponent
+    uint64_t digits = 0;
+    int digits_exponent = 0;
+    if (f != 0.0) _kdl_double_to_decimal(fabs(f), &digits, &digits_exponent);
+    char digit_chars[20];
+    int n_digits = (int)(_write_uint(digit_chars, digits) - digit_chars);
 
-        f_so_far = f_intpart + fractional_part_so_far * pos;
-
-        if (next_digit == 0) {
-            ++zeros;
-        } else if (next_digit == 9) {
-            ++nines;
-        } else if (next_digit >= 10) {
-            fprintf(stderr, "- ckdl WARNING - _float_to_string calculated digit > 9\n");
-            int overflow = next_digit - 9;
-            next_digit -= overflow;
-            fractional_part_so_far -= overflow;
+    // exponent in scientific notation (position of the first digit)
+    int exponent = n_digits - 1 + digits_exponent;
+    bool written_point = false;
+    if (abs(exponent) < opts->min_exponent) {
+        // don't use scientific notation
+        if (exponent < 0) {
+            *(p++) = '0';
+            *(p++) = '.';
+            for (int i = 0; i < -exponent - 1; ++i) *(p++) = '0';
+            memcpy(p, digit_chars, n_digits);
+            p += n_digits;
+            written_point = true;
+        } else if (n_digits <= exponent + 1) {
+            memcpy(p, digit_chars, n_digits);
+            p += n_digits;
+            for (int i = n_digits; i < exponent + 1; ++i) *(p++) = '0';
         } else {
-            // write the queued digit
-            if (queued_digit >= 0 || zeros != 0 || nines != 0) {
-                if (!written_point) {
-                    _kdl_buf_push_char(&buf, '.');
-                    written_point = true;
-                }
-                if (queued_digit >= 0) _kdl_buf_push_char(&buf, (char)('0' + queued_digit));
-                while (zeros != 0) {
-                    _kdl_buf_push_char(&buf, '0');
-                    --zeros;
-                }
-                while (nines != 0) {
-                    _kdl_buf_push_char(&buf, '9');
-                    --nines;
-                }
-            }
-            // queue this one
-            queued_digit = next_digit;
-        }
-
-        pos /= 10.0;
-    }
-    // Write the queued digit (if any)
-    if (queued_digit != -1) {
-        if (!written_point) {
-            _kdl_buf_push_char(&buf, '.');
+            memcpy(p, digit_chars, exponent + 1);
+            p += exponent + 1;
+            *(p++) = '.';
+            memcpy(p, digit_chars + exponent + 1, n_digits - exponent - 1);
+            p += n_digits - exponent - 1;
             written_point = true;
         }
-        if (nines != 0) {
-            ++queued_digit;
+        exponent = 0;
+    } else {
+        // do use scientific notation
+        *(p++) = digit_chars[0];
+        if (n_digits > 1) {
+            *(p++) = '.';
+            memcpy(p, digit_chars + 1, n_digits - 1);
+            p += n_digits - 1;
+            written_point = true;
         }
-        _kdl_buf_push_char(&buf, (char)('0' + queued_digit));
     }
-    // Adding more decimal digits now makes no difference to the number.
 
     // Add ".0" IFF requested
     if (!written_point && opts->always_write_decimal_point) {
-        _kdl_buf_push_chars(&buf, ".0", 2);
+        memcpy(p, ".0", 2);
+        p += 2;
         written_point = true;
     }
 
     // Add exponent (if any)
     if (exponent != 0) {
-        char exp_buf[32];
-        int exp_len = snprintf(exp_buf, 32, "%d", exponent);
-        _kdl_buf_push_char(&buf, opts->capital_e ? 'E' : 'e');
-        if (exponent >= 0 && opts->exponent_plus) {
-            _kdl_buf_push_char(&buf, '+');
-        }
-        _kdl_buf_push_chars(&buf, exp_buf, exp_len);
+        *(p++) = opts->capital_e ? 'E' : 'e';
+        if (exponent < 0) *(p++) = '-';
+        else if (opts->exponent_plus) *(p++) = '+';
+        p = _write_uint(p, (uint64_t)abs(exponent));
     } else if (!written_point && opts->always_write_decimal_point_or_exponent) {
         // Always write either an exponent or a decimal point, to mark this
         // number as float
-        _kdl_buf_push_chars(&buf, ".0", 2);
+        memcpy(p, ".0", 2);
+        p += 2;
     }
-    return _kdl_buf_to_string(&buf);
+    return (size_t)(p - buf);
 }
 
 static bool _emit_number(kdl_emitter* self, kdl_number const* n)
 {
-    char int_buf[32];
-    int int_len = 0;
-    kdl_owned_string float_str;
-    bool ok;
+    char int_buf[24];
+    char* int_start;
+    size_t int_len;
+    char float_buf[FLOAT_BUFFER_SIZE];
+    size_t float_len;
 
     switch (n->type) {
     case KDL_NUMBER_TYPE_INTEGER:
-        int_len = snprintf(int_buf, 32, "%lld", n->integer);
-        return (int)self->write_func(self->write_user_data, int_buf, int_len) == int_len;
+        // the magnitude is computed in unsigned arithmetic so that LLONG_MIN works
+        int_start = _format_uint_backwards(int_buf + sizeof(int_buf),
+            n->integer < 0 ? (uint64_t)0 - (uint64_t)n->integer : (uint64_t)n->integer);
+        if (n->integer < 0) *(--int_start) = '-';
+        int_len = (size_t)(int_buf + sizeof(int_buf) - int_start);
+        return _write(self, int_start, int_len);
     case KDL_NUMBER_TYPE_FLOATING_POINT:
-        float_str = _float_to_string(n->floating_point, &self->opt.float_mode);
-        ok = self->write_func(self->write_user_data, float_str.data, float_str.len) == float_str.len;
-        kdl_free_string(&float_str);
-        return ok;
+        float_len = _float_to_buffer(n->floating_point, &self->opt.float_mode, float_buf);
+        return _write(self, float_buf, float_len);
     case KDL_NUMBER_TYPE_STRING_ENCODED:
-        return self->write_func(self->write_user_data, n->string.data, n->string.len) == n->string.len;
+        return _write(self, n->string.data, n->string.len);
     }
     return false;
 }
 
-static bool _emit_bare_string(kdl_emitter* self, kdl_str s)
+// Can s be written as a bare identifier?
+static bool _is_bare_identifier(kdl_emitter* self, kdl_str s)
 {
-    bool bare = true;
-    if (self->opt.identifier_mode == KDL_QUOTE_ALL_IDENTIFIERS) {
-        bare = false;
-    } else if (s.len == 0) {
-        bare = false;
+    if (self->opt.identifier_mode == KDL_QUOTE_ALL_IDENTIFIERS || s.len == 0) return false;
+
+    kdl_character_set charset;
+    _kdl_ascii_class id_class;
+    if (self->opt.version == KDL_VERSION_1) {
+        charset = KDL_CHARACTER_SET_V1;
+        id_class = KDL_ASCII_WORD_V1;
     } else {
-        uint32_t c;
-        kdl_str tail = s;
-        bool first = true;
-        kdl_character_set charset
-            = self->opt.version == KDL_VERSION_1 ? KDL_CHARACTER_SET_V1 : KDL_CHARACTER_SET_V2;
-        bool require_ascii = self->opt.identifier_mode == KDL_ASCII_IDENTIFIERS
-            || (self->opt.escape_mode & KDL_ESCAPE_ASCII_MODE) == KDL_ESCAPE_ASCII_MODE;
-        while (KDL_UTF8_OK == _kdl_pop_codepoint(&tail, &c)) {
-            if ((first && !_kdl_is_id_start(charset, c)) || !_kdl_is_id(charset, c)
-                || (require_ascii && c >= 0x7f)) {
-                bare = false;
-                break;
-            }
-            first = false;
-        }
+        charset = KDL_CHARACTER_SET_V2;
+        id_class = KDL_ASCII_ID_V2;
+    }
+    bool require_ascii = self->opt.identifier_mode == KDL_ASCII_IDENTIFIERS
+        || (self->opt.escape_mode & KDL_ESCAPE_ASCII_MODE) == KDL_ESCAPE_ASCII_MODE;
+
+    uint32_t c;
+    kdl_str tail = s;
+    if (_kdl_pop_codepoint(&tail, &c) != KDL_UTF8_OK) return true;
+    if (!_kdl_is_id_start(charset, c) || (require_ascii && c >= 0x7f)) return false;
+
+    // skip ASCII identifier characters in bulk; only decode what is left over
+    while (true) {
+        size_t span = self->ascii_span(id_class, tail.data, tail.data + tail.len);
+        tail.data += span;
+        tail.len -= span;
+        if (_kdl_pop_codepoint(&tail, &c) != KDL_UTF8_OK) return true;
+        if (!_kdl_is_id(charset, c) || (require_ascii && c >= 0x7f)) return false;
     }
+}
 
-    if (bare) {
-        return self->write_func(self->write_user_data, s.data, s.len) == s.len;
+static bool _emit_bare_string(kdl_emitter* self, kdl_str s)
+{
+    if (_is_bare_identifier(self, s)) {
+        return _write(self, s.data, s.len);
     } else {
         return _emit_quoted_str(self, s);
     }
@@ -275,8 +378,7 @@ static bool _emit_string(kdl_emitter* self, kdl_str s)
     }
 }
 
-#define _write_string_literal_ok(self, s)                                                                    \
-    (self->write_func(self->write_user_data, ("" s ""), sizeof(s) - 1) == sizeof(s) - 1)
+#define _write_string_literal_ok(self, s) _write(self, ("" s ""), sizeof(s) - 1)
 
 static bool _emit_value(kdl_emitter* self, kdl_value const* v)
 {
@@ -317,15 +419,20 @@ static bool _emit_value(kdl_emitter* self, kdl_value const* v)
 
 static bool _emit_node_preamble(kdl_emitter* self)
 {
-    if (!self->start_of_line) {
-        if (!_write_string_literal_ok(self, "\n")) return false;
-    }
-    int indent = 0;
-    for (int d = 0; d < self->depth; ++d) {
-        indent += self->opt.indent;
-    }
-    for (int i = 0; i < indent; ++i) {
-        if (!_write_string_literal_ok(self, " ")) return false;
+    // newline and indentation are written in one go
+    _kdl_write_buffer* buf = &self->scratch;
+    size_t indent = self->opt.indent > 0 ? (size_t)self->opt.indent * (size_t)self->depth : 0;
+    size_t len = indent + (self->start_of_line ? 0 : 1);
+    if (len != 0) {
+        if (buf->buf_len < len) {
+            char* new_buf = _kdl_realloc(buf->alloc, buf->buf, len);
+            if (new_buf == NULL) return false;
+            buf->buf = new_buf;
+            buf->buf_len = len;
+        }
+        buf->buf[0] = '\n';
+        memset(buf->buf + len - indent, ' ', indent);
+        if (!_write(self, buf->buf, len)) return false;
     }
     self->start_of_line = false;
     return true;
@@ -383,7 +490,7 @@ bool kdl_emit_end(kdl_emitter* self)
         if (!_write_string_literal_ok(self, "\n")) return false;
         self->start_of_line = true;
     }
-    return true;
+    return kdl_emitter_flush(self);
 }
 
 kdl_str kdl_get_emitter_buffer(kdl_emitter* self) { return (kdl_str){self->buf.buf, self->buf.str_len}; }
@@ -0,0 +1,324 @@
+#include "float_conv.h"
+#include "bigint.h"
+
+#include <string.h>
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#    include <intrin.h>
+#endif
+
+// IEEE 754 binary64 parameters
+#define MANTISSA_EXPLICIT_BITS 52
+#define MINIMUM_EXPONENT (-1023)
+#define INFINITE_POWER 0x7FF
+#define MIN_EXPONENT_ROUND_TO_EVEN (-4)
+#define MAX_EXPONENT_ROUND_TO_EVEN 23
+
+// Significant digits beyond this many cannot influence the rounding of a double
+#define MAX_SIGNIFICANT_DIGITS 768
+
+typedef struct {
+    uint64_t high;
+    uint64_t low;
+} _u128;
+
+static inline _u128 _full_multiplication(uint64_t a, uint64_t b)
+{
+    _u128 r;
+#if defined(__SIZEOF_INT128__)
+    __extension__ unsigned __int128 p = (unsigned __int128)a * b;
+    r.high = (uint64_t)(p >> 64);
+    r.low = (uint64_t)p;
+#elif defined(_MSC_VER) && defined(_M_X64)
+    r.low = _umul128(a, b, &r.high);
+#else
+    uint64_t a_lo = (uint32_t)a, a_hi = a >> 32;
+    uint64_t b_lo = (uint32_t)b, b_hi = b >> 32;
+    uint64_t lo_lo = a_lo * b_lo;
+    uint64_t hi_lo = a_hi * b_lo;
+    uint64_t lo_hi = a_lo * b_hi;
+    uint64_t hi_hi = a_hi * b_hi;
+    uint64_t cross = (lo_lo >> 32) + (uint32_t)hi_lo + lo_hi;
+    r.high = hi_hi + (hi_lo >> 32) + (cross >> 32);
+    r.low = (cross << 32) | (uint32_t)lo_lo;
+#endif
+    return r;
+}
+
+static inline int _leading_zeroes(uint64_t x)
+{
+#if defined(__GNUC__)
+    return __builtin_clzll(x);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    unsigned long index;
+    _BitScanReverse64(&index, x);
+    return 63 - (int)index;
+#else
+    int n = 0;
+    while ((x & ((uint64_t)1 << 63)) == 0) {
+        x <<= 1;
+        ++n;
+    }
+    return n;
+#endif
+}
+
+// floor(log2(10^q)) + 63, valid for -342 <= q <= 308
+static inline int32_t _power(int32_t q) { return (((152170 + 65536) * q) >> 16) + 63; }
+
+static inline double _double_from_parts(uint64_t mantissa, int32_t power2)
+{
+    uint64_t bits = mantissa | ((uint64_t)power2 << MANTISSA_EXPLICIT_BITS);
+    double d;
+    memcpy(&d, &bits, sizeof(d));
+    return d;
+}
+
+double _kdl_decimal_to_double(uint64_t w, int64_t q)
+{
+    if (w == 0 || q < _KDL_SMALLEST_POWER_OF_FIVE) return 0.0;
+    if (q > _KDL_LARGEST_POWER_OF_FIVE) return _double_from_parts(0, INFINITE_POWER);
+
+    int lz = _leading_zeroes(w);
+    w <<= lz;
+
+    // Multiply by the (truncated) 128-bit power of five. The second half of the power is only
+    // needed if the bits below the ones we keep (55 = mantissa + 3) might not be exact.
+    size_t index = 2 * (size_t)(q - _KDL_SMALLEST_POWER_OF_FIVE);
+    uint64_t const precision_mask = UINT64_MAX >> (MANTISSA_EXPLICIT_BITS + 3);
+    _u128 product = _full_multiplication(w, _kdl_power_of_five_128[index]);
+    if ((product.high & precision_mask) == precision_mask) {
+        _u128 second = _full_multiplication(w, _kdl_power_of_five_128[index + 1]);
+        product.low += second.high;
+        if (second.high > product.low) ++product.high;
+    }
+
+    int upperbit = (int)(product.high >> 63);
+    int shift = upperbit + 64 - MANTISSA_EXPLICIT_BITS - 3;
+    uint64_t mantissa = product.high >> shift;
+    int32_t power2 = _power((int32_t)q) + upperbit - lz - MINIMUM_EXPONENT;
+
+    if (power2 <= 0) {
+        // subnormal (or zero)
+        if (-power2 + 1 >= 64) return 0.0;
+        mantissa >>= -power2 + 1;
+        mantissa += (mantissa & 1);
+        mantissa >>= 1;
+        // rounding may have carried the number into the normal range
+        power2 = (mantissa < ((uint64_t)1 << MANTISSA_EXPLICIT_BITS)) ? 0 : 1;
+        return _double_from_parts(mantissa & ~((uint64_t)1 << MANTISSA_EXPLICIT_BITS), power2);
+    }
+
+    // Exactly halfway between two doubles: only possible for small q, where the product is exact.
+    // Round to even instead of rounding up.
+    if (product.low <= 1 && q >= MIN_EXPONENT_ROUND_TO_EVEN && q <= MAX_EXPONENT_ROUND_TO_EVEN
+        && (mantissa & 3) == 1 && (mantissa << shift) == product.high) {
+        mantissa &= ~(uint64_t)1;
+    }
+
+    mantissa += (mantissa & 1);
+    mantissa >>= 1;
+    if (mantissa >= ((uint64_t)2 << MANTISSA_EXPLICIT_BITS)) {
+        mantissa = (uint64_t)1 << MANTISSA_EXPLICIT_BITS;
+        ++power2;
+    }
+    mantissa &= ~((uint64_t)1 << MANTISSA_EXPLICIT_BITS);
+    if (power2 >= INFINITE_POWER) return _double_from_parts(0, INFINITE_POWER);
+    return _double_from_parts(mantissa, power2);
+}
+
+static _kdl_ubigint* _multiply_power_of_five(_kdl_ubigint* n, int64_t e)
+{
+    static uint32_t const powers[] = {1, 5, 25, 125, 625, 3125, 15625, 78125, 390625, 1953125, 9765625,
+        48828125, 244140625, 1220703125};
+    while (e > 0 && n != NULL) {
+        int64_t step = e < 13 ? e : 13;
+        n = _kdl_ubigint_multiply_inplace(n, powers[step]);
+        e -= step;
+    }
+    return n;
+}
+
+bool _kdl_decimal_to_double_exact(
+    kdl_str digits, int64_t exponent, double lower_bound, kdl_allocator const* alloc, double* result)
+{
+    // Read the significant digits into a big integer
+    _kdl_ubigint* num = _kdl_ubigint_new(0, alloc);
+    _kdl_ubigint* halfway = NULL;
+    size_t n_significant = 0;
+    bool after_point = false;
+    bool dropped_nonzero = false;
+    for (size_t i = 0; i < digits.len && num != NULL; ++i) {
+        char c = digits.data[i];
+        if (c == '.') {
+            after_point = true;
+        } else if (c >= '0' && c <= '9') {
+            if (n_significant == 0 && c == '0') {
+                // leading zero
+                if (after_point) --exponent;
+            } else if (n_significant < MAX_SIGNIFICANT_DIGITS) {
+                num = _kdl_ubigint_multiply_inplace(num, 10);
+                if (num != NULL) num = _kdl_ubigint_add_inplace(num, (uint32_t)(c - '0'));
+                ++n_significant;
+                if (after_point) --exponent;
+            } else {
+                if (c != '0') dropped_nonzero = true;
+                if (!after_point) ++exponent;
+            }
+        }
+    }
+    // The dropped digits are below the precision of any halfway point, but they still break ties
+    if (dropped_nonzero && num != NULL) {
+        num = _kdl_ubigint_multiply_inplace(num, 10);
+        if (num != NULL) num = _kdl_ubigint_add_inplace(num, 1);
+        --exponent;
+    }
+    if (num == NULL) goto error;
+
+    // The halfway point between lower_bound and the next double is (2m + 1) * 2^(k - 1)
+    uint64_t bits;
+    memcpy(&bits, &lower_bound, sizeof(bits));
+    uint64_t biased_exponent = (bits >> MANTISSA_EXPLICIT_BITS) & INFINITE_POWER;
+    uint64_t m = bits & (((uint64_t)1 << MANTISSA_EXPLICIT_BITS) - 1);
+    int64_t k = -1074;
+    if (biased_exponent != 0) {
+        m |= (uint64_t)1 << MANTISSA_EXPLICIT_BITS;
+        k = (int64_t)biased_exponent - 1075;
+    }
+    uint64_t h = 2 * m + 1;
+    halfway = _kdl_ubigint_new((uint32_t)(h >> 32), alloc);
+    if (halfway != NULL) halfway = _kdl_ubigint_shift_left_inplace(halfway, 32);
+    if (halfway != NULL) halfway = _kdl_ubigint_add_inplace(halfway, (uint32_t)h);
+    if (halfway == NULL) goto error;
+
+    // Compare num * 10^exponent with the halfway point, as integers
+    int64_t power2 = (k - 1) - exponent;
+    if (exponent > 0) {
+        num = _multiply_power_of_five(num, exponent);
+    } else {
+        halfway = _multiply_power_of_five(halfway, -exponent);
+    }
+    if (num == NULL || halfway == NULL) goto error;
+    if (power2 > 0) {
+        halfway = _kdl_ubigint_shift_left_inplace(halfway, (size_t)power2);
+    } else {
+        num = _kdl_ubigint_shift_left_inplace(num, (size_t)-power2);
+    }
+    if (num == NULL || halfway == NULL) goto error;
+
+    int cmp = _kdl_ubigint_compare(num, halfway);
+    if (cmp > 0 || (cmp == 0 && (m & 1) != 0)) ++bits;
+    memcpy(result, &bits, sizeof(*result));
+
+    _kdl_ubigint_free(num);
+    _kdl_ubigint_free(halfway);
+    return true;
+
+error:
+    _kdl_ubigint_free(num);
+    _kdl_ubigint_free(halfway);
+    return false;
+}
+
+// Smallest significand of a normal double, smallest exponent, and the significand below which
+// subnormals need an extra decimal digit of precision
+#define C_MIN ((uint64_t)1 << MANTISSA_EXPLICIT_BITS)
+#define Q_MIN (-1074)
+#define C_TINY 3
+#define MASK_63 (UINT64_MAX >> 1)
+
+// floor(g * cp / 2^127), rounded to odd, where g = g1 * 2^63 + g0
+static inline uint64_t _round_to_odd(uint64_t g1, uint64_t g0, uint64_t cp)
+{
+    uint64_t x1 = _full_multiplication(g0, cp).high;
+    _u128 y = _full_multiplication(g1, cp);
+    uint64_t z = (y.low >> 1) + x1;
+    uint64_t vbp = y.high + (z >> 63);
+    return vbp | (((z & MASK_63) + MASK_63) >> 63);
+}
+
+// Schubfach for the double c * 2^q (see Raffaello Giulietti, "The Schubfach way to render doubles")
+static void _to_decimal(int q, uint64_t c, int dk, uint64_t* digits, int* exponent)
+{
+    uint64_t out = c & 1;
+    uint64_t cb = c << 2;
+    uint64_t cbr = cb + 2;
+    uint64_t cbl;
+    int k;
+    if (c != C_MIN || q == Q_MIN) {
+        cbl = cb - 2;
+        k = _kdl_floor_log10_pow2(q);
+    } else {
+        // the gap to the next lower double is only half as large
+        cbl = cb - 1;
+        k = _kdl_floor_log10_three_quarters_pow2(q);
+    }
+    int h = q + _kdl_floor_log2_pow10(-k) + 2;
+
+    size_t index = 2 * (size_t)(-k - _KDL_SMALLEST_POWER_OF_TEN);
+    uint64_t g1 = _kdl_power_of_ten_126[index];
+    uint64_t g0 = _kdl_power_of_ten_126[index + 1];
+
+    // v, and the bounds of its rounding interval, times 10^-k (in units of 1/4)
+    uint64_t vb = _round_to_odd(g1, g0, cb << h);
+    uint64_t vbl = _round_to_odd(g1, g0, cbl << h);
+    uint64_t vbr = _round_to_odd(g1, g0, cbr << h);
+
+    uint64_t s = vb >> 2;
+    *exponent = k + dk;
+    if (s >= 10) {
+        // try one digit less first
+        uint64_t sp10 = 10 * (s / 10);
+        uint64_t tp10 = sp10 + 10;
+        bool upin = vbl + out <= sp10 << 2;
+        bool wpin = (tp10 << 2) + out <= vbr;
+        if (upin != wpin) {
+            *digits = upin ? sp10 : tp10;
+            return;
+        }
+    }
+
+    uint64_t t = s + 1;
+    bool uin = vbl + out <= s << 2;
+    bool win = (t << 2) + out <= vbr;
+    if (uin != win) {
+        *digits = uin ? s : t;
+        return;
+    }
+    // both s and t are in the rounding interval: pick the closer one
+    int64_t cmp = (int64_t)(vb - ((s + t) << 1));
+    *digits = (cmp < 0 || (cmp == 0 && (s & 1) == 0)) ? s : t;
+}
+
+void _kdl_double_to_decimal(double v, uint64_t* digits, int* exponent)
+{
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    int biased_exponent = (int)((bits >> MANTISSA_EXPLICIT_BITS) & INFINITE_POWER);
+    uint64_t t = bits & (C_MIN - 1);
+
+    if (biased_exponent != 0) {
+        int mq = -Q_MIN + 1 - biased_exponent;
+        uint64_t c = C_MIN | t;
+        if (mq > 0 && mq < MANTISSA_EXPLICIT_BITS + 1) {
+            // small integers are their own shortest representation
+            uint64_t f = c >> mq;
+            if (f << mq == c) {
+                *digits = f;
+                *exponent = 0;
+                goto strip_zeros;
+            }
+        }
+        _to_decimal(-mq, c, 0, digits, exponent);
+    } else if (t < C_TINY) {
+        _to_decimal(Q_MIN, 10 * t, -1, digits, exponent);
+    } else {
+        _to_decimal(Q_MIN, t, 0, digits, exponent);
+    }
+
+strip_zeros:
+    while (*digits != 0 && *digits % 10 == 0) {
+        *digits /= 10;
+        ++*exponent;
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef KDL_INTERNAL_FLOAT_CONV_H_
+#define KDL_INTERNAL_FLOAT_CONV_H_
+
+#include <kdl/common.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Range of the table of powers of five
+#define _KDL_SMALLEST_POWER_OF_FIVE (-342)
+#define _KDL_LARGEST_POWER_OF_FIVE 308
+#define _KDL_N_POWERS_OF_FIVE (_KDL_LARGEST_POWER_OF_FIVE - _KDL_SMALLEST_POWER_OF_FIVE + 1)
+
+// 5^q for every q in the range above, normalized to 128 bits (high word first). Negative powers
+// are rounded up, positive powers are truncated. Generated at build time by gen_float_tables.c
+extern uint64_t const _kdl_power_of_five_128[2 * _KDL_N_POWERS_OF_FIVE];
+
+// Range of the table of powers of ten
+#define _KDL_SMALLEST_POWER_OF_TEN (-292)
+#define _KDL_LARGEST_POWER_OF_TEN 324
+#define _KDL_N_POWERS_OF_TEN (_KDL_LARGEST_POWER_OF_TEN - _KDL_SMALLEST_POWER_OF_TEN + 1)
+
+// floor(10^e * 2^(125 - floor(log2(10^e)))) + 1 for every e in the range above, split into two
+// 63-bit halves (high half first). Generated at build time by gen_float_tables.c
+extern uint64_t const _kdl_power_of_ten_126[2 * _KDL_N_POWERS_OF_TEN];
+
+// floor(log10(2^q)), valid for |q| <= 5456721
+static inline int _kdl_floor_log10_pow2(int64_t q) { return (int)((q * 661971961083LL) >> 41); }
+// floor(log10(3/4 * 2^q)), valid for |q| <= 5456721
+static inline int _kdl_floor_log10_three_quarters_pow2(int64_t q)
+{
+    return (int)((q * 661971961083LL - 274743187321LL) >> 41);
+}
+// floor(log2(10^e)), valid for |e| <= 1233
+static inline int _kdl_floor_log2_pow10(int64_t e) { return (int)((e * 913124641741LL) >> 38); }
+
+// Return the double nearest to w * 10^q (ties to even), using the Eisel-Lemire algorithm.
+// This is exact for every w. Results out of range are rounded to zero or infinity.
+double _kdl_decimal_to_double(uint64_t w, int64_t q);
+
+// Exact (slow) conversion of the decimal number given by its digits and exponent, for numbers with
+// more significant digits than fit into a uint64_t. The digits may contain underscores and a
+// decimal point. lower_bound must be the correct result or the double just below it.
+// Returns false if memory could not be allocated.
+bool _kdl_decimal_to_double_exact(
+    kdl_str digits, int64_t exponent, double lower_bound, kdl_allocator const* alloc, double* result);
+
+// Find the shortest decimal number digits * 10^exponent which rounds to the finite, positive double
+// v (Schubfach algorithm). If there are several, pick the one closest to v.
+void _kdl_double_to_decimal(double v, uint64_t* digits, int* exponent);
+
+#endif // KDL_INTERNAL_FLOAT_CONV_H_
@@ -0,0 +1,220 @@
+// Build-time generator for the tables of powers of five and ten declared in float_conv.h
+//
+// Usage: gen_float_tables OUTPUT.c
+
+#include "float_conv.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Fixed-size unsigned big integers, large enough for 2^1720
+#define BN_WORDS 64
+
+typedef struct {
+    uint32_t w[BN_WORDS];
+} bignum;
+
+static void bn_set(bignum* a, uint32_t v)
+{
+    memset(a, 0, sizeof(*a));
+    a->w[0] = v;
+}
+
+static void bn_mul_small(bignum* a, uint32_t b)
+{
+    uint64_t carry = 0;
+    for (int i = 0; i < BN_WORDS; ++i) {
+        uint64_t tmp = (uint64_t)a->w[i] * b + carry;
+        a->w[i] = (uint32_t)tmp;
+        carry = tmp >> 32;
+    }
+}
+
+static void bn_add_small(bignum* a, uint32_t b)
+{
+    uint64_t carry = b;
+    for (int i = 0; i < BN_WORDS && carry != 0; ++i) {
+        uint64_t tmp = (uint64_t)a->w[i] + carry;
+        a->w[i] = (uint32_t)tmp;
+        carry = tmp >> 32;
+    }
+}
+
+static int bn_bit_length(bignum const* a)
+{
+    for (int i = BN_WORDS - 1; i >= 0; --i) {
+        if (a->w[i] != 0) {
+            int bits = 0;
+            for (uint32_t v = a->w[i]; v != 0; v >>= 1) ++bits;
+            return i * 32 + bits;
+        }
+    }
+    return 0;
+}
+
+static void bn_shift_left_1(bignum* a, bool in)
+{
+    uint32_t carry = in ? 1 : 0;
+    for (int i = 0; i < BN_WORDS; ++i) {
+        uint32_t next = a->w[i] >> 31;
+        a->w[i] = (a->w[i] << 1) | carry;
+        carry = next;
+    }
+}
+
+static void bn_shift_right(bignum* a, int n)
+{
+    for (int k = 0; k < n; ++k) {
+        for (int i = 0; i < BN_WORDS; ++i) {
+            uint32_t next = i + 1 < BN_WORDS ? a->w[i + 1] & 1 : 0;
+            a->w[i] = (a->w[i] >> 1) | (next << 31);
+        }
+    }
+}
+
+static int bn_compare(bignum const* a, bignum const* b)
+{
+    for (int i = BN_WORDS - 1; i >= 0; --i) {
+        if (a->w[i] != b->w[i]) return a->w[i] < b->w[i] ? -1 : 1;
+    }
+    return 0;
+}
+
+static void bn_sub(bignum* a, bignum const* b)
+{
+    int64_t borrow = 0;
+    for (int i = 0; i < BN_WORDS; ++i) {
+        int64_t tmp = (int64_t)a->w[i] - b->w[i] - borrow;
+        borrow = tmp < 0 ? 1 : 0;
+        a->w[i] = (uint32_t)(tmp + (borrow << 32));
+    }
+}
+
+// q = 2^n / d (rounded down)
+static void bn_divide_power_of_two(bignum* q, int n, bignum const* d)
+{
+    bignum r;
+    bn_set(&r, 0);
+    bn_set(q, 0);
+    for (int bit = n; bit >= 0; --bit) {
+        bn_shift_left_1(&r, bit == n);
+        bn_shift_left_1(q, false);
+        if (bn_compare(&r, d) >= 0) {
+            bn_sub(&r, d);
+            q->w[0] |= 1;
+        }
+    }
+}
+
+static void bn_shift_left(bignum* a, int n)
+{
+    for (int k = 0; k < n; ++k) bn_shift_left_1(a, false);
+}
+
+static void write_entry(FILE* f, uint64_t hi, uint64_t lo, int base, int e)
+{
+    fprintf(f, "    0x%016llx, 0x%016llx, // %d^%d\n", (unsigned long long)hi, (unsigned long long)lo, base, e);
+}
+
+// a must have at most 128 bits
+static void write_128(FILE* f, bignum const* a, int e)
+{
+    uint64_t hi = ((uint64_t)a->w[3] << 32) | a->w[2];
+    uint64_t lo = ((uint64_t)a->w[1] << 32) | a->w[0];
+    write_entry(f, hi, lo, 5, e);
+}
+
+// a must have exactly 126 bits; split into two 63-bit halves
+static void write_126(FILE* f, bignum const* a, int e)
+{
+    uint64_t hi = ((uint64_t)a->w[3] << 32) | a->w[2];
+    uint64_t lo = ((uint64_t)a->w[1] << 32) | a->w[0];
+    write_entry(f, (hi << 1) | (lo >> 63), lo & (UINT64_MAX >> 1), 10, e);
+}
+
+int main(int argc, char** argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s OUTPUT.c\n", argv[0]);
+        return 2;
+    }
+
+    FILE* f = fopen(argv[1], "w");
+    if (f == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    fprintf(f, "// Generated by gen_float_tables.c - do not edit\n\n");
+    fprintf(f, "#include \"float_conv.h\"\n\n");
+    fprintf(f, "uint64_t const _kdl_power_of_five_128[2 * _KDL_N_POWERS_OF_FIVE] = {\n");
+
+    bignum p5, c;
+    for (int q = _KDL_SMALLEST_POWER_OF_FIVE; q < 0; ++q) {
+        // reciprocal of 5^-q, rounded up, as a 128-bit number
+        bn_set(&p5, 1);
+        for (int k = 0; k < -q; ++k) bn_mul_small(&p5, 5);
+        int z = bn_bit_length(&p5);
+        if (q >= -27) {
+            bn_divide_power_of_two(&c, z + 127, &p5);
+            bn_add_small(&c, 1);
+        } else {
+            bn_divide_power_of_two(&c, 2 * z + 128, &p5);
+            bn_add_small(&c, 1);
+            int len = bn_bit_length(&c);
+            if (len > 128) bn_shift_right(&c, len - 128);
+        }
+        write_128(f, &c, q);
+    }
+
+    bn_set(&p5, 1);
+    for (int q = 0; q <= _KDL_LARGEST_POWER_OF_FIVE; ++q) {
+        // 5^q with its most significant bit at position 127, truncated
+        c = p5;
+        int len = bn_bit_length(&c);
+        if (len > 128) {
+            bn_shift_right(&c, len - 128);
+        } else {
+            bn_shift_left(&c, 128 - len);
+        }
+        write_128(f, &c, q);
+        bn_mul_small(&p5, 5);
+    }
+
+    fprintf(f, "};\n\n");
+
+    fprintf(f, "uint64_t const _kdl_power_of_ten_126[2 * _KDL_N_POWERS_OF_TEN] = {\n");
+    bignum p10;
+    for (int e = _KDL_SMALLEST_POWER_OF_TEN; e <= _KDL_LARGEST_POWER_OF_TEN; ++e) {
+        // floor(10^e * 2^(125 - r)) + 1, where r = floor(log2(10^e))
+        bn_set(&p10, 1);
+        for (int k = 0; k < (e < 0 ? -e : e); ++k) bn_mul_small(&p10, 10);
+        int r = e >= 0 ? bn_bit_length(&p10) - 1 : -bn_bit_length(&p10);
+        if (r != _kdl_floor_log2_pow10(e)) {
+            fprintf(stderr, "floor(log2(10^%d)) approximation is wrong\n", e);
+            fclose(f);
+            return 1;
+        }
+        if (e < 0) {
+            bn_divide_power_of_two(&c, 125 - r, &p10);
+        } else {
+            c = p10;
+            if (125 - r >= 0) {
+                bn_shift_left(&c, 125 - r);
+            } else {
+                bn_shift_right(&c, r - 125);
+            }
+        }
+        bn_add_small(&c, 1);
+        write_126(f, &c, e);
+    }
+    fprintf(f, "};\n");
+
+    if (fclose(f) != 0) {
+        perror(argv[1]);
+        return 1;
+    }
+    return 0;
+}
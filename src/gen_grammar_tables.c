@@ -0,0 +1,113 @@
+// Build-time generator for the character class lookup tables declared in grammar.h
+//
+// Usage: gen_grammar_tables OUTPUT.c
+
+#include "grammar.h"
+#include "grammar_ref.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_PAGES 256
+
+static kdl_character_set const charsets[2] = {KDL_CHARACTER_SET_V1, KDL_CHARACTER_SET_V2};
+
+static uint8_t classify(kdl_character_set charset, uint32_t c)
+{
+    uint8_t flags = 0;
+    if (_kdl_ref_is_whitespace(charset, c)) flags |= _KDL_CHAR_WHITESPACE;
+    if (_kdl_ref_is_newline(c)) flags |= _KDL_CHAR_NEWLINE;
+    if (_kdl_ref_is_word_char(charset, c)) flags |= _KDL_CHAR_WORD;
+    if (_kdl_ref_is_word_start(charset, c)) flags |= _KDL_CHAR_WORD_START;
+    if (_kdl_ref_is_id(charset, c)) flags |= _KDL_CHAR_ID;
+    if (_kdl_ref_is_id_start(charset, c)) flags |= _KDL_CHAR_ID_START;
+    if (_kdl_ref_is_end_of_word(charset, c)) flags |= _KDL_CHAR_END_OF_WORD;
+    if (_kdl_ref_is_illegal_char(charset, c)) flags |= _KDL_CHAR_ILLEGAL;
+    return flags;
+}
+
+static void write_row(FILE* f, uint8_t const* data, size_t len, char const* indent)
+{
+    for (size_t i = 0; i < len; ++i) {
+        if (i % 16 == 0) fprintf(f, "%s", indent);
+        fprintf(f, "0x%02x,", data[i]);
+        fprintf(f, (i % 16 == 15 || i + 1 == len) ? "\n" : " ");
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s OUTPUT.c\n", argv[0]);
+        return 2;
+    }
+
+    static uint8_t pages[MAX_PAGES][256];
+    static uint8_t page_index[2][_KDL_CHAR_CLASS_PAGES];
+    size_t n_pages = 0;
+
+    for (int cs = 0; cs < 2; ++cs) {
+        for (uint32_t p = 0; p < _KDL_CHAR_CLASS_PAGES; ++p) {
+            uint8_t page[256];
+            for (uint32_t i = 0; i < 256; ++i) {
+                page[i] = classify(charsets[cs], (p << 8) | i);
+            }
+            // de-duplicate pages (most of them are identical)
+            size_t idx;
+            for (idx = 0; idx < n_pages; ++idx) {
+                if (memcmp(pages[idx], page, 256) == 0) break;
+            }
+            if (idx == n_pages) {
+                if (n_pages == MAX_PAGES) {
+                    fprintf(stderr, "too many distinct pages\n");
+                    return 1;
+                }
+                memcpy(pages[n_pages++], page, 256);
+            }
+            page_index[cs][p] = (uint8_t)idx;
+        }
+    }
+
+    FILE* f = fopen(argv[1], "w");
+    if (f == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    fprintf(f, "// Generated by gen_grammar_tables.c - do not edit\n\n");
+    fprintf(f, "#include \"grammar.h\"\n\n");
+
+    fprintf(f, "uint8_t const _kdl_char_class_ascii[2][128] = {\n");
+    for (int cs = 0; cs < 2; ++cs) {
+        fprintf(f, "    {\n");
+        write_row(f, pages[page_index[cs][0]], 128, "        ");
+        fprintf(f, "    },\n");
+    }
+    fprintf(f, "};\n\n");
+
+    fprintf(f, "uint8_t const _kdl_char_class_page_index[2][_KDL_CHAR_CLASS_PAGES] = {\n");
+    for (int cs = 0; cs < 2; ++cs) {
+        fprintf(f, "    {\n");
+        write_row(f, page_index[cs], _KDL_CHAR_CLASS_PAGES, "        ");
+        fprintf(f, "    },\n");
+    }
+    fprintf(f, "};\n\n");
+
+    fprintf(f, "uint8_t const _kdl_char_class_pages[%zu][256] = {\n", n_pages);
+    for (size_t i = 0; i < n_pages; ++i) {
+        fprintf(f, "    {\n");
+        write_row(f, pages[i], 256, "        ");
+        fprintf(f, "    },\n");
+    }
+    fprintf(f, "};\n\n");
+
+    fprintf(f, "uint8_t const _kdl_char_class_invalid[2] = {0x%02x, 0x%02x};\n",
+        classify(KDL_CHARACTER_SET_V1, 0x110000), classify(KDL_CHARACTER_SET_V2, 0x110000));
+
+    if (fclose(f) != 0) {
+        perror(argv[1]);
+        return 1;
+    }
+    return 0;
+}
@@ -6,14 +6,77 @@
 
 #include <kdl/tokenizer.h>
 
-bool _kdl_is_whitespace(kdl_character_set charset, uint32_t c);
-bool _kdl_is_newline(uint32_t c);
-bool _kdl_is_id(kdl_character_set charset, uint32_t c);
-bool _kdl_is_id_start(kdl_character_set charset, uint32_t c);
-bool _kdl_is_word_char(kdl_character_set charset, uint32_t c);
-bool _kdl_is_word_start(kdl_character_set charset, uint32_t c);
-bool _kdl_is_end_of_word(kdl_character_set charset, uint32_t c);
-bool _kdl_is_illegal_char(kdl_character_set charset, uint32_t c);
-bool _kdl_is_equals_sign(kdl_character_set charset, uint32_t c);
+// Character class flags
+enum {
+    _KDL_CHAR_WHITESPACE = 0x01,
+    _KDL_CHAR_NEWLINE = 0x02,
+    _KDL_CHAR_WORD = 0x04,
+    _KDL_CHAR_WORD_START = 0x08,
+    _KDL_CHAR_ID = 0x10,
+    _KDL_CHAR_ID_START = 0x20,
+    _KDL_CHAR_END_OF_WORD = 0x40,
+    _KDL_CHAR_ILLEGAL = 0x80,
+};
+
+#define _KDL_CHAR_CLASS_PAGES 0x1100 // pages of 256 codepoints up to U+10FFFF
+
+// Lookup tables (one set per character set), generated at build time from grammar_ref.h
+// by gen_grammar_tables.c
+extern uint8_t const _kdl_char_class_ascii[2][128];
+extern uint8_t const _kdl_char_class_page_index[2][_KDL_CHAR_CLASS_PAGES];
+extern uint8_t const _kdl_char_class_pages[][256];
+extern uint8_t const _kdl_char_class_invalid[2];
+
+static inline uint8_t _kdl_char_class(kdl_character_set charset, uint32_t c)
+{
+    int cs = charset == KDL_CHARACTER_SET_V1 ? 0 : 1;
+    if (c < 0x80) {
+        return _kdl_char_class_ascii[cs][c];
+    } else if (c <= 0x10FFFF) {
+        return _kdl_char_class_pages[_kdl_char_class_page_index[cs][c >> 8]][c & 0xFF];
+    } else {
+        return _kdl_char_class_invalid[cs];
+    }
+}
+
+static inline bool _kdl_is_whitespace(kdl_character_set charset, uint32_t c)
+{
+    return (_kdl_char_class(charset, c) & _KDL_CHAR_WHITESPACE) != 0;
+}
+
+static inline bool _kdl_is_newline(uint32_t c)
+{
+    return (_kdl_char_class(KDL_CHARACTER_SET_V2, c) & _KDL_CHAR_NEWLINE) != 0;
+}
+
+static inline bool _kdl_is_id(kdl_character_set charset, uint32_t c)
+{
+    return (_kdl_char_class(charset, c) & _KDL_CHAR_ID) != 0;
+}
+
+static inline bool _kdl_is_id_start(kdl_character_set charset, uint32_t c)
+{
+    return (_kdl_char_class(charset, c) & _KDL_CHAR_ID_START) != 0;
+}
+
+static inline bool _kdl_is_word_char(kdl_character_set charset, uint32_t c)
+{
+    return (_kdl_char_class(charset, c) & _KDL_CHAR_WORD) != 0;
+}
+
+static inline bool _kdl_is_word_start(kdl_character_set charset, uint32_t c)
+{
+    return (_kdl_char_class(charset, c) & _KDL_CHAR_WORD_START) != 0;
+}
+
+static inline bool _kdl_is_end_of_word(kdl_character_set charset, uint32_t c)
+{
+    return (_kdl_char_class(charset, c) & _KDL_CHAR_END_OF_WORD) != 0;
+}
+
+static inline bool _kdl_is_illegal_char(kdl_character_set charset, uint32_t c)
+{
+    return (_kdl_char_class(charset, c) & _KDL_CHAR_ILLEGAL) != 0;
+}
 
 #endif // KDL_INTERNAL_GRAMMAR_H_
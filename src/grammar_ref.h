@@ -0,0 +1,97 @@
+#ifndef KDL_INTERNAL_GRAMMAR_REF_H_
+#define KDL_INTERNAL_GRAMMAR_REF_H_
+
+// Reference definitions of the character classes of the KDL grammar, straight from the spec.
+//
+// The library doesn't use these directly: they're evaluated for every codepoint at build time by
+// gen_grammar_tables.c to produce the lookup tables used by grammar.h. The tests and benchmarks
+// also compare against them.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <kdl/tokenizer.h>
+
+static inline bool _kdl_ref_is_illegal_char(kdl_character_set charset, uint32_t c)
+{
+    return charset == KDL_CHARACTER_SET_V2
+        && (c <= 0x0008 ||                  // control characters
+            (0x000E <= c && c <= 0x001F) || //    ''
+            c == 0x007F ||                  // delete
+            (0xD800 <= c && c <= 0xDFFF) || // UTF-16 surrogates
+            c == 0x200E || c == 0x200F ||   // directional control characters
+            (0x202A <= c && c <= 0x202E) || //    ''
+            (0x2066 <= c && c <= 0x2069) || //    ''
+            c == 0xFEFF ||                  // ZWNBSP = BOM
+            c > 0x10FFFF                    // not a codepoint
+        );
+}
+
+static inline bool _kdl_ref_is_whitespace(kdl_character_set charset, uint32_t c)
+{
+    return c == 0x0009 || // Character Tabulation
+        c == 0x0020 ||    // Space
+        c == 0x00A0 ||    // No-Break Space
+        c == 0x1680 ||    // Ogham Space Mark
+        c == 0x2000 ||    // En Quad
+        c == 0x2001 ||    // Em Quad
+        c == 0x2002 ||    // En Space
+        c == 0x2003 ||    // Em Space
+        c == 0x2004 ||    // Three-Per-Em Space
+        c == 0x2005 ||    // Four-Per-Em Space
+        c == 0x2006 ||    // Six-Per-Em Space
+        c == 0x2007 ||    // Figure Space
+        c == 0x2008 ||    // Punctuation Space
+        c == 0x2009 ||    // Thin Space
+        c == 0x200A ||    // Hair Space
+        c == 0x202F ||    // Narrow No-Break Space
+        c == 0x205F ||    // Medium Mathematical Space
+        c == 0x3000 ||    // Ideographic Space
+
+        (charset == KDL_CHARACTER_SET_V1 && c == 0xFEFF) || // Byte-order mark
+        (charset == KDL_CHARACTER_SET_V2 && c == 0x000B)    // Vertical Tab
+        ;
+}
+
+static inline bool _kdl_ref_is_newline(uint32_t c)
+{
+    return c == 0x000D || // CR  Carriage Return
+        c == 0x000A ||    // LF  Line Feed
+        c == 0x0085 ||    // NEL Next Line
+        c == 0x000C ||    // FF  Form Feed
+        c == 0x2028 ||    // LS  Line Separator
+        c == 0x2029;      // PS  Paragraph Separator
+}
+
+static inline bool _kdl_ref_is_word_char(kdl_character_set charset, uint32_t c)
+{
+    return c > 0x20 && c <= 0x10FFFF && c != '\\' && c != '/' && c != '(' && c != ')' && c != '{' && c != '}'
+        && c != ';' && c != '[' && c != ']' && c != '"' && c != '='
+        && !(charset == KDL_CHARACTER_SET_V1 && (c == '<' || c == '>' || c == ','))
+        && !_kdl_ref_is_whitespace(charset, c) && !_kdl_ref_is_newline(c)
+        && !_kdl_ref_is_illegal_char(charset, c);
+}
+
+static inline bool _kdl_ref_is_id(kdl_character_set charset, uint32_t c)
+{
+    return _kdl_ref_is_word_char(charset, c) && !(charset == KDL_CHARACTER_SET_V2 && c == '#');
+}
+
+static inline bool _kdl_ref_is_word_start(kdl_character_set charset, uint32_t c)
+{
+    return _kdl_ref_is_id(charset, c) && (c < '0' || c > '9');
+}
+
+static inline bool _kdl_ref_is_id_start(kdl_character_set charset, uint32_t c)
+{
+    return _kdl_ref_is_word_start(charset, c) && !(charset == KDL_CHARACTER_SET_V2 && c == '#');
+}
+
+static inline bool _kdl_ref_is_end_of_word(kdl_character_set charset, uint32_t c)
+{
+    // is this character something that could terminate an identifier (or number) in some situation?
+    return _kdl_ref_is_whitespace(charset, c) || _kdl_ref_is_newline(c) //
+        || c == ';' || c == ')' || c == '}' || c == '/' || c == '\\' || c == '=';
+}
+
+#endif // KDL_INTERNAL_GRAMMAR_REF_H_
@@ -0,0 +1,166 @@
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#    define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "mapped_file.h"
+#include "alloc.h"
+
+#include <stdint.h>
+
+#if defined(_WIN32)
+#    define WIN32_LEAN_AND_MEAN
+#    include <windows.h>
+#elif defined(HAVE_MMAP)
+#    include <errno.h>
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+#else
+#    include <stdio.h>
+#endif
+
+// Mappings can't be empty, but empty documents are fine
+static char const _empty_file[1] = {'\0'};
+
+static void _set_empty(_kdl_mapped_file* file)
+{
+    file->data = _empty_file;
+    file->len = 0;
+    file->handle = NULL;
+}
+
+#if defined(_WIN32)
+
+bool _kdl_map_file(_kdl_mapped_file* file, char const* path, kdl_allocator const* alloc)
+{
+    (void)alloc;
+    HANDLE fh = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (fh == INVALID_HANDLE_VALUE) return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(fh, &size) || (uint64_t)size.QuadPart > SIZE_MAX) {
+        CloseHandle(fh);
+        return false;
+    }
+    if (size.QuadPart == 0) {
+        CloseHandle(fh);
+        _set_empty(file);
+        return true;
+    }
+
+    HANDLE mapping = CreateFileMappingA(fh, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(fh); // the mapping keeps the file open
+    if (mapping == NULL) return false;
+    void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (data == NULL) {
+        CloseHandle(mapping);
+        return false;
+    }
+
+    file->data = data;
+    file->len = (size_t)size.QuadPart;
+    file->handle = mapping;
+    return true;
+}
+
+void _kdl_unmap_file(_kdl_mapped_file* file, kdl_allocator const* alloc)
+{
+    (void)alloc;
+    if (file->handle != NULL) {
+        UnmapViewOfFile(file->data);
+        CloseHandle((HANDLE)file->handle);
+    }
+    _set_empty(file);
+}
+
+#elif defined(HAVE_MMAP)
+
+bool _kdl_map_file(_kdl_mapped_file* file, char const* path, kdl_allocator const* alloc)
+{
+    (void)alloc;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+    if (!S_ISREG(st.st_mode) || (uintmax_t)st.st_size > SIZE_MAX) {
+        // pipes, directories, devices etc. can't be mapped
+        close(fd);
+        errno = S_ISREG(st.st_mode) ? EFBIG : ENODEV;
+        return false;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        _set_empty(file);
+        return true;
+    }
+
+    size_t len = (size_t)st.st_size;
+    void* data = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping keeps the file open
+    if (data == MAP_FAILED) return false;
+#    if defined(HAVE_POSIX_MADVISE)
+    // The tokenizer reads the file front to back exactly once
+    posix_madvise(data, len, POSIX_MADV_SEQUENTIAL);
+#    endif
+
+    file->data = data;
+    file->len = len;
+    file->handle = data;
+    return true;
+}
+
+void _kdl_unmap_file(_kdl_mapped_file* file, kdl_allocator const* alloc)
+{
+    (void)alloc;
+    if (file->handle != NULL) {
+        munmap(file->handle, file->len);
+    }
+    _set_empty(file);
+}
+
+#else
+
+// Fallback: read the whole file into memory
+bool _kdl_map_file(_kdl_mapped_file* file, char const* path, kdl_allocator const* alloc)
+{
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL) return false;
+
+    char* buf = NULL;
+    size_t len = 0;
+    size_t buf_size = 0;
+    while (!feof(fp)) {
+        if (len == buf_size) {
+            buf_size = buf_size == 0 ? 65536 : 2 * buf_size;
+            buf = _kdl_reallocf(alloc, buf, buf_size);
+            if (buf == NULL) break;
+        }
+        len += fread(buf + len, 1, buf_size - len, fp);
+        if (ferror(fp)) {
+            _kdl_free(alloc, buf);
+            buf = NULL;
+            break;
+        }
+    }
+    fclose(fp);
+    if (buf == NULL) return false;
+
+    file->data = buf;
+    file->len = len;
+    file->handle = buf;
+    return true;
+}
+
+void _kdl_unmap_file(_kdl_mapped_file* file, kdl_allocator const* alloc)
+{
+    _kdl_free(alloc, file->handle);
+    _set_empty(file);
+}
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef KDL_INTERNAL_MAPPED_FILE_H_
+#define KDL_INTERNAL_MAPPED_FILE_H_
+
+#include "kdl/common.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// A file mapped (read-only) into memory. On platforms without memory mapping, the file is
+// read into a buffer instead.
+struct _kdl_mapped_file {
+    char const* data;
+    size_t len;
+    void* handle; // platform-specific
+};
+
+typedef struct _kdl_mapped_file _kdl_mapped_file;
+
+// Map a file into memory for a single sequential read (return true on success)
+bool _kdl_map_file(_kdl_mapped_file* file, char const* path, kdl_allocator const* alloc);
+// Unmap a file mapped with _kdl_map_file
+void _kdl_unmap_file(_kdl_mapped_file* file, kdl_allocator const* alloc);
+
+#endif // KDL_INTERNAL_MAPPED_FILE_H_
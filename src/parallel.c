@@ -0,0 +1,394 @@
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#    define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "kdl/parser.h"
+
+#include "alloc.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#if defined(_WIN32)
+#    define WIN32_LEAN_AND_MEAN
+#    include <windows.h>
+#elif defined(HAVE_PTHREADS)
+#    include <pthread.h>
+#    include <unistd.h>
+#endif
+
+kdl_parallel_options const KDL_DEFAULT_PARALLEL_OPTIONS = {
+    .n_threads = 0,
+    .chunk_size = 1 << 20,
+};
+
+// Pre-scan which finds the places where the document can be split: newlines that end a top-level
+// node. It knows just enough about the syntax to avoid strings, comments and child blocks, and to
+// recognize line continuations and slashdashes, after which a newline doesn't end the node.
+// If it gets confused by invalid input, the chunks it produces are invalid, too.
+typedef struct {
+    char const* begin;
+    char const* end;
+    char const* p;
+    long depth;  // brace depth
+    bool joined; // a line continuation or slashdash joins the next line to this one
+} _kdl_split_scanner;
+
+// Skip a string, given its opening quote. Raw strings have hashes and/or an r (KDLv1) before the
+// quote. Returns the position after the string.
+static char const* _skip_string(char const* begin, char const* p, char const* end)
+{
+    char const* q = p;
+    while (q > begin && q[-1] == '#') --q;
+    size_t hashes = (size_t)(p - q);
+    bool raw_v1 = q > begin && q[-1] == 'r';
+    bool raw = raw_v1 || hashes > 0;
+
+    size_t quotes = 1;
+    if (!raw_v1 && end - p >= 3 && p[1] == '"' && p[2] == '"') {
+        quotes = 3; // multi-line string
+    } else if (!raw && end - p >= 2 && p[1] == '"') {
+        return p + 2; // empty string
+    }
+    p += quotes;
+
+    while (p < end) {
+        if (*p == '\\' && !raw) {
+            if (end - p < 2) break;
+            p += 2; // escaped character
+            continue;
+        }
+        if (*p == '"' && (size_t)(end - p) >= quotes + hashes) {
+            size_t i = 1;
+            while (i < quotes && p[i] == '"') ++i;
+            while (i < quotes + hashes && p[i] == '#') ++i;
+            if (i == quotes + hashes) return p + i;
+        }
+        ++p;
+    }
+    return end;
+}
+
+// Skip a single-line comment, up to (not including) the newline
+static char const* _skip_line_comment(char const* p, char const* end)
+{
+    for (; p < end; ++p) {
+        unsigned char c = (unsigned char)*p;
+        if (c == '\n' || c == '\r' || c == '\f') break;
+        // NEL, LS, PS
+        if (c == 0xc2 && end - p >= 2 && (unsigned char)p[1] == 0x85) break;
+        if (c == 0xe2 && end - p >= 3 && (unsigned char)p[1] == 0x80
+            && ((unsigned char)p[2] == 0xa8 || (unsigned char)p[2] == 0xa9)) {
+            break;
+        }
+    }
+    return p;
+}
+
+// Skip a (possibly nested) multi-line comment
+static char const* _skip_block_comment(char const* p, char const* end)
+{
+    long depth = 1;
+    p += 2;
+    while (end - p >= 2) {
+        if (p[0] == '/' && p[1] == '*') {
+            ++depth;
+            p += 2;
+        } else if (p[0] == '*' && p[1] == '/') {
+            p += 2;
+            if (--depth == 0) return p;
+        } else {
+            ++p;
+        }
+    }
+    return end;
+}
+
+// Characters the scanner has to look at when no line continuation or slashdash is pending
+static bool _is_split_special(unsigned char c)
+{
+    return c == '\n' || c == '\\' || c == '/' || c == '"' || c == '{' || c == '}';
+}
+
+// Find the first place the document can be split at offset target or later (SIZE_MAX if there is
+// none). The split is after the newline.
+static size_t _next_split(_kdl_split_scanner* sc, size_t target)
+{
+    char const* p = sc->p;
+    char const* end = sc->end;
+    while (p < end) {
+        if (!sc->joined) {
+            while (p < end && !_is_split_special((unsigned char)*p)) ++p;
+            if (p == end) break;
+        }
+        switch (*p) {
+        case '\n':
+            ++p;
+            if (sc->depth == 0 && !sc->joined && (size_t)(p - sc->begin) >= target) {
+                sc->p = p;
+                return (size_t)(p - sc->begin);
+            }
+            continue;
+        case ' ':
+        case '\t':
+        case '\r':
+        case '\f':
+        case '\v':
+            ++p;
+            continue;
+        case '\\':
+            sc->joined = true;
+            ++p;
+            continue;
+        case '/':
+            if (end - p >= 2 && p[1] == '/') {
+                p = _skip_line_comment(p, end);
+                continue;
+            } else if (end - p >= 2 && p[1] == '*') {
+                p = _skip_block_comment(p, end);
+                continue;
+            } else if (end - p >= 2 && p[1] == '-') {
+                sc->joined = true;
+                p += 2;
+                continue;
+            }
+            break;
+        case '"':
+            p = _skip_string(sc->begin, p, end);
+            sc->joined = false;
+            continue;
+        case '{':
+            ++sc->depth;
+            break;
+        case '}':
+            --sc->depth;
+            break;
+        default:
+            // non-ASCII characters might be whitespace
+            if ((unsigned char)*p >= 0x80) {
+                ++p;
+                continue;
+            }
+            break;
+        }
+        sc->joined = false;
+        ++p;
+    }
+    sc->p = end;
+    return SIZE_MAX;
+}
+
+#if defined(_WIN32)
+
+typedef SRWLOCK _kdl_mutex;
+typedef HANDLE _kdl_thread;
+
+static void _mutex_init(_kdl_mutex* mutex) { InitializeSRWLock(mutex); }
+static void _mutex_destroy(_kdl_mutex* mutex) { (void)mutex; }
+static void _mutex_lock(_kdl_mutex* mutex) { AcquireSRWLockExclusive(mutex); }
+static void _mutex_unlock(_kdl_mutex* mutex) { ReleaseSRWLockExclusive(mutex); }
+
+static unsigned int _number_of_cpus(void)
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (unsigned int)info.dwNumberOfProcessors;
+}
+
+#elif defined(HAVE_PTHREADS)
+
+typedef pthread_mutex_t _kdl_mutex;
+typedef pthread_t _kdl_thread;
+
+static void _mutex_init(_kdl_mutex* mutex) { pthread_mutex_init(mutex, NULL); }
+static void _mutex_destroy(_kdl_mutex* mutex) { pthread_mutex_destroy(mutex); }
+static void _mutex_lock(_kdl_mutex* mutex) { pthread_mutex_lock(mutex); }
+static void _mutex_unlock(_kdl_mutex* mutex) { pthread_mutex_unlock(mutex); }
+
+static unsigned int _number_of_cpus(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (unsigned int)n : 1;
+}
+
+#else
+
+// No threads: everything happens in the calling thread
+typedef int _kdl_mutex;
+
+static void _mutex_init(_kdl_mutex* mutex) { (void)mutex; }
+static void _mutex_destroy(_kdl_mutex* mutex) { (void)mutex; }
+static void _mutex_lock(_kdl_mutex* mutex) { (void)mutex; }
+static void _mutex_unlock(_kdl_mutex* mutex) { (void)mutex; }
+
+static unsigned int _number_of_cpus(void) { return 1; }
+
+#endif
+
+struct _kdl_parallel_job {
+    kdl_str doc;
+    kdl_parse_option opt;
+    kdl_chunk_event_func func;
+    void* user_data;
+    size_t const* chunk_starts; // n_chunks + 1 offsets into doc
+    size_t n_chunks;
+    _kdl_mutex mutex; // protects the members below
+    size_t next_chunk;
+    bool ok;
+    kdl_parse_option version; // KDL version found so far (KDL_DETECT_VERSION: none yet)
+};
+
+static bool _parse_chunk(struct _kdl_parallel_job* job, size_t index, kdl_parse_option version)
+{
+    size_t start = job->chunk_starts[index];
+    kdl_str chunk = {job->doc.data + start, job->chunk_starts[index + 1] - start};
+    kdl_parse_option opt = (job->opt & ~KDL_DETECT_VERSION) | version;
+    kdl_parser* parser = kdl_create_string_parser(chunk, opt);
+    if (parser == NULL) return false;
+
+    bool ok = true;
+    while (true) {
+        kdl_event_data* ev = kdl_parser_next_event(parser);
+        if (!job->func(job->user_data, index, ev) || ev->event == KDL_EVENT_PARSE_ERROR) {
+            ok = false;
+            break;
+        } else if (ev->event == KDL_EVENT_EOF) {
+            break;
+        }
+    }
+
+    // With version detection, the whole document has to be in the same version, as if it had been
+    // parsed in one go
+    version = kdl_parser_get_version(parser);
+    if (ok && version != KDL_DETECT_VERSION) {
+        _mutex_lock(&job->mutex);
+        if (job->version == KDL_DETECT_VERSION) {
+            job->version = version;
+        } else if (job->version != version) {
+            ok = false;
+        }
+        _mutex_unlock(&job->mutex);
+    }
+    kdl_destroy_parser(parser);
+    return ok;
+}
+
+// Parse chunks until there are none left (or something has gone wrong)
+static void _run_worker(struct _kdl_parallel_job* job)
+{
+    while (true) {
+        _mutex_lock(&job->mutex);
+        bool done = !job->ok || job->next_chunk == job->n_chunks;
+        size_t index = done ? 0 : job->next_chunk++;
+        // Once one chunk has settled the version, the others needn't detect it
+        kdl_parse_option version = job->version;
+        _mutex_unlock(&job->mutex);
+        if (done) break;
+
+        if (!_parse_chunk(job, index, version)) {
+            _mutex_lock(&job->mutex);
+            job->ok = false;
+            _mutex_unlock(&job->mutex);
+        }
+    }
+}
+
+#if defined(_WIN32)
+
+static DWORD WINAPI _worker_thread(LPVOID job)
+{
+    _run_worker((struct _kdl_parallel_job*)job);
+    return 0;
+}
+
+static bool _start_thread(_kdl_thread* thread, struct _kdl_parallel_job* job)
+{
+    *thread = CreateThread(NULL, 0, &_worker_thread, job, 0, NULL);
+    return *thread != NULL;
+}
+
+static void _join_thread(_kdl_thread thread)
+{
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+
+#elif defined(HAVE_PTHREADS)
+
+static void* _worker_thread(void* job)
+{
+    _run_worker((struct _kdl_parallel_job*)job);
+    return NULL;
+}
+
+static bool _start_thread(_kdl_thread* thread, struct _kdl_parallel_job* job)
+{
+    return pthread_create(thread, NULL, &_worker_thread, job) == 0;
+}
+
+static void _join_thread(_kdl_thread thread) { pthread_join(thread, NULL); }
+
+#endif
+
+bool kdl_parse_parallel(kdl_str doc, kdl_parse_option opt, kdl_parallel_options const* parallel_opt,
+    kdl_chunk_event_func func, void* user_data)
+{
+    if (parallel_opt == NULL) parallel_opt = &KDL_DEFAULT_PARALLEL_OPTIONS;
+    size_t chunk_size = parallel_opt->chunk_size != 0 ? parallel_opt->chunk_size : 1;
+    unsigned int n_threads = parallel_opt->n_threads != 0 ? parallel_opt->n_threads : _number_of_cpus();
+    kdl_allocator const* alloc = &_kdl_default_allocator;
+
+    // Split the document
+    size_t capacity = 64;
+    size_t* chunk_starts = _kdl_malloc(alloc, capacity * sizeof(size_t));
+    if (chunk_starts == NULL) return false;
+    _kdl_split_scanner scanner = {doc.data, doc.data + doc.len, doc.data, 0, false};
+    size_t n_chunks = 1;
+    chunk_starts[0] = 0;
+    while (chunk_size < doc.len - chunk_starts[n_chunks - 1]) {
+        size_t split = _next_split(&scanner, chunk_starts[n_chunks - 1] + chunk_size);
+        if (split >= doc.len) break;
+        if (n_chunks + 2 > capacity) {
+            capacity *= 2;
+            chunk_starts = _kdl_reallocf(alloc, chunk_starts, capacity * sizeof(size_t));
+            if (chunk_starts == NULL) return false;
+        }
+        chunk_starts[n_chunks++] = split;
+    }
+    chunk_starts[n_chunks] = doc.len;
+
+    struct _kdl_parallel_job job;
+    job.doc = doc;
+    job.opt = opt;
+    job.func = func;
+    job.user_data = user_data;
+    job.chunk_starts = chunk_starts;
+    job.n_chunks = n_chunks;
+    _mutex_init(&job.mutex);
+    job.next_chunk = 0;
+    job.ok = true;
+    // no version given means detect, as in kdl_create_string_parser()
+    job.version = (opt & KDL_DETECT_VERSION) != 0 ? opt & KDL_DETECT_VERSION : KDL_DETECT_VERSION;
+
+#if defined(_WIN32) || defined(HAVE_PTHREADS)
+    // The calling thread is one of the workers
+    size_t n_extra_threads = (n_threads < n_chunks ? n_threads : n_chunks) - 1;
+    _kdl_thread* threads = NULL;
+    if (n_extra_threads > 0) {
+        threads = _kdl_malloc(alloc, n_extra_threads * sizeof(_kdl_thread));
+        if (threads == NULL) n_extra_threads = 0;
+    }
+    size_t n_started = 0;
+    while (n_started < n_extra_threads && _start_thread(&threads[n_started], &job)) ++n_started;
+    _run_worker(&job);
+    for (size_t i = 0; i < n_started; ++i) _join_thread(threads[i]);
+    _kdl_free(alloc, threads);
+#else
+    (void)n_threads;
+    _run_worker(&job);
+#endif
+
+    _mutex_destroy(&job.mutex);
+    _kdl_free(alloc, chunk_starts);
+    return job.ok;
+}
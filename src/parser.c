@@ -2,12 +2,16 @@
 #include "kdl/common.h"
 #include "kdl/tokenizer.h"
 
+#include "alloc.h"
+#include "arena.h"
 #include "bigint.h"
 #include "compat.h"
+#include "float_conv.h"
 #include "grammar.h"
 #include "str.h"
 #include "utf8.h"
 
+#include <limits.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -61,11 +65,23 @@ struct _kdl_parser {
     int child_block_at_depth;
     enum _kdl_parser_state state;
     kdl_event_data event;
+    kdl_allocator alloc;
+    _kdl_ascii_span_func ascii_span;
+    bool input_is_stable; // token text stays valid after the next token is read (not for streams)
+    bool skipping;        // inside kdl_parser_skip_node(): events are discarded, values not decoded
+    // All temporary strings below live in the arena, which is reset between events
+    _kdl_arena arena;
+    kdl_allocator tmp_alloc;
     kdl_owned_string tmp_string_type;
     kdl_owned_string tmp_string_key;
     kdl_owned_string tmp_string_value;
+    kdl_owned_string tmp_string_materialized;
     kdl_str waiting_type_annotation;
-    kdl_owned_string waiting_prop_name;
+    kdl_str waiting_prop_name;
+    kdl_owned_string waiting_prop_name_storage;
+    // KDL_LAZY_VALUES: waiting_prop_name is the undecoded text of a token of this type
+    bool waiting_prop_name_is_raw;
+    kdl_token_type waiting_prop_token_type;
     kdl_token next_token;
     bool have_next_token;
 };
@@ -79,9 +95,16 @@ static void _init_kdl_parser(kdl_parser* self, kdl_parse_option opt)
     self->tmp_string_type = (kdl_owned_string){NULL, 0};
     self->tmp_string_key = (kdl_owned_string){NULL, 0};
     self->tmp_string_value = (kdl_owned_string){NULL, 0};
+    self->tmp_string_materialized = (kdl_owned_string){NULL, 0};
     self->waiting_type_annotation = (kdl_str){NULL, 0};
-    self->waiting_prop_name = (kdl_owned_string){NULL, 0};
+    self->waiting_prop_name = (kdl_str){NULL, 0};
+    self->waiting_prop_name_storage = (kdl_owned_string){NULL, 0};
+    self->waiting_prop_name_is_raw = false;
     self->have_next_token = false;
+    self->input_is_stable = true;
+    self->skipping = false;
+    self->event.token = (kdl_token){KDL_TOKEN_WORD, {NULL, 0}};
+    self->ascii_span = _kdl_select_ascii_span_func();
 
     // Fallback: use KDLv1 only
     if ((opt & KDL_PARSE_OPT_VERSION_BITS) == 0) {
@@ -102,21 +125,89 @@ inline static kdl_character_set _default_character_set(kdl_parse_option opt)
 
 kdl_parser* kdl_create_string_parser(kdl_str doc, kdl_parse_option opt)
 {
-    kdl_parser* self = malloc(sizeof(kdl_parser));
+    return kdl_create_string_parser_ex(doc, opt, NULL);
+}
+
+kdl_parser* kdl_create_stream_parser(kdl_read_func read_func, void* user_data, kdl_parse_option opt)
+{
+    return kdl_create_stream_parser_ex(read_func, user_data, opt, NULL);
+}
+
+kdl_parser* kdl_create_file_parser(char const* path, kdl_parse_option opt)
+{
+    return kdl_create_file_parser_ex(path, opt, NULL);
+}
+
+kdl_parser* kdl_create_indexed_parser(kdl_str doc, kdl_parse_option opt)
+{
+    return kdl_create_indexed_parser_ex(doc, opt, NULL);
+}
+
+static kdl_parser* _new_kdl_parser(kdl_allocator const* allocator)
+{
+    kdl_allocator alloc = _kdl_allocator_or_default(allocator);
+    kdl_parser* self = _kdl_malloc(&alloc, sizeof(kdl_parser));
+    if (self != NULL) {
+        self->alloc = alloc;
+        _kdl_arena_init(&self->arena, &self->alloc);
+        self->tmp_alloc = _kdl_arena_allocator(&self->arena);
+    }
+    return self;
+}
+
+kdl_parser* kdl_create_string_parser_ex(kdl_str doc, kdl_parse_option opt, kdl_allocator const* allocator)
+{
+    kdl_parser* self = _new_kdl_parser(allocator);
     if (self != NULL) {
         _init_kdl_parser(self, opt);
-        self->tokenizer = kdl_create_string_tokenizer(doc);
+        self->tokenizer = kdl_create_string_tokenizer_ex(doc, &self->alloc);
         kdl_tokenizer_set_character_set(self->tokenizer, _default_character_set(self->opt));
     }
     return self;
 }
 
-kdl_parser* kdl_create_stream_parser(kdl_read_func read_func, void* user_data, kdl_parse_option opt)
+kdl_parser* kdl_create_stream_parser_ex(
+    kdl_read_func read_func, void* user_data, kdl_parse_option opt, kdl_allocator const* allocator)
 {
-    kdl_parser* self = malloc(sizeof(kdl_parser));
+    kdl_parser* self = _new_kdl_parser(allocator);
     if (self != NULL) {
+        // The stream buffer moves around, so strings can't be borrowed from it
+        _init_kdl_parser(self, opt & ~KDL_BORROW_STRINGS);
+        self->input_is_stable = false;
+        self->tokenizer = kdl_create_stream_tokenizer_ex(read_func, user_data, &self->alloc);
+        kdl_tokenizer_set_character_set(self->tokenizer, _default_character_set(self->opt));
+    }
+    return self;
+}
+
+kdl_parser* kdl_create_file_parser_ex(char const* path, kdl_parse_option opt, kdl_allocator const* allocator)
+{
+    kdl_parser* self = _new_kdl_parser(allocator);
+    if (self != NULL) {
+        // The mapping stays in place until the parser is destroyed, so strings can be borrowed
+        self->tokenizer = kdl_create_file_tokenizer_ex(path, &self->alloc);
+        if (self->tokenizer == NULL) {
+            kdl_allocator alloc = self->alloc;
+            _kdl_free(&alloc, self);
+            return NULL;
+        }
+        _init_kdl_parser(self, opt);
+        kdl_tokenizer_set_character_set(self->tokenizer, _default_character_set(self->opt));
+    }
+    return self;
+}
+
+kdl_parser* kdl_create_indexed_parser_ex(kdl_str doc, kdl_parse_option opt, kdl_allocator const* allocator)
+{
+    kdl_parser* self = _new_kdl_parser(allocator);
+    if (self != NULL) {
+        self->tokenizer = kdl_create_indexed_tokenizer_ex(doc, &self->alloc);
+        if (self->tokenizer == NULL) {
+            kdl_allocator alloc = self->alloc;
+            _kdl_free(&alloc, self);
+            return NULL;
+        }
         _init_kdl_parser(self, opt);
-        self->tokenizer = kdl_create_stream_tokenizer(read_func, user_data);
         kdl_tokenizer_set_character_set(self->tokenizer, _default_character_set(self->opt));
     }
     return self;
@@ -125,11 +216,19 @@ kdl_parser* kdl_create_stream_parser(kdl_read_func read_func, void* user_data, k
 void kdl_destroy_parser(kdl_parser* self)
 {
     kdl_destroy_tokenizer(self->tokenizer);
-    kdl_free_string(&self->tmp_string_type);
-    kdl_free_string(&self->tmp_string_key);
-    kdl_free_string(&self->tmp_string_value);
-    kdl_free_string(&self->waiting_prop_name);
-    free(self);
+    _kdl_arena_destroy(&self->arena);
+    kdl_allocator alloc = self->alloc;
+    _kdl_free(&alloc, self);
+}
+
+void kdl_parser_set_read_chunk_size(kdl_parser* self, size_t chunk_size)
+{
+    kdl_tokenizer_set_read_chunk_size(self->tokenizer, chunk_size);
+}
+
+kdl_parse_option kdl_parser_get_version(kdl_parser const* self)
+{
+    return self->opt & KDL_PARSE_OPT_VERSION_BITS;
 }
 
 static void _set_version(kdl_parser* self, kdl_version version)
@@ -140,11 +239,40 @@ static void _set_version(kdl_parser* self, kdl_version version)
     kdl_tokenizer_set_character_set(self->tokenizer, _default_character_set(self->opt));
 }
 
+// Until the version is known, the tokenizer uses the stricter KDLv2 character set. A character that
+// is only illegal in KDLv2 (e.g. a bidi control) means the document must be KDLv1.
+static kdl_tokenizer_status _pop_token(kdl_parser* self, kdl_token* token)
+{
+    kdl_tokenizer_status status = kdl_pop_token(self->tokenizer, token);
+    if (status == KDL_TOKENIZER_ERROR && _v1_allowed(self) && _v2_allowed(self)) {
+        // the tokenizer hasn't consumed anything, so the token can be read again
+        kdl_tokenizer_set_character_set(self->tokenizer, KDL_CHARACTER_SET_V1);
+        status = kdl_pop_token(self->tokenizer, token);
+        if (status != KDL_TOKENIZER_ERROR) _set_version(self, KDL_VERSION_1);
+    }
+    return status;
+}
+
+// Free all temporary strings from the previous event. Strings that are still needed, because
+// they belong to a property name or type annotation that hasn't been emitted yet, keep the
+// arena alive until the next event.
+static void _release_temporaries(kdl_parser* self)
+{
+    if (self->waiting_prop_name.data != NULL || self->waiting_type_annotation.data != NULL) return;
+    self->tmp_string_type = (kdl_owned_string){NULL, 0};
+    self->tmp_string_key = (kdl_owned_string){NULL, 0};
+    self->tmp_string_value = (kdl_owned_string){NULL, 0};
+    self->tmp_string_materialized = (kdl_owned_string){NULL, 0};
+    self->waiting_prop_name_storage = (kdl_owned_string){NULL, 0};
+    _kdl_arena_reset(&self->arena);
+}
+
 static void _reset_event(kdl_parser* self)
 {
     self->event.name = (kdl_str){NULL, 0};
     self->event.value.type = KDL_TYPE_NULL;
     self->event.value.type_annotation = (kdl_str){NULL, 0};
+    self->event.token.value = (kdl_str){NULL, 0};
 }
 
 static void _set_parse_error(kdl_parser* self, char const* message)
@@ -164,22 +292,32 @@ static void _set_comment_event(kdl_parser* self, kdl_token const* token)
 static kdl_event_data* _next_node(kdl_parser* self, kdl_token* token);
 static kdl_event_data* _next_event_in_node(kdl_parser* self, kdl_token* token);
 static kdl_event_data* _apply_slashdash(kdl_parser* self);
+static kdl_event_data* _skip_node_unchecked(kdl_parser* self, int end_depth);
 static bool _parse_value(kdl_parser* self, kdl_token const* token, kdl_value* val, kdl_owned_string* s);
-static bool _parse_number(kdl_str number, kdl_value* val, kdl_owned_string* s);
-static bool _parse_decimal_number(kdl_str number, kdl_value* val, kdl_owned_string* s);
-static bool _parse_decimal_integer(kdl_str number, kdl_value* val, kdl_owned_string* s);
-static bool _parse_decimal_float(kdl_str number, kdl_value* val, kdl_owned_string* s);
-static bool _parse_hex_number(kdl_str number, kdl_value* val, kdl_owned_string* s);
-static bool _parse_octal_number(kdl_str number, kdl_value* val, kdl_owned_string* s);
-static bool _parse_binary_number(kdl_str number, kdl_value* val, kdl_owned_string* s);
+static bool _parse_number(kdl_str number, kdl_value* val, kdl_owned_string* s, kdl_allocator const* alloc);
+static bool _parse_decimal_number(
+    kdl_str number, kdl_value* val, kdl_owned_string* s, kdl_allocator const* alloc);
+static bool _parse_decimal_integer(
+    kdl_str number, kdl_value* val, kdl_owned_string* s, kdl_allocator const* alloc);
+static bool _parse_decimal_float(
+    kdl_str number, kdl_value* val, kdl_owned_string* s, kdl_allocator const* alloc);
+static bool _parse_hex_number(
+    kdl_str number, kdl_value* val, kdl_owned_string* s, kdl_allocator const* alloc);
+static bool _parse_octal_number(
+    kdl_str number, kdl_value* val, kdl_owned_string* s, kdl_allocator const* alloc);
+static bool _parse_binary_number(
+    kdl_str number, kdl_value* val, kdl_owned_string* s, kdl_allocator const* alloc);
 static bool _identifier_is_valid_v1(kdl_str value);
 static bool _identifier_is_valid_v2(kdl_str value);
+static bool _plain_string_is_valid_v2(kdl_parser* self, kdl_str value);
+static bool _word_is_number(kdl_str word);
 
 kdl_event_data* kdl_parser_next_event(kdl_parser* self)
 {
     kdl_token token;
     kdl_event_data* ev;
 
+    _release_temporaries(self);
     _reset_event(self);
 
     while (true) {
@@ -189,7 +327,7 @@ kdl_event_data* kdl_parser_next_event(kdl_parser* self)
             token = self->next_token;
             self->have_next_token = false;
         } else {
-            switch (kdl_pop_token(self->tokenizer, &token)) {
+            switch (_pop_token(self, &token)) {
             case KDL_TOKENIZER_EOF:
                 if ((self->state & 0xff) == PARSER_IN_NODE) {
                     // EOF may be ok, but we have to close the node first
@@ -395,7 +533,11 @@ static kdl_event_data* _next_node(kdl_parser* self, kdl_token* token)
         case KDL_TOKEN_RAW_STRING_V1:
         case KDL_TOKEN_RAW_STRING_V2:
         case KDL_TOKEN_RAW_MULTILINE_STRING:
-            if (!_parse_value(self, token, &tmp_val, &self->tmp_string_key)) {
+            if (self->skipping && token->type != KDL_TOKEN_WORD) {
+                // quoted names are always strings; the name itself is never seen
+                tmp_val.type = KDL_TYPE_STRING;
+                tmp_val.string = token->value;
+            } else if (!_parse_value(self, token, &tmp_val, &self->tmp_string_key)) {
                 _set_parse_error(self, "Error parsing node name");
                 return &self->event;
             }
@@ -509,6 +651,24 @@ static kdl_event_data* _next_event_in_node(kdl_parser* self, kdl_token* token)
                 }
             }
 
+            if (self->waiting_prop_name_is_raw && self->skipping) {
+                // The name is never seen
+                self->waiting_prop_name_is_raw = false;
+            } else if (self->waiting_prop_name_is_raw) {
+                // Property names are always decoded
+                kdl_token name_token = {self->waiting_prop_token_type, self->waiting_prop_name};
+                kdl_value name;
+                kdl_owned_string name_storage = {NULL, 0};
+                if (!_parse_value(self, &name_token, &name, &name_storage)) {
+                    _set_parse_error(self, "Error parsing property or argument");
+                    return &self->event;
+                }
+                // the raw text stays in the arena until the next reset
+                self->waiting_prop_name = name.string;
+                self->waiting_prop_name_storage = name_storage;
+                self->waiting_prop_name_is_raw = false;
+            }
+
             return NULL;
         } else {
             // We'll need that token again
@@ -526,10 +686,17 @@ static kdl_event_data* _next_event_in_node(kdl_parser* self, kdl_token* token)
             }
 
             self->event.event = KDL_EVENT_ARGUMENT;
-            self->event.value.type = KDL_TYPE_STRING;
-            self->tmp_string_value = self->waiting_prop_name;
-            self->waiting_prop_name = (kdl_owned_string){NULL, 0};
-            self->event.value.string = kdl_borrow_str(&self->tmp_string_value);
+            _kdl_free_string(&self->tmp_string_value, &self->tmp_alloc);
+            self->tmp_string_value = self->waiting_prop_name_storage;
+            self->waiting_prop_name_storage = (kdl_owned_string){NULL, 0};
+            if (self->waiting_prop_name_is_raw) {
+                self->event.token = (kdl_token){self->waiting_prop_token_type, self->waiting_prop_name};
+                self->waiting_prop_name_is_raw = false;
+            } else {
+                self->event.value.type = KDL_TYPE_STRING;
+                self->event.value.string = self->waiting_prop_name;
+            }
+            self->waiting_prop_name = (kdl_str){NULL, 0};
             ev = _apply_slashdash(self);
             enum _kdl_parser_state new_state = PARSER_IN_NODE;
             if ((self->state & PARSER_FLAG_CONTEXTUALLY_ILLEGAL_WHITESPACE) == 0) {
@@ -636,7 +803,34 @@ static kdl_event_data* _next_event_in_node(kdl_parser* self, kdl_token* token)
                 return &self->event;
             }
             // Either a property key, or a property value, or an argument.
-            if (!_parse_value(self, token, &self->event.value, &self->tmp_string_value)) {
+            if ((self->opt & KDL_LAZY_VALUES || self->skipping)
+                && (token->type != KDL_TOKEN_WORD || _word_is_number(token->value))) {
+                // Strings and numbers are decoded on demand. Other words (keywords and
+                // identifiers) are cheap to decode and affect the grammar.
+                kdl_str text = token->value;
+                _kdl_free_string(&self->tmp_string_value, &self->tmp_alloc);
+                if (!self->input_is_stable && !self->skipping) {
+                    // the text has to survive reading the next token
+                    self->tmp_string_value = _kdl_clone_str(&text, &self->tmp_alloc);
+                    if (self->tmp_string_value.data == NULL) {
+                        _set_parse_error(self, "Out of memory");
+                        return &self->event;
+                    }
+                    text = kdl_borrow_str(&self->tmp_string_value);
+                }
+                if (self->waiting_type_annotation.data == NULL && (self->state & PARSER_FLAG_IN_PROPERTY) == 0
+                    && token->type != KDL_TOKEN_WORD) {
+                    // this string may yet turn out to be a property name
+                    self->waiting_prop_name = text;
+                    self->waiting_prop_name_storage = self->tmp_string_value;
+                    self->tmp_string_value = (kdl_owned_string){NULL, 0};
+                    self->waiting_prop_name_is_raw = true;
+                    self->waiting_prop_token_type = token->type;
+                    self->state |= PARSER_FLAG_MAYBE_IN_PROPERTY;
+                    return NULL;
+                }
+                self->event.token = (kdl_token){token->type, text};
+            } else if (!_parse_value(self, token, &self->event.value, &self->tmp_string_value)) {
                 _set_parse_error(self, "Error parsing property or argument");
                 return &self->event;
             }
@@ -645,7 +839,8 @@ static kdl_event_data* _next_event_in_node(kdl_parser* self, kdl_token* token)
             if (self->waiting_type_annotation.data == NULL && (self->state & PARSER_FLAG_IN_PROPERTY) == 0
                 && self->event.value.type == KDL_TYPE_STRING) {
                 // carry over the potential name in waiting_prop_name
-                self->waiting_prop_name = self->tmp_string_value;
+                self->waiting_prop_name = self->event.value.string;
+                self->waiting_prop_name_storage = self->tmp_string_value;
                 self->tmp_string_value = (kdl_owned_string){NULL, 0};
                 self->event.value.type = KDL_TYPE_NULL;
                 self->state |= PARSER_FLAG_MAYBE_IN_PROPERTY;
@@ -675,9 +870,11 @@ static kdl_event_data* _next_event_in_node(kdl_parser* self, kdl_token* token)
                 self->waiting_type_annotation = (kdl_str){NULL, 0};
             }
             if (self->state & PARSER_FLAG_IN_PROPERTY) {
-                self->tmp_string_key = self->waiting_prop_name;
-                self->waiting_prop_name = (kdl_owned_string){NULL, 0};
-                self->event.name = kdl_borrow_str(&self->tmp_string_key);
+                _kdl_free_string(&self->tmp_string_key, &self->tmp_alloc);
+                self->tmp_string_key = self->waiting_prop_name_storage;
+                self->waiting_prop_name_storage = (kdl_owned_string){NULL, 0};
+                self->event.name = self->waiting_prop_name;
+                self->waiting_prop_name = (kdl_str){NULL, 0};
                 self->event.event = KDL_EVENT_PROPERTY;
             } else {
                 self->event.event = KDL_EVENT_ARGUMENT;
@@ -707,18 +904,170 @@ static kdl_event_data* _next_event_in_node(kdl_parser* self, kdl_token* token)
     }
 }
 
+bool kdl_event_materialize_value(kdl_parser* self, kdl_event_data* event)
+{
+    if (event->token.value.data == NULL) return true;
+
+    kdl_token token = event->token;
+    event->token.value = (kdl_str){NULL, 0};
+    if (!_parse_value(self, &token, &event->value, &self->tmp_string_materialized)) {
+        _set_parse_error(self, "Error parsing property or argument");
+        return false;
+    }
+    return true;
+}
+
+kdl_event_data* kdl_parser_skip_node(kdl_parser* self)
+{
+    // Depth at which the innermost open node ends
+    int end_depth;
+    if ((self->state & 0xff) == PARSER_IN_NODE) {
+        end_depth = self->depth - 1;
+    } else if (self->depth > 0) {
+        end_depth = self->depth - 2; // in a child block
+    } else {
+        end_depth = -1; // no open node: skip to the end of the document
+    }
+
+    if (self->opt & KDL_UNCHECKED_SKIP) {
+        return _skip_node_unchecked(self, end_depth);
+    }
+
+    kdl_event_data* ev;
+    self->skipping = true;
+    while (true) {
+        ev = kdl_parser_next_event(self);
+        if (ev->event == KDL_EVENT_EOF || ev->event == KDL_EVENT_PARSE_ERROR) break;
+        if ((ev->event & ~KDL_EVENT_COMMENT) == KDL_EVENT_END_NODE && self->depth == end_depth) break;
+    }
+    self->skipping = false;
+    return ev;
+}
+
+// Find the end of the node by matching braces, without looking at anything else
+static kdl_event_data* _skip_node_unchecked(kdl_parser* self, int end_depth)
+{
+    _release_temporaries(self);
+    _reset_event(self);
+    // forget about any half-finished property or type annotation
+    self->waiting_prop_name = (kdl_str){NULL, 0};
+    self->waiting_type_annotation = (kdl_str){NULL, 0};
+    self->waiting_prop_name_is_raw = false;
+
+    // Number of open child blocks. At level 0, we're in the node itself (or at the top level),
+    // where it ends at a newline, semicolon, or '}' (or end of file)
+    int level = (self->state & 0xff) == PARSER_IN_NODE || end_depth < 0 ? 0 : 1;
+    bool slashdash = false; // a slashdash is waiting for its target
+    bool line_cont = false; // a line continuation is waiting for its newline
+    kdl_token token;
+    bool end_of_node = false;
+    while (!end_of_node) {
+        if (self->have_next_token) {
+            token = self->next_token;
+            self->have_next_token = false;
+        } else {
+            switch (_pop_token(self, &token)) {
+            case KDL_TOKENIZER_OK:
+                break;
+            case KDL_TOKENIZER_EOF:
+                if (level > 0) {
+                    _set_parse_error(self, "Unexpected end of data (unclosed lists of children)");
+                    return &self->event;
+                }
+                token.type = KDL_TOKEN_NEWLINE;
+                token.value = (kdl_str){NULL, 0};
+                break;
+            default:
+            case KDL_TOKENIZER_ERROR:
+                _set_parse_error(self, "Parse error");
+                return &self->event;
+            }
+        }
+
+        switch (token.type) {
+        case KDL_TOKEN_START_CHILDREN:
+            ++level;
+            break;
+        case KDL_TOKEN_END_CHILDREN:
+            if (level == 0) {
+                if (end_depth < 0) {
+                    _set_parse_error(self, "Unexpected '}'");
+                    return &self->event;
+                }
+                // this ends the parent node; process the token again
+                self->next_token = token;
+                self->have_next_token = true;
+                end_of_node = true;
+                break;
+            }
+            --level;
+            break;
+        case KDL_TOKEN_SLASHDASH:
+            slashdash = true;
+            continue;
+        case KDL_TOKEN_LINE_CONTINUATION:
+            line_cont = true;
+            continue;
+        case KDL_TOKEN_WHITESPACE:
+        case KDL_TOKEN_SINGLE_LINE_COMMENT:
+        case KDL_TOKEN_MULTI_LINE_COMMENT:
+            continue;
+        case KDL_TOKEN_NEWLINE:
+            if ((slashdash || line_cont) && token.value.data != NULL) {
+                line_cont = false;
+                continue;
+            }
+            _fallthrough_;
+        case KDL_TOKEN_SEMICOLON:
+            if (level == 0 && end_depth < 0 && token.value.data == NULL) {
+                // end of the document
+                self->state = PARSER_OUTSIDE_NODE;
+                self->depth = 0;
+                self->slashdash_depth = -1;
+                self->child_block_at_depth = -1;
+                self->event.event = KDL_EVENT_EOF;
+                return &self->event;
+            }
+            end_of_node = level == 0 && end_depth >= 0;
+            break;
+        default:
+            break;
+        }
+        slashdash = false;
+        line_cont = false;
+    }
+
+    self->state = PARSER_OUTSIDE_NODE;
+    self->depth = end_depth;
+    if (self->child_block_at_depth > self->depth) {
+        self->child_block_at_depth = -1;
+    }
+    if (self->slashdash_depth > self->depth + 1) {
+        self->slashdash_depth = -1;
+    }
+    self->event.event = KDL_EVENT_END_NODE;
+    _apply_slashdash(self);
+    return &self->event;
+}
+
 static bool _parse_value(kdl_parser* self, kdl_token const* token, kdl_value* val, kdl_owned_string* s)
 {
-    kdl_free_string(s);
+    // when skipping, the strings are never seen, so they don't have to be copied
+    bool borrow = (self->opt & KDL_BORROW_STRINGS) != 0 || self->skipping;
+    _kdl_free_string(s, &self->tmp_alloc);
 
     switch (token->type) {
     case KDL_TOKEN_RAW_STRING_V1:
         if (_v1_allowed(self)) {
             _set_version(self, KDL_VERSION_1);
             // no parsing necessary
-            *s = kdl_clone_str(&token->value);
             val->type = KDL_TYPE_STRING;
-            val->string = kdl_borrow_str(s);
+            if (borrow) {
+                val->string = token->value;
+            } else {
+                *s = _kdl_clone_str(&token->value, &self->tmp_alloc);
+                val->string = kdl_borrow_str(s);
+            }
             return true;
         } else {
             return false;
@@ -731,9 +1080,13 @@ static bool _parse_value(kdl_parser* self, kdl_token const* token, kdl_value* va
                 return false;
             }
             // no parsing necessary
-            *s = kdl_clone_str(&token->value);
             val->type = KDL_TYPE_STRING;
-            val->string = kdl_borrow_str(s);
+            if (borrow) {
+                val->string = token->value;
+            } else {
+                *s = _kdl_clone_str(&token->value, &self->tmp_alloc);
+                val->string = kdl_borrow_str(s);
+            }
             return true;
         } else {
             return false;
@@ -742,7 +1095,7 @@ static bool _parse_value(kdl_parser* self, kdl_token const* token, kdl_value* va
         if (_v2_allowed(self)) {
             _set_version(self, KDL_VERSION_2);
             // dedent multi-line string
-            *s = _kdl_dedent_multiline_string(&token->value);
+            *s = _kdl_dedent_multi_line(&token->value, false, self->ascii_span, &self->tmp_alloc);
             if (s->data == NULL) {
                 return false;
             }
@@ -753,36 +1106,38 @@ static bool _parse_value(kdl_parser* self, kdl_token const* token, kdl_value* va
             return false;
         }
     case KDL_TOKEN_STRING: {
-        // parse escapes
-        kdl_owned_string v1_str = (kdl_owned_string){NULL, 0};
-        kdl_owned_string v2_str = (kdl_owned_string){NULL, 0};
-
-        if (_v1_allowed(self)) v1_str = kdl_unescape_v1(&token->value);
-        if (_v2_allowed(self)) v2_str = kdl_unescape_v2_single_line(&token->value);
-
-        if (v1_str.data == NULL && v2_str.data != NULL) {
-            _set_version(self, KDL_VERSION_2);
-            *s = v2_str;
-        } else if (v1_str.data != NULL && v2_str.data == NULL) {
-            _set_version(self, KDL_VERSION_1);
-            *s = v1_str;
-        } else if (v1_str.data != NULL && v2_str.data != NULL) {
-            // Could be either version, used KDLv2 value
-            *s = v2_str;
-            kdl_free_string(&v1_str);
+        bool is_v1 = _v1_allowed(self);
+        bool is_v2 = _v2_allowed(self);
+        if (memchr(token->value.data, '\\', token->value.len) == NULL) {
+            // no escapes: the string is its own value in both versions, but KDLv2 is stricter
+            is_v2 = is_v2 && _plain_string_is_valid_v2(self, token->value);
+            if (borrow) {
+                val->string = token->value;
+            } else {
+                *s = _kdl_clone_str(&token->value, &self->tmp_alloc);
+                if (s->data == NULL) return false;
+                val->string = kdl_borrow_str(s);
+            }
+        } else {
+            // parse escapes for both versions at once
+            *s = _kdl_unescape_v1_or_v2(&token->value, &is_v1, &is_v2, self->ascii_span, &self->tmp_alloc);
+            val->string = kdl_borrow_str(s);
         }
 
-        if (s->data == NULL) {
+        if (is_v1 && !is_v2) {
+            _set_version(self, KDL_VERSION_1);
+        } else if (is_v2 && !is_v1) {
+            _set_version(self, KDL_VERSION_2);
+        } else if (!is_v1 && !is_v2) {
             return false;
-        } else {
-            val->type = KDL_TYPE_STRING;
-            val->string = kdl_borrow_str(s);
-            return true;
         }
+        val->type = KDL_TYPE_STRING;
+        return true;
     }
     case KDL_TOKEN_MULTILINE_STRING: {
         if (_v2_allowed(self)) {
-            *s = kdl_unescape_v2_multi_line(&token->value);
+            _set_version(self, KDL_VERSION_2);
+            *s = _kdl_dedent_multi_line(&token->value, true, self->ascii_span, &self->tmp_alloc);
             if (s->data == NULL) {
                 return false;
             } else {
@@ -855,6 +1210,7 @@ static bool _parse_value(kdl_parser* self, kdl_token const* token, kdl_value* va
             return true;
         }
         // either a number or an identifier
+        bool almost_number = false;
         if (token->value.len >= 1) {
             char first_char = token->value.data[0];
             int offset = 0;
@@ -865,18 +1221,17 @@ static bool _parse_value(kdl_parser* self, kdl_token const* token, kdl_value* va
             }
             if (first_char >= '0' && first_char <= '9') {
                 // first character after sign is a digit, this value should be interpreted as a number
-                return _parse_number(token->value, val, s);
-            } else if (_v2_only(self) && first_char == '.' && token->value.len - offset >= 2) {
+                return _parse_number(token->value, val, s, &self->tmp_alloc);
+            } else if (first_char == '.' && token->value.len - offset >= 2) {
                 // check for v2 rule of banned "almost numbers"
                 char second_char = token->value.data[offset + 1];
-                if (second_char >= '0' && second_char <= '9') {
-                    return false;
-                }
+                almost_number = second_char >= '0' && second_char <= '9';
             }
         }
         // this is a regular identifier (or a syntax error)
         bool is_v1_identifier = _v1_allowed(self) && _identifier_is_valid_v1(token->value);
-        bool is_v2_identifier = _v2_allowed(self) && _identifier_is_valid_v2(token->value);
+        bool is_v2_identifier
+            = _v2_allowed(self) && !almost_number && _identifier_is_valid_v2(token->value);
         bool is_identifier = is_v1_identifier || is_v2_identifier;
         if (is_v1_identifier && !is_v2_identifier) {
             _set_version(self, KDL_VERSION_1);
@@ -884,9 +1239,13 @@ static bool _parse_value(kdl_parser* self, kdl_token const* token, kdl_value* va
             _set_version(self, KDL_VERSION_2);
         }
         if (is_identifier) {
-            *s = kdl_clone_str(&token->value);
             val->type = KDL_TYPE_STRING;
-            val->string = kdl_borrow_str(s);
+            if (borrow) {
+                val->string = token->value;
+            } else {
+                *s = _kdl_clone_str(&token->value, &self->tmp_alloc);
+                val->string = kdl_borrow_str(s);
+            }
             return true;
         }
         _fallthrough_;
@@ -896,7 +1255,7 @@ static bool _parse_value(kdl_parser* self, kdl_token const* token, kdl_value* va
     }
 }
 
-static bool _parse_number(kdl_str number, kdl_value* val, kdl_owned_string* s)
+static bool _parse_number(kdl_str number, kdl_value* val, kdl_owned_string* s, kdl_allocator const* alloc)
 {
     kdl_str orig_number = number;
     if (number.len >= 1) {
@@ -913,19 +1272,20 @@ static bool _parse_number(kdl_str number, kdl_value* val, kdl_owned_string* s)
     if (number.len > 2 && number.data[0] == '0') {
         switch (number.data[1]) {
         case 'x':
-            return _parse_hex_number(orig_number, val, s);
+            return _parse_hex_number(orig_number, val, s, alloc);
         case 'o':
-            return _parse_octal_number(orig_number, val, s);
+            return _parse_octal_number(orig_number, val, s, alloc);
         case 'b':
-            return _parse_binary_number(orig_number, val, s);
+            return _parse_binary_number(orig_number, val, s, alloc);
         default:
             break;
         }
     }
-    return _parse_decimal_number(orig_number, val, s);
+    return _parse_decimal_number(orig_number, val, s, alloc);
 }
 
-static bool _parse_decimal_number(kdl_str number, kdl_value* val, kdl_owned_string* s)
+static bool _parse_decimal_number(
+    kdl_str number, kdl_value* val, kdl_owned_string* s, kdl_allocator const* alloc)
 {
     // Check this is an integer or a decimal
     for (size_t i = 0; i < number.len; ++i) {
@@ -933,73 +1293,145 @@ static bool _parse_decimal_number(kdl_str number, kdl_value* val, kdl_owned_stri
         case '.':
         case 'e':
         case 'E':
-            return _parse_decimal_float(number, val, s);
+            return _parse_decimal_float(number, val, s, alloc);
         }
     }
-    return _parse_decimal_integer(number, val, s);
+    return _parse_decimal_integer(number, val, s, alloc);
 }
 
-static bool _parse_decimal_integer(kdl_str number, kdl_value* val, kdl_owned_string* s)
+// Check whether the 8 bytes in v (loaded little-endian) are all ASCII digits
+static inline bool _is_eight_digits(uint64_t v)
 {
-    bool negative = false;
-    _kdl_ubigint* n = _kdl_ubigint_new(0);
-    if (n == NULL) return false;
+    return ((v & 0xF0F0F0F0F0F0F0F0) | (((v + 0x0606060606060606) & 0xF0F0F0F0F0F0F0F0) >> 4))
+        == 0x3333333333333333;
+}
 
-    size_t i = 0; // index into number-string
+// Convert 8 ASCII digits (loaded little-endian) to their value, 2, 4, and then 8 digits at a time
+static inline uint64_t _parse_eight_digits(uint64_t v)
+{
+    uint64_t const mask = 0x000000FF000000FF;
+    uint64_t const mul1 = 100 + (1000000ULL << 32);
+    uint64_t const mul2 = 1 + (10000ULL << 32);
+    v -= 0x3030303030303030;
+    v = (v * 10) + (v >> 8);
+    return (((v & mask) * mul1) + (((v >> 16) & mask) * mul2)) >> 32;
+}
 
-    // handle sign
-    if (number.len > 1) {
-        switch (number.data[0]) {
-        case '-':
-            negative = true;
-            _fallthrough_;
-        case '+':
-            i = 1;
-        }
-    }
+static inline uint64_t _load_eight_bytes(char const* p)
+{
+    unsigned char const* u = (unsigned char const*)p;
+    return (uint64_t)u[0] | (uint64_t)u[1] << 8 | (uint64_t)u[2] << 16 | (uint64_t)u[3] << 24
+        | (uint64_t)u[4] << 32 | (uint64_t)u[5] << 40 | (uint64_t)u[6] << 48 | (uint64_t)u[7] << 56;
+}
 
-    if (number.len - i > 0 && number.data[i] == '_') goto error;
+static inline int _digit_value(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    else if (c >= 'a' && c <= 'f') return c - 'a' + 0xa;
+    else if (c >= 'A' && c <= 'F') return c - 'A' + 0xa;
+    else return 99;
+}
+
+// Parse the digits (and underscores) of an integer in a given base. Numbers that fit into a
+// long long are accumulated in a uint64_t; only larger numbers use a big integer.
+static bool _parse_integer(
+    kdl_str digits, int base, bool negative, kdl_value* val, kdl_owned_string* s, kdl_allocator const* alloc)
+{
+    uint64_t const limit = (uint64_t)LLONG_MAX;
+    uint64_t n = 0;
+    bool fits = true;
 
     // scan through entire number
-    for (; i < number.len; ++i) {
-        char c = number.data[i];
+    for (size_t i = 0; i < digits.len;) {
+        if (base == 10 && fits && digits.len - i >= 8) {
+            uint64_t chunk = _load_eight_bytes(digits.data + i);
+            if (_is_eight_digits(chunk)) {
+                uint64_t value = _parse_eight_digits(chunk);
+                if (n > (limit - value) / 100000000) {
+                    fits = false;
+                } else {
+                    n = n * 100000000 + value;
+                }
+                i += 8;
+                continue;
+            }
+        }
+
+        char c = digits.data[i++];
         if (c == '_') continue;
-        else if (c < '0' || c > '9') goto error;
+        int digit = _digit_value(c);
+        if (digit >= base) return false;
 
-        int digit = c - '0';
-        n = _kdl_ubigint_multiply_inplace(n, 10);
-        n = _kdl_ubigint_add_inplace(n, digit);
+        if (fits) {
+            if (n > (limit - (uint64_t)digit) / (uint64_t)base) {
+                fits = false;
+            } else {
+                n = n * (uint64_t)base + (uint64_t)digit;
+            }
+        }
     }
 
-    // try to reduce down to long long
-    long long n_ll;
-    if (_kdl_ubigint_as_long_long(n, &n_ll)) {
+    if (fits) {
         // number is representable as long long
+        long long n_ll = (long long)n;
         if (negative) n_ll = -n_ll;
         val->type = KDL_TYPE_NUMBER;
         val->number.type = KDL_NUMBER_TYPE_INTEGER;
         val->number.integer = n_ll;
-    } else {
-        // represent number as string
-        *s = _kdl_ubigint_as_string_sgn(negative ? -1 : +1, n);
-        val->type = KDL_TYPE_NUMBER;
-        val->number.type = KDL_NUMBER_TYPE_STRING_ENCODED;
-        val->number.string = kdl_borrow_str(s);
+        return true;
     }
-    _kdl_ubigint_free(n);
+
+    // The number is too large: start over with a big integer (the digits are known to be valid)
+    _kdl_ubigint* big = _kdl_ubigint_new(0, alloc);
+    for (size_t i = 0; i < digits.len && big != NULL; ++i) {
+        if (digits.data[i] == '_') continue;
+        big = _kdl_ubigint_multiply_inplace(big, base);
+        if (big != NULL) big = _kdl_ubigint_add_inplace(big, _digit_value(digits.data[i]));
+    }
+    if (big == NULL) return false;
+
+    // represent number as string
+    *s = _kdl_ubigint_as_string_sgn(negative ? -1 : +1, big);
+    _kdl_ubigint_free(big);
+    if (s->data == NULL) return false;
+    val->type = KDL_TYPE_NUMBER;
+    val->number.type = KDL_NUMBER_TYPE_STRING_ENCODED;
+    val->number.string = kdl_borrow_str(s);
     return true;
-error:
-    _kdl_ubigint_free(n);
-    return false;
 }
 
-static bool _parse_decimal_float(kdl_str number, kdl_value* val, kdl_owned_string* s)
+static bool _parse_decimal_integer(
+    kdl_str number, kdl_value* val, kdl_owned_string* s, kdl_allocator const* alloc)
 {
     bool negative = false;
-    int digits_before_decimal = 0;
-    int digits_after_decimal = 0;
-    unsigned long long decimal_mantissa = 0;
-    int explicit_exponent = 0;
+    size_t i = 0; // index into number-string
+
+    // handle sign
+    if (number.len > 1) {
+        switch (number.data[0]) {
+        case '-':
+            negative = true;
+            _fallthrough_;
+        case '+':
+            i = 1;
+        }
+    }
+
+    if (number.len - i > 0 && number.data[i] == '_') return false;
+
+    kdl_str digits = {number.data + i, number.len - i};
+    return _parse_integer(digits, 10, negative, val, s, alloc);
+}
+
+static bool _parse_decimal_float(
+    kdl_str number, kdl_value* val, kdl_owned_string* s, kdl_allocator const* alloc)
+{
+    bool negative = false;
+    uint64_t mantissa = 0; // the first 19 significant digits
+    int n_mantissa_digits = 0;
+    int64_t mantissa_exponent = 0; // power of ten applying to mantissa (apart from the explicit exponent)
+    bool truncated = false; // non-zero digits were dropped from mantissa
+    int64_t explicit_exponent = 0;
     bool exponent_negative = false;
     enum {
         before_decimal,
@@ -1024,6 +1456,8 @@ static bool _parse_decimal_float(kdl_str number, kdl_value* val, kdl_owned_strin
 
     if (number.len - i > 0 && number.data[i] == '_') return false;
 
+    kdl_str digits = {number.data + i, 0}; // mantissa digits, including '.' and '_'
+
     // scan through entire number
     for (; i < number.len; ++i) {
         char c = number.data[i];
@@ -1031,6 +1465,7 @@ static bool _parse_decimal_float(kdl_str number, kdl_value* val, kdl_owned_strin
             state = after_decimal_nodigit;
             if (number.len - i <= 1 || number.data[i + 1] == '_') return false;
         } else if ((c == 'e' || c == 'E') && state != exponent && state != after_decimal_nodigit) {
+            digits.len = (size_t)(number.data + i - digits.data);
             state = exponent_nodigit;
             if (i + 1 < number.len) {
                 // handle exponent sign
@@ -1048,17 +1483,23 @@ static bool _parse_decimal_float(kdl_str number, kdl_value* val, kdl_owned_strin
             int digit = c - '0';
             if (state == exponent || state == exponent_nodigit) {
                 state = exponent;
-                // stop parsing beyond rough heuristic, avoids overflow
-                if (explicit_exponent < 285) {
+                // saturate: anything this large is zero or infinite anyway
+                if (explicit_exponent < 0x10000000) {
                     explicit_exponent = explicit_exponent * 10 + digit;
                 }
             } else {
-                decimal_mantissa = decimal_mantissa * 10 + digit;
-                if (state == before_decimal) {
-                    ++digits_before_decimal;
+                bool after_point = state != before_decimal;
+                if (after_point) state = after_decimal;
+                if (n_mantissa_digits == 0 && digit == 0) {
+                    // leading zero
+                    if (after_point) --mantissa_exponent;
+                } else if (n_mantissa_digits < 19) {
+                    mantissa = mantissa * 10 + (uint64_t)digit;
+                    ++n_mantissa_digits;
+                    if (after_point) --mantissa_exponent;
                 } else {
-                    state = after_decimal;
-                    ++digits_after_decimal;
+                    if (digit != 0) truncated = true;
+                    if (!after_point) ++mantissa_exponent;
                 }
             }
         } else if (c == '_') {
@@ -1073,33 +1514,29 @@ static bool _parse_decimal_float(kdl_str number, kdl_value* val, kdl_owned_strin
         // invalid
         return false;
     }
-
-    // rough heuristic for numbers that fit into a double exactly
-    if (digits_before_decimal + digits_after_decimal <= 15 && explicit_exponent < 285
-        && explicit_exponent > -285) {
-        // "strip zeros"
-        while (decimal_mantissa % 10 == 0 && digits_after_decimal > 0) {
-            decimal_mantissa /= 10;
-            --digits_after_decimal;
-        }
-        double n = (double)decimal_mantissa;
-        if (negative) n = -n;
-        if (exponent_negative) explicit_exponent = -explicit_exponent;
-        int net_exponent = explicit_exponent - digits_after_decimal;
-        if (net_exponent < 0) {
-            n /= pow(10.0, -net_exponent);
-        }
-        if (net_exponent > 0) {
-            n *= pow(10.0, net_exponent);
+    if (state != exponent) digits.len = (size_t)(number.data + number.len - digits.data);
+    if (exponent_negative) explicit_exponent = -explicit_exponent;
+
+    double n = _kdl_decimal_to_double(mantissa, mantissa_exponent + explicit_exponent);
+    if (truncated) {
+        // The true value lies between mantissa and mantissa + 1 (times the power of ten). If both
+        // round to the same double, that's the answer. Otherwise, compare all the digits.
+        double upper = _kdl_decimal_to_double(mantissa + 1, mantissa_exponent + explicit_exponent);
+        if (n != upper && !_kdl_decimal_to_double_exact(digits, explicit_exponent, n, alloc, &n)) {
+            return false;
         }
+    }
 
+    if (!isinf(n) && (n != 0.0 || mantissa == 0)) {
+        if (negative) n = -n;
         val->type = KDL_TYPE_NUMBER;
         val->number.type = KDL_NUMBER_TYPE_FLOATING_POINT;
         val->number.floating_point = n;
         return true;
     } else {
-        // Remove all underscores and the initial plus
-        *s = kdl_clone_str(&number);
+        // Out of range for a double: keep the original text (without underscores and the initial plus)
+        *s = _kdl_clone_str(&number, alloc);
+        if (s->data == NULL) return false;
         char const* p1 = number.data;
         char const* end = number.data + number.len;
         char* p2 = s->data;
@@ -1122,12 +1559,10 @@ static bool _parse_decimal_float(kdl_str number, kdl_value* val, kdl_owned_strin
     }
 }
 
-static bool _parse_hex_number(kdl_str number, kdl_value* val, kdl_owned_string* s)
+static bool _parse_hex_number(
+    kdl_str number, kdl_value* val, kdl_owned_string* s, kdl_allocator const* alloc)
 {
     bool negative = false;
-    _kdl_ubigint* n = _kdl_ubigint_new(0);
-    if (n == NULL) return false;
-
     size_t i = 0; // index into number-string
 
     // handle sign
@@ -1142,52 +1577,17 @@ static bool _parse_hex_number(kdl_str number, kdl_value* val, kdl_owned_string*
     }
 
     if (number.len - i < 3 || number.data[i] != '0' || number.data[i + 1] != 'x' || number.data[i + 2] == '_')
-        goto error;
+        return false;
     i += 2;
 
-    // scan through entire number
-    for (; i < number.len; ++i) {
-        char c = number.data[i];
-        int digit;
-
-        if (c == '_') continue;
-        else if (c >= '0' && c <= '9') digit = c - '0';
-        else if (c >= 'a' && c <= 'f') digit = c - 'a' + 0xa;
-        else if (c >= 'A' && c <= 'F') digit = c - 'A' + 0xa;
-        else goto error;
-
-        n = _kdl_ubigint_multiply_inplace(n, 16);
-        n = _kdl_ubigint_add_inplace(n, digit);
-    }
-
-    // try to reduce down to long long
-    long long n_ll;
-    if (_kdl_ubigint_as_long_long(n, &n_ll)) {
-        // number is representable as long long
-        if (negative) n_ll = -n_ll;
-        val->type = KDL_TYPE_NUMBER;
-        val->number.type = KDL_NUMBER_TYPE_INTEGER;
-        val->number.integer = n_ll;
-    } else {
-        // represent number as string
-        *s = _kdl_ubigint_as_string_sgn(negative ? -1 : +1, n);
-        val->type = KDL_TYPE_NUMBER;
-        val->number.type = KDL_NUMBER_TYPE_STRING_ENCODED;
-        val->number.string = kdl_borrow_str(s);
-    }
-    _kdl_ubigint_free(n);
-    return true;
-error:
-    _kdl_ubigint_free(n);
-    return false;
+    kdl_str digits = {number.data + i, number.len - i};
+    return _parse_integer(digits, 16, negative, val, s, alloc);
 }
 
-static bool _parse_octal_number(kdl_str number, kdl_value* val, kdl_owned_string* s)
+static bool _parse_octal_number(
+    kdl_str number, kdl_value* val, kdl_owned_string* s, kdl_allocator const* alloc)
 {
     bool negative = false;
-    _kdl_ubigint* n = _kdl_ubigint_new(0);
-    if (n == NULL) return false;
-
     size_t i = 0; // index into number-string
 
     // handle sign
@@ -1202,49 +1602,17 @@ static bool _parse_octal_number(kdl_str number, kdl_value* val, kdl_owned_string
     }
 
     if (number.len - i < 3 || number.data[i] != '0' || number.data[i + 1] != 'o' || number.data[i + 2] == '_')
-        goto error;
+        return false;
     i += 2;
 
-    // scan through entire number
-    for (; i < number.len; ++i) {
-        char c = number.data[i];
-
-        if (c == '_') continue;
-        else if (c < '0' || c > '7') goto error;
-
-        int digit = c - '0';
-        n = _kdl_ubigint_multiply_inplace(n, 8);
-        n = _kdl_ubigint_add_inplace(n, digit);
-    }
-
-    // try to reduce down to long long
-    long long n_ll;
-    if (_kdl_ubigint_as_long_long(n, &n_ll)) {
-        // number is representable as long long
-        if (negative) n_ll = -n_ll;
-        val->type = KDL_TYPE_NUMBER;
-        val->number.type = KDL_NUMBER_TYPE_INTEGER;
-        val->number.integer = n_ll;
-    } else {
-        // represent number as string
-        *s = _kdl_ubigint_as_string_sgn(negative ? -1 : +1, n);
-        val->type = KDL_TYPE_NUMBER;
-        val->number.type = KDL_NUMBER_TYPE_STRING_ENCODED;
-        val->number.string = kdl_borrow_str(s);
-    }
-    _kdl_ubigint_free(n);
-    return true;
-error:
-    _kdl_ubigint_free(n);
-    return false;
+    kdl_str digits = {number.data + i, number.len - i};
+    return _parse_integer(digits, 8, negative, val, s, alloc);
 }
 
-static bool _parse_binary_number(kdl_str number, kdl_value* val, kdl_owned_string* s)
+static bool _parse_binary_number(
+    kdl_str number, kdl_value* val, kdl_owned_string* s, kdl_allocator const* alloc)
 {
     bool negative = false;
-    _kdl_ubigint* n = _kdl_ubigint_new(0);
-    if (n == NULL) return false;
-
     size_t i = 0; // index into number-string
 
     // handle sign
@@ -1259,41 +1627,11 @@ static bool _parse_binary_number(kdl_str number, kdl_value* val, kdl_owned_strin
     }
 
     if (number.len - i < 3 || number.data[i] != '0' || number.data[i + 1] != 'b' || number.data[i + 2] == '_')
-        goto error;
+        return false;
     i += 2;
 
-    // scan through entire number
-    for (; i < number.len; ++i) {
-        char c = number.data[i];
-
-        if (c == '_') continue;
-        else if (c < '0' || c > '1') goto error;
-
-        int digit = c - '0';
-        n = _kdl_ubigint_multiply_inplace(n, 2);
-        n = _kdl_ubigint_add_inplace(n, digit);
-    }
-
-    // try to reduce down to long long
-    long long n_ll;
-    if (_kdl_ubigint_as_long_long(n, &n_ll)) {
-        // number is representable as long long
-        if (negative) n_ll = -n_ll;
-        val->type = KDL_TYPE_NUMBER;
-        val->number.type = KDL_NUMBER_TYPE_INTEGER;
-        val->number.integer = n_ll;
-    } else {
-        // represent number as string
-        *s = _kdl_ubigint_as_string_sgn(negative ? -1 : +1, n);
-        val->type = KDL_TYPE_NUMBER;
-        val->number.type = KDL_NUMBER_TYPE_STRING_ENCODED;
-        val->number.string = kdl_borrow_str(s);
-    }
-    _kdl_ubigint_free(n);
-    return true;
-error:
-    _kdl_ubigint_free(n);
-    return false;
+    kdl_str digits = {number.data + i, number.len - i};
+    return _parse_integer(digits, 2, negative, val, s, alloc);
 }
 
 static bool _identifier_is_valid_v1(kdl_str value)
@@ -1341,3 +1679,31 @@ static bool _identifier_is_valid_v2(kdl_str value)
         }
     }
 }
+
+// Is this string (which contains no backslashes) valid as a single-line KDLv2 string?
+static bool _plain_string_is_valid_v2(kdl_parser* self, kdl_str value)
+{
+    uint32_t c = 0;
+    while (true) {
+        // printable ASCII is always fine
+        size_t plain = self->ascii_span(KDL_ASCII_NO_ESCAPE, value.data, value.data + value.len);
+        value.data += plain;
+        value.len -= plain;
+        switch (_kdl_pop_codepoint(&value, &c)) {
+        case KDL_UTF8_OK:
+            if (_kdl_is_newline(c) || _kdl_is_illegal_char(KDL_CHARACTER_SET_V2, c)) return false;
+            break;
+        case KDL_UTF8_EOF:
+            return true;
+        default:
+            return false;
+        }
+    }
+}
+
+// Does this word start like a number (with a digit, possibly after a sign)?
+static bool _word_is_number(kdl_str word)
+{
+    size_t i = word.len >= 2 && (word.data[0] == '+' || word.data[0] == '-') ? 1 : 0;
+    return word.len > i && word.data[i] >= '0' && word.data[i] <= '9';
+}
@@ -0,0 +1,323 @@
+#include "simd.h"
+#include "compat.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#    define KDL_HAVE_SSE2
+#    include <emmintrin.h>
+#    if defined(__GNUC__) && !defined(__INTEL_COMPILER)
+#        define KDL_HAVE_AVX2
+#        define KDL_TARGET_AVX2 __attribute__((target("avx2")))
+#        include <immintrin.h>
+#    elif defined(_MSC_VER)
+#        define KDL_HAVE_AVX2
+#        define KDL_TARGET_AVX2
+#        include <immintrin.h>
+#        include <intrin.h>
+#    endif
+#endif
+
+// Is the (ASCII) byte c part of the class cls?
+static inline bool _in_class(_kdl_ascii_class cls, unsigned char c)
+{
+    switch (cls) {
+    case KDL_ASCII_WHITESPACE_V1:
+        return c == ' ' || c == '\t';
+    case KDL_ASCII_WHITESPACE_V2:
+        return c == ' ' || c == '\t' || c == '\v';
+    case KDL_ASCII_WORD_V1:
+        if (c == '<' || c == '>' || c == ',') return false;
+        _fallthrough_;
+    case KDL_ASCII_WORD_V2:
+    case KDL_ASCII_ID_V2:
+        if (cls == KDL_ASCII_ID_V2 && c == '#') return false;
+        return c > 0x20 && c < 0x7F && c != '\\' && c != '/' && c != '(' && c != ')' && c != '{' && c != '}'
+            && c != ';' && c != '[' && c != ']' && c != '"' && c != '=';
+    case KDL_ASCII_STRING_BODY:
+        return (c >= 0x20 && c < 0x7F && c != '"' && c != '\\' && c != '#') //
+            || c == '\t' || c == '\n' || c == '\r';
+    case KDL_ASCII_NO_ESCAPE:
+        return c >= 0x20 && c < 0x7F && c != '"' && c != '\\';
+    }
+    return false;
+}
+
+size_t _kdl_ascii_span_scalar(_kdl_ascii_class cls, char const* begin, char const* end)
+{
+    char const* p = begin;
+    while (p != end && _in_class(cls, (unsigned char)*p)) ++p;
+    return (size_t)(p - begin);
+}
+
+// Combine the masks of plain word characters and of spaces/tabs in a block into a structural mask
+static inline uint64_t _structural_bits(uint64_t word, uint64_t space, unsigned* carry)
+{
+    uint64_t word_before = (word << 1) | (*carry & 1);
+    uint64_t space_before = (space << 1) | ((*carry >> 1) & 1);
+    *carry = (unsigned)(word >> 63) | (unsigned)(space >> 63) << 1;
+    return ~(word | space) | (word & ~word_before) | (space & ~space_before);
+}
+
+uint64_t _kdl_structural_mask_scalar(char const* block, unsigned* carry)
+{
+    uint64_t word = 0;
+    uint64_t space = 0;
+    for (int i = 0; i < 64; ++i) {
+        unsigned char c = (unsigned char)block[i];
+        unsigned cls = _kdl_structural_carry(c);
+        word |= (uint64_t)(cls & 1) << i;
+        space |= (uint64_t)(cls >> 1) << i;
+    }
+    return _structural_bits(word, space, carry);
+}
+
+static inline unsigned _count_trailing_zeros(uint32_t x)
+{
+#if defined(__GNUC__)
+    return (unsigned)__builtin_ctz(x);
+#elif defined(_MSC_VER)
+    unsigned long idx;
+    _BitScanForward(&idx, x);
+    return (unsigned)idx;
+#else
+    unsigned n = 0;
+    while ((x & 1) == 0) {
+        x >>= 1;
+        ++n;
+    }
+    return n;
+#endif
+}
+
+#ifdef KDL_HAVE_SSE2
+
+// Set all bits of each byte in v which is part of the class cls
+static inline __m128i _match_sse2(_kdl_ascii_class cls, __m128i v)
+{
+#    define EQ(ch) _mm_cmpeq_epi8(v, _mm_set1_epi8(ch))
+    __m128i m;
+    switch (cls) {
+    case KDL_ASCII_WHITESPACE_V1:
+        return _mm_or_si128(EQ(' '), EQ('\t'));
+    case KDL_ASCII_WHITESPACE_V2:
+        return _mm_or_si128(_mm_or_si128(EQ(' '), EQ('\t')), EQ('\v'));
+    case KDL_ASCII_WORD_V1:
+    case KDL_ASCII_WORD_V2:
+    case KDL_ASCII_ID_V2:
+        // signed comparison: bytes >= 0x80 are negative and thus excluded
+        m = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(0x20)), _mm_cmplt_epi8(v, _mm_set1_epi8(0x7F)));
+        __m128i excl = _mm_or_si128(_mm_or_si128(EQ('\\'), EQ('/')), _mm_or_si128(EQ('('), EQ(')')));
+        excl = _mm_or_si128(excl, _mm_or_si128(EQ('{'), EQ('}')));
+        excl = _mm_or_si128(excl, _mm_or_si128(EQ(';'), EQ('=')));
+        excl = _mm_or_si128(excl, _mm_or_si128(EQ('['), EQ(']')));
+        excl = _mm_or_si128(excl, EQ('"'));
+        if (cls == KDL_ASCII_WORD_V1) {
+            excl = _mm_or_si128(excl, _mm_or_si128(_mm_or_si128(EQ('<'), EQ('>')), EQ(',')));
+        } else if (cls == KDL_ASCII_ID_V2) {
+            excl = _mm_or_si128(excl, EQ('#'));
+        }
+        return _mm_andnot_si128(excl, m);
+    case KDL_ASCII_STRING_BODY:
+        m = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(0x1F)), _mm_cmplt_epi8(v, _mm_set1_epi8(0x7F)));
+        m = _mm_andnot_si128(_mm_or_si128(_mm_or_si128(EQ('"'), EQ('\\')), EQ('#')), m);
+        return _mm_or_si128(m, _mm_or_si128(_mm_or_si128(EQ('\t'), EQ('\n')), EQ('\r')));
+    case KDL_ASCII_NO_ESCAPE:
+        m = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(0x1F)), _mm_cmplt_epi8(v, _mm_set1_epi8(0x7F)));
+        return _mm_andnot_si128(_mm_or_si128(EQ('"'), EQ('\\')), m);
+    }
+#    undef EQ
+    return _mm_setzero_si128();
+}
+
+static inline size_t _span_sse2(_kdl_ascii_class cls, char const* begin, char const* end)
+{
+    char const* p = begin;
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((__m128i const*)p);
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(_match_sse2(cls, v));
+        if (mask != 0xFFFF) {
+            return (size_t)(p - begin) + _count_trailing_zeros(~mask);
+        }
+        p += 16;
+    }
+    return (size_t)(p - begin) + _kdl_ascii_span_scalar(cls, p, end);
+}
+
+static size_t _kdl_ascii_span_sse2(_kdl_ascii_class cls, char const* begin, char const* end)
+{
+    // Dispatch to specialized loops so the class checks are resolved at compile time
+    switch (cls) {
+    case KDL_ASCII_WHITESPACE_V1:
+        return _span_sse2(KDL_ASCII_WHITESPACE_V1, begin, end);
+    case KDL_ASCII_WHITESPACE_V2:
+        return _span_sse2(KDL_ASCII_WHITESPACE_V2, begin, end);
+    case KDL_ASCII_WORD_V1:
+        return _span_sse2(KDL_ASCII_WORD_V1, begin, end);
+    case KDL_ASCII_WORD_V2:
+        return _span_sse2(KDL_ASCII_WORD_V2, begin, end);
+    case KDL_ASCII_ID_V2:
+        return _span_sse2(KDL_ASCII_ID_V2, begin, end);
+    case KDL_ASCII_STRING_BODY:
+        return _span_sse2(KDL_ASCII_STRING_BODY, begin, end);
+    case KDL_ASCII_NO_ESCAPE:
+        return _span_sse2(KDL_ASCII_NO_ESCAPE, begin, end);
+    }
+    return 0;
+}
+
+static uint64_t _kdl_structural_mask_sse2(char const* block, unsigned* carry)
+{
+    uint64_t word = 0;
+    uint64_t space = 0;
+    for (int i = 0; i < 4; ++i) {
+        __m128i v = _mm_loadu_si128((__m128i const*)(block + 16 * i));
+        __m128i w = _match_sse2(KDL_ASCII_WORD_V1, v);
+        __m128i s = _match_sse2(KDL_ASCII_WHITESPACE_V1, v);
+        word |= (uint64_t)(uint32_t)_mm_movemask_epi8(w) << (16 * i);
+        space |= (uint64_t)(uint32_t)_mm_movemask_epi8(s) << (16 * i);
+    }
+    return _structural_bits(word, space, carry);
+}
+
+#endif // KDL_HAVE_SSE2
+
+#ifdef KDL_HAVE_AVX2
+
+KDL_TARGET_AVX2 static inline __m256i _match_avx2(_kdl_ascii_class cls, __m256i v)
+{
+#    define EQ(ch) _mm256_cmpeq_epi8(v, _mm256_set1_epi8(ch))
+    __m256i m;
+    switch (cls) {
+    case KDL_ASCII_WHITESPACE_V1:
+        return _mm256_or_si256(EQ(' '), EQ('\t'));
+    case KDL_ASCII_WHITESPACE_V2:
+        return _mm256_or_si256(_mm256_or_si256(EQ(' '), EQ('\t')), EQ('\v'));
+    case KDL_ASCII_WORD_V1:
+    case KDL_ASCII_WORD_V2:
+    case KDL_ASCII_ID_V2:
+        // 0x21 <= c <= 0x7E (signed comparison excludes bytes >= 0x80)
+        m = _mm256_andnot_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(0x7E)),
+            _mm256_cmpgt_epi8(v, _mm256_set1_epi8(0x20)));
+        __m256i excl = _mm256_or_si256(_mm256_or_si256(EQ('\\'), EQ('/')), _mm256_or_si256(EQ('('), EQ(')')));
+        excl = _mm256_or_si256(excl, _mm256_or_si256(EQ('{'), EQ('}')));
+        excl = _mm256_or_si256(excl, _mm256_or_si256(EQ(';'), EQ('=')));
+        excl = _mm256_or_si256(excl, _mm256_or_si256(EQ('['), EQ(']')));
+        excl = _mm256_or_si256(excl, EQ('"'));
+        if (cls == KDL_ASCII_WORD_V1) {
+            excl = _mm256_or_si256(excl, _mm256_or_si256(_mm256_or_si256(EQ('<'), EQ('>')), EQ(',')));
+        } else if (cls == KDL_ASCII_ID_V2) {
+            excl = _mm256_or_si256(excl, EQ('#'));
+        }
+        return _mm256_andnot_si256(excl, m);
+    case KDL_ASCII_STRING_BODY:
+        m = _mm256_andnot_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(0x7E)),
+            _mm256_cmpgt_epi8(v, _mm256_set1_epi8(0x1F)));
+        m = _mm256_andnot_si256(_mm256_or_si256(_mm256_or_si256(EQ('"'), EQ('\\')), EQ('#')), m);
+        return _mm256_or_si256(m, _mm256_or_si256(_mm256_or_si256(EQ('\t'), EQ('\n')), EQ('\r')));
+    case KDL_ASCII_NO_ESCAPE:
+        m = _mm256_andnot_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(0x7E)),
+            _mm256_cmpgt_epi8(v, _mm256_set1_epi8(0x1F)));
+        return _mm256_andnot_si256(_mm256_or_si256(EQ('"'), EQ('\\')), m);
+    }
+#    undef EQ
+    return _mm256_setzero_si256();
+}
+
+KDL_TARGET_AVX2 static inline size_t _span_avx2(_kdl_ascii_class cls, char const* begin, char const* end)
+{
+    char const* p = begin;
+    while (end - p >= 32) {
+        __m256i v = _mm256_loadu_si256((__m256i const*)p);
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_match_avx2(cls, v));
+        if (mask != 0xFFFFFFFFu) {
+            return (size_t)(p - begin) + _count_trailing_zeros(~mask);
+        }
+        p += 32;
+    }
+    return (size_t)(p - begin) + _span_sse2(cls, p, end);
+}
+
+KDL_TARGET_AVX2 static size_t _kdl_ascii_span_avx2(_kdl_ascii_class cls, char const* begin, char const* end)
+{
+    switch (cls) {
+    case KDL_ASCII_WHITESPACE_V1:
+        return _span_avx2(KDL_ASCII_WHITESPACE_V1, begin, end);
+    case KDL_ASCII_WHITESPACE_V2:
+        return _span_avx2(KDL_ASCII_WHITESPACE_V2, begin, end);
+    case KDL_ASCII_WORD_V1:
+        return _span_avx2(KDL_ASCII_WORD_V1, begin, end);
+    case KDL_ASCII_WORD_V2:
+        return _span_avx2(KDL_ASCII_WORD_V2, begin, end);
+    case KDL_ASCII_ID_V2:
+        return _span_avx2(KDL_ASCII_ID_V2, begin, end);
+    case KDL_ASCII_STRING_BODY:
+        return _span_avx2(KDL_ASCII_STRING_BODY, begin, end);
+    case KDL_ASCII_NO_ESCAPE:
+        return _span_avx2(KDL_ASCII_NO_ESCAPE, begin, end);
+    }
+    return 0;
+}
+
+KDL_TARGET_AVX2 static uint64_t _kdl_structural_mask_avx2(char const* block, unsigned* carry)
+{
+    uint64_t word = 0;
+    uint64_t space = 0;
+    for (int i = 0; i < 2; ++i) {
+        __m256i v = _mm256_loadu_si256((__m256i const*)(block + 32 * i));
+        __m256i w = _match_avx2(KDL_ASCII_WORD_V1, v);
+        __m256i s = _match_avx2(KDL_ASCII_WHITESPACE_V1, v);
+        word |= (uint64_t)(uint32_t)_mm256_movemask_epi8(w) << (32 * i);
+        space |= (uint64_t)(uint32_t)_mm256_movemask_epi8(s) << (32 * i);
+    }
+    return _structural_bits(word, space, carry);
+}
+
+static bool _cpu_has_avx2(void)
+{
+#    if defined(__GNUC__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#    elif defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx) return false;
+    // Check that the OS saves the YMM registers
+    if ((_xgetbv(0) & 0x6) != 0x6) return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#    else
+    return false;
+#    endif
+}
+
+#endif // KDL_HAVE_AVX2
+
+_kdl_ascii_span_func _kdl_select_ascii_span_func(void)
+{
+#if defined(KDL_HAVE_AVX2)
+    if (_cpu_has_avx2()) return &_kdl_ascii_span_avx2;
+#endif
+#if defined(KDL_HAVE_SSE2)
+    return &_kdl_ascii_span_sse2;
+#else
+    return &_kdl_ascii_span_scalar;
+#endif
+}
+
+_kdl_structural_mask_func _kdl_select_structural_mask_func(void)
+{
+#if defined(KDL_HAVE_AVX2)
+    if (_cpu_has_avx2()) return &_kdl_structural_mask_avx2;
+#endif
+#if defined(KDL_HAVE_SSE2)
+    return &_kdl_structural_mask_sse2;
+#else
+    return &_kdl_structural_mask_scalar;
+#endif
+}
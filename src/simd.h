@@ -0,0 +1,74 @@
+#ifndef KDL_INTERNAL_SIMD_H_
+#define KDL_INTERNAL_SIMD_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Classes of ASCII characters that can be skipped in bulk by the tokenizer and the escape functions
+enum _kdl_ascii_class {
+    KDL_ASCII_WHITESPACE_V1, // space, tab
+    KDL_ASCII_WHITESPACE_V2, // space, tab, vertical tab
+    KDL_ASCII_WORD_V1,       // characters allowed in a bare word (KDLv1)
+    KDL_ASCII_WORD_V2,       // characters allowed in a bare word (KDLv2)
+    KDL_ASCII_ID_V2,         // characters allowed in a bare identifier (KDLv2: word characters except '#')
+    KDL_ASCII_STRING_BODY,   // characters without special meaning inside a string
+    KDL_ASCII_NO_ESCAPE,     // printable characters which never need escaping (not '"' or '\\')
+};
+
+typedef enum _kdl_ascii_class _kdl_ascii_class;
+
+// Return the length of the longest prefix of [begin, end) which consists only of ASCII characters
+// of the class cls. Any byte >= 0x80 ends the span.
+typedef size_t (*_kdl_ascii_span_func)(_kdl_ascii_class cls, char const* begin, char const* end);
+
+// Pick the fastest implementation of the ASCII span function supported by this CPU
+_kdl_ascii_span_func _kdl_select_ascii_span_func(void);
+
+// Portable implementation (used for short spans and on CPUs without SIMD support)
+size_t _kdl_ascii_span_scalar(_kdl_ascii_class cls, char const* begin, char const* end);
+
+// Is c an ASCII character which is part of a bare word in both KDLv1 and KDLv2?
+// (the class KDL_ASCII_WORD_V1)
+static inline bool _kdl_is_plain_word_char(unsigned char c)
+{
+    switch (c) {
+    case '\\':
+    case '/':
+    case '(':
+    case ')':
+    case '{':
+    case '}':
+    case ';':
+    case '[':
+    case ']':
+    case '"':
+    case '=':
+    case '<':
+    case '>':
+    case ',':
+        return false;
+    default:
+        return c > 0x20 && c < 0x7F;
+    }
+}
+
+// Stage 1 of the indexed tokenizer: classify the 64 bytes at block and return a mask with a bit set
+// for every byte at which a token may start or end. Runs of spaces and tabs and runs of plain word
+// characters only get a bit for their first byte. carry is the class of the byte before the block
+// (see _kdl_structural_carry), and is updated to the class of the last byte of the block.
+typedef uint64_t (*_kdl_structural_mask_func)(char const* block, unsigned* carry);
+
+// The carry for a block which follows the byte c (use 0 at the start of the document)
+static inline unsigned _kdl_structural_carry(unsigned char c)
+{
+    return _kdl_is_plain_word_char(c) ? 1u : (c == ' ' || c == '\t') ? 2u : 0u;
+}
+
+// Pick the fastest implementation of the structural mask function supported by this CPU
+_kdl_structural_mask_func _kdl_select_structural_mask_func(void);
+
+// Portable implementation of the structural mask function
+uint64_t _kdl_structural_mask_scalar(char const* block, unsigned* carry);
+
+#endif // KDL_INTERNAL_SIMD_H_
@@ -1,4 +1,5 @@
 #include "str.h"
+#include "alloc.h"
 #include "compat.h"
 #include "grammar.h"
 #include "kdl/common.h"
@@ -20,10 +21,26 @@ KDL_EXPORT extern inline kdl_str kdl_borrow_str(kdl_owned_string const* str);
 
 kdl_str kdl_str_from_cstr(char const* s) { return (kdl_str){s, strlen(s)}; }
 
-kdl_owned_string kdl_clone_str(kdl_str const* s)
+kdl_owned_string kdl_clone_str(kdl_str const* s) { return _kdl_clone_str(s, &_kdl_default_allocator); }
+
+void kdl_free_string(kdl_owned_string* s) { _kdl_free_string(s, &_kdl_default_allocator); }
+
+kdl_owned_string kdl_clone_str_ex(kdl_str const* s, kdl_allocator const* allocator)
+{
+    kdl_allocator alloc = _kdl_allocator_or_default(allocator);
+    return _kdl_clone_str(s, &alloc);
+}
+
+void kdl_free_string_ex(kdl_owned_string* s, kdl_allocator const* allocator)
+{
+    kdl_allocator alloc = _kdl_allocator_or_default(allocator);
+    _kdl_free_string(s, &alloc);
+}
+
+kdl_owned_string _kdl_clone_str(kdl_str const* s, kdl_allocator const* alloc)
 {
     kdl_owned_string result;
-    result.data = malloc(s->len + 1);
+    result.data = _kdl_malloc(alloc, s->len + 1);
     if (result.data != NULL) {
         memcpy(result.data, s->data, s->len);
         result.data[s->len] = '\0';
@@ -34,23 +51,24 @@ kdl_owned_string kdl_clone_str(kdl_str const* s)
     return result;
 }
 
-void kdl_free_string(kdl_owned_string* s)
+void _kdl_free_string(kdl_owned_string* s, kdl_allocator const* alloc)
 {
     if (s->data != NULL) {
-        free(s->data);
+        _kdl_free(alloc, s->data);
         s->data = NULL;
     }
     s->len = 0;
 }
 
-_kdl_write_buffer _kdl_new_write_buffer(size_t initial_size)
+_kdl_write_buffer _kdl_new_write_buffer(size_t initial_size, kdl_allocator const* alloc)
 {
-    return (_kdl_write_buffer){.buf = malloc(initial_size), .buf_len = initial_size, .str_len = 0};
+    return (_kdl_write_buffer){
+        .buf = _kdl_malloc(alloc, initial_size), .buf_len = initial_size, .str_len = 0, .alloc = alloc};
 }
 
 void _kdl_free_write_buffer(_kdl_write_buffer* buf)
 {
-    free(buf->buf);
+    _kdl_free(buf->alloc, buf->buf);
     buf->buf = NULL;
     buf->buf_len = 0;
     buf->str_len = 0;
@@ -61,7 +79,7 @@ bool _kdl_buf_push_chars(_kdl_write_buffer* buf, char const* s, size_t count)
     if (buf->buf_len - buf->str_len < count) {
         size_t increment = BUFFER_SIZE_INCREMENT >= count ? BUFFER_SIZE_INCREMENT : count;
         buf->buf_len += increment;
-        buf->buf = reallocf(buf->buf, buf->buf_len);
+        buf->buf = _kdl_reallocf(buf->alloc, buf->buf, buf->buf_len);
         if (buf->buf == NULL) {
             return false;
         }
@@ -79,7 +97,7 @@ bool _kdl_buf_push_codepoint(_kdl_write_buffer* buf, uint32_t c)
     if (buf->buf_len - buf->str_len < 4) {
         size_t increment = BUFFER_SIZE_INCREMENT >= 4 ? BUFFER_SIZE_INCREMENT : 4;
         buf->buf_len += increment;
-        buf->buf = reallocf(buf->buf, buf->buf_len);
+        buf->buf = _kdl_reallocf(buf->alloc, buf->buf, buf->buf_len);
         if (buf->buf == NULL) {
             return false;
         }
@@ -95,67 +113,103 @@ bool _kdl_buf_push_codepoint(_kdl_write_buffer* buf, uint32_t c)
 
 kdl_owned_string _kdl_buf_to_string(_kdl_write_buffer* buf)
 {
-    kdl_owned_string s = {reallocf(buf->buf, buf->str_len + 1), buf->str_len};
-    if (s.data == NULL) s.len = 0;
+    kdl_owned_string s = {_kdl_reallocf(buf->alloc, buf->buf, buf->str_len + 1), buf->str_len};
     buf->buf = NULL;
     buf->buf_len = 0;
     buf->str_len = 0;
-    s.data[s.len] = '\0';
+    if (s.data == NULL) s.len = 0;
+    else s.data[s.len] = '\0';
     return s;
 }
 
-kdl_owned_string kdl_escape(kdl_str const* s, kdl_escape_mode mode) { return kdl_escape_v1(s, mode); }
+kdl_owned_string kdl_escape(kdl_str const* s, kdl_escape_mode mode)
+{
+    return kdl_escape_v1(s, mode, &_kdl_default_allocator);
+}
 
-kdl_owned_string kdl_unescape(kdl_str const* s) { return kdl_unescape_v1(s); }
+kdl_owned_string kdl_unescape(kdl_str const* s) { return kdl_unescape_v1(s, &_kdl_default_allocator); }
 
 kdl_owned_string kdl_escape_v(kdl_version version, kdl_str const* s, kdl_escape_mode mode)
 {
+    return kdl_escape_v_ex(version, s, mode, NULL);
+}
+
+kdl_owned_string kdl_unescape_v(kdl_version version, kdl_str const* s)
+{
+    return kdl_unescape_v_ex(version, s, NULL);
+}
+
+kdl_owned_string kdl_unescape_multi_line(kdl_version version, kdl_str const* s)
+{
+    return kdl_unescape_multi_line_ex(version, s, NULL);
+}
+
+kdl_owned_string kdl_escape_v_ex(
+    kdl_version version, kdl_str const* s, kdl_escape_mode mode, kdl_allocator const* allocator)
+{
+    kdl_allocator alloc = _kdl_allocator_or_default(allocator);
     switch (version) {
     case KDL_VERSION_1:
-        return kdl_escape_v1(s, mode);
+        return kdl_escape_v1(s, mode, &alloc);
     case KDL_VERSION_2:
-        return kdl_escape_v2(s, mode);
+        return kdl_escape_v2(s, mode, &alloc);
     default:
         return (kdl_owned_string){NULL, 0};
     }
 }
 
-kdl_owned_string kdl_unescape_v(kdl_version version, kdl_str const* s)
+kdl_owned_string kdl_unescape_v_ex(kdl_version version, kdl_str const* s, kdl_allocator const* allocator)
 {
+    kdl_allocator alloc = _kdl_allocator_or_default(allocator);
     switch (version) {
     case KDL_VERSION_1:
-        return kdl_unescape_v1(s);
+        return kdl_unescape_v1(s, &alloc);
     case KDL_VERSION_2:
-        return kdl_unescape_v2_single_line(s);
+        return kdl_unescape_v2_single_line(s, &alloc);
     default:
         return (kdl_owned_string){NULL, 0};
     }
 }
 
-kdl_owned_string kdl_unescape_multi_line(kdl_version version, kdl_str const* s)
+kdl_owned_string kdl_unescape_multi_line_ex(
+    kdl_version version, kdl_str const* s, kdl_allocator const* allocator)
 {
+    kdl_allocator alloc = _kdl_allocator_or_default(allocator);
     switch (version) {
     case KDL_VERSION_1:
-        return kdl_unescape_v1(s);
+        return kdl_unescape_v1(s, &alloc);
     case KDL_VERSION_2:
-        return kdl_unescape_v2_multi_line(s);
+        return kdl_unescape_v2_multi_line(s, &alloc);
     default:
         return (kdl_owned_string){NULL, 0};
     }
 }
 
-kdl_owned_string kdl_escape_v1(kdl_str const* s, kdl_escape_mode mode)
+kdl_owned_string kdl_escape_v1(kdl_str const* s, kdl_escape_mode mode, kdl_allocator const* alloc)
 {
-    kdl_owned_string result;
-    kdl_str unescaped = *s;
-
-    size_t orig_len = unescaped.len;
-    _kdl_write_buffer buf = _kdl_new_write_buffer(2 * orig_len);
-    if (buf.buf == NULL) goto esc_error;
+    _kdl_write_buffer buf = _kdl_new_write_buffer(2 * s->len, alloc);
+    if (buf.buf == NULL || !_kdl_escape_v1_into(&buf, s, mode, _kdl_select_ascii_span_func())) {
+        _kdl_free_write_buffer(&buf);
+        return (kdl_owned_string){NULL, 0};
+    }
+    return _kdl_buf_to_string(&buf);
+}
 
+bool _kdl_escape_v1_into(
+    _kdl_write_buffer* buf, kdl_str const* s, kdl_escape_mode mode, _kdl_ascii_span_func ascii_span)
+{
+    kdl_str unescaped = *s;
     uint32_t c;
 
     while (true) {
+        // copy everything up to the next character that might need escaping
+        size_t plain = ascii_span(KDL_ASCII_NO_ESCAPE, unescaped.data, unescaped.data + unescaped.len);
+        if (plain != 0) {
+            if (!_kdl_buf_push_chars(buf, unescaped.data, plain)) goto esc_error;
+            unescaped.data += plain;
+            unescaped.len -= plain;
+        }
+
         char const* orig_char = unescaped.data;
         switch (_kdl_pop_codepoint(&unescaped, &c)) {
         case KDL_UTF8_EOF:
@@ -167,19 +221,19 @@ kdl_owned_string kdl_escape_v1(kdl_str const* s, kdl_escape_mode mode)
         }
 
         if (c == 0x0A && (mode & KDL_ESCAPE_NEWLINE)) {
-            if (!_kdl_buf_push_chars(&buf, "\\n", 2)) goto esc_error;
+            if (!_kdl_buf_push_chars(buf, "\\n", 2)) goto esc_error;
         } else if (c == 0x0D && (mode & KDL_ESCAPE_NEWLINE)) {
-            if (!_kdl_buf_push_chars(&buf, "\\r", 2)) goto esc_error;
+            if (!_kdl_buf_push_chars(buf, "\\r", 2)) goto esc_error;
         } else if (c == 0x09 && (mode & KDL_ESCAPE_TAB)) {
-            if (!_kdl_buf_push_chars(&buf, "\\t", 2)) goto esc_error;
+            if (!_kdl_buf_push_chars(buf, "\\t", 2)) goto esc_error;
         } else if (c == 0x5C) {
-            if (!_kdl_buf_push_chars(&buf, "\\\\", 2)) goto esc_error;
+            if (!_kdl_buf_push_chars(buf, "\\\\", 2)) goto esc_error;
         } else if (c == 0x22) {
-            if (!_kdl_buf_push_chars(&buf, "\\\"", 2)) goto esc_error;
+            if (!_kdl_buf_push_chars(buf, "\\\"", 2)) goto esc_error;
         } else if (c == 0x08 && (mode & KDL_ESCAPE_CONTROL)) {
-            if (!_kdl_buf_push_chars(&buf, "\\b", 2)) goto esc_error;
+            if (!_kdl_buf_push_chars(buf, "\\b", 2)) goto esc_error;
         } else if (c == 0x0C && (mode & KDL_ESCAPE_NEWLINE)) {
-            if (!_kdl_buf_push_chars(&buf, "\\f", 2)) goto esc_error;
+            if (!_kdl_buf_push_chars(buf, "\\f", 2)) goto esc_error;
         } else if (((mode & KDL_ESCAPE_CONTROL)
                        && ((c < 0x20 && c != 0x0A && c != 0x0D && c != 0x09 && c != 0x0C)
                            || c == 0x7F /* DEL */))
@@ -188,7 +242,7 @@ kdl_owned_string kdl_escape_v1(kdl_str const* s, kdl_escape_mode mode)
             // \u escape
             char u_esc_buf[11];
             int count = snprintf(u_esc_buf, 11, "\\u{%x}", (unsigned int)c);
-            if (count < 0 || !_kdl_buf_push_chars(&buf, u_esc_buf, count)) {
+            if (count < 0 || !_kdl_buf_push_chars(buf, u_esc_buf, count)) {
                 goto esc_error;
             }
         } else if (c > 0x10ffff) {
@@ -196,26 +250,24 @@ kdl_owned_string kdl_escape_v1(kdl_str const* s, kdl_escape_mode mode)
             goto esc_error;
         } else {
             // keep the rest
-            _kdl_buf_push_chars(&buf, orig_char, unescaped.data - orig_char);
+            if (!_kdl_buf_push_chars(buf, orig_char, unescaped.data - orig_char)) goto esc_error;
         }
     }
 esc_eof:
-    return _kdl_buf_to_string(&buf);
+    return true;
 
 esc_error:
-    _kdl_free_write_buffer(&buf);
-    result = (kdl_owned_string){NULL, 0};
-    return result;
+    return false;
 }
 
-kdl_owned_string kdl_unescape_v1(kdl_str const* s)
+kdl_owned_string kdl_unescape_v1(kdl_str const* s, kdl_allocator const* alloc)
 {
     kdl_owned_string result;
     kdl_str escaped = *s;
     uint32_t c;
 
     size_t orig_len = escaped.len;
-    _kdl_write_buffer buf = _kdl_new_write_buffer(2 * orig_len);
+    _kdl_write_buffer buf = _kdl_new_write_buffer(2 * orig_len, alloc);
     if (buf.buf == NULL) goto unesc_error;
 
     char const* p = s->data;
@@ -294,18 +346,31 @@ unesc_error:
     return result;
 }
 
-kdl_owned_string kdl_escape_v2(kdl_str const* s, kdl_escape_mode mode)
+kdl_owned_string kdl_escape_v2(kdl_str const* s, kdl_escape_mode mode, kdl_allocator const* alloc)
 {
-    kdl_owned_string result;
-    kdl_str unescaped = *s;
-
-    size_t orig_len = unescaped.len;
-    _kdl_write_buffer buf = _kdl_new_write_buffer(2 * orig_len);
-    if (buf.buf == NULL) goto esc_error;
+    _kdl_write_buffer buf = _kdl_new_write_buffer(2 * s->len, alloc);
+    if (buf.buf == NULL || !_kdl_escape_v2_into(&buf, s, mode, _kdl_select_ascii_span_func())) {
+        _kdl_free_write_buffer(&buf);
+        return (kdl_owned_string){NULL, 0};
+    }
+    return _kdl_buf_to_string(&buf);
+}
 
+bool _kdl_escape_v2_into(
+    _kdl_write_buffer* buf, kdl_str const* s, kdl_escape_mode mode, _kdl_ascii_span_func ascii_span)
+{
+    kdl_str unescaped = *s;
     uint32_t c;
 
     while (true) {
+        // copy everything up to the next character that might need escaping
+        size_t plain = ascii_span(KDL_ASCII_NO_ESCAPE, unescaped.data, unescaped.data + unescaped.len);
+        if (plain != 0) {
+            if (!_kdl_buf_push_chars(buf, unescaped.data, plain)) goto esc_error;
+            unescaped.data += plain;
+            unescaped.len -= plain;
+        }
+
         char const* orig_char = unescaped.data;
         switch (_kdl_pop_codepoint(&unescaped, &c)) {
         case KDL_UTF8_EOF:
@@ -320,19 +385,19 @@ kdl_owned_string kdl_escape_v2(kdl_str const* s, kdl_escape_mode mode)
             // Not a valid character
             goto esc_error;
         } else if (c == 0x0A && (mode & KDL_ESCAPE_NEWLINE)) {
-            if (!_kdl_buf_push_chars(&buf, "\\n", 2)) goto esc_error;
+            if (!_kdl_buf_push_chars(buf, "\\n", 2)) goto esc_error;
         } else if (c == 0x0D && (mode & KDL_ESCAPE_NEWLINE)) {
-            if (!_kdl_buf_push_chars(&buf, "\\r", 2)) goto esc_error;
+            if (!_kdl_buf_push_chars(buf, "\\r", 2)) goto esc_error;
         } else if (c == 0x09 && (mode & KDL_ESCAPE_TAB)) {
-            if (!_kdl_buf_push_chars(&buf, "\\t", 2)) goto esc_error;
+            if (!_kdl_buf_push_chars(buf, "\\t", 2)) goto esc_error;
         } else if (c == 0x5C) {
-            if (!_kdl_buf_push_chars(&buf, "\\\\", 2)) goto esc_error;
+            if (!_kdl_buf_push_chars(buf, "\\\\", 2)) goto esc_error;
         } else if (c == 0x22) {
-            if (!_kdl_buf_push_chars(&buf, "\\\"", 2)) goto esc_error;
+            if (!_kdl_buf_push_chars(buf, "\\\"", 2)) goto esc_error;
         } else if (c == 0x08 && (mode & KDL_ESCAPE_CONTROL)) {
-            if (!_kdl_buf_push_chars(&buf, "\\b", 2)) goto esc_error;
+            if (!_kdl_buf_push_chars(buf, "\\b", 2)) goto esc_error;
         } else if (c == 0x0C && (mode & KDL_ESCAPE_NEWLINE)) {
-            if (!_kdl_buf_push_chars(&buf, "\\f", 2)) goto esc_error;
+            if (!_kdl_buf_push_chars(buf, "\\f", 2)) goto esc_error;
         } else if (_kdl_is_illegal_char(KDL_CHARACTER_SET_V2, c)
             || ((mode & KDL_ESCAPE_CONTROL) && c == 0x0B /* vertical tab */)
             || ((mode & KDL_ESCAPE_NEWLINE) && (c == 0x85 || c == 0x2028 || c == 0x2029))
@@ -340,187 +405,438 @@ kdl_owned_string kdl_escape_v2(kdl_str const* s, kdl_escape_mode mode)
             // \u escape
             char u_esc_buf[11];
             int count = snprintf(u_esc_buf, 11, "\\u{%x}", (unsigned int)c);
-            if (count < 0 || !_kdl_buf_push_chars(&buf, u_esc_buf, count)) {
+            if (count < 0 || !_kdl_buf_push_chars(buf, u_esc_buf, count)) {
                 goto esc_error;
             }
         } else {
             // keep the rest
-            _kdl_buf_push_chars(&buf, orig_char, unescaped.data - orig_char);
+            if (!_kdl_buf_push_chars(buf, orig_char, unescaped.data - orig_char)) goto esc_error;
         }
     }
 esc_eof:
-    return _kdl_buf_to_string(&buf);
+    return true;
 
 esc_error:
-    _kdl_free_write_buffer(&buf);
-    result = (kdl_owned_string){NULL, 0};
-    return result;
+    return false;
 }
 
-kdl_owned_string kdl_unescape_v2_single_line(kdl_str const* s)
+kdl_owned_string kdl_unescape_v2_single_line(kdl_str const* s, kdl_allocator const* alloc)
 {
     kdl_owned_string result;
-    kdl_owned_string no_ws_escapes = _kdl_remove_escaped_whitespace(s);
+    kdl_owned_string no_ws_escapes = _kdl_remove_escaped_whitespace(s, alloc);
     kdl_str escaped = kdl_borrow_str(&no_ws_escapes);
 
-    if (_kdl_str_contains_newline(&escaped)) {
+    if (no_ws_escapes.data == NULL || _kdl_str_contains_newline(&escaped)) {
         result = (kdl_owned_string){NULL, 0};
     } else {
-        result = _kdl_resolve_escapes_v2(&escaped);
+        result = _kdl_resolve_escapes_v2(&escaped, alloc);
     }
 
-    kdl_free_string(&no_ws_escapes);
+    _kdl_free_string(&no_ws_escapes, alloc);
     return result;
 }
 
-kdl_owned_string kdl_unescape_v2_multi_line(kdl_str const* s)
+// KDLv2 removes escaped whitespace before resolving other escapes, so it may even appear within a
+// \u{...} escape. Return where the escaped whitespace at p ends, and set *found if there is any.
+static char const* _skip_escaped_whitespace(char const* p, char const* end, bool* found)
 {
-    kdl_owned_string result;
-    kdl_owned_string no_ws_escapes = _kdl_remove_escaped_whitespace(s);
-    kdl_str pre_dedent = kdl_borrow_str(&no_ws_escapes);
-    kdl_owned_string dedented = _kdl_dedent_multiline_string(&pre_dedent);
-    kdl_str escaped = kdl_borrow_str(&dedented);
-
-    kdl_free_string(&no_ws_escapes);
-
-    if (dedented.data == NULL) {
-        // dedenting error
-        result = (kdl_owned_string){NULL, 0};
-    } else {
-        result = _kdl_resolve_escapes_v2(&escaped);
+    while (p != end && *p == '\\') {
+        char const* ws_end = p + 1;
+        kdl_str tail = {ws_end, (size_t)(end - ws_end)};
+        uint32_t c;
+        while (_kdl_pop_codepoint(&tail, &c) == KDL_UTF8_OK
+            && (_kdl_is_whitespace(KDL_CHARACTER_SET_V2, c) || _kdl_is_newline(c))) {
+            ws_end = tail.data;
+        }
+        if (ws_end == p + 1) break;
+        p = ws_end;
+        *found = true;
     }
+    return p;
+}
 
-    kdl_free_string(&dedented);
-
-    return result;
+// Parse the rest of a \u{...} escape after the 'u'. Returns where the escape ends, or NULL if it
+// is invalid. *escaped_ws is set if there is escaped whitespace in it (KDLv2 only).
+static char const* _parse_unicode_escape(
+    char const* p, char const* end, uint32_t* codepoint, bool* escaped_ws)
+{
+    // u should be followed by {
+    p = _skip_escaped_whitespace(p, end, escaped_ws);
+    if (p == end || *(p++) != '{') return NULL;
+    // parse hex
+    uint32_t c = 0;
+    for (;; ++p) {
+        p = _skip_escaped_whitespace(p, end, escaped_ws);
+        if (p == end) return NULL;
+        else if (*p == '}') break;
+        else if (*p >= '0' && *p <= '9') c = (c << 4) + (*p - '0');
+        else if (*p >= 'a' && *p <= 'f') c = (c << 4) + (*p - 'a' + 0xa);
+        else if (*p >= 'A' && *p <= 'F') c = (c << 4) + (*p - 'A' + 0xa);
+        else return NULL;
+    }
+    *codepoint = c;
+    return p + 1;
 }
 
-kdl_owned_string _kdl_dedent_multiline_string(kdl_str const* s)
+kdl_owned_string _kdl_unescape_v1_or_v2(
+    kdl_str const* s, bool* v1, bool* v2, _kdl_ascii_span_func ascii_span, kdl_allocator const* alloc)
 {
+    // Where the two versions disagree about an escape, at most one of them accepts it, so the
+    // output only ever has to follow the version(s) still in the running.
     kdl_owned_string result;
+    _kdl_write_buffer buf = _kdl_new_write_buffer(s->len + 1, alloc);
+    if (buf.buf == NULL) goto unesc_error;
 
+    char const* p = s->data;
+    char const* end = p + s->len;
+    kdl_str tail;
     uint32_t c;
-    kdl_str orig = *s;
-    kdl_utf8_status status;
-
-    char* buf_dedented = NULL;
 
-    // Normalize newlines first
-    _kdl_write_buffer buf_norm_lf = _kdl_new_write_buffer(s->len);
+    while (p != end) {
+        // printable ASCII other than '"' and '\' means the same in both versions
+        size_t plain = ascii_span(KDL_ASCII_NO_ESCAPE, p, end);
+        if (plain != 0) {
+            if (!_kdl_buf_push_chars(&buf, p, plain)) goto unesc_error;
+            p += plain;
+            if (p == end) break;
+        }
 
-    while ((status = _kdl_pop_codepoint(&orig, &c)) == KDL_UTF8_OK) {
-        if (_kdl_is_newline(c)) {
-            // Normalize CRLF
-            if (c == '\r' && orig.len >= 1 && orig.data[0] == '\n') {
-                ++orig.data;
-                --orig.len;
-            }
-            // every newline becomes a line feed
-            _kdl_buf_push_char(&buf_norm_lf, '\n');
+        tail = (kdl_str){p, (size_t)(end - p)};
+        if (*p != '\\') {
+            // a literal character: KDLv2 rejects newlines and illegal characters
+            if (_kdl_pop_codepoint(&tail, &c) != KDL_UTF8_OK) goto invalid_utf8;
+            if (_kdl_is_newline(c) || _kdl_is_illegal_char(KDL_CHARACTER_SET_V2, c)) *v2 = false;
+            if (!_kdl_buf_push_chars(&buf, p, (size_t)(tail.data - p))) goto unesc_error;
+            p = tail.data;
+        } else if (++p == end) {
+            // stray backslash
+            goto unesc_error;
         } else {
-            _kdl_buf_push_codepoint(&buf_norm_lf, c);
+            switch (*p) {
+            case 'n':
+                if (!_kdl_buf_push_char(&buf, '\n')) goto unesc_error;
+                ++p;
+                break;
+            case 'r':
+                if (!_kdl_buf_push_char(&buf, '\r')) goto unesc_error;
+                ++p;
+                break;
+            case 't':
+                if (!_kdl_buf_push_char(&buf, '\t')) goto unesc_error;
+                ++p;
+                break;
+            case '\\':
+                if (!_kdl_buf_push_char(&buf, '\\')) goto unesc_error;
+                ++p;
+                break;
+            case '"':
+                if (!_kdl_buf_push_char(&buf, '\"')) goto unesc_error;
+                ++p;
+                break;
+            case 'b':
+                if (!_kdl_buf_push_char(&buf, '\b')) goto unesc_error;
+                ++p;
+                break;
+            case 'f':
+                if (!_kdl_buf_push_char(&buf, '\f')) goto unesc_error;
+                ++p;
+                break;
+            case '/':
+                // KDLv1 only
+                *v2 = false;
+                if (!_kdl_buf_push_char(&buf, '/')) goto unesc_error;
+                ++p;
+                break;
+            case 's':
+                // KDLv2 only
+                *v1 = false;
+                if (!_kdl_buf_push_char(&buf, ' ')) goto unesc_error;
+                ++p;
+                break;
+            case 'u': {
+                bool escaped_ws = false;
+                p = _parse_unicode_escape(p + 1, end, &c, &escaped_ws);
+                if (p == NULL) goto unesc_error;
+                // escaped whitespace is KDLv2 only
+                if (escaped_ws) *v1 = false;
+                // only Unicode Scalar values are allowed in KDLv2 strings
+                if (0xD800 <= c && c <= 0xDFFF) *v2 = false;
+                if (!_kdl_buf_push_codepoint(&buf, c)) goto unesc_error;
+                break;
+            }
+            default:
+                // KDLv2: escaped whitespace (including newlines) is removed; anything else is an error
+                *v1 = false;
+                tail = (kdl_str){p, (size_t)(end - p)};
+                bool removed_whitespace = false;
+                kdl_utf8_status status;
+                while ((status = _kdl_pop_codepoint(&tail, &c)) == KDL_UTF8_OK
+                    && (_kdl_is_whitespace(KDL_CHARACTER_SET_V2, c) || _kdl_is_newline(c))) {
+                    p = tail.data;
+                    removed_whitespace = true;
+                }
+                if (!removed_whitespace || (status != KDL_UTF8_OK && status != KDL_UTF8_EOF)) {
+                    goto unesc_error;
+                }
+                break;
+            }
         }
-    }
 
-    if (status != KDL_UTF8_EOF) {
-        goto dedent_err;
+        if (!*v1 && !*v2) goto unesc_error;
     }
 
-    kdl_str norm_lf = (kdl_str){.data = buf_norm_lf.buf, .len = buf_norm_lf.str_len};
+    return _kdl_buf_to_string(&buf);
 
-    // What's after the final newline?
-    char const* final_newline = NULL;
-    for (char const* p = norm_lf.data + norm_lf.len - 1; p >= norm_lf.data; --p) {
-        if (*p == '\n') {
-            final_newline = p;
-            break;
-        }
+invalid_utf8:
+    // KDLv1 doesn't care about encoding errors
+    *v2 = false;
+    _kdl_free_write_buffer(&buf);
+    if (*v1) {
+        result = kdl_unescape_v1(s, alloc);
+        *v1 = result.data != NULL;
+        return result;
     }
+    return (kdl_owned_string){NULL, 0};
 
-    if (final_newline == NULL) {
-        // no newlines: this is not a valid multi-line string!
-        goto dedent_err;
+unesc_error:
+    *v1 = *v2 = false;
+    _kdl_free_write_buffer(&buf);
+    result = (kdl_owned_string){NULL, 0};
+    return result;
+}
+
+kdl_owned_string kdl_unescape_v2_multi_line(kdl_str const* s, kdl_allocator const* alloc)
+{
+    return _kdl_dedent_multi_line(s, true, _kdl_select_ascii_span_func(), alloc);
+}
+
+kdl_owned_string _kdl_dedent_multiline_string(kdl_str const* s, kdl_allocator const* alloc)
+{
+    return _kdl_dedent_multi_line(s, false, _kdl_select_ascii_span_func(), alloc);
+}
+
+// Decode the codepoint which ends at end. Returns where it starts, or NULL if there is no valid
+// codepoint between begin and end.
+static char const* _codepoint_before(char const* begin, char const* end, uint32_t* c)
+{
+    if (end == begin) return NULL;
+    char const* start = end - 1;
+    while (start != begin && end - start < 4 && ((unsigned char)*start & 0xc0) == 0x80) --start;
+    kdl_str cp = {start, (size_t)(end - start)};
+    if (_kdl_pop_codepoint(&cp, c) != KDL_UTF8_OK || cp.len != 0) return NULL;
+    return start;
+}
+
+// If the string has whitespace or newlines just before end, and they are escaped, return the
+// backslash escaping them; else NULL.
+static char const* _escaping_backslash(char const* begin, char const* end)
+{
+    char const* p = end;
+    char const* prev;
+    uint32_t c;
+    while ((prev = _codepoint_before(begin, p, &c)) != NULL
+        && (_kdl_is_whitespace(KDL_CHARACTER_SET_V2, c) || _kdl_is_newline(c))) {
+        p = prev;
     }
+    if (p == end) return NULL;
+    // in a run of backslashes, every pair is an escaped backslash
+    size_t n = 0;
+    while (p != begin && p[-1] == '\\') {
+        --p;
+        ++n;
+    }
+    return n % 2 == 1 ? p + n - 1 : NULL;
+}
 
-    kdl_str indent
-        = (kdl_str){.data = final_newline + 1, .len = (norm_lf.data + norm_lf.len) - (final_newline + 1)};
+// Find the last line of a multi-line string (the indentation) by scanning backwards from the end.
+// Escaped whitespace counts as removed, so if the string ends in escaped whitespace, the last line
+// ends at the backslash.
+static bool _find_final_line(kdl_str const* s, bool escapes, char const** final_newline, kdl_str* indent)
+{
+    char const* begin = s->data;
+    char const* line_end = begin + s->len;
+    for (;;) {
+        char const* p = line_end;
+        char const* prev;
+        uint32_t c;
+        while ((prev = _codepoint_before(begin, p, &c)) != NULL
+            && _kdl_is_whitespace(KDL_CHARACTER_SET_V2, c)) {
+            p = prev;
+        }
 
-    // Check that the indentation is all whitespace
-    kdl_str indent_ = indent;
-    while (_kdl_pop_codepoint(&indent_, &c) == KDL_UTF8_OK) {
-        if (!_kdl_is_whitespace(KDL_CHARACTER_SET_V2, c)) {
-            goto dedent_err;
+        char const* backslash = escapes ? _escaping_backslash(begin, line_end) : NULL;
+        if (backslash != NULL) {
+            line_end = backslash;
+        } else if (prev != NULL && _kdl_is_newline(c)) {
+            // Normalize CRLF
+            if (c == '\n' && prev != begin && prev[-1] == '\r') --prev;
+            *final_newline = prev;
+            *indent = (kdl_str){.data = p, .len = (size_t)(line_end - p)};
+            return true;
+        } else {
+            // no newline, or the last line is not all whitespace
+            return false;
         }
     }
+}
 
-    // The first character of the string MUST be a newline
-    if (norm_lf.data[0] != '\n') {
-        goto dedent_err;
-    }
+// If there is a newline at p, return where it ends; else NULL
+static char const* _after_newline(char const* p, char const* end)
+{
+    uint32_t c;
+    kdl_str tail = {p, (size_t)(end - p)};
+    if (_kdl_pop_codepoint(&tail, &c) != KDL_UTF8_OK || !_kdl_is_newline(c)) return NULL;
+    // Normalize CRLF
+    if (c == '\r' && tail.len != 0 && tail.data[0] == '\n') ++tail.data;
+    return tail.data;
+}
 
-    // Remove the whitespace from the beginning of all lines
-    buf_dedented = malloc(norm_lf.len);
-    char* out = buf_dedented;
-    char const* in = norm_lf.data + 1; // skip initial LF
-    char const* end = norm_lf.data + norm_lf.len;
-    // copy the rest of the string
-    while (in < end) {
-        // find the next newline
-        char const* eol = in;
-        while (eol < end && *eol != '\n') ++eol;
-        if (eol == end) break;
-
-        // check if the line is all whitespace
-        kdl_str line = (kdl_str){.data = in, .len = (eol - in)};
+// Resolve the KDLv2 escape sequence after a backslash at p into *out. Returns where the escape
+// sequence ends, or NULL if it is invalid. (Escaped whitespace is not handled here.)
+static char const* _resolve_escape_v2(char const* p, char const* end, char** out)
+{
+    char e;
+    if (p == end) return NULL;
+    switch (*(p++)) {
+    case 'n':
+        e = '\n';
+        break;
+    case 'r':
+        e = '\r';
+        break;
+    case 't':
+        e = '\t';
+        break;
+    case 's':
+        e = ' ';
+        break;
+    case '\\':
+        e = '\\';
+        break;
+    case '"':
+        e = '\"';
+        break;
+    case 'b':
+        e = '\b';
+        break;
+    case 'f':
+        e = '\f';
+        break;
+    case 'u': {
         uint32_t c;
-        bool is_ws = true;
-        while (_kdl_pop_codepoint(&line, &c) == KDL_UTF8_OK) {
-            if (!_kdl_is_whitespace(KDL_CHARACTER_SET_V2, c)) {
-                is_ws = false;
-                break;
-            }
-        }
+        bool escaped_ws = false;
+        p = _parse_unicode_escape(p, end, &c, &escaped_ws);
+        // only Unicode Scalar values are allowed in strings
+        if (p == NULL || (0xD800 <= c && c <= 0xDFFF)) return NULL;
+        int n = _kdl_push_codepoint(c, *out);
+        if (n == 0) return NULL;
+        *out += n;
+        return p;
+    }
+    default:
+        // invalid escape
+        return NULL;
+    }
+    *((*out)++) = e;
+    return p;
+}
+
+kdl_owned_string _kdl_dedent_multi_line(
+    kdl_str const* s, bool escapes, _kdl_ascii_span_func ascii_span, kdl_allocator const* alloc)
+{
+    char const* final_newline;
+    kdl_str indent;
+    if (!_find_final_line(s, escapes, &final_newline, &indent)) return (kdl_owned_string){NULL, 0};
+
+    // The first character of the string MUST be a newline. The lines after it are copied up to and
+    // including the final newline.
+    char const* end = _after_newline(final_newline, s->data + s->len);
+    char const* p = _after_newline(s->data, end);
+    if (p == NULL) return (kdl_owned_string){NULL, 0};
 
-        if (is_ws) {
-            // push a single newline
+    // Nothing below makes the string longer, so the output fits into s->len bytes
+    char* buf = _kdl_malloc(alloc, s->len + 1);
+    if (buf == NULL) return (kdl_owned_string){NULL, 0};
+    char* out = buf;
+
+    uint32_t c;
+    kdl_str tail;
+    kdl_utf8_status status;
+    while (p != end) {
+        // Lines which are all whitespace become empty, all others must start with the indent
+        bool indented = (size_t)(end - p) >= indent.len && memcmp(p, indent.data, indent.len) == 0;
+        char const* line = indented ? p + indent.len : p;
+        char const* ws_end = line;
+        tail = (kdl_str){line, (size_t)(end - line)};
+        while ((status = _kdl_pop_codepoint(&tail, &c)) == KDL_UTF8_OK
+            && _kdl_is_whitespace(KDL_CHARACTER_SET_V2, c)) {
+            ws_end = tail.data;
+        }
+        if (status == KDL_UTF8_OK && _kdl_is_newline(c)) {
+            p = _after_newline(ws_end, end);
             *(out++) = '\n';
-        } else {
-            // check if the line starts with the indent
-            size_t line_len = eol - in;
-            if (line_len >= indent.len && memcmp(in, indent.data, indent.len) == 0) {
-                // copy the line after the indent to the output (incl newline)
-                size_t n = line_len - indent.len + 1;
-                memcpy(out, in + indent.len, n);
-                out += n;
-            } else {
+            continue;
+        } else if (!indented) {
+            goto dedent_err;
+        }
+
+        // Copy the rest of the line, up to and including the newline
+        p = line;
+        for (;;) {
+            size_t plain = ascii_span(KDL_ASCII_NO_ESCAPE, p, end);
+            memcpy(out, p, plain);
+            out += plain;
+            p += plain;
+
+            tail = (kdl_str){p, (size_t)(end - p)};
+            if (_kdl_pop_codepoint(&tail, &c) != KDL_UTF8_OK) goto dedent_err;
+            if (_kdl_is_newline(c)) {
+                // every newline becomes a line feed
+                if (c == '\r' && tail.len != 0 && tail.data[0] == '\n') ++tail.data;
+                p = tail.data;
+                *(out++) = '\n';
+                break;
+            } else if (escapes && _kdl_is_illegal_char(KDL_CHARACTER_SET_V2, c)) {
                 goto dedent_err;
+            } else if (!escapes || c != '\\') {
+                // Nothing special, copy the character
+                memcpy(out, p, (size_t)(tail.data - p));
+                out += tail.data - p;
+                p = tail.data;
+            } else {
+                // Escaped whitespace (including newlines) is removed, and the line goes on after it
+                char const* escaped = tail.data;
+                p = escaped;
+                while ((status = _kdl_pop_codepoint(&tail, &c)) == KDL_UTF8_OK
+                    && (_kdl_is_whitespace(KDL_CHARACTER_SET_V2, c) || _kdl_is_newline(c))) {
+                    p = tail.data;
+                }
+                if (status != KDL_UTF8_OK && status != KDL_UTF8_EOF) goto dedent_err;
+                if (p == escaped) {
+                    p = _resolve_escape_v2(escaped, end, &out);
+                    if (p == NULL) goto dedent_err;
+                }
             }
         }
-
-        in = eol + 1;
     }
 
-    size_t len = out - buf_dedented;
     // Strip the final line feed
-    if (len > 0 && buf_dedented[len - 1] == '\n') --len;
-    buf_dedented = realloc(buf_dedented, len + 1);
-    buf_dedented[len] = '\0';
-    return (kdl_owned_string){.data = buf_dedented, .len = len};
+    if (out != buf && out[-1] == '\n') --out;
+    *out = '\0';
+    return (kdl_owned_string){.data = buf, .len = (size_t)(out - buf)};
 
 dedent_err:
-    _kdl_free_write_buffer(&buf_norm_lf);
-    if (buf_dedented != NULL) free(buf_dedented);
-    result = (kdl_owned_string){NULL, 0};
-    return result;
+    _kdl_free(alloc, buf);
+    return (kdl_owned_string){NULL, 0};
 }
 
-kdl_owned_string _kdl_remove_escaped_whitespace(kdl_str const* s)
+kdl_owned_string _kdl_remove_escaped_whitespace(kdl_str const* s, kdl_allocator const* alloc)
 {
     kdl_owned_string result;
     kdl_str escaped = *s;
 
     size_t orig_len = escaped.len;
-    _kdl_write_buffer buf = _kdl_new_write_buffer(orig_len);
+    _kdl_write_buffer buf = _kdl_new_write_buffer(orig_len, alloc);
     if (buf.buf == NULL) goto unesc_error;
     if (escaped.data == NULL) goto unesc_error;
 
@@ -577,13 +893,13 @@ unesc_error:
     return result;
 }
 
-kdl_owned_string _kdl_resolve_escapes_v2(kdl_str const* s)
+kdl_owned_string _kdl_resolve_escapes_v2(kdl_str const* s, kdl_allocator const* alloc)
 {
     kdl_owned_string result;
     kdl_str escaped = *s;
 
     size_t orig_len = escaped.len;
-    _kdl_write_buffer buf = _kdl_new_write_buffer(orig_len);
+    _kdl_write_buffer buf = _kdl_new_write_buffer(orig_len, alloc);
     if (buf.buf == NULL) goto unesc_error;
 
     uint32_t c = 0;
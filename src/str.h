@@ -2,6 +2,7 @@
 #define KDL_INTERNAL_STR_H_
 
 #include "kdl/common.h"
+#include "simd.h"
 
 #include <stdbool.h>
 #include <stdint.h>
@@ -11,11 +12,18 @@ struct _kdl_write_buffer {
     char* buf;
     size_t buf_len;
     size_t str_len;
+    kdl_allocator const* alloc;
 };
 
 typedef struct _kdl_write_buffer _kdl_write_buffer;
 
-KDL_NODISCARD _kdl_write_buffer _kdl_new_write_buffer(size_t initial_size);
+// The functions below that take a kdl_allocator allocate all memory, including the result, with
+// it. It must not be NULL.
+
+KDL_NODISCARD kdl_owned_string _kdl_clone_str(kdl_str const* s, kdl_allocator const* alloc);
+void _kdl_free_string(kdl_owned_string* s, kdl_allocator const* alloc);
+
+KDL_NODISCARD _kdl_write_buffer _kdl_new_write_buffer(size_t initial_size, kdl_allocator const* alloc);
 bool _kdl_buf_push_chars(_kdl_write_buffer* buf, char const* s, size_t count);
 bool _kdl_buf_push_char(_kdl_write_buffer* buf, char c);
 bool _kdl_buf_push_codepoint(_kdl_write_buffer* buf, uint32_t c);
@@ -23,20 +31,39 @@ KDL_NODISCARD kdl_owned_string _kdl_buf_to_string(_kdl_write_buffer* buf);
 void _kdl_free_write_buffer(_kdl_write_buffer* buf);
 
 // Escape special characters in a string according to KDLv1 string rules
-KDL_NODISCARD kdl_owned_string kdl_escape_v1(kdl_str const* s, kdl_escape_mode mode);
+KDL_NODISCARD kdl_owned_string kdl_escape_v1(
+    kdl_str const* s, kdl_escape_mode mode, kdl_allocator const* alloc);
+// Append the escaped string to buf (KDLv1 rules). Returns false on error.
+// Runs of characters that need no escaping are found with ascii_span and copied in bulk.
+bool _kdl_escape_v1_into(
+    _kdl_write_buffer* buf, kdl_str const* s, kdl_escape_mode mode, _kdl_ascii_span_func ascii_span);
 // Resolve backslash escape sequences according to KDLv1 rules
-KDL_NODISCARD kdl_owned_string kdl_unescape_v1(kdl_str const* s);
+KDL_NODISCARD kdl_owned_string kdl_unescape_v1(kdl_str const* s, kdl_allocator const* alloc);
 
 // Escape special characters in a string according to KDLv2 string rules
-KDL_NODISCARD kdl_owned_string kdl_escape_v2(kdl_str const* s, kdl_escape_mode mode);
+KDL_NODISCARD kdl_owned_string kdl_escape_v2(
+    kdl_str const* s, kdl_escape_mode mode, kdl_allocator const* alloc);
+// Append the escaped string to buf (KDLv2 rules). Returns false on error.
+bool _kdl_escape_v2_into(
+    _kdl_write_buffer* buf, kdl_str const* s, kdl_escape_mode mode, _kdl_ascii_span_func ascii_span);
 // Resolve backslash escape sequences according to KDLv2 rules for single-line strings
-KDL_NODISCARD kdl_owned_string kdl_unescape_v2_single_line(kdl_str const* s);
+KDL_NODISCARD kdl_owned_string kdl_unescape_v2_single_line(kdl_str const* s, kdl_allocator const* alloc);
+// Resolve backslash escape sequences in a single-line string according to the KDLv1 and KDLv2 rules
+// at the same time, in one pass. On input, *v1 and *v2 say which versions to consider; on output,
+// which of them accept the string. The result is the KDLv2 value if KDLv2 accepts the string, and
+// the KDLv1 value otherwise. If neither does, the result is {NULL, 0}.
+KDL_NODISCARD kdl_owned_string _kdl_unescape_v1_or_v2(
+    kdl_str const* s, bool* v1, bool* v2, _kdl_ascii_span_func ascii_span, kdl_allocator const* alloc);
 // Resolve backslash escape sequences according to KDLv2 rules for multi-line strings
-KDL_NODISCARD kdl_owned_string kdl_unescape_v2_multi_line(kdl_str const* s);
+KDL_NODISCARD kdl_owned_string kdl_unescape_v2_multi_line(kdl_str const* s, kdl_allocator const* alloc);
+// Dedent a multi-line string and, if escapes is set, resolve its escape sequences (KDLv2 rules).
+// This is done in a single pass, with a single allocation for the result.
+KDL_NODISCARD kdl_owned_string _kdl_dedent_multi_line(
+    kdl_str const* s, bool escapes, _kdl_ascii_span_func ascii_span, kdl_allocator const* alloc);
 
-KDL_NODISCARD kdl_owned_string _kdl_dedent_multiline_string(kdl_str const* s);
-KDL_NODISCARD kdl_owned_string _kdl_remove_escaped_whitespace(kdl_str const* s);
-KDL_NODISCARD kdl_owned_string _kdl_resolve_escapes_v2(kdl_str const* s);
+KDL_NODISCARD kdl_owned_string _kdl_dedent_multiline_string(kdl_str const* s, kdl_allocator const* alloc);
+KDL_NODISCARD kdl_owned_string _kdl_remove_escaped_whitespace(kdl_str const* s, kdl_allocator const* alloc);
+KDL_NODISCARD kdl_owned_string _kdl_resolve_escapes_v2(kdl_str const* s, kdl_allocator const* alloc);
 bool _kdl_str_contains_newline(kdl_str const* s);
 
 #endif // KDL_INTERNAL_STR_H_
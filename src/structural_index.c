@@ -0,0 +1,111 @@
+#include "structural_index.h"
+#include "alloc.h"
+
+#include <string.h>
+
+#if defined(_MSC_VER)
+#    include <intrin.h>
+#endif
+
+// Small windows in Debug mode to find more bugs
+#ifdef KDL_DEBUG
+#    define WINDOW_SIZE 64
+#else
+#    define WINDOW_SIZE 16384
+#endif
+
+// offsets are 16 bits, and every window but the last one is made of whole 64-byte blocks
+#if WINDOW_SIZE > 65536 || WINDOW_SIZE % 64 != 0
+#    error "invalid WINDOW_SIZE"
+#endif
+
+static inline unsigned _count_trailing_zeros_64(uint64_t x)
+{
+#if defined(__GNUC__)
+    return (unsigned)__builtin_ctzll(x);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    unsigned long idx;
+    _BitScanForward64(&idx, x);
+    return (unsigned)idx;
+#else
+    unsigned n = 0;
+    while ((x & 1) == 0) {
+        x >>= 1;
+        ++n;
+    }
+    return n;
+#endif
+}
+
+bool _kdl_init_structural_index(_kdl_structural_index* index, kdl_str doc, kdl_allocator const* alloc)
+{
+    index->doc_begin = doc.data;
+    index->doc_end = doc.data + doc.len;
+    index->base = doc.data;
+    index->limit = doc.data; // no window yet
+    index->len = 0;
+    index->pos = 0;
+    index->structural_mask = _kdl_select_structural_mask_func();
+    index->offsets = _kdl_malloc(alloc, WINDOW_SIZE * sizeof(uint16_t));
+    return index->offsets != NULL;
+}
+
+void _kdl_free_structural_index(_kdl_structural_index* index, kdl_allocator const* alloc)
+{
+    _kdl_free(alloc, index->offsets);
+    index->offsets = NULL;
+    index->len = 0;
+}
+
+// Build the index of the window starting at base (which is at the start of a 64-byte block)
+static void _build_window(_kdl_structural_index* index, char const* base)
+{
+    size_t size = (size_t)(index->doc_end - base);
+    if (size > WINDOW_SIZE) size = WINDOW_SIZE;
+    unsigned carry = base == index->doc_begin ? 0 : _kdl_structural_carry((unsigned char)base[-1]);
+    uint16_t* offsets = index->offsets;
+    size_t n = 0;
+
+    for (size_t block_start = 0; block_start < size; block_start += 64) {
+        uint64_t mask;
+        if (size - block_start >= 64) {
+            mask = index->structural_mask(base + block_start, &carry);
+        } else {
+            // Pad the last block of the document with spaces, and ignore the padding
+            char tail[64];
+            memset(tail, ' ', sizeof(tail));
+            memcpy(tail, base + block_start, size - block_start);
+            mask = index->structural_mask(tail, &carry);
+            mask &= ((uint64_t)1 << (size - block_start)) - 1;
+        }
+        while (mask != 0) {
+            offsets[n++] = (uint16_t)(block_start + _count_trailing_zeros_64(mask));
+            mask &= mask - 1;
+        }
+    }
+
+    index->base = base;
+    index->limit = base + size;
+    index->len = n;
+    index->pos = 0;
+}
+
+char const* _kdl_next_structural_slow(_kdl_structural_index* index, char const* p)
+{
+    char const* window;
+    if (p >= index->base && p < index->limit) {
+        // all entries of this window are at or before p
+        window = index->limit;
+    } else {
+        // start over at the block containing p
+        window = p - (size_t)(p - index->doc_begin) % 64;
+    }
+
+    while (window < index->doc_end) {
+        _build_window(index, window);
+        while (index->pos < index->len && index->base + index->offsets[index->pos] <= p) ++index->pos;
+        if (index->pos < index->len) return index->base + index->offsets[index->pos];
+        window = index->limit;
+    }
+    return index->doc_end;
+}
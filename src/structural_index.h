@@ -0,0 +1,54 @@
+#ifndef KDL_INTERNAL_STRUCTURAL_INDEX_H_
+#define KDL_INTERNAL_STRUCTURAL_INDEX_H_
+
+#include "kdl/common.h"
+#include "simd.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Offsets of all the places in a document where a token may start or end, found by a SIMD pass
+// over the document before it is tokenized (like stage 1 of simdjson). Every byte is listed,
+// except those in the middle of a run of spaces and tabs or of a run of plain word characters, so
+// the first entry after any byte in such a run is the end of the run.
+//
+// The index is built for one window of the document at a time, as the tokenizer gets there, so
+// that it stays small (and in the cache) however large the document is.
+struct _kdl_structural_index {
+    char const* doc_begin;
+    char const* doc_end;
+    char const* base;  // start of the current window
+    char const* limit; // end of the current window
+    uint16_t* offsets; // entries in the current window, relative to base, in increasing order
+    size_t len;
+    size_t pos; // the first entry after the last position looked up
+    _kdl_structural_mask_func structural_mask;
+};
+
+typedef struct _kdl_structural_index _kdl_structural_index;
+
+// Prepare the index of a document (return false if memory allocation fails)
+bool _kdl_init_structural_index(_kdl_structural_index* index, kdl_str doc, kdl_allocator const* alloc);
+// Free an index set up by _kdl_init_structural_index
+void _kdl_free_structural_index(_kdl_structural_index* index, kdl_allocator const* alloc);
+
+// Move to another window and return the first entry after p (or the end of the document)
+char const* _kdl_next_structural_slow(_kdl_structural_index* index, char const* p);
+
+// Return the first entry after p (or the end of the document)
+static inline char const* _kdl_next_structural(_kdl_structural_index* index, char const* p)
+{
+    if (p >= index->base && p < index->limit) {
+        size_t offset = (size_t)(p - index->base);
+        size_t pos = index->pos;
+        // positions only go backwards when a token is read again (after an error)
+        while (pos > 0 && index->offsets[pos - 1] > offset) --pos;
+        while (pos < index->len && index->offsets[pos] <= offset) ++pos;
+        index->pos = pos;
+        if (pos < index->len) return index->base + index->offsets[pos];
+    }
+    return _kdl_next_structural_slow(index, p);
+}
+
+#endif // KDL_INTERNAL_STRUCTURAL_INDEX_H_
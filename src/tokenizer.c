@@ -1,6 +1,10 @@
 #include "kdl/tokenizer.h"
+#include "alloc.h"
 #include "compat.h"
 #include "grammar.h"
+#include "mapped_file.h"
+#include "simd.h"
+#include "structural_index.h"
 #include "utf8.h"
 
 #include <stdbool.h>
@@ -9,11 +13,9 @@
 
 // No buffering in Debug mode to find more bugs
 #ifdef KDL_DEBUG
-#    define MIN_BUFFER_SIZE 1
-#    define BUFFER_SIZE_INCREMENT 1
+#    define DEFAULT_READ_CHUNK_SIZE 1
 #else
-#    define MIN_BUFFER_SIZE 1024
-#    define BUFFER_SIZE_INCREMENT 4096
+#    define DEFAULT_READ_CHUNK_SIZE 4096
 #endif
 
 struct _kdl_tokenizer {
@@ -23,6 +25,12 @@ struct _kdl_tokenizer {
     void* read_user_data;
     char* buffer;
     size_t buffer_size;
+    size_t read_chunk_size; // minimum amount of space offered to read_func
+    bool at_start;          // a BOM may still have to be skipped
+    _kdl_ascii_span_func ascii_span;
+    kdl_allocator alloc;
+    _kdl_mapped_file file; // backs the document for file tokenizers
+    _kdl_structural_index index; // indexed tokenizers only (index.offsets == NULL otherwise)
 };
 
 static inline void _remove_initial_bom(kdl_tokenizer* self);
@@ -30,42 +38,97 @@ static inline void _update_doc_ptr(kdl_tokenizer* self, char const* new_ptr);
 static inline kdl_utf8_status _tok_get_char(
     kdl_tokenizer* self, char const** cur, char const** next, uint32_t* codepoint);
 
-kdl_tokenizer* kdl_create_string_tokenizer(kdl_str doc)
+kdl_tokenizer* kdl_create_string_tokenizer(kdl_str doc) { return kdl_create_string_tokenizer_ex(doc, NULL); }
+
+kdl_tokenizer* kdl_create_stream_tokenizer(kdl_read_func read_func, void* user_data)
+{
+    return kdl_create_stream_tokenizer_ex(read_func, user_data, NULL);
+}
+
+kdl_tokenizer* kdl_create_file_tokenizer(char const* path)
 {
-    kdl_tokenizer* self = malloc(sizeof(kdl_tokenizer));
+    return kdl_create_file_tokenizer_ex(path, NULL);
+}
+
+kdl_tokenizer* kdl_create_string_tokenizer_ex(kdl_str doc, kdl_allocator const* allocator)
+{
+    kdl_allocator alloc = _kdl_allocator_or_default(allocator);
+    kdl_tokenizer* self = _kdl_malloc(&alloc, sizeof(kdl_tokenizer));
     if (self != NULL) {
+        self->alloc = alloc;
         self->document = doc;
         self->charset = KDL_CHARACTER_SET_DEFAULT;
         self->read_func = NULL;
         self->read_user_data = NULL;
         self->buffer = NULL;
         self->buffer_size = 0;
+        self->read_chunk_size = DEFAULT_READ_CHUNK_SIZE;
+        self->at_start = true;
+        self->ascii_span = _kdl_select_ascii_span_func();
+        self->file = (_kdl_mapped_file){NULL, 0, NULL};
+        self->index = (_kdl_structural_index){.offsets = NULL};
     }
-    _remove_initial_bom(self);
     return self;
 }
 
-kdl_tokenizer* kdl_create_stream_tokenizer(kdl_read_func read_func, void* user_data)
+kdl_tokenizer* kdl_create_stream_tokenizer_ex(
+    kdl_read_func read_func, void* user_data, kdl_allocator const* allocator)
 {
-    kdl_tokenizer* self = malloc(sizeof(kdl_tokenizer));
+    kdl_allocator alloc = _kdl_allocator_or_default(allocator);
+    kdl_tokenizer* self = _kdl_malloc(&alloc, sizeof(kdl_tokenizer));
     if (self != NULL) {
+        self->alloc = alloc;
         self->document = (kdl_str){.data = NULL, .len = 0};
         self->charset = KDL_CHARACTER_SET_DEFAULT;
         self->read_func = read_func;
         self->read_user_data = user_data;
         self->buffer = NULL;
         self->buffer_size = 0;
+        self->read_chunk_size = DEFAULT_READ_CHUNK_SIZE;
+        self->at_start = true;
+        self->ascii_span = _kdl_select_ascii_span_func();
+        self->file = (_kdl_mapped_file){NULL, 0, NULL};
+        self->index = (_kdl_structural_index){.offsets = NULL};
     }
-    _remove_initial_bom(self);
     return self;
 }
 
-void kdl_destroy_tokenizer(kdl_tokenizer* tokenizer)
+kdl_tokenizer* kdl_create_file_tokenizer_ex(char const* path, kdl_allocator const* allocator)
 {
-    if (tokenizer->buffer != NULL) {
-        free(tokenizer->buffer);
+    kdl_allocator alloc = _kdl_allocator_or_default(allocator);
+    _kdl_mapped_file file;
+    if (!_kdl_map_file(&file, path, &alloc)) return NULL;
+    kdl_tokenizer* self = kdl_create_string_tokenizer_ex((kdl_str){file.data, file.len}, &alloc);
+    if (self == NULL) {
+        _kdl_unmap_file(&file, &alloc);
+    } else {
+        self->file = file;
     }
-    free(tokenizer);
+    return self;
+}
+
+kdl_tokenizer* kdl_create_indexed_tokenizer(kdl_str doc)
+{
+    return kdl_create_indexed_tokenizer_ex(doc, NULL);
+}
+
+kdl_tokenizer* kdl_create_indexed_tokenizer_ex(kdl_str doc, kdl_allocator const* allocator)
+{
+    kdl_tokenizer* self = kdl_create_string_tokenizer_ex(doc, allocator);
+    if (self != NULL && !_kdl_init_structural_index(&self->index, doc, &self->alloc)) {
+        kdl_destroy_tokenizer(self);
+        return NULL;
+    }
+    return self;
+}
+
+void kdl_destroy_tokenizer(kdl_tokenizer* tokenizer)
+{
+    kdl_allocator alloc = tokenizer->alloc;
+    _kdl_free_structural_index(&tokenizer->index, &alloc);
+    _kdl_unmap_file(&tokenizer->file, &alloc);
+    _kdl_free(&alloc, tokenizer->buffer);
+    _kdl_free(&alloc, tokenizer);
 }
 
 static inline void _remove_initial_bom(kdl_tokenizer* self)
@@ -82,126 +145,58 @@ static inline void _remove_initial_bom(kdl_tokenizer* self)
 
 void kdl_tokenizer_set_character_set(kdl_tokenizer* self, kdl_character_set cs) { self->charset = cs; }
 
+void kdl_tokenizer_set_read_chunk_size(kdl_tokenizer* self, size_t chunk_size)
+{
+    self->read_chunk_size = chunk_size > 0 ? chunk_size : DEFAULT_READ_CHUNK_SIZE;
+}
+
+// Read more data into the buffer. The unparsed data (self->document) stays contiguous, but it is only
+// moved to the front of the buffer once the space in front of it is at least as large as the data
+// itself, and the buffer grows geometrically, so that even a token spanning the entire stream costs
+// amortized O(1) per byte.
 static size_t _refill_tokenizer(kdl_tokenizer* self)
 {
     if (self->read_func == NULL) return 0;
 
+    size_t chunk_size = self->read_chunk_size;
     if (self->buffer == NULL) {
-        self->buffer = malloc(BUFFER_SIZE_INCREMENT);
+        self->buffer = _kdl_malloc(&self->alloc, chunk_size);
         if (self->buffer == NULL) {
             // memory allocation failed
             return 0;
         }
-        self->buffer_size = BUFFER_SIZE_INCREMENT;
-        self->document.len = 0;
+        self->buffer_size = chunk_size;
+        self->document = (kdl_str){.data = self->buffer, .len = 0};
     }
-    // Move whatever data is left unparsed to the top of the buffer
-    if (self->document.len > 0) {
-        memmove(self->buffer, self->document.data, self->document.len);
-    }
-    self->document.data = self->buffer;
-    size_t len_available = self->buffer_size - self->document.len;
-    if (len_available < MIN_BUFFER_SIZE) {
-        // Need more room
-        size_t new_buf_size = self->buffer_size + BUFFER_SIZE_INCREMENT;
-        char* new_buffer = realloc(self->buffer, new_buf_size);
-        if (new_buffer == NULL) {
-            return 0;
-        } else {
+
+    size_t offset = (size_t)(self->document.data - self->buffer);
+    size_t len = self->document.len;
+    if (self->buffer_size - offset - len < chunk_size) {
+        if (offset >= len) {
+            // Reclaim the space taken up by data that has already been parsed
+            if (len > 0) memmove(self->buffer, self->document.data, len);
+            offset = 0;
+        }
+        if (self->buffer_size - offset - len < chunk_size) {
+            // Need more room
+            size_t new_buf_size = 2 * self->buffer_size;
+            if (new_buf_size < offset + len + chunk_size) new_buf_size = offset + len + chunk_size;
+            char* new_buffer = _kdl_realloc(&self->alloc, self->buffer, new_buf_size);
+            if (new_buffer == NULL) {
+                return 0;
+            }
             self->buffer = new_buffer;
             self->buffer_size = new_buf_size;
-            self->document.data = new_buffer;
-            len_available = self->buffer_size - self->document.len;
         }
+        self->document.data = self->buffer + offset;
     }
-    char* end = self->buffer + self->document.len;
+    char* end = self->buffer + offset + len;
 
-    size_t read_count = self->read_func(self->read_user_data, end, len_available);
+    size_t read_count = self->read_func(self->read_user_data, end, self->buffer_size - offset - len);
     self->document.len += read_count;
     return read_count;
 }
 
-bool _kdl_is_whitespace(kdl_character_set charset, uint32_t c)
-{
-    return c == 0x0009 || // Character Tabulation
-        c == 0x0020 ||    // Space
-        c == 0x00A0 ||    // No-Break Space
-        c == 0x1680 ||    // Ogham Space Mark
-        c == 0x2000 ||    // En Quad
-        c == 0x2001 ||    // Em Quad
-        c == 0x2002 ||    // En Space
-        c == 0x2003 ||    // Em Space
-        c == 0x2004 ||    // Three-Per-Em Space
-        c == 0x2005 ||    // Four-Per-Em Space
-        c == 0x2006 ||    // Six-Per-Em Space
-        c == 0x2007 ||    // Figure Space
-        c == 0x2008 ||    // Punctuation Space
-        c == 0x2009 ||    // Thin Space
-        c == 0x200A ||    // Hair Space
-        c == 0x202F ||    // Narrow No-Break Space
-        c == 0x205F ||    // Medium Mathematical Space
-        c == 0x3000 ||    // Ideographic Space
-
-        (charset == KDL_CHARACTER_SET_V1 && c == 0xFEFF) || // Byte-order mark
-        (charset == KDL_CHARACTER_SET_V2 && c == 0x000B)    // Vertical Tab
-        ;
-}
-
-bool _kdl_is_newline(uint32_t c)
-{
-    return c == 0x000D || // CR  Carriage Return
-        c == 0x000A ||    // LF  Line Feed
-        c == 0x0085 ||    // NEL Next Line
-        c == 0x000C ||    // FF  Form Feed
-        c == 0x2028 ||    // LS  Line Separator
-        c == 0x2029;      // PS  Paragraph Separator
-}
-
-bool _kdl_is_id(kdl_character_set charset, uint32_t c)
-{
-    return _kdl_is_word_char(charset, c) && !(charset == KDL_CHARACTER_SET_V2 && c == '#');
-}
-
-bool _kdl_is_id_start(kdl_character_set charset, uint32_t c)
-{
-    return _kdl_is_word_start(charset, c) && !(charset == KDL_CHARACTER_SET_V2 && c == '#');
-}
-
-bool _kdl_is_word_char(kdl_character_set charset, uint32_t c)
-{
-    return c > 0x20 && c <= 0x10FFFF && c != '\\' && c != '/' && c != '(' && c != ')' && c != '{' && c != '}'
-        && c != ';' && c != '[' && c != ']' && c != '"' && c != '='
-        && !(charset == KDL_CHARACTER_SET_V1 && (c == '<' || c == '>' || c == ','))
-        && !_kdl_is_whitespace(charset, c) && !_kdl_is_newline(c) && !_kdl_is_illegal_char(charset, c);
-}
-
-bool _kdl_is_word_start(kdl_character_set charset, uint32_t c)
-{
-    return _kdl_is_id(charset, c) && (c < '0' || c > '9');
-}
-
-bool _kdl_is_end_of_word(kdl_character_set charset, uint32_t c)
-{
-    // is this character something that could terminate an identifier (or number) in some situation?
-    return _kdl_is_whitespace(charset, c) || _kdl_is_newline(c) //
-        || c == ';' || c == ')' || c == '}' || c == '/' || c == '\\' || c == '=';
-}
-
-bool _kdl_is_illegal_char(kdl_character_set charset, uint32_t c)
-{
-    return charset == KDL_CHARACTER_SET_V2
-        && (c <= 0x0008 ||                  // control characters
-            (0x000E <= c && c <= 0x001F) || //    ''
-            c == 0x007F ||                  // delete
-            (0xD800 <= c && c <= 0xDFFF) || // UTF-16 surrogates
-            c == 0x200E || c == 0x200F ||   // directional control characters
-            (0x202A <= c && c <= 0x202E) || //    ''
-            (0x2066 <= c && c <= 0x2069) || //    ''
-            c == 0xFEFF ||                  // ZWNBSP = BOM
-            c > 0x10FFFF                    // not a codepoint
-        );
-}
-
 static inline kdl_utf8_status _tok_get_char(
     kdl_tokenizer* self, char const** cur, char const** next, uint32_t* codepoint)
 {
@@ -238,11 +233,34 @@ static inline void _update_doc_ptr(kdl_tokenizer* self, char const* new_ptr)
     self->document.data = new_ptr;
 }
 
+// Skip over a run of ASCII characters of class cls - only looks at data that is already in the buffer
+static inline char const* _skip_ascii(kdl_tokenizer* self, _kdl_ascii_class cls, char const* cur)
+{
+    return cur + self->ascii_span(cls, cur, self->document.data + self->document.len);
+}
+
+static kdl_tokenizer_status _scan_token(kdl_tokenizer* self, kdl_token* dest);
+static kdl_tokenizer_status _pop_indexed_token(kdl_tokenizer* self, kdl_token* dest);
 static kdl_tokenizer_status _pop_word(kdl_tokenizer* self, kdl_token* dest);
 static kdl_tokenizer_status _pop_comment(kdl_tokenizer* self, kdl_token* dest);
 static kdl_tokenizer_status _pop_string(kdl_tokenizer* self, kdl_token* dest);
 
 kdl_tokenizer_status kdl_pop_token(kdl_tokenizer* self, kdl_token* dest)
+{
+    if (self->at_start) {
+        _remove_initial_bom(self);
+        self->at_start = false;
+    }
+
+    if (self->index.offsets != NULL) {
+        return _pop_indexed_token(self, dest);
+    } else {
+        return _scan_token(self, dest);
+    }
+}
+
+// Read the next token character by character
+static kdl_tokenizer_status _scan_token(kdl_tokenizer* self, kdl_token* dest)
 {
     uint32_t c = 0;
     char const* cur = self->document.data;
@@ -264,9 +282,15 @@ kdl_tokenizer_status kdl_pop_token(kdl_tokenizer* self, kdl_token* dest)
         } else if (_kdl_is_whitespace(self->charset, c)) {
             // find whitespace run
             size_t ws_start_offset = cur - self->document.data;
+            _kdl_ascii_class ws_class = self->charset == KDL_CHARACTER_SET_V1 ? KDL_ASCII_WHITESPACE_V1
+                                                                              : KDL_ASCII_WHITESPACE_V2;
             cur = next;
-            while (
-                _tok_get_char(self, &cur, &next, &c) == KDL_UTF8_OK && _kdl_is_whitespace(self->charset, c)) {
+            while (true) {
+                cur = _skip_ascii(self, ws_class, cur);
+                if (_tok_get_char(self, &cur, &next, &c) != KDL_UTF8_OK
+                    || !_kdl_is_whitespace(self->charset, c)) {
+                    break;
+                }
                 // accept whitespace character
                 cur = next;
             }
@@ -363,13 +387,172 @@ kdl_tokenizer_status kdl_pop_token(kdl_tokenizer* self, kdl_token* dest)
     }
 }
 
+static kdl_tokenizer_status _pop_indexed_string(kdl_tokenizer* self, kdl_token* dest);
+
+// Read the next token using the structural index: the end of a run of whitespace or of a word, or
+// the next quote or backslash in a string, is the next entry in the index which isn't part of the
+// token, so the bytes in between never have to be looked at. Anything out of the ordinary (non-ASCII
+// characters, comments, raw and multi-line strings, errors) is left to _scan_token.
+static kdl_tokenizer_status _pop_indexed_token(kdl_tokenizer* self, kdl_token* dest)
+{
+    char const* cur = self->document.data;
+    char const* end = cur + self->document.len;
+    if (cur == end) return KDL_TOKENIZER_EOF;
+
+    unsigned char c = (unsigned char)*cur;
+    if (c >= 0x80) return _scan_token(self, dest);
+    uint8_t cls = _kdl_char_class(self->charset, c);
+    char const* token_end = cur + 1;
+
+    if ((cls & _KDL_CHAR_ILLEGAL) != 0) {
+        return KDL_TOKENIZER_ERROR;
+    } else if ((cls & _KDL_CHAR_WHITESPACE) != 0) {
+        // find whitespace run
+        while (true) {
+            token_end = _kdl_next_structural(&self->index, token_end - 1);
+            if (token_end == end) break;
+            c = (unsigned char)*token_end;
+            if (c >= 0x80) return _scan_token(self, dest);
+            if (!_kdl_is_whitespace(self->charset, c)) break;
+            ++token_end;
+        }
+        dest->type = KDL_TOKEN_WHITESPACE;
+    } else if (_kdl_is_newline(c)) {
+        // special treatment for CRLF
+        if (c == '\r' && token_end != end && *token_end == '\n') ++token_end;
+        dest->type = KDL_TOKEN_NEWLINE;
+    } else if ((cls & _KDL_CHAR_WORD) != 0) {
+        if ((c == 'r' || c == '#') && token_end != end && (*token_end == '"' || *token_end == '#')) {
+            // this *could* be a raw string
+            return _scan_token(self, dest);
+        }
+        while (true) {
+            token_end = _kdl_next_structural(&self->index, token_end - 1);
+            if (token_end == end) break;
+            c = (unsigned char)*token_end;
+            if (c >= 0x80) return _pop_word(self, dest);
+            cls = _kdl_char_class(self->charset, c);
+            if ((cls & _KDL_CHAR_END_OF_WORD) != 0) {
+                break;
+            } else if ((cls & _KDL_CHAR_WORD) == 0) {
+                // invalid character
+                return KDL_TOKENIZER_ERROR;
+            }
+            ++token_end;
+        }
+        dest->type = KDL_TOKEN_WORD;
+    } else {
+        switch (c) {
+        case ';':
+            // the semicolon token is empty, as in _scan_token
+            dest->type = KDL_TOKEN_SEMICOLON;
+            dest->value.data = cur;
+            dest->value.len = 0;
+            _update_doc_ptr(self, token_end);
+            return KDL_TOKENIZER_OK;
+        case '\\':
+            dest->type = KDL_TOKEN_LINE_CONTINUATION;
+            break;
+        case '(':
+            dest->type = KDL_TOKEN_START_TYPE;
+            break;
+        case ')':
+            dest->type = KDL_TOKEN_END_TYPE;
+            break;
+        case '{':
+            dest->type = KDL_TOKEN_START_CHILDREN;
+            break;
+        case '}':
+            dest->type = KDL_TOKEN_END_CHILDREN;
+            break;
+        case '=':
+            dest->type = KDL_TOKEN_EQUALS;
+            break;
+        case '/':
+            if (token_end == end || *token_end != '-') return _pop_comment(self, dest);
+            ++token_end;
+            dest->type = KDL_TOKEN_SLASHDASH;
+            break;
+        case '"':
+            if (token_end == end || *token_end == '"') {
+                // empty or multi-line string
+                return _pop_string(self, dest);
+            }
+            return _pop_indexed_string(self, dest);
+        default:
+            return _scan_token(self, dest);
+        }
+    }
+
+    dest->value.data = cur;
+    dest->value.len = (size_t)(token_end - cur);
+    _update_doc_ptr(self, token_end);
+    return KDL_TOKENIZER_OK;
+}
+
+// Printable ASCII characters without special meaning in a string
+static inline bool _is_plain_string_char(unsigned char c)
+{
+    return c >= 0x20 && c < 0x7F && c != '"' && c != '\\';
+}
+
+// Read a single-line, non-raw string using the structural index
+static kdl_tokenizer_status _pop_indexed_string(kdl_tokenizer* self, kdl_token* dest)
+{
+    char const* start = self->document.data + 1; // after the quote
+    char const* end = self->document.data + self->document.len;
+    char const* cur = self->document.data;
+    _kdl_structural_index* index = &self->index;
+
+    while (true) {
+        cur = _kdl_next_structural(index, cur);
+        if (cur == end) return _pop_string(self, dest);
+        // Skip the entries of printable ASCII text in the rest of the window
+        unsigned char c = (unsigned char)*cur;
+        size_t pos = index->pos;
+        while (_is_plain_string_char(c) && pos + 1 < index->len) {
+            cur = index->base + index->offsets[++pos];
+            c = (unsigned char)*cur;
+        }
+        index->pos = pos;
+
+        if (_is_plain_string_char(c)) {
+            continue;
+        } else if (c == '"') {
+            break;
+        } else if (c == '\\') {
+            // skip escaped backslashes and quotes
+            if (cur + 1 != end && (cur[1] == '\\' || cur[1] == '"')) ++cur;
+        } else if (c >= 0x80) {
+            uint32_t codepoint;
+            kdl_str rest = {cur, (size_t)(end - cur)};
+            if (_kdl_pop_codepoint(&rest, &codepoint) != KDL_UTF8_OK
+                || _kdl_is_illegal_char(self->charset, codepoint)) {
+                return _pop_string(self, dest);
+            }
+            cur = rest.data - 1;
+        } else if (_kdl_is_illegal_char(self->charset, c)) {
+            return KDL_TOKENIZER_ERROR;
+        }
+    }
+
+    dest->type = KDL_TOKEN_STRING;
+    dest->value.data = start;
+    dest->value.len = (size_t)(cur - start);
+    _update_doc_ptr(self, cur + 1);
+    return KDL_TOKENIZER_OK;
+}
+
 static kdl_tokenizer_status _pop_word(kdl_tokenizer* self, kdl_token* dest)
 {
     uint32_t c = 0;
     char const* cur = self->document.data;
     char const* next = NULL;
+    _kdl_ascii_class word_class
+        = self->charset == KDL_CHARACTER_SET_V1 ? KDL_ASCII_WORD_V1 : KDL_ASCII_WORD_V2;
 
     while (true) {
+        cur = _skip_ascii(self, word_class, cur);
         switch (_tok_get_char(self, &cur, &next, &c)) {
         case KDL_UTF8_OK:
             break;
@@ -574,6 +757,15 @@ static kdl_tokenizer_status _pop_string(kdl_tokenizer* self, kdl_token* dest)
     uint32_t prev_char = 0;
 
     while (true) {
+        // Fast path: skip over characters that can't end the string
+        char const* plain_end = _skip_ascii(self, KDL_ASCII_STRING_BODY, cur);
+        if (plain_end != cur) {
+            prev_char = (unsigned char)plain_end[-1];
+            quotes_found = hashes_found = 0;
+            end_quote_offset = 0;
+            cur = plain_end;
+        }
+
         switch (_tok_get_char(self, &cur, &next, &c)) {
         case KDL_UTF8_OK:
             break;
@@ -28,7 +28,7 @@ void print_usage(char const* argv0, FILE* fp)
 
 int main(int argc, char** argv)
 {
-    FILE* in = stdin;
+    char const* fn = NULL;
     char const* argv0 = argv[0];
     kdl_parse_option parse_opts = KDL_DETECT_VERSION;
     bool opts_ended = false;
@@ -57,16 +57,26 @@ int main(int argc, char** argv)
                 }
             }
         } else {
-            char const* fn = *argv;
+            fn = *argv;
+        }
+    }
+
+    FILE* in = NULL;
+    kdl_parser* parser;
+    if (fn == NULL) {
+        parser = kdl_create_stream_parser(&read_func, (void*)stdin, parse_opts);
+    } else {
+        parser = kdl_create_file_parser(fn, parse_opts);
+        if (parser == NULL) {
+            // Not a regular file (e.g. a pipe) or mapping failed: read it as a stream instead
             in = fopen(fn, "r");
             if (in == NULL) {
                 fprintf(stderr, "Error opening file \"%s\": %s\n", fn, strerror(errno));
                 return 1;
             }
+            parser = kdl_create_stream_parser(&read_func, (void*)in, parse_opts);
         }
     }
-
-    kdl_parser* parser = kdl_create_stream_parser(&read_func, (void*)in, parse_opts);
     kdl_emitter_options emitter_opts = KDL_DEFAULT_EMITTER_OPTIONS;
     emitter_opts.version = KDL_VERSION_2;
     kdl_emitter* emitter = kdl_create_stream_emitter(&write_func, NULL, &emitter_opts);
@@ -147,7 +157,7 @@ int main(int argc, char** argv)
     kdl_destroy_emitter(emitter);
     kdl_destroy_parser(parser);
 
-    if (in != stdin) {
+    if (in != NULL) {
         fclose(in);
     }
     return have_error ? 1 : 0;
@@ -20,25 +20,26 @@ static size_t write_func(void* user_data, char const* data, size_t nbytes)
 int main(int argc, char** argv)
 {
     FILE* in = NULL;
-    if (argc == 1) {
-        in = stdin;
+    kdl_tokenizer* tokenizer = NULL;
+    if (argc == 1 || (argc == 2 && strcmp(argv[1], "-") == 0)) {
+        tokenizer = kdl_create_stream_tokenizer(&read_func, (void*)stdin);
     } else if (argc == 2) {
         char const* fn = argv[1];
-        if (strcmp(fn, "-") == 0) {
-            in = stdin;
-        } else {
+        tokenizer = kdl_create_file_tokenizer(fn);
+        if (tokenizer == NULL) {
+            // Not a regular file (e.g. a pipe) or mapping failed: read it as a stream instead
             in = fopen(fn, "r");
             if (in == NULL) {
                 fprintf(stderr, "Error opening file \"%s\": %s\n", fn, strerror(errno));
                 return 1;
             }
+            tokenizer = kdl_create_stream_tokenizer(&read_func, (void*)in);
         }
     } else {
         fprintf(stderr, "Error: Too many arguments\n");
         return 2;
     }
 
-    kdl_tokenizer* tokenizer = kdl_create_stream_tokenizer(&read_func, (void*)in);
     kdl_emitter_options emitter_opts = KDL_DEFAULT_EMITTER_OPTIONS;
     emitter_opts.version = KDL_VERSION_2;
     kdl_emitter* emitter = kdl_create_stream_emitter(&write_func, NULL, &emitter_opts);
@@ -134,7 +135,7 @@ int main(int argc, char** argv)
 
     kdl_destroy_emitter(emitter);
     kdl_destroy_tokenizer(tokenizer);
-    if (in != stdin) {
+    if (in != NULL) {
         fclose(in);
     }
     return have_error ? 1 : 0;
@@ -2,7 +2,9 @@
 
 #include "test_util.h"
 
+#include <limits.h>
 #include <math.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -140,10 +142,452 @@ static void test_ascii_mode(void)
     ASSERT(memcmp(result.data, expected_str.data, result.len) == 0);
 }
 
+static void* counting_malloc(void* user_data, size_t size)
+{
+    ++*(long*)user_data;
+    return malloc(size);
+}
+
+static void* counting_realloc(void* user_data, void* ptr, size_t size)
+{
+    if (ptr == NULL) ++*(long*)user_data;
+    return realloc(ptr, size);
+}
+
+static void counting_free(void* user_data, void* ptr)
+{
+    --*(long*)user_data;
+    free(ptr);
+}
+
+static void test_custom_allocator(void)
+{
+    long n_live = 0;
+    kdl_allocator allocator = {&counting_malloc, &counting_realloc, &counting_free, &n_live};
+    kdl_emitter* emitter = kdl_create_buffering_emitter_ex(&KDL_DEFAULT_EMITTER_OPTIONS, &allocator);
+
+    ASSERT(emitter);
+    ASSERT(n_live > 0);
+    ASSERT(kdl_emit_node(emitter, kdl_str_from_cstr("node")));
+    ASSERT(kdl_emit_arg(emitter,
+        &(kdl_value){
+            .type = KDL_TYPE_NUMBER,
+            .number = (kdl_number){.type = KDL_NUMBER_TYPE_FLOATING_POINT, .floating_point = 1.5}
+    }));
+    ASSERT(kdl_emit_arg(
+        emitter, &(kdl_value){.type = KDL_TYPE_STRING, .string = kdl_str_from_cstr("tab\there")}));
+    ASSERT(kdl_emit_end(emitter));
+
+    kdl_str result = kdl_get_emitter_buffer(emitter);
+    char const* expected = "node 1.5 \"tab\\there\"\n";
+    ASSERT(strlen(expected) == result.len);
+    ASSERT(memcmp(result.data, expected, result.len) == 0);
+
+    kdl_destroy_emitter(emitter);
+    ASSERT(n_live == 0);
+
+    // Strings returned to the caller come from the same allocator
+    kdl_str s = kdl_str_from_cstr("a\\\\");
+    kdl_owned_string unesc = kdl_unescape_v_ex(KDL_VERSION_2, &s, &allocator);
+    ASSERT(n_live == 1);
+    ASSERT(unesc.len == 2 && memcmp(unesc.data, "a\\", 2) == 0);
+    kdl_owned_string clone = kdl_clone_str_ex(&s, &allocator);
+    ASSERT(n_live == 2);
+    kdl_free_string_ex(&unesc, &allocator);
+    kdl_free_string_ex(&clone, &allocator);
+    ASSERT(n_live == 0);
+    ASSERT(unesc.data == NULL && clone.data == NULL);
+}
+
+static void test_integers(void)
+{
+    struct {
+        long long i;
+        char const* expected;
+    } const cases[] = {
+        { 0, "0" },
+        { 7, "7" },
+        { -1, "-1" },
+        { 10, "10" },
+        { 100, "100" },
+        { -4096, "-4096" },
+        { 1234567890123LL, "1234567890123" },
+        { LLONG_MAX, "9223372036854775807" },
+        { LLONG_MIN, "-9223372036854775808" },
+    };
+
+    kdl_emitter* emitter = kdl_create_buffering_emitter(&KDL_DEFAULT_EMITTER_OPTIONS);
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        kdl_value v = {
+            .type = KDL_TYPE_NUMBER,
+            .number = (kdl_number){.type = KDL_NUMBER_TYPE_INTEGER, .integer = cases[i].i}
+        };
+        kdl_str before = kdl_get_emitter_buffer(emitter);
+        ASSERT(kdl_emit_node(emitter, kdl_str_from_cstr("n")));
+        ASSERT(kdl_emit_arg(emitter, &v));
+        ASSERT(kdl_emit_end(emitter));
+        kdl_str result = kdl_get_emitter_buffer(emitter);
+        // skip the earlier output, "n " and "\n"
+        size_t len = result.len - before.len - 3;
+        ASSERT2(len == strlen(cases[i].expected), cases[i].expected);
+        ASSERT2(memcmp(result.data + before.len + 2, cases[i].expected, len) == 0, cases[i].expected);
+    }
+    kdl_destroy_emitter(emitter);
+}
+
+static size_t discard(void* user_data, char const* data, size_t nbytes)
+{
+    (void)user_data;
+    (void)data;
+    return nbytes;
+}
+
+static void test_no_allocations(void)
+{
+    // once the scratch space has grown, a stream emitter should not allocate
+    long n_allocs = 0;
+    kdl_allocator allocator = {&counting_malloc, &counting_realloc, &counting_free, &n_allocs};
+    kdl_emitter* emitter
+        = kdl_create_stream_emitter_ex(&discard, NULL, &KDL_DEFAULT_EMITTER_OPTIONS, &allocator);
+    ASSERT(emitter);
+    long baseline = n_allocs;
+
+    kdl_value i = {
+        .type = KDL_TYPE_NUMBER,
+        .number = (kdl_number){.type = KDL_NUMBER_TYPE_INTEGER, .integer = -12345}
+    };
+    kdl_value s = {.type = KDL_TYPE_STRING, .string = kdl_str_from_cstr("\"quoted\"\n")};
+    for (int round = 0; round < 3; ++round) {
+        for (int d = 0; d < 5; ++d) {
+            ASSERT(kdl_emit_node_with_type(
+                emitter, kdl_str_from_cstr("my type"), kdl_str_from_cstr("a node")));
+            ASSERT(kdl_emit_arg(emitter, &i));
+            ASSERT(kdl_emit_property(emitter, kdl_str_from_cstr("a key"), &s));
+            ASSERT(kdl_start_emitting_children(emitter));
+        }
+        for (int d = 0; d < 5; ++d) {
+            ASSERT(kdl_finish_emitting_children(emitter));
+        }
+    }
+    ASSERT(kdl_emit_end(emitter));
+    ASSERT(n_allocs == baseline);
+
+    kdl_destroy_emitter(emitter);
+    ASSERT(n_allocs == 0);
+}
+
+struct write_log {
+    int n_calls;
+    size_t len;
+    char data[1024];
+};
+
+static size_t logging_write_func(void* user_data, char const* data, size_t nbytes)
+{
+    struct write_log* log = (struct write_log*)user_data;
+    ++log->n_calls;
+    if (log->len + nbytes > sizeof(log->data)) return 0;
+    memcpy(log->data + log->len, data, nbytes);
+    log->len += nbytes;
+    return nbytes;
+}
+
+static void emit_sample(kdl_emitter* emitter)
+{
+    kdl_value s = {
+        .type = KDL_TYPE_STRING, .string = kdl_str_from_cstr("a string that is longer than 16 bytes")};
+    kdl_value i = {
+        .type = KDL_TYPE_NUMBER,
+        .number = (kdl_number){.type = KDL_NUMBER_TYPE_INTEGER, .integer = 42}
+    };
+    for (int n = 0; n < 3; ++n) {
+        kdl_emit_node(emitter, kdl_str_from_cstr("node"));
+        kdl_emit_arg(emitter, &i);
+        kdl_emit_property(emitter, kdl_str_from_cstr("key"), &s);
+        kdl_start_emitting_children(emitter);
+        kdl_emit_node(emitter, kdl_str_from_cstr("child"));
+        kdl_finish_emitting_children(emitter);
+    }
+}
+
+static void test_write_buffering(void)
+{
+    // reference output
+    kdl_emitter* emitter = kdl_create_buffering_emitter(&KDL_DEFAULT_EMITTER_OPTIONS);
+    emit_sample(emitter);
+    ASSERT(kdl_emit_end(emitter));
+    kdl_str expected = kdl_get_emitter_buffer(emitter);
+
+    // unbuffered, small and default buffer sizes produce the same output
+    size_t const sizes[] = {0, 1, 16, 100, KDL_DEFAULT_EMITTER_OPTIONS.write_buffer_size};
+    int n_calls[sizeof(sizes) / sizeof(sizes[0])];
+    for (size_t k = 0; k < sizeof(sizes) / sizeof(sizes[0]); ++k) {
+        struct write_log log = {0};
+        kdl_emitter_options opts = KDL_DEFAULT_EMITTER_OPTIONS;
+        opts.write_buffer_size = sizes[k];
+        kdl_emitter* stream_emitter = kdl_create_stream_emitter(&logging_write_func, &log, &opts);
+        emit_sample(stream_emitter);
+        ASSERT(kdl_emit_end(stream_emitter));
+        ASSERT(log.len == expected.len);
+        ASSERT(memcmp(log.data, expected.data, expected.len) == 0);
+        n_calls[k] = log.n_calls;
+        kdl_destroy_emitter(stream_emitter);
+    }
+    ASSERT(n_calls[1] <= n_calls[0]);
+    ASSERT(n_calls[2] < n_calls[0]);
+    ASSERT(n_calls[3] < n_calls[2]);
+    ASSERT(n_calls[4] == 1);
+    kdl_destroy_emitter(emitter);
+
+    // nothing is written until the buffer is flushed
+    struct write_log log = {0};
+    emitter = kdl_create_stream_emitter(&logging_write_func, &log, &KDL_DEFAULT_EMITTER_OPTIONS);
+    ASSERT(kdl_emit_node(emitter, kdl_str_from_cstr("node")));
+    ASSERT(log.n_calls == 0);
+    ASSERT(kdl_emitter_flush(emitter));
+    ASSERT(log.n_calls == 1 && log.len == 4 && memcmp(log.data, "node", 4) == 0);
+    ASSERT(kdl_emitter_flush(emitter));
+    ASSERT(log.n_calls == 1);
+    ASSERT(kdl_emit_node(emitter, kdl_str_from_cstr("other")));
+    kdl_destroy_emitter(emitter);
+    ASSERT(log.n_calls == 2 && log.len == 11 && memcmp(log.data, "node\nother\n", 11) == 0);
+}
+
+static void test_string_escaping(void)
+{
+    // insert a character at every position in a string that spans several SIMD blocks
+    struct {
+        char const* raw;
+        char const* escaped;
+    } const cases[] = {
+        { "\"", "\\\"" },
+        { "\\", "\\\\" },
+        { "\n", "\\n" },
+        { "\t", "\\t" },
+        { "\x01", "\\u{1}" },
+        { "\x7f", "\\u{7f}" },
+        { "\xc3\xa9", "\xc3\xa9" }, // é
+    };
+    char const* plain = "The quick brown fox jumps over the lazy dog, and then some more text!";
+    size_t plain_len = strlen(plain);
+
+    kdl_emitter_options opts = KDL_DEFAULT_EMITTER_OPTIONS;
+    opts.write_buffer_size = 0;
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        size_t raw_len = strlen(cases[i].raw);
+        size_t esc_len = strlen(cases[i].escaped);
+        for (size_t pos = 0; pos <= plain_len; ++pos) {
+            char raw[128];
+            char expected[128];
+            memcpy(raw, plain, pos);
+            memcpy(raw + pos, cases[i].raw, raw_len);
+            memcpy(raw + pos + raw_len, plain + pos, plain_len - pos);
+            kdl_str raw_str = {raw, plain_len + raw_len};
+            expected[0] = '"';
+            memcpy(expected + 1, plain, pos);
+            memcpy(expected + 1 + pos, cases[i].escaped, esc_len);
+            memcpy(expected + 1 + pos + esc_len, plain + pos, plain_len - pos);
+            expected[1 + plain_len + esc_len] = '"';
+            size_t expected_len = plain_len + esc_len + 2;
+
+            kdl_owned_string esc = kdl_escape_v(KDL_VERSION_2, &raw_str, KDL_ESCAPE_DEFAULT);
+            ASSERT2(esc.len == expected_len - 2, cases[i].escaped);
+            ASSERT2(memcmp(esc.data, expected + 1, esc.len) == 0, cases[i].escaped);
+            kdl_free_string(&esc);
+
+            kdl_emitter* emitter = kdl_create_buffering_emitter(&opts);
+            kdl_value v = {.type = KDL_TYPE_STRING, .string = raw_str};
+            ASSERT(kdl_emit_node(emitter, kdl_str_from_cstr("n")));
+            ASSERT(kdl_emit_arg(emitter, &v));
+            kdl_str result = kdl_get_emitter_buffer(emitter);
+            ASSERT2(result.len == expected_len + 2, cases[i].escaped);
+            ASSERT2(memcmp(result.data + 2, expected, expected_len) == 0, cases[i].escaped);
+            kdl_destroy_emitter(emitter);
+        }
+    }
+
+    // invalid UTF-8 is an error, even after a long run of plain characters
+    char invalid[80];
+    memset(invalid, 'a', sizeof(invalid));
+    invalid[70] = (char)0xff;
+    kdl_str invalid_str = {invalid, sizeof(invalid)};
+    kdl_owned_string esc = kdl_escape_v(KDL_VERSION_2, &invalid_str, KDL_ESCAPE_DEFAULT);
+    ASSERT(esc.data == NULL);
+    esc = kdl_escape_v(KDL_VERSION_1, &invalid_str, KDL_ESCAPE_DEFAULT);
+    ASSERT(esc.data == NULL);
+}
+
+// 35 characters, so that the end of the identifier is in the second SIMD block
+#define LONG_ID "a_rather_long_node_name_of_35_bytes"
+
+static void test_bare_identifiers(void)
+{
+    struct {
+        kdl_version version;
+        kdl_identifier_emission_mode mode;
+        char const* name;
+        bool bare;
+    } const cases[] = {
+        { KDL_VERSION_2, KDL_PREFER_BARE_IDENTIFIERS, "node", true },
+        { KDL_VERSION_2, KDL_PREFER_BARE_IDENTIFIERS, "node-2.x", true },
+        { KDL_VERSION_2, KDL_PREFER_BARE_IDENTIFIERS, "1node", false },
+        { KDL_VERSION_2, KDL_PREFER_BARE_IDENTIFIERS, "#node", false },
+        { KDL_VERSION_2, KDL_PREFER_BARE_IDENTIFIERS, "no#de", false },
+        { KDL_VERSION_2, KDL_PREFER_BARE_IDENTIFIERS, "no de", false },
+        { KDL_VERSION_2, KDL_PREFER_BARE_IDENTIFIERS, "a<b>,c", true },
+        { KDL_VERSION_2, KDL_PREFER_BARE_IDENTIFIERS, "\xc3\xa9t\xc3\xa9", true }, // été
+        { KDL_VERSION_2, KDL_PREFER_BARE_IDENTIFIERS, "a\xe2\x80\xa8" "b", false }, // U+2028
+        { KDL_VERSION_2, KDL_PREFER_BARE_IDENTIFIERS, LONG_ID, true },
+        { KDL_VERSION_2, KDL_PREFER_BARE_IDENTIFIERS, LONG_ID "=s", false },
+        { KDL_VERSION_2, KDL_PREFER_BARE_IDENTIFIERS, LONG_ID "\xc3\xa9", true },
+        { KDL_VERSION_2, KDL_ASCII_IDENTIFIERS, LONG_ID "\xc3\xa9", false },
+        { KDL_VERSION_2, KDL_QUOTE_ALL_IDENTIFIERS, "node", false },
+        { KDL_VERSION_1, KDL_PREFER_BARE_IDENTIFIERS, "no#de", true },
+        { KDL_VERSION_1, KDL_PREFER_BARE_IDENTIFIERS, "a<b", false },
+        { KDL_VERSION_1, KDL_PREFER_BARE_IDENTIFIERS, LONG_ID ",", false },
+    };
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        kdl_emitter_options opts = KDL_DEFAULT_EMITTER_OPTIONS;
+        opts.version = cases[i].version;
+        opts.identifier_mode = cases[i].mode;
+        kdl_emitter* emitter = kdl_create_buffering_emitter(&opts);
+        ASSERT(kdl_emit_node(emitter, kdl_str_from_cstr(cases[i].name)));
+        kdl_str result = kdl_get_emitter_buffer(emitter);
+        size_t len = strlen(cases[i].name);
+        if (cases[i].bare) {
+            ASSERT2(result.len == len && memcmp(result.data, cases[i].name, len) == 0, cases[i].name);
+        } else {
+            ASSERT2(result.len > len && result.data[0] == '"', cases[i].name);
+        }
+        kdl_destroy_emitter(emitter);
+    }
+}
+
+static void test_indentation(void)
+{
+    kdl_emitter_options opts = KDL_DEFAULT_EMITTER_OPTIONS;
+    opts.indent = 3;
+    kdl_emitter* emitter = kdl_create_buffering_emitter(&opts);
+    ASSERT(kdl_emit_node(emitter, kdl_str_from_cstr("a")));
+    ASSERT(kdl_start_emitting_children(emitter));
+    ASSERT(kdl_emit_node(emitter, kdl_str_from_cstr("b")));
+    ASSERT(kdl_start_emitting_children(emitter));
+    ASSERT(kdl_emit_node(emitter, kdl_str_from_cstr("c")));
+    ASSERT(kdl_emit_node(emitter, kdl_str_from_cstr("d")));
+    ASSERT(kdl_emit_end(emitter));
+
+    kdl_str result = kdl_get_emitter_buffer(emitter);
+    char const* expected = "a {\n   b {\n      c\n      d\n   }\n}\n";
+    ASSERT(strlen(expected) == result.len);
+    ASSERT(memcmp(result.data, expected, result.len) == 0);
+    kdl_destroy_emitter(emitter);
+}
+
+static kdl_str emit_float(kdl_emitter* emitter, double f)
+{
+    kdl_value v = {
+        .type = KDL_TYPE_NUMBER,
+        .number = (kdl_number){.type = KDL_NUMBER_TYPE_FLOATING_POINT, .floating_point = f}
+    };
+    kdl_emit_node(emitter, kdl_str_from_cstr("n"));
+    kdl_emit_arg(emitter, &v);
+    kdl_emit_end(emitter);
+    kdl_str result = kdl_get_emitter_buffer(emitter);
+    // strip "n " and "\n"
+    return (kdl_str){result.data + 2, result.len - 3};
+}
+
+static void test_float_options(void)
+{
+    struct {
+        double f;
+        kdl_float_printing_options opts;
+        char const* expected;
+    } const cases[] = {
+        { 0.0, KDL_DEFAULT_EMITTER_OPTIONS.float_mode, "0.0" },
+        { 0.3, KDL_DEFAULT_EMITTER_OPTIONS.float_mode, "0.3" },
+        { -1.5, KDL_DEFAULT_EMITTER_OPTIONS.float_mode, "-1.5" },
+        { 123456789.0, KDL_DEFAULT_EMITTER_OPTIONS.float_mode, "1.23456789e8" },
+        { 9999.0, KDL_DEFAULT_EMITTER_OPTIONS.float_mode, "9999.0" },
+        { 1e-3, KDL_DEFAULT_EMITTER_OPTIONS.float_mode, "0.001" },
+        { 1.5e-4, KDL_DEFAULT_EMITTER_OPTIONS.float_mode, "1.5e-4" },
+        { 5e-324, KDL_DEFAULT_EMITTER_OPTIONS.float_mode, "5e-324" },
+        { 1.7976931348623157e308, KDL_DEFAULT_EMITTER_OPTIONS.float_mode, "1.7976931348623157e308" },
+        { 1e22, { false, false, false, false, false, 4 }, "1e22" },
+        { 100.0, { false, false, false, false, false, 4 }, "100" },
+        { 100.0, { true, false, false, false, false, 4 }, "100.0" },
+        { 1e22, { true, true, true, true, true, 4 }, "+1.0E+22" },
+        { 2.5e-7, { false, true, true, true, false, 4 }, "2.5E-7" },
+        { 12.5, { false, true, false, false, false, 0 }, "1.25e1" },
+        { 1.0, { false, true, false, false, false, 0 }, "1.0" },
+        { 1e21, { false, true, false, false, false, 25 }, "1000000000000000000000.0" },
+        { 1.25e-5, { false, true, false, false, false, 25 }, "0.0000125" },
+    };
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        kdl_emitter_options opts = KDL_DEFAULT_EMITTER_OPTIONS;
+        opts.float_mode = cases[i].opts;
+        kdl_emitter* emitter = kdl_create_buffering_emitter(&opts);
+        kdl_str result = emit_float(emitter, cases[i].f);
+        ASSERT2(result.len == strlen(cases[i].expected), cases[i].expected);
+        ASSERT2(memcmp(result.data, cases[i].expected, result.len) == 0, cases[i].expected);
+        kdl_destroy_emitter(emitter);
+    }
+}
+
+static void test_float_round_trip(void)
+{
+    kdl_emitter_options opts = KDL_DEFAULT_EMITTER_OPTIONS;
+    opts.float_mode.min_exponent = 1;
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    for (int i = 0; i < 100000; ++i) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        double f;
+        memcpy(&f, &state, sizeof(f));
+        if (isnan(f) || isinf(f)) continue;
+
+        kdl_emitter* emitter = kdl_create_buffering_emitter(&opts);
+        kdl_str result = emit_float(emitter, f);
+        char text[64];
+        ASSERT(result.len < sizeof(text));
+        memcpy(text, result.data, result.len);
+        text[result.len] = '\0';
+        kdl_destroy_emitter(emitter);
+
+        // the output reads back as the same number ...
+        double g = strtod(text, NULL);
+        ASSERT2(memcmp(&f, &g, sizeof(f)) == 0, text);
+
+        // ... and no shorter number does
+        int n_digits = 0;
+        for (char const* p = text; *p != '\0' && *p != 'e'; ++p) {
+            if (*p >= '0' && *p <= '9') ++n_digits;
+        }
+        if (n_digits > 1) {
+            char shorter[64];
+            snprintf(shorter, sizeof(shorter), "%.*e", n_digits - 2, f);
+            g = strtod(shorter, NULL);
+            ASSERT2(memcmp(&f, &g, sizeof(f)) != 0, text);
+        }
+    }
+}
+
 void TEST_MAIN(void)
 {
     run_test("Emitter: basics (v1)", &test_basics_v1);
     run_test("Emitter: basics (v2)", &test_basics_v2);
     run_test("Emitter: all types", &test_data_types);
     run_test("Emitter: ASCII mode", &test_ascii_mode);
+    run_test("Emitter: custom allocator", &test_custom_allocator);
+    run_test("Emitter: integers", &test_integers);
+    run_test("Emitter: no allocations while emitting", &test_no_allocations);
+    run_test("Emitter: indentation", &test_indentation);
+    run_test("Emitter: write buffering", &test_write_buffering);
+    run_test("Emitter: string escaping", &test_string_escaping);
+    run_test("Emitter: bare identifiers", &test_bare_identifiers);
+    run_test("Emitter: float formatting options", &test_float_options);
+    run_test("Emitter: floats are written with the fewest digits", &test_float_round_trip);
 }
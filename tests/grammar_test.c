@@ -0,0 +1,47 @@
+#include "grammar.h"
+#include "grammar_ref.h"
+
+#include "test_util.h"
+
+static kdl_character_set const CHARSETS[] = {KDL_CHARACTER_SET_V1, KDL_CHARACTER_SET_V2};
+
+static void test_tables_match_spec(void)
+{
+    for (int i = 0; i < 2; ++i) {
+        kdl_character_set cs = CHARSETS[i];
+        // all codepoints, plus some values beyond the end of Unicode
+        for (uint32_t c = 0; c < 0x110100; ++c) {
+            ASSERT(_kdl_is_whitespace(cs, c) == _kdl_ref_is_whitespace(cs, c));
+            ASSERT(_kdl_is_newline(c) == _kdl_ref_is_newline(c));
+            ASSERT(_kdl_is_word_char(cs, c) == _kdl_ref_is_word_char(cs, c));
+            ASSERT(_kdl_is_word_start(cs, c) == _kdl_ref_is_word_start(cs, c));
+            ASSERT(_kdl_is_id(cs, c) == _kdl_ref_is_id(cs, c));
+            ASSERT(_kdl_is_id_start(cs, c) == _kdl_ref_is_id_start(cs, c));
+            ASSERT(_kdl_is_end_of_word(cs, c) == _kdl_ref_is_end_of_word(cs, c));
+            ASSERT(_kdl_is_illegal_char(cs, c) == _kdl_ref_is_illegal_char(cs, c));
+        }
+        ASSERT(_kdl_is_illegal_char(cs, 0xFFFFFFFFu) == _kdl_ref_is_illegal_char(cs, 0xFFFFFFFFu));
+        ASSERT(_kdl_is_word_char(cs, 0xFFFFFFFFu) == _kdl_ref_is_word_char(cs, 0xFFFFFFFFu));
+    }
+}
+
+static void test_charset_differences(void)
+{
+    ASSERT(_kdl_is_whitespace(KDL_CHARACTER_SET_V1, 0xFEFF));
+    ASSERT(!_kdl_is_whitespace(KDL_CHARACTER_SET_V2, 0xFEFF));
+    ASSERT(_kdl_is_illegal_char(KDL_CHARACTER_SET_V2, 0xFEFF));
+    ASSERT(_kdl_is_whitespace(KDL_CHARACTER_SET_V2, '\v'));
+    ASSERT(!_kdl_is_whitespace(KDL_CHARACTER_SET_V1, '\v'));
+    ASSERT(_kdl_is_word_char(KDL_CHARACTER_SET_V2, ','));
+    ASSERT(!_kdl_is_word_char(KDL_CHARACTER_SET_V1, ','));
+    ASSERT(_kdl_is_id(KDL_CHARACTER_SET_V1, '#'));
+    ASSERT(!_kdl_is_id(KDL_CHARACTER_SET_V2, '#'));
+    ASSERT(_kdl_is_illegal_char(KDL_CHARACTER_SET_V2, 0xD800));
+    ASSERT(!_kdl_is_illegal_char(KDL_CHARACTER_SET_V1, 0xD800));
+}
+
+void TEST_MAIN(void)
+{
+    run_test("Grammar: lookup tables match the spec", &test_tables_match_spec);
+    run_test("Grammar: KDLv1 vs KDLv2 character sets", &test_charset_differences);
+}
@@ -0,0 +1,175 @@
+#include <kdl/kdl.h>
+
+#include "fs_util.h"
+#include "test_util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static bool same_str(kdl_str a, kdl_str b)
+{
+    return a.len == b.len && (a.len == 0 || memcmp(a.data, b.data, a.len) == 0);
+}
+
+static bool same_value(kdl_value const* a, kdl_value const* b)
+{
+    if (a->type != b->type || !same_str(a->type_annotation, b->type_annotation)) return false;
+    switch (a->type) {
+    case KDL_TYPE_BOOLEAN:
+        return a->boolean == b->boolean;
+    case KDL_TYPE_NUMBER:
+        if (a->number.type != b->number.type) return false;
+        switch (a->number.type) {
+        case KDL_NUMBER_TYPE_INTEGER:
+            return a->number.integer == b->number.integer;
+        case KDL_NUMBER_TYPE_FLOATING_POINT:
+            return memcmp(&a->number.floating_point, &b->number.floating_point, sizeof(double)) == 0;
+        default:
+            return same_str(a->number.string, b->number.string);
+        }
+    case KDL_TYPE_STRING:
+        return same_str(a->string, b->string);
+    default:
+        return true;
+    }
+}
+
+// Parse doc with a string parser and an indexed parser and check that the events are identical
+static void compare_parsers(kdl_str doc, kdl_parse_option opt, char const* name)
+{
+    kdl_parser* str_parser = kdl_create_string_parser(doc, opt);
+    kdl_parser* indexed_parser = kdl_create_indexed_parser(doc, opt);
+    ASSERT2(indexed_parser != NULL, name);
+
+    while (true) {
+        kdl_event_data* ev1 = kdl_parser_next_event(str_parser);
+        kdl_event_data* ev2 = kdl_parser_next_event(indexed_parser);
+        ASSERT2(ev1->event == ev2->event, name);
+        if (ev1->event == KDL_EVENT_PARSE_ERROR || ev1->event == KDL_EVENT_EOF) break;
+        ASSERT2(same_str(ev1->name, ev2->name), name);
+        ASSERT2(same_value(&ev1->value, &ev2->value), name);
+    }
+
+    kdl_destroy_parser(str_parser);
+    kdl_destroy_parser(indexed_parser);
+}
+
+static kdl_str read_file(char const* path)
+{
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL) return (kdl_str){NULL, 0};
+    fseek(fp, 0, SEEK_END);
+    long len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    char* data = malloc(len + 1);
+    size_t n = fread(data, 1, len, fp);
+    fclose(fp);
+    return (kdl_str){data, n};
+}
+
+static void check_test_documents(char const* dir)
+{
+    static kdl_parse_option const options[] = {
+        KDL_READ_VERSION_1,
+        KDL_READ_VERSION_2,
+        KDL_DETECT_VERSION,
+        KDL_DETECT_VERSION | KDL_BORROW_STRINGS,
+    };
+
+    char** filenames;
+    size_t n_files;
+    get_files_in_dir(dir, &filenames, &n_files, true);
+    ASSERT2(n_files > 0, dir);
+
+    size_t dir_len = strlen(dir);
+    for (size_t i = 0; i < n_files; ++i) {
+        char* path = malloc(dir_len + strlen(filenames[i]) + 2);
+        sprintf(path, "%s/%s", dir, filenames[i]);
+        kdl_str doc = read_file(path);
+        ASSERT2(doc.data != NULL, path);
+        for (size_t j = 0; j < sizeof(options) / sizeof(options[0]); ++j) {
+            compare_parsers(doc, options[j], path);
+        }
+        free((char*)doc.data);
+        free(path);
+    }
+    free(filenames);
+}
+
+static char const* test_documents_root(void)
+{
+    return test_argc() == 2 ? test_arg(1) : KDL_TEST_DOCUMENTS_ROOT;
+}
+
+static void test_upstream_v1(void)
+{
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/1.0.0/input", test_documents_root());
+    check_test_documents(path);
+}
+
+static void test_upstream_v2(void)
+{
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/2.0.0/input", test_documents_root());
+    check_test_documents(path);
+}
+
+static void test_events(void)
+{
+    kdl_str doc = kdl_str_from_cstr("\xEF\xBB\xBFnode-with-a-long-name \"arg\" key=0x10 {\n"
+                                    "    (t)child #true\v; other\xe2\x80\x83x /- y #\"raw\"# \\\n"
+                                    "        z=1.5\n}\n");
+    kdl_parser* parser = kdl_create_indexed_parser(doc, KDL_READ_VERSION_2);
+    ASSERT(parser != NULL);
+
+    kdl_event_data* ev = kdl_parser_next_event(parser);
+    ASSERT(ev->event == KDL_EVENT_START_NODE);
+    ASSERT(same_str(ev->name, kdl_str_from_cstr("node-with-a-long-name")));
+    ev = kdl_parser_next_event(parser);
+    ASSERT(ev->event == KDL_EVENT_ARGUMENT);
+    ASSERT(same_str(ev->value.string, kdl_str_from_cstr("arg")));
+    ev = kdl_parser_next_event(parser);
+    ASSERT(ev->event == KDL_EVENT_PROPERTY);
+    ASSERT(ev->value.number.integer == 16);
+    ev = kdl_parser_next_event(parser);
+    ASSERT(ev->event == KDL_EVENT_START_NODE);
+    ASSERT(same_str(ev->value.type_annotation, kdl_str_from_cstr("t")));
+    ev = kdl_parser_next_event(parser);
+    ASSERT(ev->event == KDL_EVENT_ARGUMENT);
+    ASSERT(ev->value.type == KDL_TYPE_BOOLEAN && ev->value.boolean);
+    ev = kdl_parser_next_event(parser);
+    ASSERT(ev->event == KDL_EVENT_END_NODE);
+    ev = kdl_parser_next_event(parser);
+    ASSERT(ev->event == KDL_EVENT_START_NODE);
+    ASSERT(same_str(ev->name, kdl_str_from_cstr("other")));
+    ev = kdl_parser_next_event(parser);
+    ASSERT(ev->event == KDL_EVENT_ARGUMENT);
+    ASSERT(same_str(ev->value.string, kdl_str_from_cstr("x")));
+    ev = kdl_parser_next_event(parser);
+    ASSERT(ev->event == KDL_EVENT_ARGUMENT);
+    ASSERT(same_str(ev->value.string, kdl_str_from_cstr("raw")));
+    ev = kdl_parser_next_event(parser);
+    ASSERT(ev->event == KDL_EVENT_PROPERTY);
+    ASSERT(ev->value.number.floating_point == 1.5);
+    ev = kdl_parser_next_event(parser);
+    ASSERT(ev->event == KDL_EVENT_END_NODE);
+    ev = kdl_parser_next_event(parser);
+    ASSERT(ev->event == KDL_EVENT_END_NODE);
+    ev = kdl_parser_next_event(parser);
+    ASSERT(ev->event == KDL_EVENT_EOF);
+    kdl_destroy_parser(parser);
+
+    // empty document
+    parser = kdl_create_indexed_parser((kdl_str){"", 0}, KDL_DEFAULTS);
+    ASSERT(kdl_parser_next_event(parser)->event == KDL_EVENT_EOF);
+    kdl_destroy_parser(parser);
+}
+
+void TEST_MAIN(void)
+{
+    run_test("Indexed parser: events", &test_events);
+    run_test("Indexed parser: upstream test documents (KDLv1)", &test_upstream_v1);
+    run_test("Indexed parser: upstream test documents (KDLv2)", &test_upstream_v2);
+}
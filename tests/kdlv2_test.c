@@ -226,6 +226,8 @@ static void test_multiline_strings(void)
     kdl_str invalid_strings[] = {
         kdl_str_from_cstr("\na\n  "),         // indent missing at start
         kdl_str_from_cstr("\n  \r\t\ta\n  "), // indent wrong in middle
+        kdl_str_from_cstr("\n  a\n  \\\\  "),  // escaped backslash on last line
+        kdl_str_from_cstr("\n  a\n  \\"),      // stray backslash at the end
     };
     int n_invalid_strings = sizeof(invalid_strings) / sizeof(invalid_strings[0]);
 
@@ -246,6 +248,11 @@ static void test_multiline_strings(void)
         {kdl_str_from_cstr("\n  \n     \n  "),    kdl_str_from_cstr("\n")     }, // empty line with extra ws
         {kdl_str_from_cstr("\n  \n\t\n  "),       kdl_str_from_cstr("\n")     }, // empty line with odd whitespace
         {kdl_str_from_cstr("\n  \n  \\s   \n  "), kdl_str_from_cstr("\n    ") }, // whitespace only
+        {kdl_str_from_cstr("\r\n  a\r\n  b\r\n  "), kdl_str_from_cstr("a\nb")   }, // CRLF
+        {kdl_str_from_cstr("\n  a\xc2\x85  b\n  "), kdl_str_from_cstr("a\nb")   }, // NEL
+        {kdl_str_from_cstr("\n\xe3\x80\x80" "a\n\xe3\x80\x80"), kdl_str_from_cstr("a")}, // unicode indent
+        {kdl_str_from_cstr("\n  a\n  \\  \n"),   kdl_str_from_cstr("a")      }, // escaped final newline
+        {kdl_str_from_cstr("\n  a\\u{\\\n  62}\n  "), kdl_str_from_cstr("ab")}, // escaped ws in \u{}
     };
     int n_edge_cases = sizeof(edge_cases) / sizeof(edge_cases[0]);
 
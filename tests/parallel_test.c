@@ -0,0 +1,281 @@
+#include <kdl/kdl.h>
+
+#include "fs_util.h"
+#include "test_util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A growing text buffer
+struct text {
+    char* data;
+    size_t len;
+};
+
+static void append(struct text* t, char const* data, size_t len)
+{
+    t->data = realloc(t->data, t->len + len + 1);
+    memcpy(t->data + t->len, data, len);
+    t->len += len;
+    t->data[t->len] = '\0';
+}
+
+static void append_str(struct text* t, kdl_str s)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "[%zu]", s.len);
+    append(t, buf, strlen(buf));
+    if (s.data != NULL) append(t, s.data, s.len);
+}
+
+// Write a description of an event (except EOF)
+static void dump_event(struct text* t, kdl_event_data const* ev)
+{
+    if (ev->event == KDL_EVENT_EOF) return;
+    char buf[64];
+    snprintf(buf, sizeof(buf), "\n%d %d ", (int)ev->event, (int)ev->value.type);
+    append(t, buf, strlen(buf));
+    append_str(t, ev->name);
+    append_str(t, ev->value.type_annotation);
+    switch (ev->value.type) {
+    case KDL_TYPE_BOOLEAN:
+        append(t, ev->value.boolean ? "T" : "F", 1);
+        break;
+    case KDL_TYPE_NUMBER:
+        switch (ev->value.number.type) {
+        case KDL_NUMBER_TYPE_INTEGER:
+            snprintf(buf, sizeof(buf), "%lld", (long long)ev->value.number.integer);
+            break;
+        case KDL_NUMBER_TYPE_FLOATING_POINT:
+            snprintf(buf, sizeof(buf), "%.17g", ev->value.number.floating_point);
+            break;
+        default:
+            append_str(t, ev->value.number.string);
+            buf[0] = '\0';
+            break;
+        }
+        append(t, buf, strlen(buf));
+        break;
+    case KDL_TYPE_STRING:
+        if (ev->event != KDL_EVENT_PARSE_ERROR) append_str(t, ev->value.string);
+        break;
+    default:
+        break;
+    }
+}
+
+struct chunk_results {
+    struct text* chunks;
+    size_t max_chunks;
+};
+
+// Each chunk is only ever touched by one thread
+static bool record_event(void* user_data, size_t chunk_index, kdl_event_data* event)
+{
+    struct chunk_results* results = user_data;
+    if (chunk_index >= results->max_chunks) return false;
+    dump_event(&results->chunks[chunk_index], event);
+    return true;
+}
+
+// Parse sequentially; returns false if the document is invalid
+static bool parse_sequentially(kdl_str doc, kdl_parse_option opt, struct text* out)
+{
+    kdl_parser* parser = kdl_create_string_parser(doc, opt);
+    kdl_event_data* ev;
+    do {
+        ev = kdl_parser_next_event(parser);
+        dump_event(out, ev);
+    } while (ev->event != KDL_EVENT_EOF && ev->event != KDL_EVENT_PARSE_ERROR);
+    bool ok = ev->event == KDL_EVENT_EOF;
+    kdl_destroy_parser(parser);
+    return ok;
+}
+
+// Parse in parallel and put the chunks back together
+static bool parse_in_parallel(kdl_str doc, kdl_parse_option opt, size_t chunk_size, struct text* out)
+{
+    kdl_parallel_options popt = {4, chunk_size};
+    struct chunk_results results;
+    results.max_chunks = doc.len / chunk_size + 1;
+    results.chunks = calloc(results.max_chunks, sizeof(struct text));
+    bool ok = kdl_parse_parallel(doc, opt, &popt, &record_event, &results);
+    for (size_t i = 0; i < results.max_chunks; ++i) {
+        if (results.chunks[i].data != NULL) append(out, results.chunks[i].data, results.chunks[i].len);
+        free(results.chunks[i].data);
+    }
+    free(results.chunks);
+    return ok;
+}
+
+static void check_same_result(kdl_str doc, kdl_parse_option opt, char const* name)
+{
+    struct text expected = {NULL, 0};
+    bool valid = parse_sequentially(doc, opt, &expected);
+
+    size_t const chunk_sizes[] = {1, 64, 1 << 20};
+    for (size_t i = 0; i < sizeof(chunk_sizes) / sizeof(chunk_sizes[0]); ++i) {
+        struct text actual = {NULL, 0};
+        bool ok = parse_in_parallel(doc, opt, chunk_sizes[i], &actual);
+        if (valid) {
+            ASSERT2(ok, name);
+            ASSERT2(actual.len == expected.len
+                    && (actual.len == 0 || memcmp(actual.data, expected.data, actual.len) == 0),
+                name);
+        } else {
+            ASSERT2(!ok, name);
+        }
+        free(actual.data);
+    }
+    free(expected.data);
+}
+
+static kdl_str read_file(char const* path)
+{
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL) return (kdl_str){NULL, 0};
+    fseek(fp, 0, SEEK_END);
+    long len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    char* data = malloc(len + 1);
+    size_t n = fread(data, 1, len, fp);
+    fclose(fp);
+    return (kdl_str){data, n};
+}
+
+static void check_test_documents(char const* dir, kdl_parse_option opt)
+{
+    char** filenames;
+    size_t n_files;
+    get_files_in_dir(dir, &filenames, &n_files, true);
+    ASSERT2(n_files > 0, dir);
+
+    // Each document on its own, and all valid documents concatenated
+    struct text all = {NULL, 0};
+    size_t dir_len = strlen(dir);
+    for (size_t i = 0; i < n_files; ++i) {
+        char* path = malloc(dir_len + strlen(filenames[i]) + 2);
+        sprintf(path, "%s/%s", dir, filenames[i]);
+        kdl_str doc = read_file(path);
+        ASSERT2(doc.data != NULL, path);
+        check_same_result(doc, opt, path);
+
+        struct text ignored = {NULL, 0};
+        if (parse_sequentially(doc, opt, &ignored) && (doc.len < 3 || memcmp(doc.data, "\xEF\xBB\xBF", 3) != 0)) {
+            append(&all, doc.data, doc.len);
+            append(&all, "\n", 1);
+        }
+        free(ignored.data);
+        free((char*)doc.data);
+        free(path);
+    }
+    free(filenames);
+
+    check_same_result((kdl_str){all.data, all.len}, opt, dir);
+    free(all.data);
+}
+
+static char const* test_documents_root(void)
+{
+    return test_argc() == 2 ? test_arg(1) : KDL_TEST_DOCUMENTS_ROOT;
+}
+
+static void test_upstream_v1(void)
+{
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/1.0.0/input", test_documents_root());
+    check_test_documents(path, KDL_READ_VERSION_1);
+}
+
+static void test_upstream_v2(void)
+{
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/2.0.0/input", test_documents_root());
+    check_test_documents(path, KDL_READ_VERSION_2);
+}
+
+static void test_tricky_splits(void)
+{
+    // Newlines which don't end a top-level node
+    char const* const docs[] = {
+        "a \"x\ny\" \"\\\"\n\"\nb r#\"\n\"\n\"# r\"\n\"\nc /* \n\n /* \n */ \n*/ 1\nd // \"\ne\n", // KDLv1
+        "a \"\"\"\n  \"\n  \\\"\"\"\n  \"\"\"\nb #\"\"\"\n  \"\"\"\n  \"\"\"#\nc \\\n  1 \\ // x\n  2\n"
+        "d /-\n\n  1 2\ne { f\n g { h\n }\n }\nk 1\n/-\nl\n#\"\n\"# m\nn\n",
+    };
+    check_same_result(kdl_str_from_cstr(docs[0]), KDL_READ_VERSION_1, docs[0]);
+    check_same_result(kdl_str_from_cstr(docs[1]), KDL_READ_VERSION_2, docs[1]);
+    check_same_result(kdl_str_from_cstr(docs[1]), KDL_DETECT_VERSION, docs[1]);
+}
+
+static bool count_chunks(void* user_data, size_t chunk_index, kdl_event_data* event)
+{
+    (void)event;
+    size_t* max_index = user_data;
+    // benign race: only used with one thread
+    if (chunk_index > *max_index) *max_index = chunk_index;
+    return true;
+}
+
+static bool stop_at_second_node(void* user_data, size_t chunk_index, kdl_event_data* event)
+{
+    (void)chunk_index;
+    (void)user_data;
+    return !(event->event == KDL_EVENT_START_NODE && event->name.len == 1 && event->name.data[0] == 'b');
+}
+
+static void test_chunks(void)
+{
+    kdl_str doc = kdl_str_from_cstr("a 1\nb 2\nc 3 {\n  d\n}\ne 4\n");
+
+    // one chunk per top-level node
+    size_t max_index = 0;
+    kdl_parallel_options popt = {1, 1};
+    ASSERT(kdl_parse_parallel(doc, KDL_DEFAULTS, &popt, &count_chunks, &max_index));
+    ASSERT(max_index == 3);
+
+    // everything in one chunk
+    max_index = 0;
+    ASSERT(kdl_parse_parallel(doc, KDL_DEFAULTS, NULL, &count_chunks, &max_index));
+    ASSERT(max_index == 0);
+
+    // the callback can stop the parser
+    ASSERT(!kdl_parse_parallel(doc, KDL_DEFAULTS, &popt, &stop_at_second_node, NULL));
+
+    // an empty document has one empty chunk
+    max_index = 0;
+    ASSERT(kdl_parse_parallel(kdl_str_from_cstr(""), KDL_DEFAULTS, &popt, &count_chunks, &max_index));
+    ASSERT(max_index == 0);
+}
+
+static void test_version_detection(void)
+{
+    // Chunks in either version, or in neither; the version is only known from the second chunk on
+    char const* const docs[] = {
+        "a 1\nb r\"raw\"\nc true\nd \"x\"\n",  // KDLv1
+        "a 1\nb #\"raw\"#\nc #true\nd \"x\"\n", // KDLv2
+        "a 1\nb r\"raw\"\nc 2\nd #true\n",      // mixed
+        "a 1\nb #true\nc 2\nd r\"raw\"\n",      // mixed
+    };
+    for (size_t i = 0; i < sizeof(docs) / sizeof(docs[0]); ++i) {
+        check_same_result(kdl_str_from_cstr(docs[i]), KDL_DETECT_VERSION, docs[i]);
+    }
+
+    // one chunk per node
+    kdl_parallel_options popt = {1, 1};
+    size_t max_index = 0;
+    kdl_str v2_doc = kdl_str_from_cstr(docs[1]);
+    ASSERT(kdl_parse_parallel(v2_doc, KDL_DETECT_VERSION, &popt, &count_chunks, &max_index));
+    ASSERT(max_index == 3);
+    kdl_str mixed_doc = kdl_str_from_cstr(docs[3]);
+    ASSERT(!kdl_parse_parallel(mixed_doc, KDL_DEFAULTS, &popt, &count_chunks, &max_index));
+}
+
+void TEST_MAIN(void)
+{
+    run_test("Parallel: chunks", &test_chunks);
+    run_test("Parallel: newlines that don't end nodes", &test_tricky_splits);
+    run_test("Parallel: version detection", &test_version_detection);
+    run_test("Parallel: upstream test documents (KDLv1)", &test_upstream_v1);
+    run_test("Parallel: upstream test documents (KDLv2)", &test_upstream_v2);
+}
@@ -2,7 +2,10 @@
 
 #include "test_util.h"
 
+#include <math.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 static void test_basics(void)
@@ -354,7 +357,7 @@ static void test_parser_detects_version(void)
 
     kdl_str doc_v1 = kdl_str_from_cstr(kdl_text_v1);
     kdl_parser* parser_v1 = kdl_create_string_parser(doc_v1, KDL_DEFAULTS);
-
+    ASSERT(kdl_parser_get_version(parser_v1) == KDL_DETECT_VERSION);
 
     ev = kdl_parser_next_event(parser_v1);
     ASSERT(ev->event == KDL_EVENT_START_NODE);
@@ -365,6 +368,7 @@ static void test_parser_detects_version(void)
 
     ev = kdl_parser_next_event(parser_v1);
     ASSERT(ev->event == KDL_EVENT_EOF);
+    ASSERT(kdl_parser_get_version(parser_v1) == KDL_READ_VERSION_1);
 
     kdl_destroy_parser(parser_v1);
 
@@ -384,8 +388,55 @@ static void test_parser_detects_version(void)
 
     ev = kdl_parser_next_event(parser_v2);
     ASSERT(ev->event == KDL_EVENT_EOF);
+    ASSERT(kdl_parser_get_version(parser_v2) == KDL_READ_VERSION_2);
 
     kdl_destroy_parser(parser_v2);
+
+    // valid in both versions
+    kdl_parser* parser_any = kdl_create_string_parser(kdl_str_from_cstr("node 1 \"a\""), KDL_DEFAULTS);
+    do {
+        ev = kdl_parser_next_event(parser_any);
+    } while (ev->event != KDL_EVENT_EOF && ev->event != KDL_EVENT_PARSE_ERROR);
+    ASSERT(ev->event == KDL_EVENT_EOF);
+    ASSERT(kdl_parser_get_version(parser_any) == KDL_DETECT_VERSION);
+    kdl_destroy_parser(parser_any);
+
+    // invalid in both versions: a bare .0 is an identifier in KDLv1, and banned in KDLv2
+    kdl_parser* parser_neither = kdl_create_string_parser(kdl_str_from_cstr("node .0"), KDL_DEFAULTS);
+    do {
+        ev = kdl_parser_next_event(parser_neither);
+    } while (ev->event != KDL_EVENT_EOF && ev->event != KDL_EVENT_PARSE_ERROR);
+    ASSERT(ev->event == KDL_EVENT_PARSE_ERROR);
+    kdl_destroy_parser(parser_neither);
+
+    // bidi controls (here U+2066) are only illegal in KDLv2
+    kdl_str doc_lri = kdl_str_from_cstr("node1\xe2\x81\xa6"
+                                        "arg");
+    kdl_parser* parser_lri = kdl_create_string_parser(doc_lri, KDL_DEFAULTS);
+    ev = kdl_parser_next_event(parser_lri);
+    ASSERT(ev->event == KDL_EVENT_START_NODE && ev->name.len == 11);
+    ASSERT(kdl_parser_get_version(parser_lri) == KDL_READ_VERSION_1);
+    kdl_destroy_parser(parser_lri);
+
+    // multi-line strings are KDLv2 only
+    kdl_str doc_ml = kdl_str_from_cstr("n \"\"\"\n  x\n  \"\"\"\n");
+    kdl_parser* parser_ml = kdl_create_string_parser(doc_ml, KDL_DEFAULTS);
+    do {
+        ev = kdl_parser_next_event(parser_ml);
+    } while (ev->event != KDL_EVENT_EOF && ev->event != KDL_EVENT_PARSE_ERROR);
+    ASSERT(ev->event == KDL_EVENT_EOF);
+    ASSERT(kdl_parser_get_version(parser_ml) == KDL_READ_VERSION_2);
+    kdl_destroy_parser(parser_ml);
+
+    // ... so a newline (here U+2028) in a single-line string after one is an error
+    kdl_str doc_ml_v1 = kdl_str_from_cstr("n \"\"\"\n  x\n  \"\"\" \"a\xe2\x80\xa8"
+                                          "b\"");
+    kdl_parser* parser_ml_v1 = kdl_create_string_parser(doc_ml_v1, KDL_DEFAULTS);
+    do {
+        ev = kdl_parser_next_event(parser_ml_v1);
+    } while (ev->event != KDL_EVENT_EOF && ev->event != KDL_EVENT_PARSE_ERROR);
+    ASSERT(ev->event == KDL_EVENT_PARSE_ERROR);
+    kdl_destroy_parser(parser_ml_v1);
 }
 
 static void test_extreme_float(void)
@@ -415,6 +466,729 @@ static void test_extreme_float(void)
     kdl_destroy_parser(parser);
 }
 
+static void test_integers(void)
+{
+    struct {
+        char const* text;
+        bool valid;
+        bool fits;
+        long long value;
+        char const* encoded;
+    } const cases[] = {
+        { "0", true, true, 0, NULL },
+        { "-12", true, true, -12, NULL },
+        { "+1_000", true, true, 1000, NULL },
+        { "1234567890123", true, true, 1234567890123LL, NULL },
+        { "1234_5678_9012_3456", true, true, 1234567890123456LL, NULL },
+        { "12345678_", true, true, 12345678, NULL },
+        { "9223372036854775807", true, true, 9223372036854775807LL, NULL },
+        { "-9223372036854775807", true, true, -9223372036854775807LL, NULL },
+        { "9223372036854775808", true, false, 0, "9223372036854775808" },
+        { "-9223372036854775808", true, false, 0, "-9223372036854775808" },
+        { "123456789012345678901", true, false, 0, "123456789012345678901" },
+        { "0x7fff_ffff_ffff_FFFF", true, true, 0x7fffffffffffffffLL, NULL },
+        { "-0xdead_beef", true, true, -0xdeadbeefLL, NULL },
+        { "0x8000000000000000", true, false, 0, "9223372036854775808" },
+        { "0o777", true, true, 0777, NULL },
+        { "0b1010_1010", true, true, 0xaa, NULL },
+        { "12345678a", false, false, 0, NULL },
+        { "1234567812345678x", false, false, 0, NULL },
+        { "0o8", false, false, 0, NULL },
+        { "0b102", false, false, 0, NULL },
+        { "0xg", false, false, 0, NULL },
+        { "0x_1", false, false, 0, NULL },
+    };
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "node %s", cases[i].text);
+        kdl_parser* parser = kdl_create_string_parser(kdl_str_from_cstr(buf), KDL_READ_VERSION_2);
+
+        kdl_event_data* ev = kdl_parser_next_event(parser);
+        ASSERT(ev->event == KDL_EVENT_START_NODE);
+        ev = kdl_parser_next_event(parser);
+        if (!cases[i].valid) {
+            ASSERT(ev->event == KDL_EVENT_PARSE_ERROR);
+        } else {
+            ASSERT(ev->event == KDL_EVENT_ARGUMENT);
+            ASSERT(ev->value.type == KDL_TYPE_NUMBER);
+            if (cases[i].fits) {
+                ASSERT(ev->value.number.type == KDL_NUMBER_TYPE_INTEGER);
+                ASSERT(ev->value.number.integer == cases[i].value);
+            } else {
+                ASSERT(ev->value.number.type == KDL_NUMBER_TYPE_STRING_ENCODED);
+                kdl_str expected = kdl_str_from_cstr(cases[i].encoded);
+                ASSERT(ev->value.number.string.len == expected.len);
+                ASSERT(memcmp(ev->value.number.string.data, expected.data, expected.len) == 0);
+            }
+        }
+
+        kdl_destroy_parser(parser);
+    }
+}
+
+static bool parse_float_arg(char const* text, double* result)
+{
+    char buf[128];
+    snprintf(buf, sizeof(buf), "node %s", text);
+    kdl_parser* parser = kdl_create_string_parser(kdl_str_from_cstr(buf), KDL_READ_VERSION_2);
+    kdl_event_data* ev = kdl_parser_next_event(parser);
+    ev = kdl_parser_next_event(parser);
+    bool ok = ev->event == KDL_EVENT_ARGUMENT && ev->value.type == KDL_TYPE_NUMBER
+        && ev->value.number.type == KDL_NUMBER_TYPE_FLOATING_POINT;
+    if (ok) *result = ev->value.number.floating_point;
+    kdl_destroy_parser(parser);
+    return ok;
+}
+
+static bool same_double(double a, double b) { return memcmp(&a, &b, sizeof(double)) == 0; }
+
+static void test_float_round_trip(void)
+{
+    // hard cases: exactly halfway between two doubles, subnormals, many digits
+    static char const* const fixed_cases[] = {
+        "0.1",
+        "9007199254740993.0",
+        "9007199254740993.000000000000000000000000001",
+        "9_007_199_254_740_995.0",
+        "2.2250738585072011e-308",
+        "2.2250738585072014e-308",
+        "4.9406564584124654e-324",
+        "1.7976931348623157e308",
+        "0.000000000000000000000000000000000000000000001e10",
+        "3.14159265358979323846264338327950288419716939937510582097494459",
+        "1.00000000000000011102230246251565404236316680908203125",
+        "1.00000000000000011102230246251565404236316680908203124",
+        "1.00000000000000011102230246251565404236316680908203126",
+        "-0.0",
+    };
+    for (size_t i = 0; i < sizeof(fixed_cases) / sizeof(fixed_cases[0]); ++i) {
+        double d = 0.0;
+        ASSERT2(parse_float_arg(fixed_cases[i], &d), fixed_cases[i]);
+        char plain[128];
+        size_t k = 0;
+        for (char const* p = fixed_cases[i]; *p; ++p) {
+            if (*p != '_') plain[k++] = *p;
+        }
+        plain[k] = 0;
+        ASSERT2(same_double(d, strtod(plain, NULL)), fixed_cases[i]);
+    }
+
+    // random doubles, written with 17 significant digits, and random decimal strings
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    for (int i = 0; i < 100000; ++i) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        char text[64];
+        if (i % 2 == 0) {
+            double d;
+            memcpy(&d, &state, sizeof(d));
+            if (isnan(d) || isinf(d)) continue;
+            snprintf(text, sizeof(text), "%.17e", d);
+        } else {
+            int n_digits = 1 + (int)(state % 25);
+            int exponent = (int)((state >> 8) % 600) - 300;
+            uint64_t digits = state >> 16;
+            size_t k = 0;
+            text[k++] = (char)('1' + digits % 9);
+            text[k++] = '.';
+            for (int j = 1; j < n_digits; ++j) {
+                digits = digits * 6364136223846793005ULL + 1442695040888963407ULL;
+                text[k++] = (char)('0' + (digits >> 60) % 10);
+            }
+            snprintf(text + k, sizeof(text) - k, "0e%d", exponent);
+        }
+        double d = 0.0;
+        ASSERT2(parse_float_arg(text, &d), text);
+        ASSERT2(same_double(d, strtod(text, NULL)), text);
+    }
+}
+
+// Parse the document, which must consist of a single node with one argument, and return the argument
+// (or {NULL, 0} on a parse error)
+static kdl_owned_string parse_string_arg(kdl_str doc, kdl_parse_option opt)
+{
+    kdl_owned_string result = {NULL, 0};
+    kdl_parser* parser = kdl_create_string_parser(doc, opt);
+    kdl_event_data* ev = kdl_parser_next_event(parser);
+    if (ev->event == KDL_EVENT_START_NODE) {
+        ev = kdl_parser_next_event(parser);
+        if (ev->event == KDL_EVENT_ARGUMENT && ev->value.type == KDL_TYPE_STRING) {
+            result = kdl_clone_str(&ev->value.string);
+        }
+    }
+    kdl_destroy_parser(parser);
+    return result;
+}
+
+static void test_string_escapes(void)
+{
+    // random strings made of pieces which KDLv1 and KDLv2 treat differently, parsed with version
+    // detection: the value must be the one kdl_unescape_v() gives for a version that accepts it
+    static char const* const pieces[] = {
+        "a",
+        "plain text that is long enough to fill a vector register",
+        "#",
+        " ",
+        "\\n",
+        "\\t",
+        "\\\\",
+        "\\\"",
+        "\\/",
+        "\\s",
+        "\\ \t ",
+        "\\\n  ",
+        "\\u{e9}",
+        "\\u{1F600}",
+        "\\u{D800}",
+        "\\u{110000}",
+        "\\u{}",
+        "\\u{\\ 41}",
+        "\\u{zz}",
+        "\\q",
+        "\n",
+        "\t",
+        "\xc3\xa9",
+        "\xe2\x80\xa8",
+    };
+    size_t const n_pieces = sizeof(pieces) / sizeof(pieces[0]);
+
+    uint64_t state = 0x2545F4914F6CDD1DULL;
+    for (int i = 0; i < 20000; ++i) {
+        char doc_buf[512] = "n \"";
+        size_t len = 3;
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        int count = 1 + (int)(state % 6);
+        uint64_t choice = state >> 8;
+        for (int k = 0; k < count; ++k) {
+            char const* piece = pieces[choice % n_pieces];
+            choice /= n_pieces;
+            memcpy(doc_buf + len, piece, strlen(piece));
+            len += strlen(piece);
+        }
+        doc_buf[len++] = 'x';
+        kdl_str raw = {doc_buf + 3, len - 3};
+        doc_buf[len++] = '"';
+        kdl_str doc = {doc_buf, len};
+
+        kdl_owned_string v1 = kdl_unescape_v(KDL_VERSION_1, &raw);
+        kdl_owned_string v2 = kdl_unescape_v(KDL_VERSION_2, &raw);
+        kdl_owned_string const* either = v2.data != NULL ? &v2 : &v1;
+
+        struct {
+            kdl_parse_option opt;
+            kdl_owned_string const* expected;
+        } const modes[] = {
+            { KDL_DETECT_VERSION, either },
+            { KDL_DETECT_VERSION | KDL_BORROW_STRINGS, either },
+            { KDL_READ_VERSION_1, &v1 },
+            { KDL_READ_VERSION_2, &v2 },
+        };
+        for (size_t k = 0; k < sizeof(modes) / sizeof(modes[0]); ++k) {
+            kdl_owned_string const* expected = modes[k].expected;
+            kdl_owned_string result = parse_string_arg(doc, modes[k].opt);
+            if (expected->data == NULL) {
+                ASSERT2(result.data == NULL, doc_buf);
+            } else {
+                ASSERT2(result.data != NULL, doc_buf);
+                ASSERT2(result.len == expected->len, doc_buf);
+                ASSERT2(memcmp(result.data, expected->data, result.len) == 0, doc_buf);
+            }
+            kdl_free_string(&result);
+        }
+        kdl_free_string(&v1);
+        kdl_free_string(&v2);
+    }
+}
+
+static size_t read_from_str(void* user_data, char* buf, size_t bufsize)
+{
+    kdl_str* str = (kdl_str*)user_data;
+    size_t count = str->len < bufsize ? str->len : bufsize;
+    memcpy(buf, str->data, count);
+    str->data += count;
+    str->len -= count;
+    return count;
+}
+
+static bool points_into(kdl_str s, kdl_str doc)
+{
+    return s.data >= doc.data && s.data + s.len <= doc.data + doc.len;
+}
+
+static void test_borrow_strings(void)
+{
+    char const* const kdl_text = "node1 key=\"plain\" #\"raw\"# \"esc\\taped\" ident=(type)\"x\"";
+    // only valid in KDLv1
+    char const* const kdl_text_v1 = "node \"string with\nnewline\" r#\"v1 raw\"# key=\"val\"";
+
+    kdl_str doc = kdl_str_from_cstr(kdl_text);
+    kdl_parser* parser = kdl_create_string_parser(doc, KDL_BORROW_STRINGS);
+    kdl_parser* ref_parser;
+
+    kdl_event_data* ev;
+    kdl_event_data* ref_ev;
+
+    ev = kdl_parser_next_event(parser);
+    ASSERT(ev->event == KDL_EVENT_START_NODE);
+    ASSERT(points_into(ev->name, doc));
+
+    ev = kdl_parser_next_event(parser);
+    ASSERT(ev->event == KDL_EVENT_PROPERTY);
+    ASSERT(points_into(ev->name, doc));
+    ASSERT(ev->value.type == KDL_TYPE_STRING);
+    ASSERT(points_into(ev->value.string, doc));
+    ASSERT(ev->value.string.len == 5 && memcmp(ev->value.string.data, "plain", 5) == 0);
+
+    ev = kdl_parser_next_event(parser);
+    ASSERT(ev->event == KDL_EVENT_ARGUMENT);
+    ASSERT(points_into(ev->value.string, doc));
+    ASSERT(ev->value.string.len == 3 && memcmp(ev->value.string.data, "raw", 3) == 0);
+
+    // escaped strings have to be copied
+    ev = kdl_parser_next_event(parser);
+    ASSERT(ev->event == KDL_EVENT_ARGUMENT);
+    ASSERT(!points_into(ev->value.string, doc));
+    ASSERT(ev->value.string.len == 8 && memcmp(ev->value.string.data, "esc\taped", 8) == 0);
+
+    ev = kdl_parser_next_event(parser);
+    ASSERT(ev->event == KDL_EVENT_PROPERTY);
+    ASSERT(points_into(ev->name, doc));
+    ASSERT(points_into(ev->value.type_annotation, doc));
+
+    kdl_destroy_parser(parser);
+
+    // The results must be the same as without borrowing (including the version detection
+    // triggered by the string with a newline)
+    doc = kdl_str_from_cstr(kdl_text_v1);
+    parser = kdl_create_string_parser(doc, KDL_BORROW_STRINGS);
+    ref_parser = kdl_create_string_parser(doc, KDL_DEFAULTS);
+    do {
+        ev = kdl_parser_next_event(parser);
+        ref_ev = kdl_parser_next_event(ref_parser);
+        ASSERT(ev->event == ref_ev->event);
+        ASSERT(ev->name.len == ref_ev->name.len);
+        ASSERT(ev->name.len == 0 || memcmp(ev->name.data, ref_ev->name.data, ev->name.len) == 0);
+        ASSERT(ev->value.type == ref_ev->value.type);
+        if (ev->value.type == KDL_TYPE_STRING) {
+            ASSERT(ev->value.string.len == ref_ev->value.string.len);
+            ASSERT(memcmp(ev->value.string.data, ref_ev->value.string.data, ev->value.string.len) == 0);
+        }
+        if (ev->value.type == KDL_TYPE_STRING && ev->event != KDL_EVENT_PARSE_ERROR) {
+            ASSERT(points_into(ev->value.string, doc));
+        }
+    } while (ev->event != KDL_EVENT_EOF && ev->event != KDL_EVENT_PARSE_ERROR);
+    ASSERT(ev->event == KDL_EVENT_EOF);
+
+    kdl_destroy_parser(parser);
+    kdl_destroy_parser(ref_parser);
+}
+
+static void test_borrow_strings_stream(void)
+{
+    // Stream parsers ignore KDL_BORROW_STRINGS
+    char const* kdl_text = "node \"arg\"";
+    kdl_str doc = kdl_str_from_cstr(kdl_text);
+    kdl_parser* parser = kdl_create_stream_parser(&read_from_str, &doc, KDL_BORROW_STRINGS);
+
+    kdl_event_data* ev = kdl_parser_next_event(parser);
+    ASSERT(ev->event == KDL_EVENT_START_NODE);
+    ev = kdl_parser_next_event(parser);
+    ASSERT(ev->event == KDL_EVENT_ARGUMENT);
+    ASSERT(ev->value.string.len == 3 && memcmp(ev->value.string.data, "arg", 3) == 0);
+    ASSERT(ev->value.string.data[3] == '\0'); // owned strings are nul-terminated
+
+    kdl_destroy_parser(parser);
+}
+
+static size_t read_bytewise(void* user_data, char* buf, size_t bufsize)
+{
+    return read_from_str(user_data, buf, bufsize < 1 ? bufsize : 1);
+}
+
+static bool same_str(kdl_str a, kdl_str b)
+{
+    // empty strings may have NULL data, which memcmp() doesn't accept
+    return a.len == b.len && (a.len == 0 || memcmp(a.data, b.data, a.len) == 0);
+}
+
+static bool same_value(kdl_value const* a, kdl_value const* b)
+{
+    if (a->type != b->type || !same_str(a->type_annotation, b->type_annotation)) return false;
+    switch (a->type) {
+    case KDL_TYPE_BOOLEAN:
+        return a->boolean == b->boolean;
+    case KDL_TYPE_NUMBER:
+        if (a->number.type != b->number.type) return false;
+        switch (a->number.type) {
+        case KDL_NUMBER_TYPE_INTEGER:
+            return a->number.integer == b->number.integer;
+        case KDL_NUMBER_TYPE_FLOATING_POINT:
+            return same_double(a->number.floating_point, b->number.floating_point);
+        default:
+            return same_str(a->number.string, b->number.string);
+        }
+    case KDL_TYPE_STRING:
+        return same_str(a->string, b->string);
+    default:
+        return true;
+    }
+}
+
+static void test_lazy_values(void)
+{
+    // Once materialized, the values must be the same as without KDL_LAZY_VALUES
+    char const* const docs[] = {
+        "node 1 -2.5e3 0x1f \"esc\\taped\" #\"raw\"# key=\"val\" (t)\"x\" n=0b101 #true b=#null ident\n"
+        "multi \"\"\"\n    line one\n      line two\n    \"\"\" #\"\"\"\n  raw\n  \"\"\"#\n"
+        "parent { child \"a\" \"b\"=\"c\"; /-sd \"skipped\" 12; (t)leaf 1e1000 }\n",
+        // KDLv1
+        "node \"string with\nnewline\" r#\"v1 raw\"# key=\"val\" 1.5 true\n",
+    };
+    kdl_parse_option const opts[] = {KDL_DEFAULTS, KDL_EMIT_COMMENTS | KDL_BORROW_STRINGS};
+
+    for (size_t i = 0; i < sizeof(docs) / sizeof(docs[0]); ++i) {
+        for (size_t k = 0; k < 2 * sizeof(opts) / sizeof(opts[0]); ++k) {
+            kdl_str doc = kdl_str_from_cstr(docs[i]);
+            kdl_str stream_doc = doc;
+            kdl_parse_option opt = opts[k / 2];
+            kdl_parser* ref_parser = kdl_create_string_parser(doc, opt);
+            kdl_parser* parser = k % 2 == 0
+                ? kdl_create_string_parser(doc, opt | KDL_LAZY_VALUES)
+                : kdl_create_stream_parser(&read_bytewise, &stream_doc, opt | KDL_LAZY_VALUES);
+
+            kdl_event_data* ev;
+            kdl_event_data* ref_ev;
+            int n_lazy = 0;
+            do {
+                ev = kdl_parser_next_event(parser);
+                ref_ev = kdl_parser_next_event(ref_parser);
+                if (ev->token.value.data != NULL) {
+                    kdl_event event = ev->event & ~KDL_EVENT_COMMENT;
+                    ASSERT(event == KDL_EVENT_ARGUMENT || event == KDL_EVENT_PROPERTY);
+                    ASSERT(ev->value.type == KDL_TYPE_NULL);
+                    ASSERT(kdl_event_materialize_value(parser, ev));
+                    ASSERT(ev->token.value.data == NULL);
+                    ++n_lazy;
+                }
+                // materializing twice does nothing
+                ASSERT(kdl_event_materialize_value(parser, ev));
+                ASSERT(ev->event == ref_ev->event);
+                ASSERT(same_str(ev->name, ref_ev->name));
+                ASSERT(same_value(&ev->value, &ref_ev->value));
+            } while (ev->event != KDL_EVENT_EOF && ev->event != KDL_EVENT_PARSE_ERROR);
+            ASSERT(ev->event == KDL_EVENT_EOF);
+            ASSERT(n_lazy >= 4);
+
+            kdl_destroy_parser(parser);
+            kdl_destroy_parser(ref_parser);
+        }
+    }
+}
+
+static void test_lazy_values_skipped(void)
+{
+    // Values which are never materialized are not decoded, so errors in them go unnoticed
+    kdl_str doc = kdl_str_from_cstr("node \"\\q\" 0x k=\"\\u{zz}\" (t)0b12");
+    kdl_parser* parser = kdl_create_string_parser(doc, KDL_READ_VERSION_2 | KDL_LAZY_VALUES);
+
+    kdl_event_data* ev = kdl_parser_next_event(parser);
+    ASSERT(ev->event == KDL_EVENT_START_NODE);
+    ASSERT(kdl_event_materialize_value(parser, ev)); // nothing to do
+
+    ev = kdl_parser_next_event(parser);
+    ASSERT(ev->event == KDL_EVENT_ARGUMENT);
+    ASSERT(ev->token.type == KDL_TOKEN_STRING);
+    ASSERT(same_str(ev->token.value, kdl_str_from_cstr("\\q")));
+
+    ev = kdl_parser_next_event(parser);
+    ASSERT(ev->event == KDL_EVENT_ARGUMENT);
+    ASSERT(ev->token.type == KDL_TOKEN_WORD);
+    ASSERT(same_str(ev->token.value, kdl_str_from_cstr("0x")));
+
+    ev = kdl_parser_next_event(parser);
+    ASSERT(ev->event == KDL_EVENT_PROPERTY);
+    ASSERT(same_str(ev->name, kdl_str_from_cstr("k")));
+    ASSERT(ev->token.type == KDL_TOKEN_STRING);
+    ASSERT(same_str(ev->token.value, kdl_str_from_cstr("\\u{zz}")));
+
+    ev = kdl_parser_next_event(parser);
+    ASSERT(ev->event == KDL_EVENT_ARGUMENT);
+    ASSERT(same_str(ev->value.type_annotation, kdl_str_from_cstr("t")));
+    ASSERT(same_str(ev->token.value, kdl_str_from_cstr("0b12")));
+
+    ev = kdl_parser_next_event(parser);
+    ASSERT(ev->event == KDL_EVENT_END_NODE);
+    ev = kdl_parser_next_event(parser);
+    ASSERT(ev->event == KDL_EVENT_EOF);
+    kdl_destroy_parser(parser);
+
+    // Materializing an invalid value is a parse error
+    parser = kdl_create_string_parser(doc, KDL_READ_VERSION_2 | KDL_LAZY_VALUES);
+    ev = kdl_parser_next_event(parser);
+    ev = kdl_parser_next_event(parser);
+    ASSERT(ev->event == KDL_EVENT_ARGUMENT);
+    ASSERT(!kdl_event_materialize_value(parser, ev));
+    ASSERT(ev->event == KDL_EVENT_PARSE_ERROR);
+    kdl_destroy_parser(parser);
+}
+
+// Skip to the end of the current node by reading events
+static kdl_event_data* skip_node_by_events(kdl_parser* parser, int depth)
+{
+    kdl_event_data* ev;
+    do {
+        ev = kdl_parser_next_event(parser);
+        kdl_event event = ev->event & ~KDL_EVENT_COMMENT;
+        if (event == KDL_EVENT_START_NODE) ++depth;
+        if (event == KDL_EVENT_END_NODE) --depth;
+    } while (depth > 0 && ev->event != KDL_EVENT_EOF && ev->event != KDL_EVENT_PARSE_ERROR);
+    return ev;
+}
+
+static void test_skip_node(void)
+{
+    // Skipping every node named "skip" must give the same events as reading them
+    char const* const docs[] = {
+        "a 1; skip 2 \"x\" k=\"v\" { c1 #\"raw\"#; c2 { skip 3 { deep; }; c3 k=1 } }\n"
+        "b { skip; skip { x }; /-skip 1 { y }; c \"\"\"\n    ml\n    \"\"\" }\n"
+        "/-skip { a; b } \n(t)skip (u)1 \\ // comment\n  2 /-\n\n  x /- 3 /-{ z } { c } /-{ w }\nlast",
+        // KDLv1
+        "skip r#\"raw\"# 1.5 { child \"a\" key=true }\nafter { skip; } \n",
+    };
+    kdl_parse_option const opts[] = {KDL_DEFAULTS, KDL_EMIT_COMMENTS | KDL_LAZY_VALUES, KDL_UNCHECKED_SKIP,
+        KDL_EMIT_COMMENTS | KDL_UNCHECKED_SKIP};
+
+    for (size_t i = 0; i < sizeof(docs) / sizeof(docs[0]); ++i) {
+        for (size_t k = 0; k < 2 * sizeof(opts) / sizeof(opts[0]); ++k) {
+            kdl_str doc = kdl_str_from_cstr(docs[i]);
+            kdl_str stream_doc = doc;
+            kdl_parse_option opt = opts[k / 2];
+            kdl_parser* ref_parser = kdl_create_string_parser(doc, opt);
+            kdl_parser* parser = k % 2 == 0 ? kdl_create_string_parser(doc, opt)
+                                            : kdl_create_stream_parser(&read_bytewise, &stream_doc, opt);
+
+            kdl_event_data* ev;
+            kdl_event_data* ref_ev;
+            int n_skipped = 0;
+            do {
+                ev = kdl_parser_next_event(parser);
+                ref_ev = kdl_parser_next_event(ref_parser);
+                if ((ev->event & ~KDL_EVENT_COMMENT) == KDL_EVENT_START_NODE
+                    && same_str(ev->name, kdl_str_from_cstr("skip"))) {
+                    ev = kdl_parser_skip_node(parser);
+                    ref_ev = skip_node_by_events(ref_parser, 1);
+                    ++n_skipped;
+                }
+                ASSERT(ev->event == ref_ev->event);
+                ASSERT(same_str(ev->name, ref_ev->name));
+                ASSERT(kdl_event_materialize_value(parser, ev));
+                ASSERT(kdl_event_materialize_value(ref_parser, ref_ev));
+                ASSERT(same_value(&ev->value, &ref_ev->value));
+            } while (ev->event != KDL_EVENT_EOF && ev->event != KDL_EVENT_PARSE_ERROR);
+            ASSERT(ev->event == KDL_EVENT_EOF);
+            ASSERT(n_skipped >= 2);
+
+            kdl_destroy_parser(parser);
+            kdl_destroy_parser(ref_parser);
+        }
+    }
+}
+
+static void skip_node_partial(kdl_parse_option opt)
+{
+    kdl_str doc = kdl_str_from_cstr("a 1 2 { b; c 3 { d } }\ne \"\\q\" 0x { f }\ng { h; i }");
+    kdl_parser* parser = kdl_create_string_parser(doc, opt);
+
+    // Skip the rest of a node after an argument
+    kdl_event_data* ev = kdl_parser_next_event(parser);
+    ASSERT(ev->event == KDL_EVENT_START_NODE);
+    ev = kdl_parser_next_event(parser);
+    ASSERT(ev->event == KDL_EVENT_ARGUMENT);
+    ev = kdl_parser_skip_node(parser);
+    ASSERT(ev->event == KDL_EVENT_END_NODE);
+
+    // Invalid values are not noticed
+    ev = kdl_parser_next_event(parser);
+    ASSERT(ev->event == KDL_EVENT_START_NODE);
+    ASSERT(same_str(ev->name, kdl_str_from_cstr("e")));
+    ev = kdl_parser_skip_node(parser);
+    ASSERT(ev->event == KDL_EVENT_END_NODE);
+
+    // Skip the rest of the parent node from its child block
+    ev = kdl_parser_next_event(parser);
+    ASSERT(ev->event == KDL_EVENT_START_NODE);
+    ev = kdl_parser_next_event(parser);
+    ASSERT(ev->event == KDL_EVENT_START_NODE);
+    ASSERT(same_str(ev->name, kdl_str_from_cstr("h")));
+    ev = kdl_parser_next_event(parser);
+    ASSERT(ev->event == KDL_EVENT_END_NODE);
+    ev = kdl_parser_skip_node(parser);
+    ASSERT(ev->event == KDL_EVENT_END_NODE);
+    ev = kdl_parser_next_event(parser);
+    ASSERT(ev->event == KDL_EVENT_EOF);
+    kdl_destroy_parser(parser);
+
+    // Without an open node, the rest of the document is skipped
+    parser = kdl_create_string_parser(doc, opt);
+    ev = kdl_parser_next_event(parser);
+    ASSERT(ev->event == KDL_EVENT_START_NODE);
+    ev = skip_node_by_events(parser, 1);
+    ASSERT(ev->event == KDL_EVENT_END_NODE);
+    ev = kdl_parser_skip_node(parser);
+    ASSERT(ev->event == KDL_EVENT_EOF);
+    kdl_destroy_parser(parser);
+
+    // Syntax errors are found (unbalanced braces even with KDL_UNCHECKED_SKIP)
+    char const* const invalid[] = {"a { b { c }", "a { b; } }", "a { b = }", "a { (t b }", "a { b } c"};
+    size_t n_invalid = opt & KDL_UNCHECKED_SKIP ? 2 : sizeof(invalid) / sizeof(invalid[0]);
+    for (size_t i = 0; i < n_invalid; ++i) {
+        parser = kdl_create_string_parser(kdl_str_from_cstr(invalid[i]), opt);
+        ev = kdl_parser_next_event(parser);
+        ASSERT2(ev->event == KDL_EVENT_START_NODE, invalid[i]);
+        ev = kdl_parser_skip_node(parser);
+        if (ev->event != KDL_EVENT_PARSE_ERROR) ev = kdl_parser_next_event(parser);
+        ASSERT2(ev->event == KDL_EVENT_PARSE_ERROR, invalid[i]);
+        kdl_destroy_parser(parser);
+    }
+}
+
+static void test_skip_node_partial(void)
+{
+    skip_node_partial(KDL_READ_VERSION_2);
+    skip_node_partial(KDL_READ_VERSION_2 | KDL_UNCHECKED_SKIP);
+}
+
+struct counting_allocator {
+    size_t n_calls;
+    size_t n_live;
+};
+
+static void* counting_malloc(void* user_data, size_t size)
+{
+    struct counting_allocator* counts = user_data;
+    ++counts->n_calls;
+    ++counts->n_live;
+    return malloc(size);
+}
+
+static void* counting_realloc(void* user_data, void* ptr, size_t size)
+{
+    struct counting_allocator* counts = user_data;
+    ++counts->n_calls;
+    if (ptr == NULL) ++counts->n_live;
+    return realloc(ptr, size);
+}
+
+static void counting_free(void* user_data, void* ptr)
+{
+    struct counting_allocator* counts = user_data;
+    if (ptr != NULL) --counts->n_live;
+    free(ptr);
+}
+
+static void test_custom_allocator(void)
+{
+    struct counting_allocator counts = {0, 0};
+    kdl_allocator allocator = {&counting_malloc, &counting_realloc, &counting_free, &counts};
+
+    // The property name is still pending when the comment event is returned
+    char const* const kdl_text
+        = "node \"ke\\u{79}\" /* comment */ = \"valu\\u{65}\" (t)0x1_0000_0000_0000_0000\n";
+    kdl_str doc = kdl_str_from_cstr(kdl_text);
+    kdl_parser* parser = kdl_create_string_parser_ex(doc, KDL_EMIT_COMMENTS, &allocator);
+    ASSERT(counts.n_calls > 0);
+
+    kdl_event_data* ev = kdl_parser_next_event(parser);
+    ASSERT(ev->event == KDL_EVENT_START_NODE);
+    ev = kdl_parser_next_event(parser);
+    ASSERT(ev->event == KDL_EVENT_COMMENT);
+    ev = kdl_parser_next_event(parser);
+    ASSERT(ev->event == KDL_EVENT_PROPERTY);
+    ASSERT(ev->name.len == 3 && memcmp(ev->name.data, "key", 3) == 0);
+    ASSERT(ev->value.string.len == 5 && memcmp(ev->value.string.data, "value", 5) == 0);
+    ev = kdl_parser_next_event(parser);
+    ASSERT(ev->event == KDL_EVENT_ARGUMENT);
+    ASSERT(ev->value.type_annotation.len == 1 && ev->value.type_annotation.data[0] == 't');
+    ASSERT(ev->value.number.type == KDL_NUMBER_TYPE_STRING_ENCODED);
+    ASSERT(strcmp(ev->value.number.string.data, "18446744073709551616") == 0);
+    ev = kdl_parser_next_event(parser);
+    ASSERT(ev->event == KDL_EVENT_END_NODE);
+    ev = kdl_parser_next_event(parser);
+    ASSERT(ev->event == KDL_EVENT_EOF);
+
+    kdl_destroy_parser(parser);
+    ASSERT(counts.n_live == 0);
+
+    // Temporary strings are recycled between events
+    char const* const node_text = "node \"a\\tb\" 1.5e3 key=\"\"\"\n    multi\n    line\n    \"\"\"\n";
+    size_t node_len = strlen(node_text);
+    size_t n_nodes = 100;
+    char* long_text = malloc(node_len * n_nodes);
+    for (size_t i = 0; i < n_nodes; ++i) {
+        memcpy(long_text + i * node_len, node_text, node_len);
+    }
+    doc = (kdl_str){long_text, node_len * n_nodes};
+    counts.n_calls = 0;
+    parser = kdl_create_string_parser_ex(doc, KDL_DEFAULTS, &allocator);
+    size_t n_events = 0;
+    do {
+        ev = kdl_parser_next_event(parser);
+        ++n_events;
+    } while (ev->event != KDL_EVENT_EOF && ev->event != KDL_EVENT_PARSE_ERROR);
+    ASSERT(ev->event == KDL_EVENT_EOF);
+    ASSERT(n_events == 5 * n_nodes + 1);
+    ASSERT(counts.n_calls < n_nodes);
+    kdl_destroy_parser(parser);
+    ASSERT(counts.n_live == 0);
+    free(long_text);
+}
+
+static void test_file_parser(void)
+{
+    char const* const path = "parser_test_file.kdl";
+    char const* const kdl_text = "\xef\xbb\xbfnode \"arg\" key=(t)1\n";
+    FILE* fp = fopen(path, "wb");
+    ASSERT(fp != NULL);
+    fputs(kdl_text, fp);
+    fclose(fp);
+
+    kdl_parser* parser = kdl_create_file_parser(path, KDL_BORROW_STRINGS);
+    ASSERT(parser != NULL);
+    kdl_event_data* ev = kdl_parser_next_event(parser);
+    ASSERT(ev->event == KDL_EVENT_START_NODE);
+    ASSERT(ev->name.len == 4 && memcmp(ev->name.data, "node", 4) == 0);
+    ev = kdl_parser_next_event(parser);
+    ASSERT(ev->event == KDL_EVENT_ARGUMENT);
+    ASSERT(ev->value.string.len == 3 && memcmp(ev->value.string.data, "arg", 3) == 0);
+    ev = kdl_parser_next_event(parser);
+    ASSERT(ev->event == KDL_EVENT_PROPERTY);
+    ASSERT(ev->name.len == 3 && memcmp(ev->name.data, "key", 3) == 0);
+    ASSERT(ev->value.type_annotation.len == 1 && ev->value.type_annotation.data[0] == 't');
+    ASSERT(ev->value.number.type == KDL_NUMBER_TYPE_INTEGER && ev->value.number.integer == 1);
+    ev = kdl_parser_next_event(parser);
+    ASSERT(ev->event == KDL_EVENT_END_NODE);
+    ev = kdl_parser_next_event(parser);
+    ASSERT(ev->event == KDL_EVENT_EOF);
+    kdl_destroy_parser(parser);
+
+    // empty files are empty documents
+    fp = fopen(path, "wb");
+    ASSERT(fp != NULL);
+    fclose(fp);
+    parser = kdl_create_file_parser(path, KDL_DEFAULTS);
+    ASSERT(parser != NULL);
+    ev = kdl_parser_next_event(parser);
+    ASSERT(ev->event == KDL_EVENT_EOF);
+    kdl_destroy_parser(parser);
+
+    remove(path);
+    ASSERT(kdl_create_file_parser(path, KDL_DEFAULTS) == NULL);
+}
+
 void TEST_MAIN(void)
 {
     run_test("Parser: basics", &test_basics);
@@ -427,4 +1201,15 @@ void TEST_MAIN(void)
     run_test("Parser: BOM treated as whitespace", &test_bom);
     run_test("Parser: KDLv1 and KDLv2 both supported", &test_parser_detects_version);
     run_test("Parser: parse extreme floating point", &test_extreme_float);
+    run_test("Parser: parse integers", &test_integers);
+    run_test("Parser: floats are correctly rounded", &test_float_round_trip);
+    run_test("Parser: string escapes with version detection", &test_string_escapes);
+    run_test("Parser: borrowed strings", &test_borrow_strings);
+    run_test("Parser: no borrowed strings from streams", &test_borrow_strings_stream);
+    run_test("Parser: lazy values", &test_lazy_values);
+    run_test("Parser: lazy values that are never materialized", &test_lazy_values_skipped);
+    run_test("Parser: skip nodes", &test_skip_node);
+    run_test("Parser: skip the rest of a node", &test_skip_node_partial);
+    run_test("Parser: custom allocator", &test_custom_allocator);
+    run_test("Parser: memory-mapped file", &test_file_parser);
 }
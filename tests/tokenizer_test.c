@@ -0,0 +1,317 @@
+#include <kdl/kdl.h>
+
+#include "test_util.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct byte_reader {
+    char const* data;
+    size_t len;
+};
+
+// Hand out the document one byte at a time to defeat any buffering
+static size_t read_one_byte(void* user_data, char* buf, size_t bufsize)
+{
+    struct byte_reader* r = (struct byte_reader*)user_data;
+    if (r->len == 0 || bufsize == 0) return 0;
+    *buf = *r->data;
+    ++r->data;
+    --r->len;
+    return 1;
+}
+
+// Tokenize doc from a string, from a stream and from a string with a structural index and check
+// that the results are identical. Returns the number of tokens found.
+static size_t compare_tokenizers(char const* doc, size_t len, kdl_character_set charset)
+{
+    struct byte_reader reader = {doc, len};
+    kdl_tokenizer* str_tok = kdl_create_string_tokenizer((kdl_str){doc, len});
+    kdl_tokenizer* stream_tok = kdl_create_stream_tokenizer(&read_one_byte, &reader);
+    kdl_tokenizer* indexed_tok = kdl_create_indexed_tokenizer((kdl_str){doc, len});
+    kdl_tokenizer_set_character_set(str_tok, charset);
+    kdl_tokenizer_set_character_set(stream_tok, charset);
+    kdl_tokenizer_set_character_set(indexed_tok, charset);
+
+    size_t count = 0;
+    while (true) {
+        kdl_token t1, t2, t3;
+        kdl_tokenizer_status s1 = kdl_pop_token(str_tok, &t1);
+        kdl_tokenizer_status s2 = kdl_pop_token(stream_tok, &t2);
+        kdl_tokenizer_status s3 = kdl_pop_token(indexed_tok, &t3);
+        ASSERT(s1 == s2);
+        ASSERT(s1 == s3);
+        if (s1 != KDL_TOKENIZER_OK || s2 != KDL_TOKENIZER_OK) break;
+        ASSERT(t1.type == t2.type);
+        ASSERT(t1.value.len == t2.value.len);
+        ASSERT(memcmp(t1.value.data, t2.value.data, t1.value.len) == 0);
+        ASSERT(t1.type == t3.type);
+        ASSERT(t1.value.data == t3.value.data && t1.value.len == t3.value.len);
+        ++count;
+    }
+
+    kdl_destroy_tokenizer(str_tok);
+    kdl_destroy_tokenizer(stream_tok);
+    kdl_destroy_tokenizer(indexed_tok);
+    return count;
+}
+
+static void test_long_runs(void)
+{
+    static char const* const docs[] = {
+        "node                                                                      arg\n",
+        "node\t \t \t \t \t \t \t \t \t \t \t \t \t \t \t \t \t \t \t \t \t \t \t \t \t \t \t \t \t x",
+        "node \v\v\v\v\v\v\v\v\v\v\v\v\v\v\v\v\v\v\v\v\v\v\v\v\v\v\v\v\v\v\v\v\v\v x",
+        "a_very_long_node_name_that_spans_more_than_one_simd_block_of_thirty_two_bytes;",
+        "word-with-<angle>-brackets,and,commas,which-are-only-allowed-in-kdl-version-two",
+        "word_with_non_ascii_\xc3\xa5\xc3\xa4\xc3\xb6_characters_in_the_middle_of_it_all \"x\"",
+        "n \"a string with a long run of plain text, then an \\\"escaped quote\\\" and more\"",
+        "n \"ends in backslashes \\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\"",
+        "n #\"a raw string with \"quotes\" and #hashes# which goes on for a while\"#",
+        "n ##\"a raw string with \"# inside, which doesn't end the string yet\"##",
+        "n r#\"a v1 raw string with \"quotes\" which goes on for quite a while\"#",
+        "n \"\"\"\n    a multi-line string\n    with \"\" inside \"#\"\n    \"\"\"",
+        "n \"a string with a non-ascii character at the end of a block \xe2\x98\x83 ok\"",
+        "n \"a string with\ta tab\tand a carriage return\r\nin it, crossing blocks\"",
+    };
+
+    for (size_t i = 0; i < sizeof(docs) / sizeof(docs[0]); ++i) {
+        size_t len = strlen(docs[i]);
+        // some of these are not valid KDLv1, but the tokenizers must still agree
+        compare_tokenizers(docs[i], len, KDL_CHARACTER_SET_V1);
+        ASSERT(compare_tokenizers(docs[i], len, KDL_CHARACTER_SET_V2) > 0);
+    }
+}
+
+static void test_run_boundaries(void)
+{
+    // Put the end of a run at every offset around the SIMD block sizes
+    char buf[128];
+    for (size_t n = 1; n < 70; ++n) {
+        // word
+        memset(buf, 'x', n);
+        buf[n] = ';';
+        buf[n + 1] = '\0';
+        kdl_tokenizer* tok = kdl_create_string_tokenizer((kdl_str){buf, n + 1});
+        kdl_token token;
+        ASSERT(kdl_pop_token(tok, &token) == KDL_TOKENIZER_OK);
+        ASSERT(token.type == KDL_TOKEN_WORD);
+        ASSERT(token.value.len == n);
+        ASSERT(kdl_pop_token(tok, &token) == KDL_TOKENIZER_OK);
+        ASSERT(token.type == KDL_TOKEN_SEMICOLON);
+        kdl_destroy_tokenizer(tok);
+        ASSERT(compare_tokenizers(buf, n + 1, KDL_CHARACTER_SET_V2) == 2);
+
+        // whitespace
+        memset(buf, ' ', n);
+        buf[n] = 'y';
+        tok = kdl_create_string_tokenizer((kdl_str){buf, n + 1});
+        ASSERT(kdl_pop_token(tok, &token) == KDL_TOKENIZER_OK);
+        ASSERT(token.type == KDL_TOKEN_WHITESPACE);
+        ASSERT(token.value.len == n);
+        kdl_destroy_tokenizer(tok);
+        ASSERT(compare_tokenizers(buf, n + 1, KDL_CHARACTER_SET_V2) == 2);
+
+        // string, with an escaped quote at position n
+        buf[0] = '"';
+        memset(buf + 1, 'z', n);
+        buf[n + 1] = '\\';
+        buf[n + 2] = '"';
+        buf[n + 3] = '"';
+        tok = kdl_create_string_tokenizer((kdl_str){buf, n + 4});
+        ASSERT(kdl_pop_token(tok, &token) == KDL_TOKENIZER_OK);
+        ASSERT(token.type == KDL_TOKEN_STRING);
+        ASSERT(token.value.len == n + 2);
+        ASSERT(kdl_pop_token(tok, &token) == KDL_TOKENIZER_EOF);
+        kdl_destroy_tokenizer(tok);
+        ASSERT(compare_tokenizers(buf, n + 4, KDL_CHARACTER_SET_V2) == 1);
+    }
+}
+
+static void test_illegal_chars_in_runs(void)
+{
+    // DEL is a legal word character in KDLv1, but not in KDLv2
+    char const* doc = "some_long_identifier_with_a_delete_character_\x7f_in_it";
+    kdl_tokenizer* tok = kdl_create_string_tokenizer(kdl_str_from_cstr(doc));
+    kdl_token token;
+    ASSERT(kdl_pop_token(tok, &token) == KDL_TOKENIZER_ERROR);
+    kdl_destroy_tokenizer(tok);
+
+    tok = kdl_create_string_tokenizer(kdl_str_from_cstr(doc));
+    kdl_tokenizer_set_character_set(tok, KDL_CHARACTER_SET_V1);
+    ASSERT(kdl_pop_token(tok, &token) == KDL_TOKENIZER_OK);
+    ASSERT(token.type == KDL_TOKEN_WORD);
+    ASSERT(token.value.len == strlen(doc));
+    kdl_destroy_tokenizer(tok);
+
+    // control characters in strings
+    doc = "\"a string with a long prefix before the control character \x01\"";
+    tok = kdl_create_string_tokenizer(kdl_str_from_cstr(doc));
+    ASSERT(kdl_pop_token(tok, &token) == KDL_TOKENIZER_ERROR);
+    kdl_destroy_tokenizer(tok);
+}
+
+static void test_indexed_random_input(void)
+{
+    // Random mixtures of characters which start, end or continue tokens, so that every kind of
+    // token boundary lands on every offset in the 64-byte blocks of the structural index
+    static char const* const pieces[] = {"a", "#", " ", "\t", "\v", "\n", "\r\n", "\"", "\\", "/-", "//",
+        "/*", "*/", "{", "}", ";", "=", "(", ")", "r", "<", ",", "\xc3\xa5", "\xe2\x80\x83"};
+    size_t const n_pieces = sizeof(pieces) / sizeof(pieces[0]);
+    char buf[512];
+    uint64_t state = 12345;
+    for (int round = 0; round < 2000; ++round) {
+        size_t len = 0;
+        while (len < sizeof(buf) - 4) {
+            state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+            char const* piece = pieces[(state >> 33) % n_pieces];
+            // mostly plain word characters and spaces, which make up the long runs
+            if ((state >> 20) % 3 != 0) piece = (state >> 40) % 2 ? "a" : " ";
+            size_t piece_len = strlen(piece);
+            memcpy(buf + len, piece, piece_len);
+            len += piece_len;
+        }
+        compare_tokenizers(buf, len, KDL_CHARACTER_SET_V1);
+        compare_tokenizers(buf, len, KDL_CHARACTER_SET_V2);
+    }
+}
+
+// Compare a string tokenizer and an indexed tokenizer, retrying every token which is an error with
+// the KDLv1 character set (like the parser does when detecting the version). Return the number of
+// errors.
+static size_t compare_with_retries(kdl_str doc)
+{
+    kdl_tokenizer* str_tok = kdl_create_string_tokenizer(doc);
+    kdl_tokenizer* indexed_tok = kdl_create_indexed_tokenizer(doc);
+    size_t n_errors = 0;
+    while (true) {
+        kdl_token t1, t2;
+        kdl_tokenizer_status s1 = kdl_pop_token(str_tok, &t1);
+        kdl_tokenizer_status s2 = kdl_pop_token(indexed_tok, &t2);
+        ASSERT(s1 == s2);
+        if (s1 == KDL_TOKENIZER_ERROR) {
+            ++n_errors;
+            kdl_tokenizer_set_character_set(str_tok, KDL_CHARACTER_SET_V1);
+            kdl_tokenizer_set_character_set(indexed_tok, KDL_CHARACTER_SET_V1);
+            s1 = kdl_pop_token(str_tok, &t1);
+            s2 = kdl_pop_token(indexed_tok, &t2);
+            ASSERT(s1 == s2);
+            kdl_tokenizer_set_character_set(str_tok, KDL_CHARACTER_SET_V2);
+            kdl_tokenizer_set_character_set(indexed_tok, KDL_CHARACTER_SET_V2);
+        }
+        if (s1 != KDL_TOKENIZER_OK) break;
+        ASSERT(t1.type == t2.type);
+        ASSERT(t1.value.data == t2.value.data && t1.value.len == t2.value.len);
+    }
+    kdl_destroy_tokenizer(str_tok);
+    kdl_destroy_tokenizer(indexed_tok);
+    return n_errors;
+}
+
+static void test_indexed_retry(void)
+{
+    // After an error, the same token is read again, so the indexed tokenizer has to go back to an
+    // earlier position in its index (possibly in an earlier window of it, for long tokens)
+    static char const piece[] = "node \"a string\" word\x7fwith_delete "
+                                "a_long_word_with_a_delete_character_after_more_than_a_block_of_text\x7f\n";
+    size_t const piece_len = sizeof(piece) - 1;
+    size_t const n_pieces = 300;
+    char* doc = malloc(piece_len * n_pieces);
+    for (size_t i = 0; i < n_pieces; ++i) {
+        memcpy(doc + i * piece_len, piece, piece_len);
+    }
+    ASSERT(compare_with_retries((kdl_str){doc, piece_len * n_pieces}) == 2 * n_pieces);
+    free(doc);
+
+    // '<' is a word character in KDLv2 only: the KDLv1 tokenizer has to stop there
+    ASSERT(compare_with_retries(kdl_str_from_cstr("node word<with>angle>brackets\x7f x")) == 1);
+}
+
+struct chunk_reader {
+    char const* data;
+    size_t len;
+    size_t min_bufsize; // smallest buffer offered by the tokenizer
+};
+
+static size_t read_chunk(void* user_data, char* buf, size_t bufsize)
+{
+    struct chunk_reader* r = (struct chunk_reader*)user_data;
+    if (bufsize < r->min_bufsize) r->min_bufsize = bufsize;
+    size_t n = r->len < bufsize ? r->len : bufsize;
+    memcpy(buf, r->data, n);
+    r->data += n;
+    r->len -= n;
+    return n;
+}
+
+static void* counting_realloc(void* user_data, void* ptr, size_t size)
+{
+    ++*(size_t*)user_data;
+    return realloc(ptr, size);
+}
+
+static void* plain_malloc(void* user_data, size_t size)
+{
+    (void)user_data;
+    return malloc(size);
+}
+
+static void plain_free(void* user_data, void* ptr)
+{
+    (void)user_data;
+    free(ptr);
+}
+
+static void test_stream_read_chunk_size(void)
+{
+    // One huge token: the stream buffer has to hold all of it at once
+    size_t const string_len = 4 * 1024 * 1024;
+    char* doc = malloc(string_len + 32);
+    size_t len = 0;
+    memcpy(doc, "n \"\"\"\n", 6);
+    len += 6;
+    for (size_t i = 0; i < string_len; ++i) {
+        doc[len++] = (i % 64 == 63) ? '\n' : 'x';
+    }
+    memcpy(doc + len, "\n\"\"\"\nm 1\n", 10);
+    len += 10;
+
+    size_t n_reallocs = 0;
+    kdl_allocator allocator = {&plain_malloc, &counting_realloc, &plain_free, &n_reallocs};
+    struct chunk_reader reader = {doc, len, (size_t)-1};
+    kdl_tokenizer* str_tok = kdl_create_string_tokenizer((kdl_str){doc, len});
+    kdl_tokenizer* stream_tok = kdl_create_stream_tokenizer_ex(&read_chunk, &reader, &allocator);
+    kdl_tokenizer_set_read_chunk_size(stream_tok, 65536);
+
+    size_t count = 0;
+    while (true) {
+        kdl_token t1, t2;
+        kdl_tokenizer_status s1 = kdl_pop_token(str_tok, &t1);
+        kdl_tokenizer_status s2 = kdl_pop_token(stream_tok, &t2);
+        ASSERT(s1 == s2);
+        if (s1 != KDL_TOKENIZER_OK || s2 != KDL_TOKENIZER_OK) break;
+        ASSERT(t1.type == t2.type);
+        ASSERT(t1.value.len == t2.value.len);
+        ASSERT(memcmp(t1.value.data, t2.value.data, t1.value.len) == 0);
+        ++count;
+    }
+    ASSERT(count == 8);
+    ASSERT(reader.min_bufsize >= 65536);
+    // geometric growth: 64 KiB -> 4 MiB+ in a handful of steps
+    ASSERT(n_reallocs <= 8);
+
+    kdl_destroy_tokenizer(str_tok);
+    kdl_destroy_tokenizer(stream_tok);
+    free(doc);
+}
+
+void TEST_MAIN(void)
+{
+    run_test("Tokenizer: long ASCII runs", &test_long_runs);
+    run_test("Tokenizer: ends of ASCII runs", &test_run_boundaries);
+    run_test("Tokenizer: illegal characters in ASCII runs", &test_illegal_chars_in_runs);
+    run_test("Tokenizer: indexed tokenizer on random input", &test_indexed_random_input);
+    run_test("Tokenizer: indexed tokenizer after errors", &test_indexed_retry);
+    run_test("Tokenizer: stream read chunk size", &test_stream_read_chunk_size);
+}